@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * Comparison of floating point arrays. The pass check is one branch free pass
+ * that counts the elements out of tolerance and that the compiler vectorizes;
+ * it is built twice, for AVX2 and for the baseline ISA, and the kernel is
+ * chosen at run time as for mem_mismatch(). Only on failure a second, scalar
+ * pass looks for the worst element to build the message.
+ */
+
+/* Vectorize the kernels only, not the rest of the file, below -O3. */
+#if defined(__GNUC__) && !defined(__clang__)
+#define VECTORIZE \
+	__attribute__((optimize("tree-vectorize", "vect-cost-model=dynamic")))
+#else
+#define VECTORIZE
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#endif
+
+static __thread char array_msg[MAXLINE];
+
+/* Map the bits of a float to an integer with the same order as the float. */
+#define ORDERED32(bits) ((bits) < 0 ? INT32_MIN - (bits) : (bits))
+#define ORDERED64(bits) ((bits) < 0 ? INT64_MIN - (bits) : (bits))
+#define ISNAN32(bits) (((bits) & 0x7fffffff) > 0x7f800000)
+#define ISNAN64(bits) (((bits) & 0x7fffffffffffffffLL) > 0x7ff0000000000000LL)
+
+/*
+ * The elements differ if one only is NaN or if |a - b| is greater than
+ * max(abstol, reltol * max(|a|, |b|)). An infinity is only equal to itself:
+ * |a - b| must be finite, the tolerance of an infinity is infinite too. The
+ * operators are bitwise to keep the loops free of branches.
+ */
+static inline __attribute__((always_inline)) VECTORIZE size_t
+near_f32(const void *first, const void *second, size_t n, double abstol,
+		double reltol)
+{
+	const float *a = first, *b = second;
+	float at = abstol, rt = reltol, d, ax, ay, tol;
+	size_t i, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		d = fabsf(a[i] - b[i]);
+		ax = fabsf(a[i]);
+		ay = fabsf(b[i]);
+		tol = rt * (ax > ay ? ax : ay);
+		tol = tol > at ? tol : at;
+		bad += !(((d <= tol) & (d < HUGE_VALF)) | (a[i] == b[i]) |
+				((a[i] != a[i]) & (b[i] != b[i])));
+	}
+	return bad;
+}
+
+static inline __attribute__((always_inline)) VECTORIZE size_t
+near_f64(const void *first, const void *second, size_t n, double abstol,
+		double reltol)
+{
+	const double *a = first, *b = second;
+	double d, ax, ay, tol;
+	size_t i, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		d = fabs(a[i] - b[i]);
+		ax = fabs(a[i]);
+		ay = fabs(b[i]);
+		tol = reltol * (ax > ay ? ax : ay);
+		tol = tol > abstol ? tol : abstol;
+		bad += !(((d <= tol) & (d < HUGE_VAL)) | (a[i] == b[i]) |
+				((a[i] != a[i]) & (b[i] != b[i])));
+	}
+	return bad;
+}
+
+/*
+ * The elements differ if one only is NaN or if they are more than `ulps`
+ * representable numbers apart.
+ */
+static inline __attribute__((always_inline)) VECTORIZE size_t
+ulp_f32(const void *first, const void *second, size_t n, double ulps,
+		double unused)
+{
+	const int32_t *a = first, *b = second;
+	uint32_t max = ulps < UINT32_MAX ? ulps : UINT32_MAX, d;
+	int32_t x, y;
+	size_t i, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		x = ORDERED32(a[i]);
+		y = ORDERED32(b[i]);
+		d = x > y ? (uint32_t) x - (uint32_t) y : (uint32_t) y - (uint32_t) x;
+		bad += ((d > max) & !(ISNAN32(a[i]) & ISNAN32(b[i]))) |
+			(ISNAN32(a[i]) ^ ISNAN32(b[i]));
+	}
+	return bad;
+}
+
+static inline __attribute__((always_inline)) VECTORIZE size_t
+ulp_f64(const void *first, const void *second, size_t n, double ulps,
+		double unused)
+{
+	const int64_t *a = first, *b = second;
+	uint64_t max = ulps < 0x1p64 ? ulps : UINT64_MAX, d;
+	int64_t x, y;
+	size_t i, bad = 0;
+
+	for (i = 0; i < n; i++) {
+		x = ORDERED64(a[i]);
+		y = ORDERED64(b[i]);
+		d = x > y ? (uint64_t) x - (uint64_t) y : (uint64_t) y - (uint64_t) x;
+		bad += ((d > max) & !(ISNAN64(a[i]) & ISNAN64(b[i]))) |
+			(ISNAN64(a[i]) ^ ISNAN64(b[i]));
+	}
+	return bad;
+}
+
+typedef size_t (*array_kernel)(const void *, const void *, size_t, double,
+		double);
+
+#define KERNEL(name, isa, target) \
+	target VECTORIZE static size_t \
+	name##_##isa(const void *a, const void *b, size_t n, double t, double r) \
+	{ \
+		return name(a, b, n, t, r); \
+	}
+
+KERNEL(near_f32, default, )
+KERNEL(near_f64, default, )
+KERNEL(ulp_f32, default, )
+KERNEL(ulp_f64, default, )
+
+static array_kernel kernels[][2] = {
+	[ARRAY_NEAR_F32] = {near_f32_default},
+	[ARRAY_NEAR_F64] = {near_f64_default},
+	[ARRAY_ULP_F32] = {ulp_f32_default},
+	[ARRAY_ULP_F64] = {ulp_f64_default},
+};
+
+#ifdef HAVE_X86_KERNELS
+KERNEL(near_f32, avx2, __attribute__((target("avx2"))))
+KERNEL(near_f64, avx2, __attribute__((target("avx2"))))
+KERNEL(ulp_f32, avx2, __attribute__((target("avx2"))))
+KERNEL(ulp_f64, avx2, __attribute__((target("avx2"))))
+
+static void
+kernels_init(void)
+{
+	kernels[ARRAY_NEAR_F32][1] = near_f32_avx2;
+	kernels[ARRAY_NEAR_F64][1] = near_f64_avx2;
+	kernels[ARRAY_ULP_F32][1] = ulp_f32_avx2;
+	kernels[ARRAY_ULP_F64][1] = ulp_f64_avx2;
+}
+#endif
+
+/* -1 until the first call, then 1 if the AVX2 kernels are used. */
+static int useavx2 = -1;
+
+size_t
+array_violations(enum array_cmp cmp, const void *first, const void *second,
+		size_t n, double tol, double reltol)
+{
+	assert(cmp >= ARRAY_NEAR_F32 && cmp <= ARRAY_ULP_F64);
+	assert((first != NULL && second != NULL) || n == 0);
+	if (useavx2 < 0) {
+#ifdef HAVE_X86_KERNELS
+		kernels_init();
+		__builtin_cpu_init();
+		useavx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#else
+		useavx2 = 0;
+#endif
+	}
+	return kernels[cmp][useavx2](first, second, n, tol, reltol);
+}
+
+static size_t
+array_elemsize(enum array_cmp cmp)
+{
+	return cmp == ARRAY_NEAR_F32 || cmp == ARRAY_ULP_F32 ? sizeof(float) :
+		sizeof(double);
+}
+
+static double
+array_value(enum array_cmp cmp, const void *array, size_t i)
+{
+	if (array_elemsize(cmp) == sizeof(float))
+		return ((const float *) array)[i];
+	return ((const double *) array)[i];
+}
+
+/* Return the error of the i-th element, infinite if one only is NaN. */
+static double
+array_error(enum array_cmp cmp, const void *first, const void *second,
+		size_t i)
+{
+	double a = array_value(cmp, first, i), b = array_value(cmp, second, i);
+	int64_t x, y;
+
+	if (isnan(a) || isnan(b))
+		return isnan(a) && isnan(b) ? 0.0 : INFINITY;
+	switch (cmp) {
+		case ARRAY_NEAR_F32:
+		case ARRAY_NEAR_F64:
+			return a == b ? 0.0 : fabs(a - b);
+		case ARRAY_ULP_F32:
+			x = ORDERED32(((const int32_t *) first)[i]);
+			y = ORDERED32(((const int32_t *) second)[i]);
+			return x > y ? x - y : y - x;
+		case ARRAY_ULP_F64:
+			x = ORDERED64(((const int64_t *) first)[i]);
+			y = ORDERED64(((const int64_t *) second)[i]);
+			return x > y ? (double) ((uint64_t) x - (uint64_t) y) :
+				(double) ((uint64_t) y - (uint64_t) x);
+		default:
+			abort();  /* programming error */
+	}
+}
+
+const char *
+array_diff(enum array_cmp cmp, const char *msg, const void *first,
+		const void *second, size_t n, double tol, double reltol)
+{
+	size_t i, worst = 0, bad = 0, size = array_elemsize(cmp);
+	double err, maxerr = -1.0;
+	int digits = size == sizeof(float) ? 9 : 17;
+
+	for (i = 0; i < n; i++) {
+		if (array_violations(cmp, (const char *) first + i * size,
+					(const char *) second + i * size, 1, tol, reltol) == 0)
+			continue;
+		bad++;
+		err = array_error(cmp, first, second, i);
+		if (err > maxerr) {
+			maxerr = err;
+			worst = i;
+		}
+	}
+	assert(bad > 0);
+	snprintf(array_msg, sizeof(array_msg),
+			"%.512s: %zu of %zu elements differ, the worst at index %zu: "
+			"%.*g != %.*g (error %g%s)",
+			msg != NULL ? msg : "the arrays differ", bad, n, worst,
+			digits, array_value(cmp, first, worst),
+			digits, array_value(cmp, second, worst), maxerr,
+			cmp == ARRAY_ULP_F32 || cmp == ARRAY_ULP_F64 ? " ulp" : "");
+	return array_msg;
+}
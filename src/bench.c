@@ -0,0 +1,1378 @@
+#include <unistd.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * Benchmarks. As in the testing package of Go, the body runs its operation n
+ * times and n is grown until a run lasts long enough to be measured; then
+ * the body is run again a number of times, the repetitions, and the time per
+ * operation of each repetition is a sample. The samples are compared with the
+ * ones of a baseline, a JSON file in the format of Google Benchmark written
+ * by a previous run.
+ */
+
+#define BENCH_MAXN 1000000000ULL
+/* Below this time in ns the load scheduler spins rather than sleeps. */
+#define BENCH_SPIN 200000ULL
+/* The significance level of the U test that confirms a regression. */
+#define BENCH_ALPHA 0.05
+/* At most this many warmup rounds, until the last ones agree within a CV. */
+#define BENCH_WARMUP_MAX 10
+#define BENCH_WARMUP_STABLE 3
+#define BENCH_WARMUP_CV 0.05
+/* The drifts of the TSC rate and of the CPU speed that make a run noisy. */
+#define BENCH_MAXTSCDRIFT 0.01
+#define BENCH_MAXFREQDRIFT 0.05
+/* The build of the library in the JSON context, its asserts cost time. */
+#ifdef NDEBUG
+#define BENCH_BUILD_TYPE "release"
+#else
+#define BENCH_BUILD_TYPE "debug"
+#endif
+
+struct bench_baseline {
+	char *name;
+	double *samples;
+	size_t len;
+};
+
+static struct bench_config config = {
+	.mintime = 0.1,
+	.repetitions = 10,
+	.threshold = 0.05,
+	.json = NULL,
+	.baseline = NULL,
+	.cpu = -1,
+	.priority = false,
+	.maxcv = 0.0,
+	.retries = 0,
+};
+
+/* The percentiles of the latencies of the operations, in ns. */
+struct bench_latency {
+	uint64_t count;
+	uint64_t p50;
+	uint64_t p90;
+	uint64_t p99;
+	uint64_t p999;
+	uint64_t max;
+};
+
+/* The measures of a benchmark for one range. */
+struct bench_stats {
+	long range;
+	unsigned long long n;
+	/* The median, mean and stddev of the real time per operation, in ns. */
+	double median;
+	double mean;
+	double stddev;
+	/* The median CPU time per operation, in ns. */
+	double cpu;
+	/* The bytes and items processed by one operation. */
+	double bytes;
+	double items;
+	/* The number of threads and the median throughput of each. */
+	unsigned int threads;
+	double perthread;
+	struct bench_latency latency;
+	/* The warmup rounds and the retries of a noisy run. */
+	unsigned int warmup;
+	unsigned int retries;
+	/* The coefficient of variation of the repetitions. */
+	double cv;
+	/* The relative changes of the TSC rate and of the CPU speed. */
+	double tscdrift;
+	double freqdrift;
+	bool noisy;
+	bool hasbase;
+	double base;
+	double change;
+	double p;
+	bool regressed;
+};
+
+/* What runs a benchmark: the body and the threads that run it. */
+struct bench_ctx {
+	struct test_case *test;
+	struct test_result *result;
+	void (*body)(struct test_case *, struct test_result *, struct bench *,
+			void *);
+	void *usrptr;
+	/* The number of threads, 0 to run the body in the current one. */
+	unsigned int threads;
+	/* If each thread runs on its own CPU. */
+	bool pin;
+	long range;
+	/* The state of each thread. */
+	struct bench *benches;
+	/* The latencies of each thread, of the round and of all the rounds. */
+	struct bench_histogram *latency;
+	/*
+	 * The buffers of a measure and of a range, kept here to be freed when an
+	 * assertion of the body jumps out of the benchmark.
+	 */
+	struct bench_latency *latencies;
+	double *real;
+	struct bench_stats *stats;
+	double *sizes;
+};
+
+struct bench_worker {
+	pthread_t tid;
+	struct bench_ctx *ctx;
+	/* The view of the test for the thread. */
+	struct test_case *test;
+	struct bench *bench;
+	pthread_barrier_t *barrier;
+	unsigned long long n;
+	/* The CPU of the thread or -1. */
+	int cpu;
+};
+
+/* The state of a load test, shared with its scheduler thread. */
+struct bench_load {
+	struct test_case *test;
+	struct test_result *result;
+	void (*func)(struct test_case *, struct test_result *, void *);
+	void *usrptr;
+	double rate;
+	double duration;
+	/* The latencies from the intended start and from the actual one. */
+	struct bench_histogram *corrected;
+	struct bench_histogram *service;
+	/* The requests sent and the ones due but not sent at the end. */
+	uint64_t sent;
+	uint64_t missed;
+	double elapsed;
+};
+
+/* The names of the complexities in the JSON of Google Benchmark. */
+static const char *complexities[] = {
+	[BENCH_O1] = "1",
+	[BENCH_OLOGN] = "lgN",
+	[BENCH_ON] = "N",
+	[BENCH_ONLOGN] = "NlgN",
+	[BENCH_ON2] = "N^2",
+	[BENCH_OANY] = "any",
+};
+
+static const struct bench_env *benv;
+static struct list *baselines;
+static bool baselines_loaded;
+static FILE *json;
+static unsigned int json_benchmarks;
+
+static __thread char bench_msg[MAXLINE / 4];
+static __thread char bench_diag[4 * MAXLINE];
+
+static double
+bench_clock(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void
+bench_timer_start(struct bench *bench)
+{
+	if (bench->start >= 0.0)
+		return;
+	bench->start = bench_clock(CLOCK_MONOTONIC);
+	bench->cpustart = bench_clock(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void
+bench_timer_stop(struct bench *bench)
+{
+	if (bench->start < 0.0)
+		return;
+	bench->elapsed += bench_clock(CLOCK_MONOTONIC) - bench->start;
+	bench->cputime += bench_clock(CLOCK_THREAD_CPUTIME_ID) - bench->cpustart;
+	bench->start = -1.0;
+}
+
+void
+bench_timer_reset(struct bench *bench)
+{
+	bench->elapsed = 0.0;
+	bench->cputime = 0.0;
+	if (bench->start >= 0.0) {
+		bench->start = bench_clock(CLOCK_MONOTONIC);
+		bench->cpustart = bench_clock(CLOCK_THREAD_CPUTIME_ID);
+	}
+}
+
+static uint64_t
+bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void
+bench_op_start(struct bench *bench)
+{
+	bench->opstart = bench_ns();
+}
+
+void
+bench_op_stop(struct bench *bench)
+{
+	if (bench->latency != NULL)
+		bench_histogram_record(bench->latency, bench_ns() - bench->opstart);
+}
+
+static void
+bench_latency(const struct bench_histogram *histogram,
+		struct bench_latency *latency)
+{
+	latency->count = histogram->count;
+	latency->p50 = bench_histogram_percentile(histogram, 50.0);
+	latency->p90 = bench_histogram_percentile(histogram, 90.0);
+	latency->p99 = bench_histogram_percentile(histogram, 99.0);
+	latency->p999 = bench_histogram_percentile(histogram, 99.9);
+	latency->max = histogram->max;
+}
+
+static void
+bench_baseline_free(void *data)
+{
+	struct bench_baseline *baseline = data;
+
+	free(baseline->name);
+	free(baseline->samples);
+	free(baseline);
+}
+
+void
+bench_configure(const struct bench_config *newconfig)
+{
+	bench_finish();
+	list_free(baselines, bench_baseline_free);
+	baselines = NULL;
+	baselines_loaded = false;
+	bench_env_restore();
+	benv = NULL;
+	config = *newconfig;
+}
+
+/*
+ * Prepare the environment before the first benchmark, and pin the thread of
+ * the test to the CPU of the benchmarks before the others.
+ */
+static void
+bench_setup(void)
+{
+	if (benv == NULL)
+		benv = bench_env_setup(config.cpu, config.priority);
+	else
+		bench_env_pin();
+}
+
+/*
+ * End a benchmark: restore the jump buffer of the test, free what the body
+ * left allocated in `ctx` if it jumped out, and let the other tests run on
+ * all the CPUs, then go on with the jump of a failed assertion of the
+ * benchmark, if any.
+ */
+static void
+bench_end(struct test_case *test, struct bench_ctx *ctx, jmp_buf *saved,
+		int code)
+{
+	((struct test_case_impl *) test)->jmpbuffer = saved;
+	if (ctx != NULL) {
+		free(ctx->benches);
+		free(ctx->latency);
+		free(ctx->latencies);
+		free(ctx->real);
+		free(ctx->stats);
+		free(ctx->sizes);
+	}
+	bench_env_unpin();
+	if (code != 0)
+		longjmp(*saved, code);
+}
+
+static char *
+bench_read_file(const char *path)
+{
+	FILE *stream;
+	char *text;
+	long size;
+
+	if ((stream = fopen(path, "r")) == NULL)
+		return NULL;
+	if (fseek(stream, 0, SEEK_END) == -1 || (size = ftell(stream)) < 0 ||
+			fseek(stream, 0, SEEK_SET) == -1) {
+		fclose(stream);
+		return NULL;
+	}
+	if ((text = malloc(size + 1)) == NULL)
+		err_sys("malloc");
+	text[fread(text, 1, size, stream)] = '\0';
+	fclose(stream);
+	return text;
+}
+
+static double
+bench_time_unit(const struct json *entry)
+{
+	const struct json *unit = json_get(entry, "time_unit");
+
+	if (unit == NULL || unit->type != JSON_STRING ||
+			!strcmp(unit->string, "ns"))
+		return 1.0;
+	if (!strcmp(unit->string, "us"))
+		return 1e3;
+	if (!strcmp(unit->string, "ms"))
+		return 1e6;
+	return 1e9;
+}
+
+static struct bench_baseline *
+bench_baseline_find(const char *name)
+{
+	struct list *lp;
+
+	for (lp = baselines; lp != NULL; lp = lp->next)
+		if (!strcmp(((struct bench_baseline *) lp->data)->name, name))
+			return lp->data;
+	return NULL;
+}
+
+/* Collect the real time of the iterations of each benchmark, in ns. */
+static void
+bench_baseline_load(void)
+{
+	const struct json *entry, *name, *type, *time;
+	struct bench_baseline *baseline;
+	struct json *root;
+	char *text;
+
+	baselines_loaded = true;
+	if (config.baseline == NULL)
+		return;
+	if ((text = bench_read_file(config.baseline)) == NULL) {
+		fprintf(stderr, "# cannot read the baseline %s: %s\n",
+				config.baseline, strerror(errno));
+		return;
+	}
+	root = json_parse(text);
+	free(text);
+	entry = json_get(root, "benchmarks");
+	if (entry == NULL || entry->type != JSON_ARRAY) {
+		fprintf(stderr, "# the baseline %s is not valid\n", config.baseline);
+		json_free(root);
+		return;
+	}
+	for (entry = entry->child; entry != NULL; entry = entry->next) {
+		type = json_get(entry, "run_type");
+		if (type != NULL && (type->type != JSON_STRING ||
+					strcmp(type->string, "iteration")))
+			continue;
+		if ((name = json_get(entry, "run_name")) == NULL)
+			name = json_get(entry, "name");
+		time = json_get(entry, "real_time");
+		if (name == NULL || name->type != JSON_STRING || time == NULL ||
+				time->type != JSON_NUMBER)
+			continue;
+		if ((baseline = bench_baseline_find(name->string)) == NULL) {
+			if ((baseline = calloc(1, sizeof(*baseline))) == NULL ||
+					(baseline->name = strdup(name->string)) == NULL)
+				err_sys("malloc");
+			baselines = list_append(baselines, baseline);
+		}
+		baseline->samples = realloc(baseline->samples,
+				(baseline->len + 1) * sizeof(double));
+		if (baseline->samples == NULL)
+			err_sys("malloc");
+		baseline->samples[baseline->len++] = time->number *
+			bench_time_unit(entry);
+	}
+	json_free(root);
+}
+
+static void
+bench_json_open(void)
+{
+	char date[64], host[256];
+	time_t now = time(NULL);
+	double loadavg[3];
+
+	if ((json = fopen(config.json, "w")) == NULL) {
+		fprintf(stderr, "# cannot write %s: %s\n", config.json,
+				strerror(errno));
+		config.json = NULL;
+		return;
+	}
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+	if (gethostname(host, sizeof(host)) == -1)
+		strcpy(host, "unknown");
+	host[sizeof(host) - 1] = '\0';
+	fprintf(json, "{\n  \"context\": {\n    \"date\": \"%s\",\n", date);
+	fputs("    \"host_name\": ", json);
+	json_print_string(json, host);
+	fprintf(json, ",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	bench_env_loadavg(loadavg);
+	fprintf(json, "    \"load_avg\": [%.2f, %.2f, %.2f],\n", loadavg[0],
+			loadavg[1], loadavg[2]);
+	fputs("    \"cpu_governor\": ", json);
+	json_print_string(json, benv->governor);
+	fputs(",\n    \"isolated_cpus\": ", json);
+	json_print_string(json, benv->isolated);
+	fprintf(json, ",\n    \"pinned_cpu\": %d,\n"
+			"    \"raised_priority\": %s,\n"
+			"    \"library_build_type\": \"%s\"\n  },\n"
+			"  \"benchmarks\": [",
+			benv->cpu, benv->priority ? "true" : "false", BENCH_BUILD_TYPE);
+	json_benchmarks = 0;
+}
+
+static void
+bench_json_entry(const char *name, const char *aggregate, unsigned int index,
+		unsigned long long iterations, double realtime, double cputime,
+		const struct bench_stats *stats, const struct bench_latency *latency)
+{
+	bool counters;
+
+	fputs(json_benchmarks++ > 0 ? ",\n    {\n" : "\n    {\n", json);
+	if (aggregate != NULL)
+		fprintf(json, "      \"name\": \"%s_%s\",\n", name, aggregate);
+	else
+		fprintf(json, "      \"name\": \"%s\",\n", name);
+	fprintf(json, "      \"run_name\": \"%s\",\n"
+			"      \"run_type\": \"%s\",\n",
+			name, aggregate != NULL ? "aggregate" : "iteration");
+	fprintf(json, "      \"repetitions\": %u,\n", config.repetitions);
+	if (aggregate != NULL)
+		fprintf(json, "      \"aggregate_name\": \"%s\",\n", aggregate);
+	if (aggregate != NULL && !strcmp(aggregate, "cv"))
+		fputs("      \"aggregate_unit\": \"percentage\",\n", json);
+	else
+		fprintf(json, "      \"repetition_index\": %u,\n", index);
+	fprintf(json, "      \"threads\": %u,\n"
+			"      \"iterations\": %llu,\n"
+			"      \"real_time\": %.17g,\n"
+			"      \"cpu_time\": %.17g,\n",
+			stats->threads, iterations, realtime, cputime);
+	/* The throughputs of a dispersion make no sense. */
+	counters = aggregate == NULL || (strcmp(aggregate, "stddev") != 0 &&
+			strcmp(aggregate, "cv") != 0);
+	if (counters && stats->bytes > 0.0 && realtime > 0.0)
+		fprintf(json, "      \"bytes_per_second\": %.17g,\n",
+				stats->threads * stats->bytes / realtime * 1e9);
+	if (counters && stats->items > 0.0 && realtime > 0.0)
+		fprintf(json, "      \"items_per_second\": %.17g,\n",
+				stats->threads * stats->items / realtime * 1e9);
+	if (latency != NULL && latency->count > 0)
+		fprintf(json, "      \"latency_p50\": %" PRIu64 ",\n"
+				"      \"latency_p90\": %" PRIu64 ",\n"
+				"      \"latency_p99\": %" PRIu64 ",\n"
+				"      \"latency_p999\": %" PRIu64 ",\n"
+				"      \"latency_max\": %" PRIu64 ",\n",
+				latency->p50, latency->p90, latency->p99, latency->p999,
+				latency->max);
+	if (aggregate == NULL && stats->noisy)
+		fputs("      \"noisy\": true,\n", json);
+	fputs("      \"time_unit\": \"ns\"\n    }", json);
+}
+
+static bool
+bench_json_ready(const char *name)
+{
+	/* The names are C identifiers, the odd ones are not worth escaping. */
+	if (config.json == NULL || strpbrk(name, "\"\\") != NULL)
+		return false;
+	if (json == NULL)
+		bench_json_open();
+	return json != NULL;
+}
+
+/*
+ * The latencies of each repetition go with it, the merged ones with the mean
+ * and the median.
+ */
+static void
+bench_json_write(const char *name, const struct bench_stats *stats,
+		const double *real, const double *cpu,
+		const struct bench_latency *latencies)
+{
+	unsigned int r, reps = config.repetitions;
+
+	if (!bench_json_ready(name))
+		return;
+	for (r = 0; r < reps; r++)
+		bench_json_entry(name, NULL, r, stats->n, real[r], cpu[r], stats,
+				&latencies[r]);
+	bench_json_entry(name, "mean", 0, reps, stats_mean(real, reps),
+			stats_mean(cpu, reps), stats, &stats->latency);
+	bench_json_entry(name, "median", 0, reps, stats_median(real, reps),
+			stats_median(cpu, reps), stats, &stats->latency);
+	bench_json_entry(name, "stddev", 0, reps, stats_stddev(real, reps),
+			stats_stddev(cpu, reps), stats, NULL);
+	bench_json_entry(name, "cv", 0, reps, stats->cv,
+			stats_mean(cpu, reps) > 0.0 ? stats_stddev(cpu, reps) /
+			stats_mean(cpu, reps) : 0.0, stats, NULL);
+	fflush(json);
+}
+
+/* The BigO and RMS entries of Google Benchmark. */
+static void
+bench_json_complexity(const char *name, enum bench_complexity bigo,
+		double realcoef, double cpucoef, double rms)
+{
+	if (!bench_json_ready(name))
+		return;
+	fprintf(json, "%s      \"name\": \"%s_BigO\",\n"
+			"      \"run_name\": \"%s\",\n"
+			"      \"run_type\": \"aggregate\",\n"
+			"      \"aggregate_name\": \"BigO\",\n"
+			"      \"cpu_coefficient\": %.17g,\n"
+			"      \"real_coefficient\": %.17g,\n"
+			"      \"big_o\": \"%s\",\n"
+			"      \"time_unit\": \"ns\"\n    }",
+			json_benchmarks++ > 0 ? ",\n    {\n" : "\n    {\n", name, name,
+			cpucoef, realcoef, complexities[bigo]);
+	fprintf(json, ",\n    {\n      \"name\": \"%s_RMS\",\n"
+			"      \"run_name\": \"%s\",\n"
+			"      \"run_type\": \"aggregate\",\n"
+			"      \"aggregate_name\": \"RMS\",\n"
+			"      \"rms\": %.17g\n    }",
+			name, name, rms);
+	json_benchmarks++;
+	fflush(json);
+}
+
+void
+bench_finish(void)
+{
+	if (json == NULL)
+		return;
+	fputs("\n  ]\n}\n", json);
+	fclose(json);
+	json = NULL;
+}
+
+/* Run the body once in the current thread. */
+static void
+bench_body(struct bench_ctx *ctx, struct test_case *test, struct bench *bench,
+		unsigned long long n)
+{
+	bench->n = n;
+	bench->elapsed = 0.0;
+	bench->cputime = 0.0;
+	bench->start = -1.0;
+	bench->bytes = 0.0;
+	bench->items = 0.0;
+	if (bench->latency != NULL)
+		bench_histogram_reset(bench->latency);
+	bench_timer_start(bench);
+	ctx->body(test, ctx->result, bench, ctx->usrptr);
+	bench_timer_stop(bench);
+}
+
+static void *
+bench_worker(void *arg)
+{
+	struct bench_worker *worker = arg;
+
+	bench_env_thread(worker->cpu);
+	pthread_barrier_wait(worker->barrier);
+	bench_body(worker->ctx, worker->test, worker->bench, worker->n);
+	return NULL;
+}
+
+/* Start the workers together and wait for them. */
+static void
+bench_spawn(struct bench_ctx *ctx, unsigned long long n)
+{
+	struct bench_worker *workers;
+	pthread_barrier_t barrier;
+	unsigned int i;
+	int ret;
+
+	if ((workers = calloc(ctx->threads, sizeof(*workers))) == NULL)
+		err_sys("malloc");
+	pthread_barrier_init(&barrier, NULL, ctx->threads);
+	for (i = 0; i < ctx->threads; i++) {
+		workers[i].ctx = ctx;
+		workers[i].test = test_case_thread_new(ctx->test);
+		workers[i].bench = &ctx->benches[i];
+		workers[i].barrier = &barrier;
+		workers[i].n = n;
+		workers[i].cpu = ctx->pin ? bench_env_cpu(i) : -1;
+		ctx->benches[i].thread = i;
+		ctx->benches[i].threads = ctx->threads;
+		if ((ret = pthread_create(&workers[i].tid, NULL, bench_worker,
+						&workers[i])) != 0) {
+			errno = ret;
+			err_sys("pthread_create");
+		}
+	}
+	for (i = 0; i < ctx->threads; i++) {
+		pthread_join(workers[i].tid, NULL);
+		test_case_thread_free(workers[i].test);
+	}
+	pthread_barrier_destroy(&barrier);
+	free(workers);
+	test_case_thread_raise(ctx->test);
+}
+
+/*
+ * Run a round of the benchmark and return in `bench` the time of the slowest
+ * thread and the mean CPU time. The latencies of the threads are merged in
+ * the histogram of the round. Return the mean throughput of a thread.
+ */
+static double
+bench_round(struct bench_ctx *ctx, struct bench *bench, unsigned long long n)
+{
+	unsigned int i, count = ctx->threads > 0 ? ctx->threads : 1;
+	double perthread = 0.0;
+
+	if (ctx->threads == 0)
+		bench_body(ctx, ctx->test, &ctx->benches[0], n);
+	else
+		bench_spawn(ctx, n);
+	bench->n = n;
+	bench->elapsed = 0.0;
+	bench->cputime = 0.0;
+	bench->bytes = ctx->benches[0].bytes;
+	bench->items = ctx->benches[0].items;
+	bench_histogram_reset(&ctx->latency[count]);
+	for (i = 0; i < count; i++) {
+		if (ctx->benches[i].elapsed > bench->elapsed)
+			bench->elapsed = ctx->benches[i].elapsed;
+		bench->cputime += ctx->benches[i].cputime / count;
+		if (ctx->benches[i].elapsed > 0.0)
+			perthread += n / ctx->benches[i].elapsed / count;
+		bench_histogram_merge(&ctx->latency[count], &ctx->latency[i]);
+	}
+	return perthread;
+}
+
+/* Grow the iterations until a run lasts at least the minimum time. */
+static unsigned long long
+bench_calibrate(struct bench_ctx *ctx)
+{
+	struct bench bench;
+	unsigned long long n = 1;
+	double next, perop;
+
+	for (;;) {
+		bench_round(ctx, &bench, n);
+		if (bench.elapsed >= config.mintime || n >= BENCH_MAXN)
+			return n;
+		perop = bench.elapsed > 0.0 ? bench.elapsed / n : 1e-9;
+		/* Aim a bit past the minimum time, but do not grow too fast. */
+		next = config.mintime / perop * 1.2;
+		if (next > n * 100.0)
+			next = n * 100.0;
+		if (next < n + 1.0)
+			next = n + 1.0;
+		n = next < BENCH_MAXN ? (unsigned long long) next : BENCH_MAXN;
+	}
+}
+
+/*
+ * Run rounds until the last ones agree, as the caches, the branch predictors
+ * and the frequency of the CPU settle. Return the number of rounds.
+ */
+static unsigned int
+bench_warmup(struct bench_ctx *ctx, unsigned long long n)
+{
+	double times[BENCH_WARMUP_MAX], limit;
+	const double *last;
+	struct bench bench;
+	unsigned int i;
+
+	limit = config.maxcv > 0.0 ? config.maxcv : BENCH_WARMUP_CV;
+	for (i = 0; i < BENCH_WARMUP_MAX; i++) {
+		bench_round(ctx, &bench, n);
+		times[i] = bench.elapsed;
+		if (i + 1 < BENCH_WARMUP_STABLE)
+			continue;
+		last = times + i + 1 - BENCH_WARMUP_STABLE;
+		if (stats_stddev(last, BENCH_WARMUP_STABLE) <=
+				limit * stats_mean(last, BENCH_WARMUP_STABLE))
+			return i + 1;
+	}
+	return i;
+}
+
+/*
+ * Calibrate, warm up and run the benchmark for one range, then compare it. A
+ * run whose timings vary too much or during which the CPU changed speed is
+ * noisy, and it is measured again up to the configured retries.
+ */
+static void
+bench_measure(struct bench_ctx *ctx, const char *name,
+		struct bench_stats *stats)
+{
+	struct bench bench;
+	struct bench_baseline *baseline;
+	struct bench_latency *latencies;
+	unsigned int i, r, reps = config.repetitions;
+	unsigned int count = ctx->threads > 0 ? ctx->threads : 1;
+	double *real, *cpu, *perthread, *tscrate, reference, min, max;
+	uint64_t tsc, start;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->range = ctx->range;
+	stats->threads = count;
+	/* The histograms of the threads, of the round and the merged one. */
+	ctx->benches = calloc(count, sizeof(struct bench));
+	ctx->latency = calloc(count + 2, sizeof(struct bench_histogram));
+	latencies = ctx->latencies = calloc(reps, sizeof(*latencies));
+	real = ctx->real = malloc(4 * reps * sizeof(double));
+	if (ctx->benches == NULL || ctx->latency == NULL || latencies == NULL ||
+			real == NULL)
+		err_sys("malloc");
+	for (i = 0; i < count; i++) {
+		ctx->benches[i].range = ctx->range;
+		ctx->benches[i].latency = &ctx->latency[i];
+		ctx->benches[i].threads = 1;
+	}
+	stats->n = bench_calibrate(ctx);
+	stats->warmup = bench_warmup(ctx, stats->n);
+	cpu = real + reps;
+	perthread = cpu + reps;
+	tscrate = perthread + reps;
+	for (stats->retries = 0; ; stats->retries++) {
+		bench_histogram_reset(&ctx->latency[count + 1]);
+		reference = bench_env_reference();
+		for (r = 0; r < reps; r++) {
+			tsc = bench_env_tsc();
+			start = bench_ns();
+			perthread[r] = bench_round(ctx, &bench, stats->n);
+			tscrate[r] = (bench_env_tsc() - tsc) /
+				(double) (bench_ns() - start + 1);
+			real[r] = bench.elapsed / stats->n * 1e9;
+			cpu[r] = bench.cputime / stats->n * 1e9;
+			bench_latency(&ctx->latency[count], &latencies[r]);
+			bench_histogram_merge(&ctx->latency[count + 1],
+					&ctx->latency[count]);
+		}
+		stats->freqdrift = bench_env_reference() / reference - 1.0;
+		min = max = tscrate[0];
+		for (r = 1; r < reps; r++) {
+			min = tscrate[r] < min ? tscrate[r] : min;
+			max = tscrate[r] > max ? tscrate[r] : max;
+		}
+		stats->tscdrift = max > 0.0 ? (max - min) / max : 0.0;
+		stats->mean = stats_mean(real, reps);
+		stats->stddev = stats_stddev(real, reps);
+		stats->cv = stats->mean > 0.0 ? stats->stddev / stats->mean : 0.0;
+		stats->noisy = (config.maxcv > 0.0 && stats->cv > config.maxcv) ||
+			stats->tscdrift > BENCH_MAXTSCDRIFT ||
+			fabs(stats->freqdrift) > BENCH_MAXFREQDRIFT;
+		if (!stats->noisy || stats->retries >= config.retries)
+			break;
+	}
+	bench_latency(&ctx->latency[count + 1], &stats->latency);
+	stats->median = stats_median(real, reps);
+	stats->cpu = stats_median(cpu, reps);
+	stats->perthread = stats_median(perthread, reps);
+	stats->bytes = bench.bytes;
+	stats->items = bench.items;
+	bench_json_write(name, stats, real, cpu, latencies);
+	free(latencies);
+	free(ctx->latency);
+	free(ctx->benches);
+	ctx->latencies = NULL;
+	ctx->latency = NULL;
+	ctx->benches = NULL;
+
+	if (!baselines_loaded)
+		bench_baseline_load();
+	if ((baseline = bench_baseline_find(name)) != NULL) {
+		stats->hasbase = true;
+		stats->base = stats_median(baseline->samples, baseline->len);
+		stats->change = stats->median / stats->base - 1.0;
+		stats->p = stats_mann_whitney(real, reps, baseline->samples,
+				baseline->len);
+		stats->regressed = stats->change > config.threshold &&
+			stats->p < BENCH_ALPHA;
+	}
+	free(real);
+	ctx->real = NULL;
+}
+
+static double
+bench_complexity(enum bench_complexity bigo, double n)
+{
+	switch (bigo) {
+		case BENCH_O1:
+			return 1.0;
+		case BENCH_OLOGN:
+			return log2(n);
+		case BENCH_ON:
+			return n;
+		case BENCH_ONLOGN:
+			return n * log2(n);
+		default:
+			return n * n;
+	}
+}
+
+/* The least squares coefficient of times = coef * f(sizes). */
+static double
+bench_coefficient(enum bench_complexity bigo, const double *sizes,
+		const double *times, size_t len)
+{
+	double sff = 0.0, stf = 0.0, f;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		f = bench_complexity(bigo, sizes[i]);
+		sff += f * f;
+		stf += times[i] * f;
+	}
+	return sff > 0.0 ? stf / sff : 0.0;
+}
+
+/*
+ * Fit the times to coef * f(n) by least squares for each complexity and
+ * return the one with the lowest RMS, normalized by the mean time.
+ */
+enum bench_complexity
+bench_fit(const double *sizes, const double *times, size_t len, double *coef,
+		double *rms)
+{
+	enum bench_complexity bigo, best = BENCH_O1;
+	double sum, c, err, mean;
+	size_t i;
+
+	assert(len > 0);
+	mean = stats_mean(times, len);
+	*rms = INFINITY;
+	*coef = 0.0;
+	for (bigo = BENCH_O1; bigo < BENCH_OANY; bigo++) {
+		c = bench_coefficient(bigo, sizes, times, len);
+		sum = 0.0;
+		for (i = 0; i < len; i++) {
+			err = times[i] - c * bench_complexity(bigo, sizes[i]);
+			sum += err * err;
+		}
+		err = sqrt(sum / len) / (mean > 0.0 ? mean : 1.0);
+		if (err < *rms) {
+			*rms = err;
+			*coef = c;
+			best = bigo;
+		}
+	}
+	return best;
+}
+
+/* Append to the diagnostic, dropping what does not fit. */
+static void
+bench_diag_printf(size_t *len, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (*len >= sizeof(bench_diag))
+		return;
+	va_start(ap, fmt);
+	ret = vsnprintf(bench_diag + *len, sizeof(bench_diag) - *len, fmt, ap);
+	va_end(ap);
+	if (ret < 0 || (size_t) ret >= sizeof(bench_diag) - *len) {
+		bench_diag[*len] = '\0';
+		*len = sizeof(bench_diag);
+		return;
+	}
+	*len += ret;
+}
+
+static void
+bench_diag_latency(size_t *len, const char *indent, const char *key,
+		const struct bench_latency *latency)
+{
+	bench_diag_printf(len,
+			"%s%s:\n"
+			"%s  count: %" PRIu64 "\n"
+			"%s  p50: %" PRIu64 "\n"
+			"%s  p90: %" PRIu64 "\n"
+			"%s  p99: %" PRIu64 "\n"
+			"%s  p99_9: %" PRIu64 "\n"
+			"%s  max: %" PRIu64 "\n",
+			indent, key, indent, latency->count, indent, latency->p50, indent,
+			latency->p90, indent, latency->p99, indent, latency->p999, indent,
+			latency->max);
+}
+
+static void
+bench_diag_stats(size_t *len, const char *indent, const struct bench_stats *stats)
+{
+	bench_diag_printf(len,
+			"%siterations: %llu\n"
+			"%srepetitions: %u\n"
+			"%sns_per_op: %.6g\n"
+			"%smean: %.6g\n"
+			"%sstddev: %.6g\n"
+			"%scpu_ns_per_op: %.6g\n",
+			indent, stats->n, indent, config.repetitions, indent,
+			stats->median, indent, stats->mean, indent, stats->stddev,
+			indent, stats->cpu);
+	if (stats->bytes > 0.0 && stats->median > 0.0)
+		bench_diag_printf(len, "%sbytes_per_second: %.6g\n", indent,
+				stats->threads * stats->bytes / stats->median * 1e9);
+	if (stats->items > 0.0 && stats->median > 0.0)
+		bench_diag_printf(len, "%sitems_per_second: %.6g\n", indent,
+				stats->threads * stats->items / stats->median * 1e9);
+	bench_diag_printf(len,
+			"%swarmup: %u\n"
+			"%scv: %.4f\n"
+			"%sfreq_drift: %.4f\n",
+			indent, stats->warmup, indent, stats->cv, indent, stats->freqdrift);
+	if (benv->hastsc)
+		bench_diag_printf(len, "%stsc_drift: %.4f\n", indent, stats->tscdrift);
+	if (stats->noisy || stats->retries > 0)
+		bench_diag_printf(len, "%snoisy: %s\n%sretries: %u\n", indent,
+				stats->noisy ? "true" : "false", indent, stats->retries);
+	if (stats->latency.count > 0)
+		bench_diag_latency(len, indent, "latency", &stats->latency);
+	if (stats->hasbase)
+		bench_diag_printf(len,
+				"%sbaseline: %.6g\n"
+				"%schange: %.4f\n"
+				"%sp_value: %.4g\n",
+				indent, stats->base, indent, stats->change, indent, stats->p);
+}
+
+/* Record what could have made the timings noisy. */
+static void
+bench_diag_env(size_t *len)
+{
+	double loadavg[3];
+
+	bench_env_loadavg(loadavg);
+	bench_diag_printf(len, "  environment:\n");
+	if (benv->cpu >= 0)
+		bench_diag_printf(len, "    cpu: %d\n", benv->cpu);
+	if (benv->priority)
+		bench_diag_printf(len, "    priority: raised\n");
+	bench_diag_printf(len,
+			"    governor: '%s'\n"
+			"    isolated_cpus: '%s'\n"
+			"    load_avg: [%.2f, %.2f, %.2f]\n",
+			benv->governor, benv->isolated, loadavg[0], loadavg[1],
+			loadavg[2]);
+}
+
+/* Format the time of the benchmark, its throughput and baseline change. */
+static size_t
+bench_message(char *buf, size_t size, const struct bench_stats *stats)
+{
+	size_t len;
+
+	len = snprintf(buf, size, "%.4g ns/op", stats->median);
+	if (stats->bytes > 0.0 && stats->median > 0.0 && len < size)
+		len += snprintf(buf + len, size - len, ", %.3g GB/s",
+				stats->threads * stats->bytes / stats->median);
+	if (stats->items > 0.0 && stats->median > 0.0 && len < size)
+		len += snprintf(buf + len, size - len, ", %.4g items/s",
+				stats->threads * stats->items / stats->median * 1e9);
+	if (stats->latency.count > 0 && len < size)
+		len += snprintf(buf + len, size - len, ", p99 %" PRIu64 " ns",
+				stats->latency.p99);
+	if (len >= size)
+		return size - 1;
+	if (!stats->hasbase)
+		len += snprintf(buf + len, size - len, " (+/- %.1f%%)",
+				stats->mean > 0.0 ? stats->stddev / stats->mean * 100.0 : 0.0);
+	else if (stats->regressed)
+		len += snprintf(buf + len, size - len,
+				" is %.1f%% slower than the baseline %.4g ns/op (p=%.2g)",
+				stats->change * 100.0, stats->base, stats->p);
+	else
+		len += snprintf(buf + len, size - len,
+				", %+.1f%% from the baseline (p=%.2g)",
+				stats->change * 100.0, stats->p);
+	if (stats->noisy && len < size)
+		len += snprintf(buf + len, size - len, ", noisy");
+	return len < size ? len : size - 1;
+}
+
+static void
+bench_run_one(struct bench_ctx *ctx)
+{
+	struct test_case *test = ctx->test;
+	struct bench_stats stats;
+	size_t len = 0;
+
+	bench_measure(ctx, test->name, &stats);
+	bench_diag_printf(&len, "  benchmark:\n");
+	bench_diag_stats(&len, "    ", &stats);
+	bench_diag_env(&len);
+	test->diag = bench_diag;
+	bench_message(bench_msg, sizeof(bench_msg), &stats);
+	test->assert_impl(test, ctx->result, !stats.regressed, "BENCHMARK",
+			bench_msg, NULL, 0);
+}
+
+static void
+bench_run_range(struct bench_ctx *ctx, const struct bench_range *range)
+{
+	struct test_case *test = ctx->test;
+	struct bench_stats *stats, *regressed = NULL;
+	enum bench_complexity bigo;
+	double *sizes, *real, *cpu, coef, cpucoef, rms;
+	char name[MAXLINE / 4];
+	size_t i, len = 0, count = 0;
+	long r;
+
+	assert(range->lo > 0);
+	assert(range->hi >= range->lo);
+	assert(range->mult > 1);
+	for (r = range->lo; r < range->hi; r = r > range->hi / range->mult ?
+			range->hi : r * range->mult)
+		count++;
+	count++;
+	stats = ctx->stats = calloc(count, sizeof(*stats));
+	sizes = ctx->sizes = malloc(3 * count * sizeof(double));
+	if (stats == NULL || sizes == NULL)
+		err_sys("malloc");
+	real = sizes + count;
+	cpu = real + count;
+	bench_diag_printf(&len, "  benchmark:\n");
+	for (i = 0, r = range->lo; i < count; i++) {
+		snprintf(name, sizeof(name), "%s/%ld", test->name, r);
+		ctx->range = r;
+		bench_measure(ctx, name, &stats[i]);
+		bench_diag_printf(&len, "    - range: %ld\n", r);
+		bench_diag_stats(&len, "      ", &stats[i]);
+		if (stats[i].regressed && regressed == NULL)
+			regressed = &stats[i];
+		sizes[i] = r;
+		real[i] = stats[i].median;
+		cpu[i] = stats[i].cpu;
+		r = r > range->hi / range->mult ? range->hi : r * range->mult;
+	}
+
+	bigo = bench_fit(sizes, real, count, &coef, &rms);
+	cpucoef = bench_coefficient(bigo, sizes, cpu, count);
+	bench_diag_printf(&len,
+			"  complexity:\n"
+			"    big_o: %s\n"
+			"    coefficient: %.6g\n"
+			"    cpu_coefficient: %.6g\n"
+			"    rms: %.4f\n",
+			complexities[bigo], coef, cpucoef, rms);
+	if (range->bound != BENCH_OANY)
+		bench_diag_printf(&len, "    bound: %s\n", complexities[range->bound]);
+	bench_diag_env(&len);
+	test->diag = bench_diag;
+	bench_json_complexity(test->name, bigo, coef, cpucoef, rms);
+
+	if (regressed != NULL) {
+		len = snprintf(bench_msg, sizeof(bench_msg), "%s/%ld: ", test->name,
+				regressed->range);
+		if (len < sizeof(bench_msg))
+			bench_message(bench_msg + len, sizeof(bench_msg) - len, regressed);
+	} else if (range->bound != BENCH_OANY && bigo > range->bound)
+		snprintf(bench_msg, sizeof(bench_msg),
+				"O(%s) exceeds the bound O(%s) (rms %.1f%%)",
+				complexities[bigo], complexities[range->bound], rms * 100.0);
+	else
+		snprintf(bench_msg, sizeof(bench_msg), "O(%s), rms %.1f%% over %zu "
+				"ranges", complexities[bigo], rms * 100.0, count);
+	free(sizes);
+	free(stats);
+	ctx->sizes = NULL;
+	ctx->stats = NULL;
+	test->assert_impl(test, ctx->result, regressed == NULL &&
+			(range->bound == BENCH_OANY || bigo <= range->bound), "BENCHMARK",
+			bench_msg, NULL, 0);
+}
+
+void
+bench_run(struct test_case *test, struct test_result *result,
+		void (*body)(struct test_case *, struct test_result *, struct bench *,
+			void *),
+		void *usrptr, const struct bench_range *range)
+{
+	struct bench_ctx ctx = {
+		.test = test,
+		.result = result,
+		.body = body,
+		.usrptr = usrptr,
+	};
+	jmp_buf *saved, jmpbuffer;
+	int code;
+
+	assert(test != NULL);
+	assert(body != NULL);
+	assert(config.repetitions > 0);
+
+	bench_setup();
+	saved = ((struct test_case_impl *) test)->jmpbuffer;
+	((struct test_case_impl *) test)->jmpbuffer = &jmpbuffer;
+	if ((code = setjmp(jmpbuffer)) == 0) {
+		if (range == NULL)
+			bench_run_one(&ctx);
+		else
+			bench_run_range(&ctx, range);
+	}
+	bench_end(test, &ctx, saved, code);
+}
+
+static void
+bench_threads(struct bench_ctx *ctx, unsigned int maxthreads)
+{
+	struct test_case *test = ctx->test;
+	struct bench_stats stats, *regressed = NULL;
+	char name[MAXLINE / 4];
+	double single = 0.0, total = 0.0, efficiency = 1.0;
+	unsigned int threads;
+	size_t len = 0;
+
+	if (maxthreads == 0)
+		maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	bench_diag_printf(&len, "  benchmark:\n");
+	for (threads = 1; threads <= maxthreads; threads = threads < maxthreads &&
+			threads > maxthreads / 2 ? maxthreads : threads * 2) {
+		ctx->threads = threads;
+		snprintf(name, sizeof(name), "%s/threads:%u", test->name, threads);
+		bench_measure(ctx, name, &stats);
+		total = stats.median > 0.0 ? threads * 1e9 / stats.median : 0.0;
+		if (threads == 1)
+			single = total;
+		efficiency = single > 0.0 ? total / (threads * single) : 0.0;
+		bench_diag_printf(&len, "    - threads: %u\n", threads);
+		bench_diag_stats(&len, "      ", &stats);
+		bench_diag_printf(&len,
+				"      ops_per_second: %.6g\n"
+				"      ops_per_thread: %.6g\n"
+				"      efficiency: %.4f\n",
+				total, stats.perthread, efficiency);
+		if (stats.regressed && regressed == NULL) {
+			regressed = &stats;
+			len = snprintf(bench_msg, sizeof(bench_msg), "%s: ", name);
+			if (len < sizeof(bench_msg))
+				bench_message(bench_msg + len, sizeof(bench_msg) - len, &stats);
+		}
+		if (threads == maxthreads)
+			break;
+	}
+	bench_diag_env(&len);
+	test->diag = bench_diag;
+	if (regressed == NULL)
+		snprintf(bench_msg, sizeof(bench_msg),
+				"%.4g ops/s in %u thread%s, %.0f%% scaling efficiency",
+				total, maxthreads, maxthreads > 1 ? "s" : "",
+				efficiency * 100.0);
+	test->assert_impl(test, ctx->result, regressed == NULL, "BENCHMARK",
+			bench_msg, NULL, 0);
+}
+
+void
+bench_run_threads(struct test_case *test, struct test_result *result,
+		void (*body)(struct test_case *, struct test_result *, struct bench *,
+			void *),
+		void *usrptr, unsigned int maxthreads, bool pin)
+{
+	struct bench_ctx ctx = {
+		.test = test,
+		.result = result,
+		.body = body,
+		.usrptr = usrptr,
+		.pin = pin,
+	};
+	jmp_buf *saved, jmpbuffer;
+	int code;
+
+	assert(test != NULL);
+	assert(body != NULL);
+	assert(config.repetitions > 0);
+
+	bench_setup();
+	saved = ((struct test_case_impl *) test)->jmpbuffer;
+	((struct test_case_impl *) test)->jmpbuffer = &jmpbuffer;
+	if ((code = setjmp(jmpbuffer)) == 0)
+		bench_threads(&ctx, maxthreads);
+	bench_end(test, &ctx, saved, code);
+}
+
+/* Wait until the time `when` in ns, sleeping if it is far enough. */
+static void
+bench_wait(uint64_t when)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	now = bench_ns();
+	if (when > now + BENCH_SPIN) {
+		when -= BENCH_SPIN;
+		ts.tv_sec = when / 1000000000ULL;
+		ts.tv_nsec = when % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					NULL) == EINTR)
+			;
+		when += BENCH_SPIN;
+	}
+	while (bench_ns() < when)
+		;
+}
+
+/*
+ * Send the requests on schedule. The i-th request is due at start + i / rate
+ * whenever the previous ones end, so a slow request delays the following
+ * ones and their latency, measured from when they were due, counts the wait.
+ */
+static void *
+bench_scheduler(void *arg)
+{
+	struct bench_load *load = arg;
+	uint64_t start, end, intended, actual, done, i;
+	double interval = 1e9 / load->rate;
+
+	start = bench_ns();
+	end = start + (uint64_t) (load->duration * 1e9);
+	for (i = 0; ; i++) {
+		intended = start + (uint64_t) (i * interval);
+		if (intended >= end)
+			break;
+		bench_wait(intended);
+		if ((actual = bench_ns()) >= end)
+			break;
+		load->func(load->test, load->result, load->usrptr);
+		done = bench_ns();
+		bench_histogram_record(load->corrected, done - intended);
+		bench_histogram_record(load->service, done - actual);
+	}
+	load->sent = i;
+	load->elapsed = (bench_ns() - start) * 1e-9;
+	/* The requests due but not sent waited at least until the end. */
+	for (; (intended = start + (uint64_t) (i * interval)) < end; i++) {
+		bench_histogram_record(load->corrected, end - intended);
+		load->missed++;
+	}
+	return NULL;
+}
+
+static void
+bench_json_load(const char *name, const struct bench_load *load,
+		double mean, const struct bench_latency *latency)
+{
+	if (!bench_json_ready(name))
+		return;
+	fprintf(json, "%s      \"name\": \"%s\",\n"
+			"      \"run_name\": \"%s\",\n"
+			"      \"run_type\": \"load\",\n"
+			"      \"threads\": 1,\n"
+			"      \"iterations\": %" PRIu64 ",\n"
+			"      \"real_time\": %.17g,\n"
+			"      \"target_rate\": %.17g,\n"
+			"      \"achieved_rate\": %.17g,\n"
+			"      \"latency_p50\": %" PRIu64 ",\n"
+			"      \"latency_p90\": %" PRIu64 ",\n"
+			"      \"latency_p99\": %" PRIu64 ",\n"
+			"      \"latency_p999\": %" PRIu64 ",\n"
+			"      \"latency_max\": %" PRIu64 ",\n"
+			"      \"time_unit\": \"ns\"\n    }",
+			json_benchmarks++ > 0 ? ",\n    {\n" : "\n    {\n", name, name,
+			load->sent, mean, load->rate,
+			load->elapsed > 0.0 ? load->sent / load->elapsed : 0.0, latency->p50,
+			latency->p90, latency->p99, latency->p999, latency->max);
+	fflush(json);
+}
+
+static void
+bench_load_run(struct test_case *test, struct test_result *result,
+		void (*func)(struct test_case *, struct test_result *, void *),
+		void *usrptr, double rate, double duration, uint64_t slo)
+{
+	struct bench_load load = {
+		.result = result,
+		.func = func,
+		.usrptr = usrptr,
+		.rate = rate,
+		.duration = duration,
+	};
+	struct bench_latency corrected, service;
+	pthread_t tid;
+	size_t len = 0;
+	double achieved, mean;
+	int ret;
+
+	if ((load.corrected = calloc(2, sizeof(struct bench_histogram))) == NULL)
+		err_sys("malloc");
+	load.service = load.corrected + 1;
+	load.test = test_case_thread_new(test);
+	if ((ret = pthread_create(&tid, NULL, bench_scheduler, &load)) != 0) {
+		errno = ret;
+		err_sys("pthread_create");
+	}
+	pthread_join(tid, NULL);
+	test_case_thread_free(load.test);
+	bench_latency(load.corrected, &corrected);
+	bench_latency(load.service, &service);
+	mean = corrected.count > 0 ? load.corrected->sum / corrected.count : 0.0;
+	free(load.corrected);
+	load.corrected = NULL;
+	load.service = NULL;
+	test_case_thread_raise(test);
+
+	achieved = load.elapsed > 0.0 ? load.sent / load.elapsed : 0.0;
+	bench_diag_printf(&len,
+			"  load:\n"
+			"    target_rate: %.6g\n"
+			"    achieved_rate: %.6g\n"
+			"    requests: %" PRIu64 "\n"
+			"    missed: %" PRIu64 "\n"
+			"    duration: %.6g\n",
+			rate, achieved, load.sent, load.missed, load.elapsed);
+	if (slo > 0)
+		bench_diag_printf(&len, "    slo_p99: %" PRIu64 "\n", slo);
+	bench_diag_latency(&len, "    ", "latency", &corrected);
+	bench_diag_latency(&len, "    ", "service_time", &service);
+	bench_diag_env(&len);
+	test->diag = bench_diag;
+	bench_json_load(test->name, &load, mean, &corrected);
+
+	if (slo > 0 && corrected.p99 > slo)
+		snprintf(bench_msg, sizeof(bench_msg),
+				"p99 %" PRIu64 " ns exceeds the SLO %" PRIu64 " ns at %.4g "
+				"req/s of %.4g", corrected.p99, slo, achieved, rate);
+	else
+		snprintf(bench_msg, sizeof(bench_msg),
+				"%.4g req/s of %.4g, p99 %" PRIu64 " ns", achieved, rate,
+				corrected.p99);
+	test->assert_impl(test, result, slo == 0 || corrected.p99 <= slo,
+			"BENCHMARK", bench_msg, NULL, 0);
+}
+
+void
+bench_load(struct test_case *test, struct test_result *result,
+		void (*func)(struct test_case *, struct test_result *, void *),
+		void *usrptr, double rate, double duration, uint64_t slo)
+{
+	jmp_buf *saved, jmpbuffer;
+	int code;
+
+	assert(test != NULL);
+	assert(func != NULL);
+	assert(rate > 0.0);
+	assert(duration > 0.0);
+
+	bench_setup();
+	saved = ((struct test_case_impl *) test)->jmpbuffer;
+	((struct test_case_impl *) test)->jmpbuffer = &jmpbuffer;
+	if ((code = setjmp(jmpbuffer)) == 0)
+		bench_load_run(test, result, func, usrptr, rate, duration, slo);
+	bench_end(test, NULL, saved, code);
+}
@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <assert.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The environment of the benchmarks: the thread that runs them can be pinned
+ * to a CPU, only while a benchmark runs, and get a higher priority, and what
+ * makes the timings noisy, the CPU frequency governor, the isolated CPUs and
+ * the load, is recorded.
+ */
+
+/* The iterations of the reference loop, about a millisecond. */
+#define REFERENCE_LOOPS (1 << 20)
+
+static struct bench_env env;
+static bool ready;
+/* The CPUs that the process could run on before the pinning. */
+static cpu_set_t cpus;
+static bool hascpus;
+static bool pinned;
+
+/* Read the first line of a file of sysfs, or "unknown". */
+static void
+env_read(const char *path, char *buf, size_t size)
+{
+	FILE *stream;
+
+	strncpy(buf, "unknown", size);
+	if ((stream = fopen(path, "r")) == NULL)
+		return;
+	if (fgets(buf, size, stream) == NULL)
+		strncpy(buf, "unknown", size);
+	buf[strcspn(buf, "\n")] = '\0';
+	fclose(stream);
+}
+
+const struct bench_env *
+bench_env_setup(int cpu, bool priority)
+{
+	cpu_set_t set;
+
+	if (ready)
+		return &env;
+	ready = true;
+	env.cpu = -1;
+	env_read("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor",
+			env.governor, sizeof(env.governor));
+	env_read("/sys/devices/system/cpu/isolated", env.isolated,
+			sizeof(env.isolated));
+	hascpus = sched_getaffinity(0, sizeof(cpus), &cpus) == 0;
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == 0) {
+			env.cpu = cpu;
+			pinned = true;
+		} else
+			fprintf(stderr, "# cannot pin the benchmarks to the CPU %d: %s\n",
+					cpu, strerror(errno));
+	}
+	if (priority) {
+		/* The nice value of Linux is per thread. */
+		if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), -20) == 0)
+			env.priority = true;
+		else
+			fprintf(stderr, "# cannot raise the priority of the benchmarks: "
+					"%s\n", strerror(errno));
+	}
+	env.hastsc = bench_env_tsc() != 0;
+	return &env;
+}
+
+/* Pin the thread again to the CPU of the environment, if any. */
+void
+bench_env_pin(void)
+{
+	cpu_set_t set;
+
+	if (!ready || env.cpu < 0 || pinned)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(env.cpu, &set);
+	pinned = sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+/* Let the thread run on the CPUs of the process, between the benchmarks. */
+void
+bench_env_unpin(void)
+{
+	if (pinned && hascpus)
+		sched_setaffinity(0, sizeof(cpus), &cpus);
+	pinned = false;
+}
+
+/* Undo the pinning. The priority stays, lowering it back is not allowed. */
+void
+bench_env_restore(void)
+{
+	bench_env_unpin();
+	ready = false;
+	memset(&env, 0, sizeof(env));
+}
+
+void
+bench_env_loadavg(double loadavg[3])
+{
+	if (getloadavg(loadavg, 3) != 3)
+		loadavg[0] = loadavg[1] = loadavg[2] = -1.0;
+}
+
+/* Return the i-th CPU that the process could run on, modulo their number. */
+int
+bench_env_cpu(unsigned int i)
+{
+	int cpu, count;
+
+	if (!hascpus || (count = CPU_COUNT(&cpus)) == 0)
+		return -1;
+	i %= count;
+	for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		if (CPU_ISSET(cpu, &cpus) && i-- == 0)
+			return cpu;
+	return -1;
+}
+
+/*
+ * Bind the calling thread to `cpu`, or let it run on the CPUs of the process
+ * if `cpu` is negative, since it inherits the pinning of its creator.
+ */
+void
+bench_env_thread(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	} else if (pinned && hascpus)
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+}
+
+/* Return the time stamp counter, or 0 if there is none. */
+uint64_t
+bench_env_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Return the time in ns of a fixed loop of dependent additions, the best of
+ * three. Its changes over a run follow the frequency of the CPU, even when
+ * the time stamp counter has a constant rate.
+ */
+double
+bench_env_reference(void)
+{
+	struct timespec start, end;
+	double best = 0.0, time;
+	volatile uint64_t sink;
+	uint64_t x;
+	int i, j;
+
+	for (i = 0; i < 3; i++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (x = 0, j = 0; j < REFERENCE_LOOPS; j++) {
+			x += j;
+			__asm__ volatile("" : "+r" (x));
+		}
+		sink = x;
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		(void) sink;
+		time = (end.tv_sec - start.tv_sec) * 1e9 + end.tv_nsec - start.tv_nsec;
+		if (i == 0 || time < best)
+			best = time;
+	}
+	return best;
+}
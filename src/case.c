@@ -1,15 +1,27 @@
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <setjmp.h>
 #include "unittest.h"
 #include "unittest_priv.h"
 
+/*
+ * The failures of the EXPECT_ assertions are kept in a preallocated per-thread
+ * stack: a test records its failures above the ones of the tests that are
+ * running it, and releases them when it ends.
+ */
+static __thread struct test_failure expect_failures[EXPECT_MAXFAILURES];
+static __thread char expect_msgs[EXPECT_MAXFAILURES][MAXLINE];
+static __thread unsigned int expect_top;
 
-struct test_case_impl {
-	CASE_HEAD
-	jmp_buf *jmpbuffer;
-};
+/*
+ * The body of a test can start threads, e.g. a benchmark, and they can use
+ * the assertions too if they get a view of the test from
+ * test_case_thread_new. The failure of a thread ends the thread and is
+ * recorded in the test; the thread that runs the test raises it when it
+ * calls test_case_thread_raise or when the body returns.
+ */
 
 enum assert_result {
 	SUCCESS,
@@ -19,11 +31,43 @@ enum assert_result {
 	_ERROR
 };
 
+/* Report a test that failed by its EXPECT_ assertions with the first one. */
+static void
+test_case_expected(struct test_case *test)
+{
+	if (test->nfailures == 0) {
+		test->msg = "too many failed expectations to record";
+		test->condition = NULL;
+		test->filename = NULL;
+		test->lineno = 0;
+		return;
+	}
+	test->msg = test->failures[0].msg;
+	test->condition = test->failures[0].condition;
+	test->filename = test->failures[0].filename;
+	test->lineno = test->failures[0].lineno;
+}
+
+/* Remove the scratch directory of the test that just ended. */
+static void
+test_case_scratch_end(struct test_case *test, bool failed)
+{
+	struct test_case_impl *impl = (struct test_case_impl *) test;
+
+	if (impl->scratch == NULL)
+		return;
+	scratch_end(impl->scratch, test, failed);
+	free(impl->scratch);
+	impl->scratch = NULL;
+}
+
 static void
 test_case_run(struct test_case *test, struct test_suite *suite,
 		struct test_result *result)
 {
 	jmp_buf jmpbuffer;
+	unsigned int base = expect_top;
+	volatile bool failed = false;
 
 	assert(test != NULL);
 	assert(result != NULL);
@@ -33,6 +77,21 @@ test_case_run(struct test_case *test, struct test_suite *suite,
 	assert(result->add_failure != NULL);
 	assert(result->add_xfailure != NULL);
 
+	if (test->skip == NULL && isolate_enabled(test)) {
+		isolate_run(test, suite, result);
+		return;
+	}
+	result->testsrun++;
+	test->assertions = 0;
+	((struct test_case_impl *) test)->expect = expect_failures;
+	((struct test_case_impl *) test)->expectmsgs = expect_msgs;
+	((struct test_case_impl *) test)->expecttop = &expect_top;
+	((struct test_case_impl *) test)->thrown = SUCCESS;
+	test->failures = expect_failures + base;
+	test->nfailures = 0;
+	test->overflow = 0;
+	test->diag = NULL;
+	vclock_reset();
 	if (result->start_test != NULL)
 		result->start_test(result, test);
 	if (test->skip != NULL) {
@@ -46,28 +105,43 @@ test_case_run(struct test_case *test, struct test_suite *suite,
 	((struct test_case_impl *) test)->jmpbuffer = &jmpbuffer;
 	switch (setjmp(jmpbuffer)) {
 		case SUCCESS:
-			test->func(test, result, suite->usrptr);
+			test->func(test, result, test->usrptr != NULL ? test->usrptr :
+					suite->usrptr);
+			test_case_thread_raise(test);
 			/* NOTE: Reaced only if the test terminate correctly. */
 			/* NOTE: If there is no assertion, all the fields are NULL or 0. */
-			if (test->todo != NULL)
+			if (test->nfailures > 0 || test->overflow > 0) {
+				test_case_expected(test);
+				failed = test->todo == NULL;
+				if (test->todo != NULL)
+					result->add_xfailure(result, test);
+				else
+					result->add_failure(result, test);
+			} else if (test->todo != NULL)
 				result->add_xsuccess(result, test);
 			else
 				result->add_success(result, test);
 			break;
 		case FAILURE:
+			failed = true;
 			result->add_failure(result, test);
 			break;
 		case XFAILURE:
 			result->add_xfailure(result, test);
 			break;
 		case _ERROR:
+			failed = true;
 			result->add_error(result, test);
+			break;
 		default:
 			abort();  /* programming error */
 	}
 	((struct test_case_impl *) test)->jmpbuffer = NULL;
+	expect_top = base;
 	if (suite->teardown != NULL)
 		suite->teardown(suite);
+	vclock_reset();
+	test_case_scratch_end(test, failed);
 	if (result->stop_test != NULL)
 		result->stop_test(result, test);
 }
@@ -81,12 +155,16 @@ test_case_assert(struct test_case *test, struct test_result *result, bool pass,
 	test->condition = condition;
 	test->filename = filename;
 	test->lineno = lineno;
-	if (!pass) {
-		if (test->todo == NULL)
-			longjmp(*((struct test_case_impl *) test)->jmpbuffer, FAILURE);
-		else
-			longjmp(*((struct test_case_impl *) test)->jmpbuffer, XFAILURE);
+	if (pass) {
+		test->assertions++;
+		return;
 	}
+	/* The child of a death test cannot unwind the test it shares. */
+	death_child_fail();
+	if (test->todo == NULL)
+		longjmp(*((struct test_case_impl *) test)->jmpbuffer, FAILURE);
+	else
+		longjmp(*((struct test_case_impl *) test)->jmpbuffer, XFAILURE);
 }
 
 static void
@@ -95,26 +173,223 @@ test_case_error(struct test_case *test, struct test_result *result,
 {
 	assert(((struct test_case_impl *) test)->jmpbuffer != NULL);
 	test->msg = msg;
+	test->condition = NULL;
 	test->filename = filename;
 	test->lineno = lineno;
+	death_child_fail();
 	longjmp(*((struct test_case_impl *) test)->jmpbuffer, _ERROR);
 }
 
+/* Record a failed EXPECT_ assertion, from any thread of the test. */
+static void
+test_case_push(struct test_case_impl *impl, const char *condition,
+		const char *msg, const char *filename, unsigned int lineno)
+{
+	struct test_failure *failure;
+	unsigned int i;
+
+	pthread_mutex_lock(&impl->lock);
+	i = impl->failures - impl->expect + impl->nfailures;
+	if (i >= EXPECT_MAXFAILURES) {
+		impl->overflow++;
+		pthread_mutex_unlock(&impl->lock);
+		return;
+	}
+	/* The message could be in a buffer reused by the next assertion. */
+	failure = &impl->expect[i];
+	failure->msg = NULL;
+	if (msg != NULL) {
+		snprintf(impl->expectmsgs[i], sizeof(impl->expectmsgs[i]), "%s", msg);
+		failure->msg = impl->expectmsgs[i];
+	}
+	failure->condition = condition;
+	failure->filename = filename;
+	failure->lineno = lineno;
+	impl->nfailures++;
+	*impl->expecttop = i + 1;
+	pthread_mutex_unlock(&impl->lock);
+}
+
+static void
+test_case_expect(struct test_case *test, struct test_result *result, bool pass,
+		const char *condition, const char *msg, const char *filename,
+		unsigned int lineno)
+{
+	assert(((struct test_case_impl *) test)->jmpbuffer != NULL);
+	if (pass)
+		test->assert_impl(test, result, pass, condition, msg, filename, lineno);
+	else
+		test_case_push((struct test_case_impl *) test, condition, msg,
+				filename, lineno);
+}
+
+/* Record the failure of a thread, if it is the first one, and end it. */
+static void
+test_case_thread_throw(struct test_case *thread, int how,
+		const char *condition, const char *msg, const char *filename,
+		unsigned int lineno)
+{
+	struct test_case_impl *impl = ((struct test_case_impl *) thread)->parent;
+
+	pthread_mutex_lock(&impl->lock);
+	if (impl->thrown == SUCCESS) {
+		impl->thrown = how;
+		snprintf(impl->thrownmsg, sizeof(impl->thrownmsg), "%s",
+				msg != NULL ? msg : "");
+		impl->throwncondition = condition;
+		impl->thrownfilename = filename;
+		impl->thrownlineno = lineno;
+	}
+	pthread_mutex_unlock(&impl->lock);
+	pthread_exit(NULL);
+}
+
+static void
+test_case_thread_assert(struct test_case *thread, struct test_result *result,
+		bool pass, const char *condition, const char *msg,
+		const char *filename, unsigned int lineno)
+{
+	if (pass)
+		thread->assertions++;
+	else
+		test_case_thread_throw(thread, thread->todo == NULL ? FAILURE :
+				XFAILURE, condition, msg, filename, lineno);
+}
+
+static void
+test_case_thread_error(struct test_case *thread, struct test_result *result,
+		const char *msg, const char *filename, unsigned int lineno)
+{
+	test_case_thread_throw(thread, _ERROR, NULL, msg, filename, lineno);
+}
+
+static void
+test_case_thread_expect(struct test_case *thread, struct test_result *result,
+		bool pass, const char *condition, const char *msg,
+		const char *filename, unsigned int lineno)
+{
+	if (pass)
+		thread->assertions++;
+	else
+		test_case_push(((struct test_case_impl *) thread)->parent, condition,
+				msg, filename, lineno);
+}
+
+/*
+ * Return a view of the running test `test` for another thread. Its
+ * assertions are counted apart, and a failure ends the thread.
+ */
 struct test_case *
-test_case_new_impl(const char *name, const char *skip, const char *todo,
-		void (*func)(struct test_case *, struct test_result *, void *))
+test_case_thread_new(struct test_case *test)
 {
-	struct test_case *test;
+	struct test_case_impl *thread;
 
-	test = (struct test_case *) calloc(1, sizeof(struct test_case_impl));
-	if (test == NULL)
+	assert(((struct test_case_impl *) test)->jmpbuffer != NULL);
+	if ((thread = calloc(1, sizeof(struct test_case_impl))) == NULL)
 		err_sys("malloc");
+	thread->name = test->name;
+	thread->skip = test->skip;
+	thread->todo = test->todo;
+	thread->usrptr = test->usrptr;
+	thread->func = test->func;
+	thread->run = test->run;
+	thread->len = test->len;
+	thread->run_row = test->run_row;
+	thread->assert_impl = test_case_thread_assert;
+	thread->error = test_case_thread_error;
+	thread->expect_impl = test_case_thread_expect;
+	thread->parent = (struct test_case_impl *) test;
+	return (struct test_case *) thread;
+}
+
+/*
+ * Free the view of a thread and add its assertions to the test. It must be
+ * called by the thread that runs the test, after the other one ended.
+ */
+void
+test_case_thread_free(struct test_case *thread)
+{
+	((struct test_case_impl *) thread)->parent->assertions +=
+		thread->assertions;
+	free(thread);
+}
+
+/* Fail the test, from the thread that runs it, if one of its threads did. */
+void
+test_case_thread_raise(struct test_case *test)
+{
+	struct test_case_impl *impl = (struct test_case_impl *) test;
+	int how;
+
+	assert(impl->jmpbuffer != NULL);
+	if (impl->thrown == SUCCESS)
+		return;
+	how = impl->thrown;
+	impl->thrown = SUCCESS;
+	test->msg = impl->thrownmsg;
+	test->condition = impl->throwncondition;
+	test->filename = impl->thrownfilename;
+	test->lineno = impl->thrownlineno;
+	longjmp(*impl->jmpbuffer, how);
+}
+
+const char *
+test_case_scratch(struct test_case *test)
+{
+	struct test_case_impl *impl = (struct test_case_impl *) test;
+
+	if (impl->parent != NULL)
+		impl = impl->parent;
+	assert(impl->jmpbuffer != NULL);
+	pthread_mutex_lock(&impl->lock);
+	if (impl->scratch == NULL)
+		impl->scratch = scratch_new();
+	pthread_mutex_unlock(&impl->lock);
+	return impl->scratch;
+}
+
+static unsigned int
+test_case_len(struct test_case *test)
+{
+	return 1;
+}
+
+static void
+test_case_run_row(struct test_case *test, unsigned int i,
+		struct test_suite *suite, struct test_result *result)
+{
+	assert(i == 0);
+	test->run(test, suite, result);
+}
+
+void
+test_case_init(struct test_case *test, const char *name, const char *skip,
+		const char *todo,
+		void (*func)(struct test_case *, struct test_result *, void *))
+{
+	memset(test, 0, sizeof(struct test_case_impl));
+	pthread_mutex_init(&((struct test_case_impl *) test)->lock, NULL);
 	test->name = name;
 	test->skip = skip;
 	test->todo = todo;
 	test->func = func;
 	test->run = test_case_run;
+	test->len = test_case_len;
+	test->run_row = test_case_run_row;
 	test->assert_impl = test_case_assert;
 	test->error = test_case_error;
+	test->expect_impl = test_case_expect;
+}
+
+struct test_case *
+test_case_new_impl(const char *name, const char *skip, const char *todo,
+		void (*func)(struct test_case *, struct test_result *, void *))
+{
+	struct test_case *test;
+
+	test = (struct test_case *) malloc(sizeof(struct test_case_impl));
+	if (test == NULL)
+		err_sys("malloc");
+	test_case_init(test, name, skip, todo, func);
 	return test;
 }
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * A death test runs its statement in a child from fork, so that neither an
+ * exit of the child nor the locks that the other threads of the test held
+ * at the fork reach the test. The child writes its standard error in a
+ * memory file, read once it ended, and tells through a shared mapping if
+ * the statement returned or failed an assertion.
+ */
+
+/* The most of the standard error quoted in a failure. */
+#define DEATH_MAXSTDERR 1024
+
+static __thread char death_msg[MAXLINE];
+/* The death test whose child runs on this thread, if any. */
+static __thread struct death_test *death_current;
+
+void
+death_start(struct death_test *death)
+{
+	death->pid = -1;
+	death->shared = mmap(NULL, sizeof(*death->shared),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (death->shared == MAP_FAILED)
+		err_sys("mmap");
+	death->shared->returned = false;
+	death->shared->failed = false;
+	if ((death->fd = memfd_create("death", MFD_CLOEXEC)) == -1)
+		err_sys("memfd_create");
+	/* The child flushes its copy of the buffers, that must be empty. */
+	fflush(NULL);
+}
+
+void
+death_child(struct death_test *death)
+{
+	struct rlimit rl = {0, 0};
+	struct sigaction sa;
+	int sig, fd;
+
+	death_current = death;
+	/* The handlers, e.g. of the isolated mode, must not see the death. */
+	for (sig = 1; sig < NSIG; sig++)
+		if (sigaction(sig, NULL, &sa) == 0 && sa.sa_handler != SIG_DFL &&
+				sa.sa_handler != SIG_IGN)
+			signal(sig, SIG_DFL);
+	/* An expected crash leaves no core. */
+	setrlimit(RLIMIT_CORE, &rl);
+	dup2(death->fd, STDERR_FILENO);
+	if ((fd = open("/dev/null", O_WRONLY)) != -1) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+}
+
+void
+death_returned(struct death_test *death)
+{
+	death->shared->returned = true;
+	_exit(0);
+}
+
+/* End the child of a death test if an assertion of its statement failed. */
+void
+death_child_fail(void)
+{
+	if (death_current == NULL)
+		return;
+	death_current->shared->failed = true;
+	_exit(1);
+}
+
+/* Read the standard error of the child. */
+static char *
+death_stderr(int fd)
+{
+	struct stat st;
+	ssize_t n;
+	size_t len = 0;
+	char *buf;
+
+	if (fstat(fd, &st) == -1)
+		err_sys("fstat");
+	if ((buf = malloc(st.st_size + 1)) == NULL)
+		err_sys("malloc");
+	while (len < (size_t) st.st_size) {
+		n = pread(fd, buf + len, st.st_size - len, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		len += n;
+	}
+	buf[len] = '\0';
+	return buf;
+}
+
+static void
+death_signal(char *buf, size_t size, int sig)
+{
+	const char *name = isolate_signal_name(sig);
+
+	if (name != NULL)
+		snprintf(buf, size, "%s", name);
+	else
+		snprintf(buf, size, "signal %d", sig);
+}
+
+/* Describe how the child ended. */
+static void
+death_outcome(char *buf, size_t size, const struct death_test *death,
+		int status)
+{
+	char sig[32];
+
+	if (death->shared->failed)
+		snprintf(buf, size, "failed an assertion");
+	else if (death->shared->returned)
+		snprintf(buf, size, "returned");
+	else if (WIFEXITED(status))
+		snprintf(buf, size, "exited with status %d", WEXITSTATUS(status));
+	else {
+		death_signal(sig, sizeof(sig), WTERMSIG(status));
+		snprintf(buf, size, "was killed by %s", sig);
+	}
+}
+
+/* Check the standard error, return NULL or what is wrong with it. */
+static const char *
+death_match(const char *pattern, const char *err)
+{
+	regex_t re;
+	int ret;
+
+	if (regcomp(&re, pattern, REG_EXTENDED | REG_NOSUB | REG_NEWLINE) != 0)
+		return "the pattern of the standard error is invalid";
+	ret = regexec(&re, err, 0, NULL, 0);
+	regfree(&re);
+	return ret == 0 ? NULL : "the standard error does not match the pattern";
+}
+
+const char *
+death_end(struct death_test *death, enum death_how how, int value,
+		const char *pattern, const char *msg)
+{
+	char outcome[64], expected[64], sig[32];
+	const char *mismatch = NULL;
+	int status, len;
+	bool pass;
+	char *err;
+
+	death_current = NULL;
+	if (death->pid == -1)
+		err_sys("fork");
+	while (waitpid(death->pid, &status, 0) == -1)
+		if (errno != EINTR)
+			err_sys("waitpid");
+	err = death_stderr(death->fd);
+	close(death->fd);
+
+	if (how == DEATH_EXITS)
+		pass = WIFEXITED(status) && WEXITSTATUS(status) == value;
+	else
+		pass = WIFSIGNALED(status) && WTERMSIG(status) == value;
+	pass = pass && !death->shared->returned && !death->shared->failed;
+	if (pass && pattern != NULL)
+		mismatch = death_match(pattern, err);
+	if (pass && mismatch == NULL) {
+		munmap(death->shared, sizeof(*death->shared));
+		free(err);
+		return NULL;
+	}
+
+	if (msg == NULL)
+		msg = "the death test failed";
+	if (!pass) {
+		death_outcome(outcome, sizeof(outcome), death, status);
+		if (how == DEATH_EXITS)
+			snprintf(expected, sizeof(expected), "exit with status %d",
+					value);
+		else {
+			death_signal(sig, sizeof(sig), value);
+			snprintf(expected, sizeof(expected), "be killed by %s", sig);
+		}
+		len = snprintf(death_msg, sizeof(death_msg),
+				"%.512s: the statement %s, expected to %s", msg, outcome,
+				expected);
+	} else
+		len = snprintf(death_msg, sizeof(death_msg), "%.512s: %s /%.256s/",
+				msg, mismatch, pattern);
+	if (*err != '\0')
+		snprintf(death_msg + len, sizeof(death_msg) - len, "\n%.*s%s",
+				DEATH_MAXSTDERR, err,
+				strlen(err) > DEATH_MAXSTDERR ? "..." : "");
+	munmap(death->shared, sizeof(*death->shared));
+	free(err);
+	return death_msg;
+}
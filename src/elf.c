@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <link.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * Discover the test functions reading the symbol table of the objects. The
+ * file is mapped in memory and never copied, the symbols are filtered by
+ * name and only the matching ones are kept. The result, empty or not, is
+ * cached on disk, the key is the build-id of the object and a hash of the
+ * prefix.
+ */
+
+#define CACHE_DIR_ENV "UNITTEST_CACHE_DIR"
+#define BUILD_ID_MAXLEN 64
+
+struct elf_symbol {
+	ElfW(Addr) value;
+	const char *name;
+};
+
+struct elf_build_id {
+	ElfW(Addr) base;
+	const char *name;
+	char *hex;
+	bool found;
+};
+
+static int
+elf_symbol_cmp(const void *a, const void *b)
+{
+	const struct elf_symbol *sa = (const struct elf_symbol *) a,
+							*sb = (const struct elf_symbol *) b;
+
+	if (sa->value != sb->value)
+		return sa->value < sb->value ? -1 : 1;
+	return strcmp(sa->name, sb->name);
+}
+
+static int
+elf_build_id_phdr(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct elf_build_id *bid = (struct elf_build_id *) data;
+	const ElfW(Nhdr) *note;
+	const char *p, *end;
+	unsigned int i, c;
+
+	if (info->dlpi_addr != bid->base || strcmp(info->dlpi_name, bid->name))
+		return 0;
+	for (i = 0; i < info->dlpi_phnum; i++) {
+		if (info->dlpi_phdr[i].p_type != PT_NOTE)
+			continue;
+		p = (const char *) (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+		end = p + info->dlpi_phdr[i].p_memsz;
+		while (p + sizeof(ElfW(Nhdr)) <= end) {
+			note = (const ElfW(Nhdr) *) p;
+			p += sizeof(ElfW(Nhdr)) + ((note->n_namesz + 3) & ~3);
+			if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+					!memcmp(note + 1, "GNU", 4) &&
+					note->n_descsz <= BUILD_ID_MAXLEN) {
+				for (c = 0; c < note->n_descsz; c++)
+					sprintf(bid->hex + 2 * c, "%02x",
+							(unsigned char) p[c]);
+				bid->found = true;
+				return 1;
+			}
+			p += (note->n_descsz + 3) & ~3;
+		}
+	}
+	return 1;
+}
+
+/* Create the directory `path` and its parents, as mkdir -p. */
+static void
+elf_mkdirs(char *path)
+{
+	char *p;
+
+	for (p = path + 1; (p = strchr(p, '/')) != NULL; p++) {
+		*p = '\0';
+		mkdir(path, 0755);
+		*p = '/';
+	}
+	mkdir(path, 0755);
+}
+
+/* The FNV-1a hash of the prefix, in the name of the cache file. */
+static uint64_t
+elf_prefix_hash(const char *prefix)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *prefix != '\0'; prefix++)
+		hash = (hash ^ (unsigned char) *prefix) * 0x100000001b3ULL;
+	return hash;
+}
+
+static char *
+elf_cache_path(const struct link_map *lm, const char *prefix)
+{
+	struct elf_build_id bid;
+	char hex[2 * BUILD_ID_MAXLEN + 1];
+	const char *dir, *sub;
+	char *path;
+	int len;
+
+	bid.base = lm->l_addr;
+	bid.name = lm->l_name;
+	bid.hex = hex;
+	bid.found = false;
+	dl_iterate_phdr(elf_build_id_phdr, &bid);
+	if (!bid.found)
+		return NULL;
+	sub = "";
+	if ((dir = getenv(CACHE_DIR_ENV)) == NULL) {
+		sub = "/libunittest";
+		if ((dir = getenv("XDG_CACHE_HOME")) == NULL || *dir == '\0') {
+			if ((dir = getenv("HOME")) == NULL)
+				return NULL;
+			sub = "/.cache/libunittest";
+		}
+	}
+	if (*dir == '\0')
+		return NULL;  /* the cache is disabled */
+	if ((path = malloc(strlen(dir) + strlen(sub) + strlen(hex) + 19)) == NULL)
+		err_sys("malloc");
+	len = sprintf(path, "%s%s", dir, sub);
+	elf_mkdirs(path);
+	sprintf(path + len, "/%s-%016llx", hex,
+			(unsigned long long) elf_prefix_hash(prefix));
+	return path;
+}
+
+/*
+ * Pack the symbols in a single block: the array of descriptors followed by
+ * the names.
+ */
+static struct test_desc *
+elf_descs_new(const struct elf_symbol *syms, size_t n, ElfW(Addr) base)
+{
+	struct test_desc *descs;
+	size_t i, size;
+	char *names;
+
+	if (n == 0)
+		return NULL;
+	size = n * sizeof(struct test_desc);
+	for (i = 0; i < n; i++)
+		size += strlen(syms[i].name) + 1;
+	if ((descs = (struct test_desc *) calloc(1, size)) == NULL)
+		err_sys("malloc");
+	names = (char *) (descs + n);
+	for (i = 0; i < n; i++) {
+		strcpy(names, syms[i].name);
+		descs[i].name = names;
+		descs[i].func = (void (*)(struct test_case *, struct test_result *,
+					void *)) (base + syms[i].value);
+		names += strlen(names) + 1;
+	}
+	return descs;
+}
+
+/*
+ * Read the cache `path` in `descs`, NULL if it has no symbol. Return false if
+ * the cache is missing or does not match `prefix`.
+ */
+static bool
+elf_cache_read(const char *path, const char *prefix, ElfW(Addr) base,
+		struct test_desc **descs, size_t *n)
+{
+	FILE *fp;
+	char line[MAXLINE], *name, *end;
+	struct elf_symbol *syms = NULL;
+	size_t len = 0, size = 0;
+	bool found = false;
+
+	if ((fp = fopen(path, "r")) == NULL)
+		return false;
+	if (fgets(line, sizeof(line), fp) == NULL ||
+			strncmp(line, prefix, strlen(prefix)) ||
+			line[strlen(prefix)] != '\n')
+		goto out;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if ((name = strchr(line, ' ')) == NULL ||
+				(end = strchr(name, '\n')) == NULL)
+			goto out;
+		*end = '\0';
+		if (len == size) {
+			size = size ? 2 * size : 64;
+			syms = realloc(syms, size * sizeof(struct elf_symbol));
+			if (syms == NULL)
+				err_sys("malloc");
+		}
+		syms[len].value = strtoull(line, NULL, 16);
+		if ((syms[len].name = strdup(name + 1)) == NULL)
+			err_sys("malloc");
+		len++;
+	}
+	*descs = elf_descs_new(syms, len, base);
+	*n = len;
+	found = true;
+out:
+	while (len > 0)
+		free((char *) syms[--len].name);
+	free(syms);
+	fclose(fp);
+	return found;
+}
+
+static void
+elf_cache_write(const char *path, const char *prefix,
+		const struct elf_symbol *syms, size_t n)
+{
+	char *tmp;
+	FILE *fp;
+	size_t i;
+	int fd;
+
+	if ((tmp = malloc(strlen(path) + 8)) == NULL)
+		err_sys("malloc");
+	sprintf(tmp, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		if (fd != -1)
+			close(fd);
+		free(tmp);
+		return;
+	}
+	fprintf(fp, "%s\n", prefix);
+	for (i = 0; i < n; i++)
+		fprintf(fp, "%lx %s\n", (unsigned long) syms[i].value, syms[i].name);
+	if (fclose(fp) == 0)
+		rename(tmp, path);
+	else
+		unlink(tmp);
+	free(tmp);
+}
+
+static const ElfW(Shdr) *
+elf_find_section(const ElfW(Ehdr) *ehdr, size_t size, ElfW(Word) type)
+{
+	const ElfW(Shdr) *shdr;
+	unsigned int i;
+
+	if (ehdr->e_shoff == 0 || ehdr->e_shentsize != sizeof(ElfW(Shdr)) ||
+			ehdr->e_shoff + ehdr->e_shnum * sizeof(ElfW(Shdr)) > size)
+		return NULL;
+	shdr = (const ElfW(Shdr) *) ((const char *) ehdr + ehdr->e_shoff);
+	for (i = 0; i < ehdr->e_shnum; i++)
+		if (shdr[i].sh_type == type && shdr[i].sh_link < ehdr->e_shnum &&
+				shdr[i].sh_offset + shdr[i].sh_size <= size &&
+				shdr[shdr[i].sh_link].sh_offset +
+				shdr[shdr[i].sh_link].sh_size <= size)
+			return &shdr[i];
+	return NULL;
+}
+
+/*
+ * Scan the symbols of the object `map` whose name starts with `prefix` in
+ * `syms`, NULL if there is none. Return false if the object is not readable.
+ */
+static bool
+elf_scan(const char *map, size_t size, const char *prefix,
+		struct elf_symbol **syms, size_t *n)
+{
+	const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *) map;
+	const ElfW(Shdr) *symtab, *strtab;
+	const ElfW(Sym) *sym, *end;
+	const char *strings;
+	struct elf_symbol *found = NULL;
+	size_t len = 0, alloc = 0, prefixlen;
+
+	if (size < sizeof(ElfW(Ehdr)) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) ||
+			ehdr->e_ident[EI_CLASS] != (sizeof(void *) == 8 ? ELFCLASS64 :
+				ELFCLASS32))
+		return NULL;
+	/* The .symtab has all the global symbols, .dynsym only the exported. */
+	if ((symtab = elf_find_section(ehdr, size, SHT_SYMTAB)) == NULL &&
+			(symtab = elf_find_section(ehdr, size, SHT_DYNSYM)) == NULL)
+		return false;
+	strtab = (const ElfW(Shdr) *) ((const char *) ehdr + ehdr->e_shoff) +
+		symtab->sh_link;
+	strings = map + strtab->sh_offset;
+	sym = (const ElfW(Sym) *) (map + symtab->sh_offset);
+	end = sym + symtab->sh_size / sizeof(ElfW(Sym));
+	prefixlen = strlen(prefix);
+	for (; sym < end; sym++) {
+		if (ELF64_ST_TYPE(sym->st_info) != STT_FUNC ||
+				(ELF64_ST_BIND(sym->st_info) != STB_GLOBAL &&
+				 ELF64_ST_BIND(sym->st_info) != STB_WEAK) ||
+				sym->st_shndx == SHN_UNDEF || sym->st_value == 0 ||
+				sym->st_name >= strtab->sh_size ||
+				strncmp(strings + sym->st_name, prefix, prefixlen))
+			continue;
+		if (len == alloc) {
+			alloc = alloc ? 2 * alloc : 64;
+			found = realloc(found, alloc * sizeof(struct elf_symbol));
+			if (found == NULL)
+				err_sys("malloc");
+		}
+		found[len].value = sym->st_value;
+		found[len].name = strings + sym->st_name;
+		len++;
+	}
+	/* Keep the order of definition and drop the aliases. */
+	if (len > 0)
+		qsort(found, len, sizeof(struct elf_symbol), elf_symbol_cmp);
+	*n = 0;
+	for (alloc = 0; alloc < len; alloc++)
+		if (*n == 0 || found[*n - 1].value != found[alloc].value)
+			found[(*n)++] = found[alloc];
+	*syms = found;
+	return true;
+}
+
+/*
+ * Return a suite with the global functions of the object `handle` whose name
+ * start with `prefix`, or NULL. The suite owns the handle.
+ */
+struct test_suite *
+elf_suite_new(void *handle, const char *prefix)
+{
+	struct link_map *lm;
+	struct test_desc *descs = NULL;
+	struct elf_symbol *syms;
+	struct stat st;
+	char *cache;
+	const char *path;
+	void *map;
+	size_t n = 0;
+	int fd;
+
+	assert(prefix != NULL);
+	if (dlinfo(handle, RTLD_DI_LINKMAP, &lm) == -1)
+		return NULL;
+	cache = elf_cache_path(lm, prefix);
+	if (cache == NULL || !elf_cache_read(cache, prefix, lm->l_addr, &descs,
+				&n)) {
+		path = *lm->l_name != '\0' ? lm->l_name : "/proc/self/exe";
+		if ((fd = open(path, O_RDONLY)) == -1) {
+			free(cache);
+			return NULL;
+		}
+		map = MAP_FAILED;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (map == MAP_FAILED) {
+			free(cache);
+			return NULL;
+		}
+		if (elf_scan(map, st.st_size, prefix, &syms, &n)) {
+			if (cache != NULL)
+				elf_cache_write(cache, prefix, syms, n);
+			descs = elf_descs_new(syms, n, lm->l_addr);
+			free(syms);
+		}
+		munmap(map, st.st_size);
+	}
+	free(cache);
+	if (descs == NULL)
+		return NULL;
+	return desc_suite_new(descs, descs + n, handle, true);
+}
@@ -0,0 +1,137 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The files mapped for the suites. A file is mapped once, read only and
+ * shared, however many suites use it: its pages are the ones of the page
+ * cache, never copied, and the children of the isolated mode inherit the
+ * mapping. The last user unmaps it.
+ */
+
+/* The alignment of a mapping backed by transparent huge pages. */
+#define FIXTURE_HUGEPAGE (2UL << 20)
+
+struct fixture_impl {
+	struct test_fixture fixture;
+	unsigned int refs;
+	/* The reservation that holds an aligned mapping, or the mapping. */
+	void *base;
+	size_t len;
+	struct fixture_impl *next;
+};
+
+static struct fixture_impl *fixtures;
+static pthread_mutex_t fixture_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Reserve an address aligned on a huge page and map the file there, the
+ * kernel can only back an aligned range with huge pages.
+ */
+static void *
+fixture_map_aligned(struct fixture_impl *impl, int fd)
+{
+	uintptr_t addr;
+	void *p;
+
+	impl->len = impl->fixture.size + FIXTURE_HUGEPAGE;
+	impl->base = mmap(NULL, impl->len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (impl->base == MAP_FAILED)
+		return MAP_FAILED;
+	addr = ((uintptr_t) impl->base + FIXTURE_HUGEPAGE - 1) &
+		~(FIXTURE_HUGEPAGE - 1);
+	p = mmap((void *) addr, impl->fixture.size, PROT_READ,
+			MAP_SHARED | MAP_FIXED, fd, 0);
+	if (p == MAP_FAILED) {
+		munmap(impl->base, impl->len);
+		return MAP_FAILED;
+	}
+	madvise(p, impl->fixture.size, MADV_HUGEPAGE);
+	return p;
+}
+
+static void
+fixture_open(struct fixture_impl *impl, unsigned int flags)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if ((fd = open(impl->fixture.path, O_RDONLY | O_CLOEXEC)) == -1)
+		err_sys("open %s", impl->fixture.path);
+	if (fstat(fd, &st) == -1)
+		err_sys("fstat %s", impl->fixture.path);
+	impl->fixture.size = st.st_size;
+	if (impl->fixture.size == 0) {
+		close(fd);
+		return;
+	}
+	if (flags & FIXTURE_HUGEPAGES)
+		p = fixture_map_aligned(impl, fd);
+	else {
+		impl->len = impl->fixture.size;
+		p = impl->base = mmap(NULL, impl->len, PROT_READ, MAP_SHARED, fd, 0);
+	}
+	if (p == MAP_FAILED)
+		err_sys("mmap %s", impl->fixture.path);
+	close(fd);
+	if (flags & FIXTURE_WILLNEED)
+		madvise(p, impl->fixture.size, MADV_WILLNEED);
+	impl->fixture.data = p;
+}
+
+const struct test_fixture *
+fixture_map(const char *path, unsigned int flags)
+{
+	struct fixture_impl *impl;
+
+	assert(path != NULL);
+	pthread_mutex_lock(&fixture_lock);
+	for (impl = fixtures; impl != NULL; impl = impl->next)
+		if (strcmp(impl->fixture.path, path) == 0)
+			break;
+	if (impl == NULL) {
+		if ((impl = calloc(1, sizeof(struct fixture_impl))) == NULL)
+			err_sys("malloc");
+		if ((impl->fixture.path = strdup(path)) == NULL)
+			err_sys("malloc");
+		fixture_open(impl, flags);
+		impl->next = fixtures;
+		fixtures = impl;
+	}
+	impl->refs++;
+	pthread_mutex_unlock(&fixture_lock);
+	return &impl->fixture;
+}
+
+void
+fixture_unmap(const struct test_fixture *fixture)
+{
+	struct fixture_impl *impl = (struct fixture_impl *) fixture;
+	struct fixture_impl **prev;
+
+	assert(fixture != NULL);
+	pthread_mutex_lock(&fixture_lock);
+	assert(impl->refs > 0);
+	if (--impl->refs > 0) {
+		pthread_mutex_unlock(&fixture_lock);
+		return;
+	}
+	for (prev = &fixtures; *prev != impl; prev = &(*prev)->next)
+		;
+	*prev = impl->next;
+	pthread_mutex_unlock(&fixture_lock);
+	if (impl->len > 0)
+		munmap(impl->base, impl->len);
+	free((char *) impl->fixture.path);
+	free(impl);
+}
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+struct generator_suite {
+	SUITE_HEAD
+	bool (*next)(void *state, struct test_case *test);
+	void *state;
+	unsigned int length;
+};
+
+static void
+generator_suite_run(struct test_suite *suite, struct test_result *result)
+{
+	struct generator_suite *gs = (struct generator_suite *) suite;
+	struct test_case_impl test;
+
+	assert(suite != NULL);
+	assert(result != NULL);
+	assert(gs->next != NULL);
+
+	while (!result->shouldstop) {
+		test_case_init((struct test_case *) &test, NULL, NULL, NULL, NULL);
+		if (!gs->next(gs->state, (struct test_case *) &test))
+			break;
+		assert(test.name != NULL);
+		assert(test.func != NULL);
+		test.run((struct test_case *) &test, suite, result);
+	}
+}
+
+static unsigned int
+generator_suite_len(struct test_suite *suite)
+{
+	return ((struct generator_suite *) suite)->length;
+}
+
+static void
+generator_suite_add_test(struct test_suite *suite, struct test_case *test)
+{
+	abort();  /* programming error: the tests are generated */
+}
+
+static void
+generator_suite_add_suite(struct test_suite *suite, struct test_suite *suitec)
+{
+	abort();  /* programming error: the tests are generated */
+}
+
+static void
+generator_suite_free(struct test_suite *suite)
+{
+	free(suite);
+}
+
+struct test_suite *
+generator_suite_new(bool (*next)(void *state, struct test_case *test),
+		void *state, unsigned int len)
+{
+	struct generator_suite *suite;
+
+	assert(next != NULL);
+	suite = (struct generator_suite *) calloc(1,
+			sizeof(struct generator_suite));
+	if (suite == NULL)
+		err_sys("malloc");
+	suite->next = next;
+	suite->state = state;
+	suite->length = len;
+	suite->free = generator_suite_free;
+	suite->add_test = generator_suite_add_test;
+	suite->add_suite = generator_suite_add_suite;
+	suite->run = generator_suite_run;
+	suite->len = generator_suite_len;
+	return (struct test_suite *) suite;
+}
@@ -0,0 +1,177 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The golden files: the expected output of a test, checked in with the
+ * tests. A golden file is mapped read only and compared with the output in
+ * place. It is replaced by a rename, hence the tests that read it at the
+ * same time, without lock, see either the old file or the new one.
+ */
+
+/* The most of a line quoted in the diff. */
+#define GOLDEN_MAXQUOTE 72
+
+static __thread char golden_msg[MAXLINE];
+
+static struct {
+	/* Rewrite the golden files that do not match. */
+	bool update;
+} config = {false};
+
+void
+golden_configure(bool update)
+{
+	config.update = update;
+}
+
+/* Replace the golden file with `buf`, keeping the mode of the old one. */
+static const char *
+golden_write(const char *path, const void *buf, size_t len, mode_t mode)
+{
+	char tmp[PATH_MAX];
+	ssize_t n;
+	size_t off;
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) == -1)
+		return strerror(errno);
+	for (off = 0; off < len; off += n)
+		if ((n = write(fd, (const char *) buf + off, len - off)) == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			goto fail;
+		}
+	if (fchmod(fd, mode) == -1)
+		goto fail;
+	n = close(fd);
+	fd = -1;
+	if (n == -1 || rename(tmp, path) == -1)
+		goto fail;
+	return NULL;
+fail:
+	n = errno;
+	if (fd != -1)
+		close(fd);
+	unlink(tmp);
+	return strerror(n);
+}
+
+/* Append the line of `p` around `offset`, quoted, to the message. */
+static size_t
+golden_quote(size_t n, const char *label, const unsigned char *p, size_t len,
+		size_t offset)
+{
+	size_t start = offset, stop = offset, i;
+
+	while (start > 0 && p[start - 1] != '\n' &&
+			offset - start < GOLDEN_MAXQUOTE / 2)
+		start--;
+	while (stop < len && p[stop] != '\n' && stop - start < GOLDEN_MAXQUOTE)
+		stop++;
+	n += snprintf(golden_msg + n, sizeof(golden_msg) - n, "\n%s \"", label);
+	for (i = start; i < stop && n < sizeof(golden_msg); i++)
+		if (p[i] >= ' ' && p[i] < 0x7f && p[i] != '"' && p[i] != '\\')
+			n += snprintf(golden_msg + n, sizeof(golden_msg) - n, "%c", p[i]);
+		else
+			n += snprintf(golden_msg + n, sizeof(golden_msg) - n, "\\x%02x",
+					p[i]);
+	n += snprintf(golden_msg + n, sizeof(golden_msg) - n, "\"%s",
+			stop < len && p[stop] != '\n' ? "..." : "");
+	return n;
+}
+
+/*
+ * Format the diff of a mismatch at `offset`: the line and the column of the
+ * first difference, then the lines of both sides. Past the end of one side
+ * its line is empty.
+ */
+static const char *
+golden_diff(const char *msg, const char *path, const unsigned char *golden,
+		size_t size, const unsigned char *buf, size_t len, size_t offset)
+{
+	size_t line = 1, col, i, n;
+	const unsigned char *nl;
+
+	for (i = 0; i < offset; i = nl - golden + 1) {
+		if ((nl = memchr(golden + i, '\n', offset - i)) == NULL)
+			break;
+		line++;
+	}
+	nl = offset > 0 ? memrchr(golden, '\n', offset) : NULL;
+	col = nl != NULL ? offset - (nl - golden) : offset + 1;
+	n = snprintf(golden_msg, sizeof(golden_msg),
+			"%.512s: the output differs from %.512s at line %zu, column %zu",
+			msg != NULL ? msg : "the golden file does not match", path, line,
+			col);
+	if (len != size)
+		n += snprintf(golden_msg + n, sizeof(golden_msg) - n,
+				" (%zu bytes, expected %zu)", len, size);
+	n = golden_quote(n, "expected", golden, size, offset);
+	n = golden_quote(n, "     got", buf, len, offset);
+	snprintf(golden_msg + n, sizeof(golden_msg) - n,
+			"\nrun with -U to update the golden file");
+	return golden_msg;
+}
+
+const char *
+golden_check(const void *buf, size_t len, const char *path, const char *msg)
+{
+	const unsigned char *golden = NULL;
+	const char *fail = NULL, *err;
+	mode_t mode = 0644;
+	struct stat st;
+	size_t size, offset;
+	int fd;
+
+	assert(buf != NULL || len == 0);
+	assert(path != NULL);
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 ||
+			fstat(fd, &st) == -1) {
+		if (errno == ENOENT && config.update)
+			goto update;
+		snprintf(golden_msg, sizeof(golden_msg), "%.512s: %.512s: %s",
+				msg != NULL ? msg : "the golden file can't be read", path,
+				strerror(errno));
+		if (fd != -1)
+			close(fd);
+		return golden_msg;
+	}
+	size = st.st_size;
+	mode = st.st_mode & 07777;
+	if (size > 0 && (golden = mmap(NULL, size, PROT_READ, MAP_SHARED, fd,
+					0)) == MAP_FAILED)
+		err_sys("mmap %s", path);
+	close(fd);
+	offset = mem_mismatch(golden, buf, len < size ? len : size);
+	if (offset == size && offset == len) {
+		if (size > 0)
+			munmap((void *) golden, size);
+		return NULL;
+	}
+	if (!config.update)
+		fail = golden_diff(msg, path, golden, size, buf, len, offset);
+	if (size > 0)
+		munmap((void *) golden, size);
+	if (fail != NULL)
+		return fail;
+update:
+	if ((err = golden_write(path, buf, len, mode)) == NULL)
+		return NULL;
+	snprintf(golden_msg, sizeof(golden_msg), "%.512s: %.512s can't be "
+			"updated: %s", msg != NULL ? msg : "the golden file", path, err);
+	return golden_msg;
+}
@@ -0,0 +1,106 @@
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * A log-linear histogram, as in HdrHistogram: the values below 2^BITS have
+ * their own bucket, then each power of two is split in 2^(BITS - 1) linear
+ * buckets, so a value is known within 1 / 2^(BITS - 1) of itself.
+ */
+
+#define HALF (1U << (BENCH_HIST_BITS - 1))
+#define MAXVALUE ((1ULL << BENCH_HIST_MAXBITS) - 1)
+
+static unsigned int
+histogram_index(uint64_t value)
+{
+	unsigned int shift;
+
+	if (value < 2 * HALF)
+		return value;
+	shift = 63 - __builtin_clzll(value) - (BENCH_HIST_BITS - 1);
+	return (shift << (BENCH_HIST_BITS - 1)) + (value >> shift);
+}
+
+/* The highest value that falls in the bucket. */
+static uint64_t
+histogram_value(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < 2 * HALF)
+		return index;
+	shift = index / HALF - 1;
+	return (((uint64_t) (index % HALF + HALF) + 1) << shift) - 1;
+}
+
+void
+bench_histogram_reset(struct bench_histogram *histogram)
+{
+	assert(histogram != NULL);
+	memset(histogram, 0, sizeof(*histogram));
+}
+
+void
+bench_histogram_record(struct bench_histogram *histogram, uint64_t value)
+{
+	if (value > MAXVALUE)
+		value = MAXVALUE;
+	if (histogram->count == 0 || value < histogram->min)
+		histogram->min = value;
+	if (value > histogram->max)
+		histogram->max = value;
+	histogram->count++;
+	histogram->sum += value;
+	histogram->buckets[histogram_index(value)]++;
+}
+
+void
+bench_histogram_merge(struct bench_histogram *dst,
+		const struct bench_histogram *src)
+{
+	unsigned int i;
+
+	assert(dst != NULL);
+	assert(src != NULL);
+	if (src->count == 0)
+		return;
+	if (dst->count == 0 || src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->count += src->count;
+	dst->sum += src->sum;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+}
+
+uint64_t
+bench_histogram_percentile(const struct bench_histogram *histogram,
+		double percentile)
+{
+	uint64_t rank, seen = 0, value;
+	unsigned int i;
+
+	assert(histogram != NULL);
+	if (histogram->count == 0)
+		return 0;
+	if (percentile >= 100.0)
+		return histogram->max;
+	rank = ceil(percentile / 100.0 * histogram->count);
+	if (rank < 1)
+		rank = 1;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	value = histogram_value(i);
+	if (value > histogram->max)
+		value = histogram->max;
+	if (value < histogram->min)
+		value = histogram->min;
+	return value;
+}
@@ -0,0 +1,665 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <assert.h>
+#include <execinfo.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The isolated mode runs each test case in a child process, under its
+ * resource limits. The child runs the test as usual with a result that
+ * writes what it receives on a pipe, and the parent replays it on the real
+ * result with the resources used by the child in the diagnostic. A child
+ * that ends without a result, e.g. killed over its CPU time, is an error.
+ * The process of the runner only forks, hence it stays small and a fork
+ * stays cheap however much memory the tests use: a crash costs the fork of
+ * the next test and nothing else.
+ *
+ * A child that gets a fatal signal writes its backtrace on the pipe, after
+ * a header of kind ISOLATE_CRASH, and dies of the signal.
+ *
+ * A test with a sandbox always runs in a child, that enters its namespaces
+ * before the test starts.
+ */
+
+/* The longest string accepted from a child, to not trust a garbled length. */
+#define ISOLATE_MAXSTRING (16 * 1024 * 1024)
+#define ISOLATE_MAXFRAMES 64
+/* The stack of the signal handlers, to report a stack overflow too. */
+#define ISOLATE_ALTSTACK (64 * 1024)
+
+enum isolate_kind {
+	ISOLATE_SKIP,
+	ISOLATE_SUCCESS,
+	ISOLATE_XSUCCESS,
+	ISOLATE_FAILURE,
+	ISOLATE_XFAILURE,
+	ISOLATE_ERROR,
+	ISOLATE_CRASH
+};
+
+struct isolate_result {
+	RESULT_HEAD
+	FILE *out;
+};
+
+/* How the sandbox of a test was set up. */
+enum isolate_sandbox {
+	ISOLATE_NOSANDBOX,
+	ISOLATE_NAMESPACES,
+	ISOLATE_SERIALIZED
+};
+
+/* The fixed part of a test written on the pipe, followed by its strings. */
+struct isolate_header {
+	int kind;
+	int sandbox;
+	unsigned int lineno;
+	unsigned long assertions;
+	unsigned int nfailures;
+	unsigned int overflow;
+};
+
+/* A test read from the pipe, it owns its strings. */
+struct isolate_record {
+	struct isolate_header header;
+	char *msg;
+	char *condition;
+	char *filename;
+	char *diag;
+	struct test_failure *failures;
+};
+
+static struct {
+	bool enabled;
+	struct test_limits limits;
+} config;
+
+/* Set in a child, where the tests run in place. */
+static bool isolated;
+/* The sandbox of the test of a child. */
+static enum isolate_sandbox isolate_sandboxed;
+
+/* The child writes from a static buffer, in case it is out of memory. */
+static char isolate_buffer[BUFSIZ];
+
+/* The pipe of the child, for the signal handlers. */
+static int isolate_fd = -1;
+
+static const int isolate_fatal[] = {
+	SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTRAP, SIGSYS
+};
+
+static const struct {
+	int sig;
+	const char *name;
+} isolate_signames[] = {
+	{SIGHUP, "SIGHUP"}, {SIGINT, "SIGINT"}, {SIGQUIT, "SIGQUIT"},
+	{SIGILL, "SIGILL"}, {SIGTRAP, "SIGTRAP"}, {SIGABRT, "SIGABRT"},
+	{SIGBUS, "SIGBUS"}, {SIGFPE, "SIGFPE"}, {SIGKILL, "SIGKILL"},
+	{SIGUSR1, "SIGUSR1"}, {SIGSEGV, "SIGSEGV"}, {SIGUSR2, "SIGUSR2"},
+	{SIGPIPE, "SIGPIPE"}, {SIGALRM, "SIGALRM"}, {SIGTERM, "SIGTERM"},
+	{SIGXCPU, "SIGXCPU"}, {SIGXFSZ, "SIGXFSZ"}, {SIGSYS, "SIGSYS"}
+};
+
+/* Return the name of the signal `sig`, e.g. "SIGSEGV", or NULL. */
+const char *
+isolate_signal_name(int sig)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(isolate_signames) / sizeof(isolate_signames[0]);
+			i++)
+		if (isolate_signames[i].sig == sig)
+			return isolate_signames[i].name;
+	return NULL;
+}
+
+void
+isolate_configure(bool enabled, const struct test_limits *limits)
+{
+	config.enabled = enabled;
+	memset(&config.limits, 0, sizeof(config.limits));
+	if (limits != NULL)
+		config.limits = *limits;
+}
+
+bool
+isolate_enabled(const struct test_case *test)
+{
+	return (config.enabled || test->sandbox != 0) && !isolated;
+}
+
+/*
+ * Parse a comma separated list of limits such as "as=1G,cpu=10,nofile=64"
+ * into `limits`. The sizes accept the K, M and G suffixes.
+ */
+bool
+isolate_parse_limits(const char *spec, struct test_limits *limits)
+{
+	unsigned long long value;
+	unsigned int shift;
+	const char *p = spec;
+	char *end;
+	size_t len;
+
+	while (*p != '\0') {
+		len = strcspn(p, "=,");
+		if (p[len] != '=')
+			return false;
+		value = strtoull(p + len + 1, &end, 0);
+		if (end == p + len + 1)
+			return false;
+		shift = 0;
+		switch (*end) {
+			case 'K': case 'k': shift = 10; break;
+			case 'M': case 'm': shift = 20; break;
+			case 'G': case 'g': shift = 30; break;
+		}
+		if (shift > 0) {
+			value <<= shift;
+			end++;
+		}
+		if (*end != ',' && *end != '\0')
+			return false;
+		if (len == 2 && !strncmp(p, "as", len))
+			limits->as = value;
+		else if (len == 3 && !strncmp(p, "cpu", len))
+			limits->cpu = value;
+		else if (len == 6 && !strncmp(p, "nofile", len))
+			limits->nofile = value;
+		else
+			return false;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return true;
+}
+
+/* The limits of the option, overridden by the ones of the test. */
+static void
+isolate_limits(const struct test_case *test, struct test_limits *limits)
+{
+	*limits = config.limits;
+	if (test->limits == NULL)
+		return;
+	if (test->limits->as > 0)
+		limits->as = test->limits->as;
+	if (test->limits->cpu > 0)
+		limits->cpu = test->limits->cpu;
+	if (test->limits->nofile > 0)
+		limits->nofile = test->limits->nofile;
+}
+
+/* Lower the soft limit of `resource` to `value` and the hard one to `hard`. */
+static void
+isolate_setrlimit(int resource, rlim_t value, rlim_t hard)
+{
+	struct rlimit rl;
+
+	if (value == 0)
+		return;
+	if (getrlimit(resource, &rl) == -1)
+		err_sys("getrlimit");
+	if (rl.rlim_max != RLIM_INFINITY && value > rl.rlim_max)
+		value = rl.rlim_max;
+	rl.rlim_cur = value;
+	if (rl.rlim_max == RLIM_INFINITY || hard < rl.rlim_max)
+		rl.rlim_max = hard;
+	if (setrlimit(resource, &rl) == -1)
+		err_sys("setrlimit");
+}
+
+static void
+isolate_put_string(FILE *out, const char *str)
+{
+	size_t len = str != NULL ? strlen(str) + 1 : 0;
+
+	fwrite(&len, sizeof(len), 1, out);
+	if (len > 0)
+		fwrite(str, 1, len, out);
+}
+
+static void
+isolate_send(struct test_result *result, struct test_case *test, int kind)
+{
+	FILE *out = ((struct isolate_result *) result)->out;
+	struct isolate_header header = {
+		.kind = kind,
+		.sandbox = isolate_sandboxed,
+		.lineno = test->lineno,
+		.assertions = test->assertions,
+		.nfailures = test->nfailures,
+		.overflow = test->overflow,
+	};
+	unsigned int i;
+
+	fwrite(&header, sizeof(header), 1, out);
+	isolate_put_string(out, test->msg);
+	isolate_put_string(out, test->condition);
+	isolate_put_string(out, test->filename);
+	isolate_put_string(out, test->diag);
+	for (i = 0; i < test->nfailures; i++) {
+		fwrite(&test->failures[i].lineno, sizeof(unsigned int), 1, out);
+		isolate_put_string(out, test->failures[i].msg);
+		isolate_put_string(out, test->failures[i].condition);
+		isolate_put_string(out, test->failures[i].filename);
+	}
+	fflush(out);
+}
+
+static void
+isolate_add_skip(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_SKIP);
+}
+
+static void
+isolate_add_success(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_SUCCESS);
+}
+
+static void
+isolate_add_xsuccess(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_XSUCCESS);
+}
+
+static void
+isolate_add_failure(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_FAILURE);
+}
+
+static void
+isolate_add_xfailure(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_XFAILURE);
+}
+
+static void
+isolate_add_error(struct test_result *result, struct test_case *test)
+{
+	isolate_send(result, test, ISOLATE_ERROR);
+}
+
+/* Send the backtrace of a fatal signal to the parent and die of it. */
+static void
+isolate_crash(int sig)
+{
+	struct isolate_header header = {.kind = ISOLATE_CRASH};
+	void *frames[ISOLATE_MAXFRAMES];
+	int n;
+
+	n = backtrace(frames, ISOLATE_MAXFRAMES);
+	/* The first frame is the handler. */
+	if (write(isolate_fd, &header, sizeof(header)) == sizeof(header) && n > 1)
+		backtrace_symbols_fd(frames + 1, n - 1, isolate_fd);
+	/* The handler is reset, the signal kills the child when it returns. */
+	raise(sig);
+}
+
+static void
+isolate_catch(void)
+{
+	static char stack[ISOLATE_ALTSTACK];
+	struct sigaction sa;
+	void *frame;
+	stack_t ss;
+	size_t i;
+
+	/* The first call of backtrace loads libgcc, not in a handler. */
+	backtrace(&frame, 1);
+	ss.ss_sp = stack;
+	ss.ss_size = sizeof(stack);
+	ss.ss_flags = 0;
+	if (sigaltstack(&ss, NULL) == -1)
+		err_sys("sigaltstack");
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = isolate_crash;
+	sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&sa.sa_mask);
+	for (i = 0; i < sizeof(isolate_fatal) / sizeof(isolate_fatal[0]); i++)
+		if (sigaction(isolate_fatal[i], &sa, NULL) == -1)
+			err_sys("sigaction");
+}
+
+/* Run the test in the child, under its limits, and exit. */
+static void
+isolate_child(struct test_case *test, struct test_suite *suite,
+		struct test_result *parent, int fd, const struct test_limits *limits)
+{
+	struct isolate_result result;
+	char msg[MAXLINE];
+
+	isolated = true;
+	memset(&result, 0, sizeof(result));
+	if ((result.out = fdopen(fd, "w")) == NULL)
+		err_sys("fdopen");
+	setvbuf(result.out, isolate_buffer, _IOFBF, sizeof(isolate_buffer));
+	isolate_fd = fd;
+	isolate_catch();
+	result.record = parent->record;
+	result.add_skip = isolate_add_skip;
+	result.add_success = isolate_add_success;
+	result.add_xsuccess = isolate_add_xsuccess;
+	result.add_failure = isolate_add_failure;
+	result.add_xfailure = isolate_add_xfailure;
+	result.add_error = isolate_add_error;
+	if (test->sandbox != 0)
+		switch (sandbox_enter(test->sandbox, msg, sizeof(msg))) {
+			case 1:
+				isolate_sandboxed = ISOLATE_NAMESPACES;
+				break;
+			case 0:
+				isolate_sandboxed = ISOLATE_SERIALIZED;
+				break;
+			default:
+				/* The test does not run outside of its sandbox. */
+				test->msg = msg;
+				result.add_error((struct test_result *) &result, test);
+				_exit(0);
+		}
+	isolate_setrlimit(RLIMIT_AS, limits->as, limits->as);
+	/* The CPU time kills with SIGXCPU, then with SIGKILL if it is caught. */
+	isolate_setrlimit(RLIMIT_CPU, limits->cpu, limits->cpu + 1);
+	isolate_setrlimit(RLIMIT_NOFILE, limits->nofile, limits->nofile);
+	test->run(test, suite, (struct test_result *) &result);
+	fflush(NULL);
+	_exit(0);
+}
+
+static bool
+isolate_get_string(FILE *in, char **str)
+{
+	size_t len;
+
+	*str = NULL;
+	if (fread(&len, sizeof(len), 1, in) != 1)
+		return false;
+	if (len == 0)
+		return true;
+	if (len > ISOLATE_MAXSTRING)
+		return false;
+	if ((*str = malloc(len)) == NULL)
+		err_sys("malloc");
+	return fread(*str, 1, len, in) == len && (*str)[len - 1] == '\0';
+}
+
+static void
+isolate_record_free(struct isolate_record *record)
+{
+	unsigned int i;
+
+	free(record->msg);
+	free(record->condition);
+	free(record->filename);
+	free(record->diag);
+	if (record->failures != NULL)
+		for (i = 0; i < record->header.nfailures; i++) {
+			free((char *) record->failures[i].msg);
+			free((char *) record->failures[i].condition);
+			free((char *) record->failures[i].filename);
+		}
+	free(record->failures);
+	memset(record, 0, sizeof(*record));
+}
+
+/* Read the rest of a result after its header. */
+static bool
+isolate_receive_test(FILE *in, struct isolate_record *record)
+{
+	struct test_failure *failure;
+	unsigned int i;
+
+	if (record->header.nfailures > EXPECT_MAXFAILURES)
+		return false;
+	if (!isolate_get_string(in, &record->msg) ||
+			!isolate_get_string(in, &record->condition) ||
+			!isolate_get_string(in, &record->filename) ||
+			!isolate_get_string(in, &record->diag))
+		goto error;
+	record->failures = calloc(record->header.nfailures + 1,
+			sizeof(struct test_failure));
+	if (record->failures == NULL)
+		err_sys("malloc");
+	for (i = 0; i < record->header.nfailures; i++) {
+		failure = &record->failures[i];
+		if (fread(&failure->lineno, sizeof(unsigned int), 1, in) != 1 ||
+				!isolate_get_string(in, (char **) &failure->msg) ||
+				!isolate_get_string(in, (char **) &failure->condition) ||
+				!isolate_get_string(in, (char **) &failure->filename))
+			goto error;
+	}
+	return true;
+
+error:
+	isolate_record_free(record);
+	return false;
+}
+
+/*
+ * Read the result of the test and the backtrace of a crash, if any, and
+ * return false if the child sent no result.
+ */
+static bool
+isolate_receive(FILE *in, struct isolate_record *record, char **backtrace)
+{
+	struct isolate_header header;
+	bool received = false;
+	size_t size = 0;
+
+	memset(record, 0, sizeof(*record));
+	*backtrace = NULL;
+	while (fread(&header, sizeof(header), 1, in) == 1) {
+		if (header.kind == ISOLATE_CRASH) {
+			/* The frames are text up to the end of the pipe. */
+			if (getdelim(backtrace, &size, '\0', in) == -1) {
+				free(*backtrace);
+				*backtrace = NULL;
+			}
+			break;
+		}
+		/* The child sends one result, anything else is garbled. */
+		if (received)
+			break;
+		record->header = header;
+		if (!isolate_receive_test(in, record))
+			break;
+		received = true;
+	}
+	return received;
+}
+
+static double
+isolate_seconds(const struct timeval *tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/* Describe why a child ended without a result. */
+static void
+isolate_reason(char *buf, size_t size, int status,
+		const struct rusage *usage, const struct test_limits *limits)
+{
+	const char *name;
+	double cpu;
+	int sig;
+
+	cpu = isolate_seconds(&usage->ru_utime) + isolate_seconds(&usage->ru_stime);
+	if (WIFSIGNALED(status)) {
+		sig = WTERMSIG(status);
+		if (limits->cpu > 0 && (sig == SIGXCPU ||
+					(sig == SIGKILL && cpu >= limits->cpu)))
+			snprintf(buf, size, "the test exceeded its CPU time limit of "
+					"%lu s", limits->cpu);
+		else if ((name = isolate_signal_name(sig)) != NULL)
+			snprintf(buf, size, "the test process was killed by %s (%s)",
+					name, strsignal(sig));
+		else
+			snprintf(buf, size, "the test process was killed by signal %d",
+					sig);
+	} else if (WEXITSTATUS(status) != 0 && limits->as > 0)
+		snprintf(buf, size, "the test process exited with status %d, "
+				"its address space limit is %llu bytes", WEXITSTATUS(status),
+				limits->as);
+	else
+		snprintf(buf, size, "the test process exited with status %d before "
+				"the end of the test", WEXITSTATUS(status));
+}
+
+/*
+ * The diagnostic of the child, the backtrace of its crash if any, its
+ * sandbox and the resources it used.
+ */
+static char *
+isolate_diag(const char *diag, const char *backtrace, int sandbox,
+		const struct rusage *usage)
+{
+	const char *p;
+	size_t size;
+	char *buf;
+	int len;
+
+	size = (diag != NULL ? strlen(diag) : 0) + MAXLINE / 4;
+	/* Each line of the backtrace gets an indentation. */
+	if (backtrace != NULL)
+		for (p = backtrace; *p != '\0'; p++)
+			size += *p == '\n' ? 6 : 1;
+	if ((buf = malloc(size)) == NULL)
+		err_sys("malloc");
+	len = snprintf(buf, size, "%s", diag != NULL ? diag : "");
+	if (backtrace != NULL && *backtrace != '\0') {
+		len += snprintf(buf + len, size - len, "  backtrace: |-\n");
+		for (p = backtrace; *p != '\0'; p += strcspn(p, "\n") + 1) {
+			len += snprintf(buf + len, size - len, "    %.*s\n",
+					(int) strcspn(p, "\n"), p);
+			if (p[strcspn(p, "\n")] == '\0')
+				break;
+		}
+	}
+	if (sandbox == ISOLATE_NAMESPACES)
+		len += snprintf(buf + len, size - len, "  sandbox: namespaces\n");
+	else if (sandbox == ISOLATE_SERIALIZED)
+		len += snprintf(buf + len, size - len, "  sandbox: serialized\n");
+	snprintf(buf + len, size - len,
+			"  resources:\n"
+			"    max_rss_kb: %ld\n"
+			"    minor_faults: %ld\n"
+			"    major_faults: %ld\n"
+			"    voluntary_switches: %ld\n"
+			"    involuntary_switches: %ld\n"
+			"    user_time: %.6f\n"
+			"    system_time: %.6f\n",
+			usage->ru_maxrss, usage->ru_minflt, usage->ru_majflt,
+			usage->ru_nvcsw, usage->ru_nivcsw,
+			isolate_seconds(&usage->ru_utime),
+			isolate_seconds(&usage->ru_stime));
+	return buf;
+}
+
+/*
+ * Run the test in a child process and report its result to `result`, as
+ * test_case_run does in place.
+ */
+void
+isolate_run(struct test_case *test, struct test_suite *suite,
+		struct test_result *result)
+{
+	struct isolate_record record;
+	struct test_limits limits;
+	struct rusage usage;
+	char msg[MAXLINE / 4], *backtrace;
+	bool received;
+	int fds[2], status, kind;
+	FILE *in;
+	pid_t pid;
+
+	assert(test != NULL);
+	assert(result != NULL);
+
+	isolate_limits(test, &limits);
+	result->testsrun++;
+	if (result->start_test != NULL)
+		result->start_test(result, test);
+	if (pipe(fds) == -1)
+		err_sys("pipe");
+	fflush(NULL);
+	if ((pid = fork()) == -1)
+		err_sys("fork");
+	if (pid == 0) {
+		close(fds[0]);
+		isolate_child(test, suite, result, fds[1], &limits);
+	}
+	close(fds[1]);
+	if ((in = fdopen(fds[0], "r")) == NULL)
+		err_sys("fdopen");
+	received = isolate_receive(in, &record, &backtrace);
+	fclose(in);
+	while (wait4(pid, &status, 0, &usage) == -1)
+		if (errno != EINTR)
+			err_sys("wait4");
+
+	if (received && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		kind = record.header.kind;
+		test->msg = record.msg;
+		test->condition = record.condition;
+		test->filename = record.filename;
+		test->lineno = record.header.lineno;
+		test->assertions = record.header.assertions;
+		test->failures = record.failures;
+		test->nfailures = record.header.nfailures;
+		test->overflow = record.header.overflow;
+	} else {
+		kind = ISOLATE_ERROR;
+		isolate_reason(msg, sizeof(msg), status, &usage, &limits);
+		scratch_reap(pid, test);
+		test->msg = msg;
+		test->condition = NULL;
+		test->filename = NULL;
+		test->lineno = 0;
+		test->assertions = received ? record.header.assertions : 0;
+		test->failures = NULL;
+		test->nfailures = 0;
+		test->overflow = 0;
+	}
+	test->diag = isolate_diag(received ? record.diag : NULL, backtrace,
+			received ? record.header.sandbox : ISOLATE_NOSANDBOX, &usage);
+	switch (kind) {
+		case ISOLATE_SKIP:
+			result->add_skip(result, test);
+			break;
+		case ISOLATE_SUCCESS:
+			result->add_success(result, test);
+			break;
+		case ISOLATE_XSUCCESS:
+			result->add_xsuccess(result, test);
+			break;
+		case ISOLATE_FAILURE:
+			result->add_failure(result, test);
+			break;
+		case ISOLATE_XFAILURE:
+			result->add_xfailure(result, test);
+			break;
+		default:
+			result->add_error(result, test);
+	}
+	if (result->stop_test != NULL)
+		result->stop_test(result, test);
+	free((char *) test->diag);
+	test->msg = NULL;
+	test->condition = NULL;
+	test->filename = NULL;
+	test->diag = NULL;
+	test->failures = NULL;
+	test->nfailures = 0;
+	if (received)
+		isolate_record_free(&record);
+	free(backtrace);
+}
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * A small JSON reader, enough to load the benchmark baselines. The strings
+ * are decoded but the \u escapes outside ASCII are replaced by '?'.
+ */
+
+#define JSON_MAXDEPTH 64
+
+static struct json *json_value(const char **p, int depth);
+
+static void
+json_skip(const char **p)
+{
+	while (isspace((unsigned char) **p))
+		(*p)++;
+}
+
+static struct json *
+json_new(enum json_type type)
+{
+	struct json *json;
+
+	if ((json = calloc(1, sizeof(struct json))) == NULL)
+		err_sys("malloc");
+	json->type = type;
+	return json;
+}
+
+static char *
+json_string(const char **p)
+{
+	const char *s = *p + 1;
+	char *str, *d;
+	unsigned int c;
+
+	assert(**p == '"');
+	/* The decoded string is never longer than the encoded one. */
+	if ((str = malloc(strlen(s) + 1)) == NULL)
+		err_sys("malloc");
+	for (d = str; *s != '"'; s++) {
+		if (*s == '\0' || (unsigned char) *s < 0x20)
+			goto error;
+		if (*s != '\\') {
+			*d++ = *s;
+			continue;
+		}
+		switch (*++s) {
+			case 'b': *d++ = '\b'; break;
+			case 'f': *d++ = '\f'; break;
+			case 'n': *d++ = '\n'; break;
+			case 'r': *d++ = '\r'; break;
+			case 't': *d++ = '\t'; break;
+			case '"': case '\\': case '/': *d++ = *s; break;
+			case 'u':
+				if (sscanf(s + 1, "%4x", &c) != 1 || strlen(s + 1) < 4)
+					goto error;
+				*d++ = c < 0x80 ? c : '?';
+				s += 4;
+				break;
+			default:
+				goto error;
+		}
+	}
+	*d = '\0';
+	*p = s + 1;
+	return str;
+
+error:
+	free(str);
+	return NULL;
+}
+
+static struct json *
+json_container(const char **p, int depth, enum json_type type, char close)
+{
+	struct json *json, *child, **last;
+	char *key = NULL;
+
+	json = json_new(type);
+	last = &json->child;
+	(*p)++;
+	json_skip(p);
+	if (**p == close) {
+		(*p)++;
+		return json;
+	}
+	for (;;) {
+		json_skip(p);
+		if (type == JSON_OBJECT) {
+			if (**p != '"' || (key = json_string(p)) == NULL)
+				goto error;
+			json_skip(p);
+			if (*(*p)++ != ':')
+				goto error;
+		}
+		if ((child = json_value(p, depth + 1)) == NULL)
+			goto error;
+		child->key = key;
+		key = NULL;
+		*last = child;
+		last = &child->next;
+		json_skip(p);
+		if (**p == ',') {
+			(*p)++;
+			continue;
+		}
+		if (**p == close) {
+			(*p)++;
+			return json;
+		}
+		goto error;
+	}
+
+error:
+	free(key);
+	json_free(json);
+	return NULL;
+}
+
+static struct json *
+json_value(const char **p, int depth)
+{
+	struct json *json;
+	char *end;
+
+	if (depth > JSON_MAXDEPTH)
+		return NULL;
+	json_skip(p);
+	switch (**p) {
+		case '{':
+			return json_container(p, depth, JSON_OBJECT, '}');
+		case '[':
+			return json_container(p, depth, JSON_ARRAY, ']');
+		case '"':
+			json = json_new(JSON_STRING);
+			if ((json->string = json_string(p)) == NULL) {
+				json_free(json);
+				return NULL;
+			}
+			return json;
+	}
+	if (!strncmp(*p, "true", 4) || !strncmp(*p, "false", 5)) {
+		json = json_new(JSON_BOOL);
+		json->number = **p == 't';
+		*p += **p == 't' ? 4 : 5;
+		return json;
+	}
+	if (!strncmp(*p, "null", 4)) {
+		*p += 4;
+		return json_new(JSON_NULL);
+	}
+	json = json_new(JSON_NUMBER);
+	json->number = strtod(*p, &end);
+	if (end == *p) {
+		json_free(json);
+		return NULL;
+	}
+	*p = end;
+	return json;
+}
+
+struct json *
+json_parse(const char *text)
+{
+	struct json *json;
+
+	if ((json = json_value(&text, 0)) == NULL)
+		return NULL;
+	json_skip(&text);
+	if (*text != '\0') {
+		json_free(json);
+		return NULL;
+	}
+	return json;
+}
+
+const struct json *
+json_get(const struct json *object, const char *key)
+{
+	const struct json *member;
+
+	if (object == NULL || object->type != JSON_OBJECT)
+		return NULL;
+	for (member = object->child; member != NULL; member = member->next)
+		if (!strcmp(member->key, key))
+			return member;
+	return NULL;
+}
+
+void
+json_free(struct json *json)
+{
+	struct json *next;
+
+	for (; json != NULL; json = next) {
+		next = json->next;
+		json_free(json->child);
+		free(json->key);
+		free(json->string);
+		free(json);
+	}
+}
+
+void
+json_print_string(FILE *stream, const char *str)
+{
+	fputc('"', stream);
+	for (; *str != '\0'; str++)
+		if (*str == '"' || *str == '\\')
+			fprintf(stream, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(stream, "\\u%04x", *str);
+		else
+			fputc(*str, stream);
+	fputc('"', stream);
+}
@@ -8,6 +8,12 @@
 
 #define LOAD_TEST_SUITE "load_test_suite"
 
+struct test_loader_impl {
+	LOADER_HEAD
+	/* If not NULL, the prefix of the test functions to discover. */
+	const char *prefix;
+};
+
 static void
 suite_error(TESTARGS, void *usrptr)
 {
@@ -26,23 +32,49 @@ suite_error_new(const char *error)
 }
 
 struct test_suite *
-load_test_from_dyn_library(struct test_loader *loader, const char *filename)
+load_test_from_dyn_library(struct test_loader *loader, const char *filename,
+		const char *prefix)
 {
-	void *handle;
-	struct test_suite *suite;
+	void *handle, *ref;
+	struct test_suite *suites[3],
+					  *suite;
+	const struct test_section *section;
 	typedef struct test_suite* (_Loaderhook)(struct test_loader*);
 	_Loaderhook *load_suite;
+	int n = 0, c;
 
 	assert(loader != NULL);
 
 	if ((handle = dlopen(filename, RTLD_LAZY | RTLD_LOCAL)) == NULL)
 		return suite_error_new(dlerror());
 	load_suite = (_Loaderhook *) dlsym(handle, LOAD_TEST_SUITE);
-	if (load_suite == NULL)
-		suite = suite_error_new("no suite found");
-	else if ((suite = load_suite(loader)) == NULL )
-		suite = suite_error_new("error while loading suite");
-	dlclose(handle);
+	if (load_suite != NULL && (suites[n++] = load_suite(loader)) == NULL)
+		suites[n - 1] = suite_error_new("error while loading suite");
+	/* The suites own a reference to the library, the tests must outlive the
+	 * loader: the suite of the symbols takes a reference of its own, that it
+	 * closes when it is freed, and `handle` goes to the suite of the section
+	 * or is closed. */
+	if (prefix != NULL) {
+		if ((ref = dlopen(filename, RTLD_LAZY | RTLD_LOCAL)) == NULL)
+			suites[n++] = suite_error_new(dlerror());
+		else if ((suites[n] = elf_suite_new(ref, prefix)) != NULL)
+			n++;
+		else
+			dlclose(ref);
+	}
+	section = (const struct test_section *) dlsym(handle, TEST_SECTION_SYMBOL);
+	if (section != NULL && section->start != section->stop)
+		suites[n++] = desc_suite_new(section->start, section->stop, handle,
+				false);
+	else
+		dlclose(handle);
+	if (n == 0)
+		return suite_error_new("no suite found");
+	if (n == 1)
+		return suites[0];
+	suite = test_suite_new();
+	for (c = 0; c < n; c++)
+		suite->add_suite(suite, suites[c]);
 	return suite;
 }
 
@@ -50,12 +82,14 @@ static struct test_suite *
 test_loader_discover_tests(struct test_loader *loader, int argc, char *argv[])
 {
 	struct test_suite *suite;
+	const char *prefix = ((struct test_loader_impl *) loader)->prefix;
 	int c;
 
 	suite = test_suite_new();
 	for (c = 0; c < argc; c++)
-		suite->add_suite(suite, load_test_from_dyn_library(loader, argv[c]));
-	suite->add_suite(suite, load_test_from_dyn_library(loader, NULL));
+		suite->add_suite(suite, load_test_from_dyn_library(loader, argv[c],
+					prefix));
+	suite->add_suite(suite, load_test_from_dyn_library(loader, NULL, prefix));
 	return suite;
 }
 
@@ -66,18 +100,25 @@ test_loader_free(struct test_loader *loader)
 }
 
 struct test_loader *
-test_loader_new(void)
+symbol_loader_new(const char *prefix)
 {
 	struct test_loader *loader;
 
-	loader = (struct test_loader *) calloc(1, sizeof(struct test_loader));
+	loader = (struct test_loader *) calloc(1, sizeof(struct test_loader_impl));
 	if (loader == NULL)
 		err_sys("malloc");
+	((struct test_loader_impl *) loader)->prefix = prefix;
 	loader->free = test_loader_free;
 	loader->load_tests = test_loader_discover_tests;
 	return loader;
 }
 
+struct test_loader *
+test_loader_new(void)
+{
+	return symbol_loader_new(NULL);
+}
+
 static struct test_suite *
 test_loader_load_tests_function(struct test_loader *loader, int argc,
 		char *argv[])
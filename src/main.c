@@ -1,15 +1,18 @@
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include "unittest.h"
+#include "unittest_priv.h"
 
 
 static int _test_main1(struct test_runner *runner, struct test_loader *loader,
-		bool verbosity, bool failfast, bool buffered, FILE *stream, int argc,
-		char *argv[]);
+		int verbosity, bool failfast, bool buffered, FILE *stream,
+		const char *prefix, int argc, char *argv[]);
 static int _test_main2(struct test_runner *runner, struct test_loader *loader,
-		int argc, char *argv[]);
+		const char *prefix, int argc, char *argv[]);
 
 
 static const char *usage =
@@ -21,15 +24,43 @@ static const char *usage =
 	"  -q, --quiet      Minimal output\n"
 	"  -f, --failfast   Stop on first failure\n"
 	"  -c, --catch      Catch control-C and display results\n"
-	"  -b, --buffer     Buffer stdout and stderr during test runs\n";
+	"  -b, --buffer     Buffer stdout and stderr during test runs\n"
+	"  -i               Run each test in its own process\n"
+	"  -l LIMITS        Resource limits of the isolated tests, e.g.\n"
+	"                   as=1G,cpu=10,nofile=64\n"
+	"  -k               Keep the scratch directory of a failed test\n"
+	"  -U               Update the golden files that do not match\n"
+	"  -p PREFIX        Run the global functions whose name starts with PREFIX\n"
+	"  -n ITERATIONS    Number of inputs of each property (default 100)\n"
+	"  -t SECONDS       Time budget of each property\n"
+	"  -s SEED          Seed of the properties, to replay a failure\n"
+	"  -m SECONDS       Minimum time of each benchmark run (default 0.1)\n"
+	"  -r REPETITIONS   Number of runs of each benchmark (default 10)\n"
+	"  -J FILE          Write the benchmark results to FILE as JSON\n"
+	"  -B FILE          Compare the benchmarks with the JSON baseline FILE\n"
+	"  -T PERCENT       Slowdown from the baseline that fails (default 5)\n"
+	"  -A CPU           Pin the benchmarks to CPU\n"
+	"  -P               Raise the priority of the benchmarks\n"
+	"  -C PERCENT       Variation of the timings that makes a run noisy\n"
+	"  -R RETRIES       Number of times a noisy run is measured again\n";
 
 static const char *version = "0.1";
 
 struct unittest_opts {
-	bool verbosity;
+	int verbosity;
 	bool failfast;
 	bool buffered;
+	bool isolated;
+	struct test_limits limits;
+	bool keep;
+	bool update;
 	FILE *stream;
+	const char *prefix;
+	unsigned int iterations;
+	double budget;
+	uint64_t seed;
+	bool hasseed;
+	struct bench_config bench;
 	int argc;
 	char **argv;
 };
@@ -48,13 +79,41 @@ print_version(const char *prog)
 	exit(0);
 }
 
+/* Parse a whole number up to `max`, or exit with the usage. */
+static unsigned long long
+parse_number(const char *prog, const char *arg, unsigned long long max)
+{
+	unsigned long long value;
+	char *end;
+
+	errno = 0;
+	value = strtoull(arg, &end, 0);
+	if (end == arg || *end != '\0' || *arg == '-' || errno == ERANGE ||
+			value > max)
+		print_usage(prog, 1);
+	return value;
+}
+
+/* Parse a number of seconds, or exit with the usage. */
+static double
+parse_seconds(const char *prog, const char *arg)
+{
+	double value;
+	char *end;
+
+	value = strtod(arg, &end);
+	if (end == arg || *end != '\0' || !(value >= 0.0))
+		print_usage(prog, 1);
+	return value;
+}
+
 void
 unittest_parse_options(int argc, char *argv[], struct unittest_opts *options)
 {
 	const char *optstring;
 	int opt;
 
-	optstring = "fvqhVb";
+	optstring = "fvqhVbikPUl:p:n:t:s:m:r:J:B:T:A:C:R:";
 	opterr = 0;
 	while ((opt = getopt(argc, argv, optstring)) != -1) {
 		switch (opt) {
@@ -74,6 +133,61 @@ unittest_parse_options(int argc, char *argv[], struct unittest_opts *options)
 			case 'b':
 				options->buffered = true;
 				break;
+			case 'i':
+				options->isolated = true;
+				break;
+			case 'l':
+				if (!isolate_parse_limits(optarg, &options->limits))
+					print_usage(argv[0], 1);
+				break;
+			case 'k':
+				options->keep = true;
+				break;
+			case 'U':
+				options->update = true;
+				break;
+			case 'p':
+				options->prefix = optarg;
+				break;
+			case 'n':
+				options->iterations = parse_number(argv[0], optarg, UINT_MAX);
+				break;
+			case 't':
+				options->budget = parse_seconds(argv[0], optarg);
+				break;
+			case 's':
+				options->seed = parse_number(argv[0], optarg, UINT64_MAX);
+				options->hasseed = true;
+				break;
+			case 'm':
+				options->bench.mintime = strtod(optarg, NULL);
+				break;
+			case 'r':
+				options->bench.repetitions = strtoul(optarg, NULL, 0);
+				if (options->bench.repetitions == 0)
+					print_usage(argv[0], 1);
+				break;
+			case 'J':
+				options->bench.json = optarg;
+				break;
+			case 'B':
+				options->bench.baseline = optarg;
+				break;
+			case 'T':
+				options->bench.threshold = strtod(optarg, NULL) / 100.0;
+				break;
+			case 'A':
+				options->bench.cpu = strtol(optarg, NULL, 0);
+				break;
+			case 'P':
+				options->bench.priority = true;
+				break;
+			case 'C':
+				options->bench.maxcv = strtod(optarg, NULL) / 100.0;
+				break;
+			case 'R':
+				options->bench.retries = strtoul(optarg, NULL, 0);
+				break;
 			default:
 				print_usage(argv[0], 1);
 		}
@@ -90,18 +204,48 @@ test_main(int argc, char *argv[],  struct test_runner *runner,
 		.verbosity = 0,
 		.failfast = false,
 		.buffered = false,
+		.isolated = false,
+		.limits = {0, 0, 0},
+		.keep = false,
+		.update = false,
 		.stream = stdout,
+		.prefix = NULL,
+		.iterations = 100,
+		.budget = 0.0,
+		.seed = 0,
+		.hasseed = false,
+		.bench = {
+			.mintime = 0.1,
+			.repetitions = 10,
+			.threshold = 0.05,
+			.json = NULL,
+			.baseline = NULL,
+			.cpu = -1,
+			.priority = false,
+			.maxcv = 0.0,
+			.retries = 0,
+		},
 	};
+	int ret;
 
 	unittest_parse_options(argc, argv, &options);
-	return _test_main1(runner, loader, options.verbosity, options.failfast,
-			options.buffered, options.stream, options.argc, options.argv);
+	property_configure(options.iterations, options.budget, options.seed,
+			options.hasseed);
+	bench_configure(&options.bench);
+	isolate_configure(options.isolated, &options.limits);
+	scratch_configure(options.keep);
+	golden_configure(options.update);
+	ret = _test_main1(runner, loader, options.verbosity, options.failfast,
+			options.buffered, options.stream, options.prefix, options.argc,
+			options.argv);
+	bench_finish();
+	return ret;
 }
 
 static int
 _test_main1(struct test_runner *runner, struct test_loader *loader,
-		bool verbosity, bool failfast, bool buffered, FILE *stream, int argc,
-		char *argv[])
+		int verbosity, bool failfast, bool buffered, FILE *stream,
+		const char *prefix, int argc, char *argv[])
 {
 	int ret;
 	bool mustfree = false;
@@ -110,21 +254,21 @@ _test_main1(struct test_runner *runner, struct test_loader *loader,
 		runner = tap_runner_new(verbosity, failfast, buffered, stream);
 		mustfree = true;
 	}
-	ret = _test_main2(runner, loader, argc, argv);
+	ret = _test_main2(runner, loader, prefix, argc, argv);
 	if (mustfree)
 		runner->free(runner);
 	return ret;
 }
 
 static int
-_test_main2(struct test_runner *runner, struct test_loader *loader, int argc,
-		char *argv[])
+_test_main2(struct test_runner *runner, struct test_loader *loader,
+		const char *prefix, int argc, char *argv[])
 {
 	int ret;
 	bool mustfree = false;
 
 	if (loader == NULL) {
-		loader = test_loader_new();
+		loader = symbol_loader_new(prefix);
 		mustfree = true;
 	}
 	ret = run_tests(runner, loader, argc, argv);
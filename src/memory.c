@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/* The bytes per row of the hexdump and the rows around the mismatch. */
+#define DUMP_WIDTH 16
+#define DUMP_CONTEXT 2
+
+static __thread char mem_msg[MAXLINE];
+
+static size_t
+mismatch_scalar(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	uint64_t x, y;
+	size_t i = 0;
+
+	for (; i + sizeof(x) <= len; i += sizeof(x)) {
+		memcpy(&x, a + i, sizeof(x));
+		memcpy(&y, b + i, sizeof(y));
+		if (x != y)
+			break;
+	}
+	for (; i < len; i++)
+		if (a[i] != b[i])
+			break;
+	return i;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static size_t
+mismatch_sse2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	__m128i e0, e1;
+	unsigned int mask;
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+				_mm_loadu_si128((const __m128i *) (b + i)));
+		e1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+				_mm_loadu_si128((const __m128i *) (b + i + 16)));
+		if (_mm_movemask_epi8(_mm_and_si128(e0, e1)) == 0xffff)
+			continue;
+		mask = (unsigned int) _mm_movemask_epi8(e0) |
+			(unsigned int) _mm_movemask_epi8(e1) << 16;
+		return i + __builtin_ctz(~mask);
+	}
+	return i + mismatch_scalar(a + i, b + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t
+mismatch_avx2(const unsigned char *a, const unsigned char *b, size_t len)
+{
+	__m256i e0, e1;
+	uint64_t mask;
+	size_t i = 0;
+
+	for (; i + 64 <= len; i += 64) {
+		e0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+				_mm256_loadu_si256((const __m256i *) (b + i)));
+		e1 = _mm256_cmpeq_epi8(
+				_mm256_loadu_si256((const __m256i *) (a + i + 32)),
+				_mm256_loadu_si256((const __m256i *) (b + i + 32)));
+		if ((unsigned int) _mm256_movemask_epi8(_mm256_and_si256(e0, e1)) ==
+				0xffffffff)
+			continue;
+		mask = (uint32_t) _mm256_movemask_epi8(e0) |
+			(uint64_t) (uint32_t) _mm256_movemask_epi8(e1) << 32;
+		return i + __builtin_ctzll(~mask);
+	}
+	return i + mismatch_sse2(a + i, b + i, len - i);
+}
+#endif
+
+static size_t mismatch_resolve(const unsigned char *, const unsigned char *,
+		size_t);
+
+/* Resolved at the first call with the best kernel the CPU supports. */
+static size_t (*mismatch)(const unsigned char *, const unsigned char *,
+		size_t) = mismatch_resolve;
+
+static size_t
+mismatch_resolve(const unsigned char *a, const unsigned char *b, size_t len)
+{
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		mismatch = mismatch_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		mismatch = mismatch_sse2;
+	else
+		mismatch = mismatch_scalar;
+#else
+	mismatch = mismatch_scalar;
+#endif
+	return mismatch(a, b, len);
+}
+
+size_t
+mem_mismatch(const void *first, const void *second, size_t len)
+{
+	assert(first != NULL || len == 0);
+	assert(second != NULL || len == 0);
+	return mismatch((const unsigned char *) first,
+			(const unsigned char *) second, len);
+}
+
+/* Append one row of the hexdump and return the new offset in the buffer. */
+static size_t
+dump_row(char *buf, size_t n, const unsigned char *p, size_t row, size_t len)
+{
+	size_t i;
+
+	n += snprintf(buf + n, sizeof(mem_msg) - n, "\n%08zx ", row);
+	for (i = row; i < row + DUMP_WIDTH && i < len; i++)
+		n += snprintf(buf + n, sizeof(mem_msg) - n, " %02x", p[i]);
+	return n;
+}
+
+const char *
+mem_diff(const char *msg, const void *first, const void *second, size_t len,
+		size_t offset)
+{
+	const unsigned char *a = first, *b = second;
+	size_t i, n, row, start, stop, differ = 0;
+	bool marked;
+
+	assert(offset < len);
+	for (i = offset; i < len; i += mismatch(a + i, b + i, len - i)) {
+		differ++;
+		i++;
+	}
+	/* The message is bounded to leave room for the hexdump. */
+	n = snprintf(mem_msg, sizeof(mem_msg),
+			"%.512s: %zu of %zu bytes differ, the first at offset %zu",
+			msg != NULL ? msg : "the memory differs", differ, len, offset);
+	start = offset - offset % DUMP_WIDTH;
+	start = start > DUMP_CONTEXT * DUMP_WIDTH ?
+		start - DUMP_CONTEXT * DUMP_WIDTH : 0;
+	stop = offset - offset % DUMP_WIDTH + (DUMP_CONTEXT + 1) * DUMP_WIDTH;
+	for (row = start; row < stop && row < len; row += DUMP_WIDTH) {
+		n = dump_row(mem_msg, n, a, row, len);
+		n = dump_row(mem_msg, n, b, row, len);
+		marked = false;
+		for (i = row; i < row + DUMP_WIDTH && i < len; i++)
+			marked = marked || a[i] != b[i];
+		if (!marked)
+			continue;
+		/* Mark the differing bytes under the rows. */
+		n += snprintf(mem_msg + n, sizeof(mem_msg) - n, "\n%8s ", "");
+		for (i = row; i < row + DUMP_WIDTH && i < len; i++)
+			n += snprintf(mem_msg + n, sizeof(mem_msg) - n, " %s",
+					a[i] != b[i] ? "^^" : "  ");
+		while (mem_msg[n - 1] == ' ')
+			mem_msg[--n] = '\0';
+	}
+	return mem_msg;
+}
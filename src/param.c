@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+/*
+ * A test case that runs the same function over the rows of a table. Each row
+ * is run as its own test case, on the stack, with the row as usrptr. run
+ * goes over all the rows, run_row runs one of them: a runner that schedules
+ * the rows itself calls it for each i below len.
+ */
+struct param_case {
+	CASE_HEAD
+	const char *table;
+	size_t stride;
+	unsigned int count;
+};
+
+static void
+param_case_run_row(struct test_case *test, unsigned int i,
+		struct test_suite *suite, struct test_result *result)
+{
+	struct param_case *pc = (struct param_case *) test;
+	struct test_case_impl row;
+	char name[MAXLINE];
+
+	assert(test != NULL);
+	assert(result != NULL);
+	assert(i < pc->count);
+
+	snprintf(name, sizeof(name), "%s[%u]", test->name, i);
+	test_case_init((struct test_case *) &row, name, test->skip, test->todo,
+			test->func);
+	row.usrptr = (void *) (pc->table + i * pc->stride);
+	row.limits = test->limits;
+	row.sandbox = test->sandbox;
+	row.run((struct test_case *) &row, suite, result);
+}
+
+static void
+param_case_run(struct test_case *test, struct test_suite *suite,
+		struct test_result *result)
+{
+	struct param_case *pc = (struct param_case *) test;
+	unsigned int i;
+
+	assert(test != NULL);
+	assert(result != NULL);
+
+	for (i = 0; i < pc->count && !result->shouldstop; i++)
+		param_case_run_row(test, i, suite, result);
+}
+
+static unsigned int
+param_case_len(struct test_case *test)
+{
+	return ((struct param_case *) test)->count;
+}
+
+struct test_case *
+test_case_param_new_impl(const char *name,
+		void (*func)(struct test_case *, struct test_result *, void *),
+		const void *table, size_t stride, unsigned int count)
+{
+	struct param_case *test;
+
+	assert(table != NULL || count == 0);
+	test = (struct param_case *) calloc(1, sizeof(struct param_case));
+	if (test == NULL)
+		err_sys("malloc");
+	test->name = name;
+	test->func = func;
+	test->table = (const char *) table;
+	test->stride = stride;
+	test->count = count;
+	test->run = param_case_run;
+	test->len = param_case_len;
+	test->run_row = param_case_run_row;
+	return (struct test_case *) test;
+}
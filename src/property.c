@@ -0,0 +1,603 @@
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * Property based testing. The inputs of the i-th iteration are generated from
+ * a PRNG seeded with the seed of the run and i, so that any iteration can be
+ * generated again. The iterations are spread across processes, one for each
+ * core. The first failing iteration is then run again in-process, shrunk and
+ * reported.
+ */
+
+#define PROPERTY_MAXSHRINKS 1000
+#define PROPERTY_MAXARGS 16
+#define PROPERTY_MAXWORKERS 64
+
+struct property_config {
+	unsigned int iterations;
+	double budget;
+	uint64_t seed;
+	bool hasseed;
+};
+
+static struct property_config config = {
+	.iterations = 100,
+	.budget = 0.0,
+	.seed = 0,
+	.hasseed = false,
+};
+
+/* The state shared with a worker process. */
+struct property_worker {
+	uint64_t current;
+	uint64_t failed;
+	uint64_t done;
+};
+
+static __thread char property_msg[MAXLINE];
+
+void
+property_configure(unsigned int iterations, double budget, uint64_t seed,
+		bool hasseed)
+{
+	config.iterations = iterations;
+	config.budget = budget;
+	config.seed = seed;
+	config.hasseed = hasseed;
+}
+
+static uint64_t
+splitmix64(uint64_t *x)
+{
+	uint64_t z;
+
+	z = (*x += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static inline uint64_t
+rotl(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+void
+prop_rng_seed(struct prop_rng *rng, uint64_t seed)
+{
+	int i;
+
+	for (i = 0; i < 4; i++)
+		rng->s[i] = splitmix64(&seed);
+}
+
+uint64_t
+prop_rng_next(struct prop_rng *rng)
+{
+	uint64_t *s = rng->s;
+	uint64_t result, t;
+
+	/* xoshiro256** */
+	result = rotl(s[1] * 5, 7) * 9;
+	t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl(s[3], 45);
+	return result;
+}
+
+long long
+prop_rng_range(struct prop_rng *rng, long long min, long long max)
+{
+	uint64_t span;
+
+	assert(min <= max);
+	span = (uint64_t) max - (uint64_t) min + 1;
+	if (span == 0)
+		return (long long) prop_rng_next(rng);
+	return (long long) ((uint64_t) min + prop_rng_next(rng) % span);
+}
+
+/* Built-in generators. */
+
+static long long
+prop_int_get(const struct prop_gen *gen, const void *value)
+{
+	if (gen->size == sizeof(unsigned char))
+		return *(const unsigned char *) value;
+	if (gen->size == sizeof(int))
+		return *(const int *) value;
+	return *(const long long *) value;
+}
+
+static void
+prop_int_set(const struct prop_gen *gen, void *value, long long v)
+{
+	if (gen->size == sizeof(unsigned char))
+		*(unsigned char *) value = (unsigned char) v;
+	else if (gen->size == sizeof(int))
+		*(int *) value = (int) v;
+	else
+		*(long long *) value = v;
+}
+
+static long long
+prop_int_target(const struct prop_gen *gen)
+{
+	if (gen->min > 0)
+		return gen->min;
+	if (gen->max < 0)
+		return gen->max;
+	return 0;
+}
+
+void
+prop_int_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value)
+{
+	long long v;
+
+	/* Favour the boundaries, where the bugs are. */
+	switch (prop_rng_next(rng) % 16) {
+		case 0:
+			v = gen->min;
+			break;
+		case 1:
+			v = gen->max;
+			break;
+		case 2:
+			v = prop_int_target(gen);
+			break;
+		default:
+			v = prop_rng_range(rng, gen->min, gen->max);
+	}
+	prop_int_set(gen, value, v);
+}
+
+bool
+prop_int_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate)
+{
+	long long v, t, d;
+
+	v = prop_int_get(gen, value);
+	t = prop_int_target(gen);
+	d = v / 2 - t / 2 + (v % 2 - t % 2) / 2;  /* (v - t) / 2, no overflow */
+	if (v == t || k >= 64)
+		return false;
+	if (k == 0) {
+		prop_int_set(gen, candidate, t);
+		return true;
+	}
+	d = d >> (k - 1);
+	if (d == 0)
+		return false;
+	prop_int_set(gen, candidate, v - d);
+	return true;
+}
+
+int
+prop_int_print(const struct prop_gen *gen, const void *value, char *buf,
+		size_t len)
+{
+	return snprintf(buf, len, "%lld", prop_int_get(gen, value));
+}
+
+void
+prop_double_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value)
+{
+	double u;
+
+	u = (prop_rng_next(rng) >> 11) * 0x1.0p-53;
+	*(double *) value = gen->dmin + u * (gen->dmax - gen->dmin);
+}
+
+bool
+prop_double_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate)
+{
+	double v = *(const double *) value, t;
+
+	t = gen->dmin > 0.0 ? gen->dmin : gen->dmax < 0.0 ? gen->dmax : 0.0;
+	if (v == t || k >= 32)
+		return false;
+	if (k == 0)
+		*(double *) candidate = t;
+	else if (k == 1)
+		*(double *) candidate = trunc(v) >= gen->dmin &&
+			trunc(v) <= gen->dmax ? trunc(v) : v;
+	else
+		*(double *) candidate = v - (v - t) / ldexp(1.0, k - 1);
+	return true;
+}
+
+int
+prop_double_print(const struct prop_gen *gen, const void *value, char *buf,
+		size_t len)
+{
+	return snprintf(buf, len, "%.17g", *(const double *) value);
+}
+
+void
+prop_array_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value)
+{
+	struct prop_array *array = (struct prop_array *) value;
+	size_t i;
+
+	array->len = prop_rng_range(rng, 0, gen->maxlen);
+	memset(array->data, 0, gen->maxlen * gen->elem->size);
+	for (i = 0; i < array->len; i++)
+		gen->elem->generate(gen->elem, rng,
+				array->data + i * gen->elem->size);
+}
+
+/*
+ * The candidates are, in order: the first half of the array, the array
+ * without the element i, the array with the element i shrunk.
+ */
+bool
+prop_array_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate)
+{
+	const struct prop_array *array = (const struct prop_array *) value;
+	struct prop_array *cand = (struct prop_array *) candidate;
+	size_t esize = gen->elem->size, i;
+
+	memcpy(cand, array, gen->size);
+	if (array->len == 0)
+		return false;
+	if (k == 0) {
+		cand->len = array->len / 2;
+		memset(cand->data + cand->len * esize, 0,
+				(gen->maxlen - cand->len) * esize);
+		return true;
+	}
+	k--;
+	if (k < array->len) {
+		memmove(cand->data + k * esize, array->data + (k + 1) * esize,
+				(array->len - k - 1) * esize);
+		cand->len--;
+		memset(cand->data + cand->len * esize, 0, esize);
+		return true;
+	}
+	k -= array->len;
+	i = k / PROP_ARRAY_SHRINKS;
+	if (i >= array->len)
+		return false;
+	/* An unchanged candidate is skipped by the caller. */
+	gen->elem->shrink(gen->elem, array->data + i * esize,
+			k % PROP_ARRAY_SHRINKS, cand->data + i * esize);
+	return true;
+}
+
+int
+prop_array_print(const struct prop_gen *gen, const void *value, char *buf,
+		size_t len)
+{
+	const struct prop_array *array = (const struct prop_array *) value;
+	size_t i, c;
+
+	c = snprintf(buf, len, "[");
+	for (i = 0; i < array->len && c < len; i++) {
+		if (i > 0)
+			c += snprintf(buf + c, len - c, ", ");
+		if (c < len)
+			c += gen->elem->print(gen->elem,
+					array->data + i * gen->elem->size, buf + c, len - c);
+	}
+	if (c < len)
+		c += snprintf(buf + c, len - c, "]");
+	return c;
+}
+
+/* The engine. */
+
+struct property {
+	struct test_case *test;
+	struct test_result *result;
+	const struct prop_gen *const *gens;
+	unsigned int ngens;
+	void (*body)(struct test_case *, struct test_result *, void *const *);
+	/* The arguments of the current iteration. */
+	void *args[PROPERTY_MAXARGS];
+	/* The message and the location of the last failure. */
+	char msg[MAXLINE / 4];
+	const char *condition;
+	const char *filename;
+	unsigned int lineno;
+};
+
+static double
+property_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+property_generate(struct property *prop, uint64_t seed, uint64_t i)
+{
+	struct prop_rng rng;
+	unsigned int c;
+
+	prop_rng_seed(&rng, seed ^ (i * 0xd1b54a32d192ed03ULL));
+	for (c = 0; c < prop->ngens; c++)
+		prop->gens[c]->generate(prop->gens[c], &rng, prop->args[c]);
+}
+
+/*
+ * Run the body with the current arguments. The assertions of the body jump
+ * back here instead of terminating the test.
+ */
+static bool
+property_try(struct property *prop)
+{
+	struct test_case_impl *impl = (struct test_case_impl *) prop->test;
+	struct test_case *test = prop->test;
+	jmp_buf *saved, jmpbuffer;
+	unsigned int nfailures = test->nfailures, overflow = test->overflow;
+	bool pass;
+
+	saved = impl->jmpbuffer;
+	impl->jmpbuffer = &jmpbuffer;
+	if (setjmp(jmpbuffer) == 0) {
+		prop->body(test, prop->result, prop->args);
+		pass = test->nfailures == nfailures && test->overflow == overflow;
+		/* A failed EXPECT_ fails the iteration like an ASSERT_. */
+		if (test->nfailures > nfailures) {
+			test->msg = test->failures[nfailures].msg;
+			test->condition = test->failures[nfailures].condition;
+			test->filename = test->failures[nfailures].filename;
+			test->lineno = test->failures[nfailures].lineno;
+		}
+	} else
+		pass = false;
+	if (!pass) {
+		snprintf(prop->msg, sizeof(prop->msg), "%s",
+				test->msg != NULL ? test->msg : "");
+		prop->condition = test->condition;
+		prop->filename = test->filename;
+		prop->lineno = test->lineno;
+	}
+	test->nfailures = nfailures;
+	test->overflow = overflow;
+	impl->jmpbuffer = saved;
+	return pass;
+}
+
+static void
+property_run_worker(struct property *prop, struct property_worker *w,
+		uint64_t seed, unsigned int first, unsigned int step, double deadline)
+{
+	uint64_t i;
+
+	for (i = first; i < config.iterations; i += step) {
+		if (deadline > 0.0 && property_now() > deadline)
+			break;
+		w->current = i;
+		property_generate(prop, seed, i);
+		if (!property_try(prop)) {
+			w->failed = i;
+			break;
+		}
+		w->done++;
+	}
+}
+
+static void
+memswap(void *a, void *b, size_t len)
+{
+	unsigned char *pa = (unsigned char *) a, *pb = (unsigned char *) b, t;
+
+	while (len-- > 0) {
+		t = *pa;
+		*pa++ = *pb;
+		*pb++ = t;
+	}
+}
+
+static unsigned int
+property_shrink(struct property *prop, char *scratch)
+{
+	const struct prop_gen *gen;
+	unsigned int c, k, shrinks = 0, steps = 0;
+	bool progress = true;
+
+	while (progress && steps < PROPERTY_MAXSHRINKS) {
+		progress = false;
+		for (c = 0; c < prop->ngens && steps < PROPERTY_MAXSHRINKS; c++) {
+			gen = prop->gens[c];
+			if (gen->shrink == NULL)
+				continue;
+			k = 0;
+			while (steps < PROPERTY_MAXSHRINKS &&
+					gen->shrink(gen, prop->args[c], k, scratch)) {
+				if (!memcmp(scratch, prop->args[c], gen->size)) {
+					k++;
+					continue;
+				}
+				steps++;
+				/* Swap the candidate in and try it. */
+				memswap(scratch, prop->args[c], gen->size);
+				if (property_try(prop)) {
+					memswap(scratch, prop->args[c], gen->size);
+					k++;
+					continue;
+				}
+				/* Restart from the simplest candidate of the new value. */
+				shrinks++;
+				progress = true;
+				k = 0;
+			}
+		}
+	}
+	return shrinks;
+}
+
+static size_t
+property_print_args(struct property *prop, char *buf, size_t len)
+{
+	unsigned int c;
+	size_t n = 0;
+
+	for (c = 0; c < prop->ngens && n < len; c++) {
+		n += snprintf(buf + n, len - n, c == 0 ? "(" : ", ");
+		if (n < len && prop->gens[c]->print != NULL)
+			n += prop->gens[c]->print(prop->gens[c], prop->args[c], buf + n,
+					len - n);
+	}
+	if (n < len)
+		n += snprintf(buf + n, len - n, ")");
+	return n;
+}
+
+static unsigned int
+property_workers(void)
+{
+	long cpus;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	if (cpus > PROPERTY_MAXWORKERS)
+		cpus = PROPERTY_MAXWORKERS;
+	/* Not worth a process for less than a few iterations. */
+	if (cpus > config.iterations / 8)
+		cpus = config.iterations / 8;
+	if (cpus < 1)
+		cpus = 1;
+	return cpus;
+}
+
+void
+property_check(struct test_case *test, struct test_result *result,
+		const struct prop_gen *const *gens, unsigned int ngens,
+		void (*body)(struct test_case *, struct test_result *, void *const *))
+{
+	struct property prop;
+	struct property_worker *workers;
+	uint64_t seed, failed = UINT64_MAX, done = 0;
+	unsigned int nworkers, c, shrinks = 0;
+	double deadline = 0.0;
+	size_t size = 0, n;
+	char *values, args[MAXLINE / 4];
+	int status, signo = 0, signals[PROPERTY_MAXWORKERS];
+	pid_t pid, pids[PROPERTY_MAXWORKERS];
+
+	assert(ngens > 0 && ngens <= PROPERTY_MAXARGS);
+	memset(&prop, 0, sizeof(prop));
+	prop.test = test;
+	prop.result = result;
+	prop.gens = gens;
+	prop.ngens = ngens;
+	prop.body = body;
+	for (c = 0; c < ngens; c++)
+		size += (gens[c]->size + 15) & ~15;
+	/* The arguments, followed by the scratch space to shrink them. */
+	if ((values = calloc(2, size)) == NULL)
+		err_sys("malloc");
+	for (c = 0, n = 0; c < ngens; n += (gens[c++]->size + 15) & ~15)
+		prop.args[c] = values + n;
+	if (config.hasseed)
+		seed = config.seed;
+	else {
+		seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+		seed = splitmix64(&seed);
+	}
+	if (config.budget > 0.0)
+		deadline = property_now() + config.budget;
+
+	nworkers = property_workers();
+	workers = mmap(NULL, nworkers * sizeof(struct property_worker),
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (workers == MAP_FAILED)
+		err_sys("mmap");
+	for (c = 0; c < nworkers; c++) {
+		workers[c].current = UINT64_MAX;
+		workers[c].failed = UINT64_MAX;
+		workers[c].done = 0;
+	}
+	if (nworkers == 1) {
+		property_run_worker(&prop, &workers[0], seed, 0, 1, deadline);
+	} else {
+		fflush(NULL);
+		for (c = 0; c < nworkers; c++) {
+			if ((pids[c] = fork()) == -1)
+				err_sys("fork");
+			if (pids[c] == 0) {
+				property_run_worker(&prop, &workers[c], seed, c, nworkers,
+						deadline);
+				_exit(0);
+			}
+		}
+		for (c = 0; c < nworkers; c++) {
+			while ((pid = waitpid(pids[c], &status, 0)) == -1 && errno == EINTR)
+				;
+			signals[c] = 0;
+			/* A worker that crashed failed on its current iteration. */
+			if (pid != -1 && WIFSIGNALED(status) &&
+					workers[c].current < workers[c].failed) {
+				workers[c].failed = workers[c].current;
+				signals[c] = WTERMSIG(status);
+			}
+		}
+	}
+	for (c = 0; c < nworkers; c++) {
+		done += workers[c].done;
+		/* The signal only matters if it ended the first failure. */
+		if (workers[c].failed < failed) {
+			failed = workers[c].failed;
+			signo = nworkers > 1 ? signals[c] : 0;
+		}
+	}
+	munmap(workers, nworkers * sizeof(struct property_worker));
+
+	if (failed == UINT64_MAX) {
+		free(values);
+		snprintf(property_msg, sizeof(property_msg),
+				"%llu cases passed (seed 0x%016llx)",
+				(unsigned long long) done, (unsigned long long) seed);
+		test->assert_impl(test, result, true, "PROPERTY", property_msg,
+				test->filename, test->lineno);
+		return;
+	}
+	property_generate(&prop, seed, failed);
+	if (signo != 0)
+		/* Don't run it again, it would crash this process too. */
+		snprintf(prop.msg, sizeof(prop.msg),
+				"the property was terminated by signal %d", signo);
+	else if (property_try(&prop))
+		snprintf(prop.msg, sizeof(prop.msg),
+				"the property failed in a worker but passed when run again");
+	else
+		shrinks = property_shrink(&prop, values + size);
+	property_print_args(&prop, args, sizeof(args));
+	snprintf(property_msg, sizeof(property_msg),
+			"%s; falsified after %llu cases by %s, shrunk %u times "
+			"(seed 0x%016llx, iteration %llu)", prop.msg,
+			(unsigned long long) done, args, shrinks,
+			(unsigned long long) seed, (unsigned long long) failed);
+	free(values);
+	test->assert_impl(test, result, false,
+			prop.condition != NULL ? prop.condition : "PROPERTY",
+			property_msg, prop.filename, prop.lineno);
+}
@@ -0,0 +1,151 @@
+#include <dlfcn.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+/*
+ * A suite that runs the tests described by an array of test_desc, usually
+ * the TEST_SECTION of a program. The test cases live on the stack while they
+ * run, hence loading the tests does not allocate memory for each test.
+ */
+struct desc_suite {
+	SUITE_HEAD
+	const struct test_desc *start;
+	const struct test_desc *stop;
+	/* The handle of the library where the descriptors are, or NULL. */
+	void *handle;
+	/* If the suite owns the array of descriptors. */
+	bool owned;
+};
+
+static void
+desc_suite_bind(struct test_suite *suite, const struct test_suite_desc *sdesc)
+{
+	if (sdesc == NULL) {
+		suite->name = NULL;
+		suite->doc = NULL;
+		suite->setup = NULL;
+		suite->teardown = NULL;
+		return;
+	}
+	suite->name = (char *) sdesc->name;
+	suite->doc = (char *) sdesc->doc;
+	suite->setup = sdesc->setup;
+	suite->teardown = sdesc->teardown;
+}
+
+/*
+ * Map the file of the suite `sdesc` and release the mapping `held` of the
+ * previous one, in this order: consecutive suites of the same file share
+ * the mapping.
+ */
+static const struct test_fixture *
+desc_suite_map(const struct test_suite_desc *sdesc,
+		const struct test_fixture *held)
+{
+	const struct test_fixture *fixture = NULL;
+
+	if (sdesc != NULL && sdesc->mapping != NULL)
+		fixture = fixture_map(sdesc->mapping, sdesc->mapflags);
+	if (held != NULL)
+		fixture_unmap(held);
+	return fixture;
+}
+
+static void
+desc_suite_run(struct test_suite *suite, struct test_result *result)
+{
+	struct desc_suite *ds = (struct desc_suite *) suite;
+	const struct test_suite_desc *current = NULL;
+	const struct test_fixture *fixture = NULL;
+	const struct test_desc *desc;
+	struct test_case_impl test;
+
+	assert(suite != NULL);
+	assert(result != NULL);
+
+	for (desc = ds->start; desc < ds->stop; desc++) {
+		if (result->shouldstop)
+			break;
+		if (desc->suite != NULL && desc->suite->skip != NULL)
+			continue;
+		if (desc->suite != current || desc == ds->start) {
+			current = desc->suite;
+			desc_suite_bind(suite, current);
+			fixture = desc_suite_map(current, fixture);
+			suite->usrptr = (void *) fixture;
+		}
+		test_case_init((struct test_case *) &test, desc->name, desc->skip,
+				desc->todo, desc->func);
+		test.limits = desc->limits;
+		test.sandbox = desc->sandbox;
+		if (desc->suite != NULL)
+			test.sandbox |= desc->suite->sandbox;
+		test.run((struct test_case *) &test, suite, result);
+	}
+	if (fixture != NULL)
+		fixture_unmap(fixture);
+	suite->usrptr = NULL;
+}
+
+static unsigned int
+desc_suite_len(struct test_suite *suite)
+{
+	struct desc_suite *ds = (struct desc_suite *) suite;
+	const struct test_desc *desc;
+	unsigned int c;
+
+	c = 0;
+	for (desc = ds->start; desc < ds->stop; desc++)
+		if (desc->suite == NULL || desc->suite->skip == NULL)
+			c++;
+	return c;
+}
+
+static void
+desc_suite_add_test(struct test_suite *suite, struct test_case *test)
+{
+	abort();  /* programming error: the tests are fixed at compile time */
+}
+
+static void
+desc_suite_add_suite(struct test_suite *suite, struct test_suite *suitec)
+{
+	abort();  /* programming error: the tests are fixed at compile time */
+}
+
+static void
+desc_suite_free(struct test_suite *suite)
+{
+	struct desc_suite *ds = (struct desc_suite *) suite;
+
+	if (ds->owned)
+		free((void *) ds->start);
+	if (ds->handle != NULL)
+		dlclose(ds->handle);
+	free(suite);
+}
+
+struct test_suite *
+desc_suite_new(const struct test_desc *start, const struct test_desc *stop,
+		void *handle, bool owned)
+{
+	struct desc_suite *suite;
+
+	assert(start <= stop);
+	suite = (struct desc_suite *) calloc(1, sizeof(struct desc_suite));
+	if (suite == NULL)
+		err_sys("malloc");
+	suite->start = start;
+	suite->stop = stop;
+	suite->handle = handle;
+	suite->owned = owned;
+	suite->free = desc_suite_free;
+	suite->add_test = desc_suite_add_test;
+	suite->add_suite = desc_suite_add_suite;
+	suite->run = desc_suite_run;
+	suite->len = desc_suite_len;
+	return (struct test_suite *) suite;
+}
@@ -1,21 +1,102 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
 #include <assert.h>
 #include "unittest.h"
 #include "unittest_priv.h"
 
+/* The test line shows only the first line of a message, the diagnostic the
+ * rest. */
+#define LINELEN(msg) ((int) strcspn(msg, "\n"))
 
+
+/*
+ * A tap_result prints each test as it is added and keeps only counts, hence
+ * its memory is constant however many tests it reports, e.g. a replayed log.
+ */
 struct tap_result {
 	RESULT_HEAD
-	struct list *failures;
-	struct list *xfailures;
-	struct list *successes;
-	struct list *xsuccesses;
-	struct list *skipped;
-	struct list *errors;
+	unsigned long failures;
+	unsigned long xfailures;
+	unsigned long successes;
+	unsigned long xsuccesses;
+	unsigned long skipped;
+	unsigned long errors;
 };
 
+/*
+ * Print a single quoted YAML scalar or a literal block if it spans lines.
+ * `prefix` is printed before the key and sets the indentation.
+ */
+static void
+yaml_string(FILE *stream, const char *prefix, const char *key,
+		const char *value)
+{
+	int indent = strlen(prefix) + 2;
+
+	if (strchr(value, '\n') != NULL) {
+		fprintf(stream, "%s%s: |-\n%*s", prefix, key, indent, "");
+		for (; *value != '\0'; value++)
+			if (*value == '\n')
+				fprintf(stream, "\n%*s", indent, "");
+			else
+				fputc(*value, stream);
+		fputc('\n', stream);
+		return;
+	}
+	fprintf(stream, "%s%s: '", prefix, key);
+	for (; *value != '\0'; value++)
+		if (*value == '\'')
+			fputs("''", stream);
+		else
+			fputc(*value, stream);
+	fputs("'\n", stream);
+}
+
+/* Print a failed EXPECT_ assertion as an item of the failures list. */
+static void
+yaml_failure(FILE *stream, const struct test_failure *failure)
+{
+	const char *prefix = "    - ";
+
+	if (failure->msg != NULL) {
+		yaml_string(stream, prefix, "message", failure->msg);
+		prefix = "      ";
+	}
+	yaml_string(stream, prefix, "condition", failure->condition);
+	yaml_string(stream, "      ", "file", failure->filename);
+	fprintf(stream, "      line: %u\n", failure->lineno);
+}
+
+/* Print the YAML diagnostic block that follows the test line. */
+static void
+tap_result_diagnostic(struct test_result *result, struct test_case *test)
+{
+	unsigned int i;
+
+	fputs("  ---\n", result->stream);
+	if (test->msg != NULL)
+		yaml_string(result->stream, "  ", "message", test->msg);
+	if (test->condition != NULL)
+		yaml_string(result->stream, "  ", "condition", test->condition);
+	if (test->filename != NULL) {
+		yaml_string(result->stream, "  ", "file", test->filename);
+		fprintf(result->stream, "  line: %u\n", test->lineno);
+	}
+	fprintf(result->stream, "  assertions: %lu\n", test->assertions);
+	if (test->nfailures > 0) {
+		fputs("  failures:\n", result->stream);
+		for (i = 0; i < test->nfailures; i++)
+			yaml_failure(result->stream, &test->failures[i]);
+	}
+	if (test->overflow > 0)
+		fprintf(result->stream, "  unrecorded: %u\n", test->overflow);
+	if (test->diag != NULL)
+		fputs(test->diag, result->stream);
+	fputs("  ...\n", result->stream);
+}
+
 static void
 tap_result_start_run(struct test_result *result)
 { }
@@ -27,11 +108,9 @@ tap_result_stop_run(struct test_result *result)
 static void
 tap_result_add_skip(struct test_result *result, struct test_case *test)
 {
-	struct list **skipped = &((struct tap_result *) result)->skipped;
-
 	assert(test->name != NULL);
 	assert(test->skip != NULL);
-	*skipped = list_append(*skipped, test);
+	((struct tap_result *) result)->skipped++;
 	if (result->stream != NULL)
 		fprintf(result->stream, "ok %s # SKIP %s\n", test->name, test->skip);
 }
@@ -39,26 +118,25 @@ tap_result_add_skip(struct test_result *result, struct test_case *test)
 static void
 tap_result_add_success(struct test_result *result, struct test_case *test)
 {
-	struct list **successes = &((struct tap_result *) result)->successes;
-
 	assert(test->name != NULL);
-	*successes = list_append(*successes, test);
+	((struct tap_result *) result)->successes++;
 	if (result->stream != NULL) {
 		if (test->msg != NULL)
-			fprintf(result->stream, "ok %s # %s\n", test->name, test->msg);
+			fprintf(result->stream, "ok %s # %.*s\n", test->name,
+					LINELEN(test->msg), test->msg);
 		else
 			fprintf(result->stream, "ok %s\n", test->name);
+		if (result->record || test->diag != NULL)
+			tap_result_diagnostic(result, test);
 	}
 }
 
 static void
 tap_result_add_xsuccess(struct test_result *result, struct test_case *test)
 {
-	struct list **xsuccesses = &((struct tap_result *) result)->xsuccesses;
-
 	assert(test->name != NULL);
 	assert(test->todo != NULL);
-	*xsuccesses = list_append(*xsuccesses, test);
+	((struct tap_result *) result)->xsuccesses++;
 	if (result->stream != NULL)
 		fprintf(result->stream, "ok %s # TODO %s\n", test->name, test->todo);
 	if (result->failfast)
@@ -68,15 +146,15 @@ tap_result_add_xsuccess(struct test_result *result, struct test_case *test)
 static void
 tap_result_add_failure(struct test_result *result, struct test_case *test)
 {
-	struct list **failures = &((struct tap_result *) result)->failures;
-
 	assert(test->name != NULL);
-	*failures = list_append(*failures, test);
+	((struct tap_result *) result)->failures++;
 	if (result->stream != NULL) {
 		if (test->msg != NULL)
-			fprintf(result->stream, "not ok %s # %s\n", test->name, test->msg);
+			fprintf(result->stream, "not ok %s # %.*s\n", test->name,
+					LINELEN(test->msg), test->msg);
 		else
 			fprintf(result->stream, "not ok %s\n", test->name);
+		tap_result_diagnostic(result, test);
 	}
 	if (result->failfast)
 		result->shouldstop = true;
@@ -85,11 +163,9 @@ tap_result_add_failure(struct test_result *result, struct test_case *test)
 static void
 tap_result_add_xfailure(struct test_result *result, struct test_case *test)
 {
-	struct list **xfailures = &((struct tap_result *) result)->xfailures;
-
 	assert(test->name != NULL);
 	assert(test->todo != NULL);
-	*xfailures = list_append(*xfailures, test);
+	((struct tap_result *) result)->xfailures++;
 	if (result->stream != NULL)
 		fprintf(result->stream, "not ok %s # TODO %s\n", test->name,
 			test->todo);
@@ -98,14 +174,14 @@ tap_result_add_xfailure(struct test_result *result, struct test_case *test)
 static void
 tap_result_add_error(struct test_result *result, struct test_case *test)
 {
-	struct list **errors = &((struct tap_result *) result)->errors;
-
 	assert(test->name != NULL);
 	assert(test->msg != NULL);
-	*errors = list_append(*errors, test);
-	if (result->stream != NULL)
-		fprintf(result->stream, "not ok %s # ERROR %s\n", test->name,
-			test->msg);
+	((struct tap_result *) result)->errors++;
+	if (result->stream != NULL) {
+		fprintf(result->stream, "not ok %s # ERROR %.*s\n", test->name,
+			LINELEN(test->msg), test->msg);
+		tap_result_diagnostic(result, test);
+	}
 }
 
 static int
@@ -113,9 +189,9 @@ tap_result_was_successful(struct test_result *_result)
 {
 	struct tap_result *result = (struct tap_result *) _result;
 
-	if (result->failures != NULL)
+	if (result->failures > 0 || result->errors > 0)
 		return 1;
-	if (result->successes == NULL && result->skipped)
+	if (result->successes == 0 && result->skipped > 0)
 		return 77;
 	return 0;
 }
@@ -123,14 +199,7 @@ tap_result_was_successful(struct test_result *_result)
 static void
 tap_result_free(struct test_result *result)
 {
-	struct tap_result *tapresult = (struct tap_result *) result;
-
 	assert(result != NULL);
-	list_free(tapresult->failures, NULL);
-	list_free(tapresult->xfailures, NULL);
-	list_free(tapresult->successes, NULL);
-	list_free(tapresult->xsuccesses, NULL);
-	list_free(tapresult->skipped, NULL);
 	free(result);
 }
 
@@ -144,18 +213,22 @@ tap_result_new(bool failfast, FILE *stream)
 	if (result == NULL)
 		err_sys("malloc");
 	tapresult = (struct tap_result *) result;
-	tapresult->failures = NULL;
-	tapresult->xfailures = NULL;
-	tapresult->successes = NULL;
-	tapresult->xsuccesses = NULL;
-	tapresult->skipped = NULL;
-	tapresult->errors = NULL;
+	tapresult->failures = 0;
+	tapresult->xfailures = 0;
+	tapresult->successes = 0;
+	tapresult->xsuccesses = 0;
+	tapresult->skipped = 0;
+	tapresult->errors = 0;
 	result->shouldstop = false;
 	result->failfast = failfast;
+	result->testsrun = 0;
+	result->record = false;
 	result->stream = stream;
 	result->free = tap_result_free;
 	result->start_run = tap_result_start_run;
 	result->stop_run = tap_result_stop_run;
+	result->start_test = NULL;
+	result->stop_test = NULL;
 	result->add_skip = tap_result_add_skip;
 	result->add_success = tap_result_add_success;
 	result->add_xsuccess = tap_result_add_xsuccess;
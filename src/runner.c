@@ -14,6 +14,8 @@ struct tap_runner {
 static struct test_result *
 test_runner_run(struct test_runner *runner, struct test_suite *suite)
 {
+	unsigned int len;
+
 	assert(runner != NULL);
 	assert(runner->result != NULL);
 	assert(suite != NULL);
@@ -23,13 +25,18 @@ test_runner_run(struct test_runner *runner, struct test_suite *suite)
 		if (runner->result->stream != NULL)
 			fprintf(runner->result->stream, "1..0 # SKIP %s\n", suite->skip);
 	} else {
-		if (runner->result->stream != NULL)
-			fprintf(runner->result->stream, "1..%d\n", suite->len(suite));
+		len = suite->len(suite);
+		if (runner->result->stream != NULL && len != SUITE_LEN_UNKNOWN)
+			fprintf(runner->result->stream, "1..%u\n", len);
 		if (runner->result->start_run != NULL)
 			runner->result->start_run(runner->result);
 		suite->run(suite, runner->result);
 		if (runner->result->stop_run != NULL)
 			runner->result->stop_run(runner->result);
+		/* The plan could be at the end of the stream. */
+		if (runner->result->stream != NULL && len == SUITE_LEN_UNKNOWN)
+			fprintf(runner->result->stream, "1..%u\n",
+					runner->result->testsrun);
 	}
 	return runner->result;
 }
@@ -50,6 +57,7 @@ tap_runner_new(int verbosity, bool failfast, bool buffer, FILE *stream)
 	if (runner == NULL)
 		err_sys("malloc");
 	runner->result = tap_result_new(failfast, stream);
+	runner->result->record = verbosity > 0;
 	runner->run = test_runner_run;
 	runner->free = test_runner_free;
 	return runner;
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <net/if.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/socket.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The sandbox of a test: the child of the isolated mode enters new
+ * namespaces before it runs the test. The user namespace comes first, in it
+ * the child has the capabilities to create the others, to mount and to bring
+ * up its loopback, without any privilege on the host. Where the namespaces
+ * cannot be created, e.g. disabled or filtered by seccomp, the child takes a
+ * lock shared by all the programs on the host instead, and the sandboxed
+ * tests run one at a time. Once they are created, a failure to set them up
+ * is an error of the test.
+ */
+
+#define SANDBOX_LOCK "unittest-sandbox.lock"
+
+/* Whether the process has its own mount namespace. */
+static bool sandbox_mntns;
+
+static bool
+sandbox_write(const char *path, const char *fmt, ...)
+{
+	char buf[64];
+	va_list ap;
+	int fd, len;
+	bool ok;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if ((fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+		return false;
+	ok = write(fd, buf, len) == len;
+	close(fd);
+	return ok;
+}
+
+static bool
+sandbox_loopback(void)
+{
+	struct ifreq ifr;
+	bool ok;
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0)) == -1)
+		return false;
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, "lo", IFNAMSIZ - 1);
+	ok = ioctl(fd, SIOCGIFFLAGS, &ifr) == 0;
+	ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+	ok = ok && ioctl(fd, SIOCSIFFLAGS, &ifr) == 0;
+	close(fd);
+	return ok;
+}
+
+/* Set up the namespaces `clone`, return NULL or the step that failed. */
+static const char *
+sandbox_setup(unsigned int flags, int clone, uid_t uid, gid_t gid)
+{
+	/* The user keeps its ids in the namespace. */
+	if (!sandbox_write("/proc/self/setgroups", "deny"))
+		return "write /proc/self/setgroups";
+	if (!sandbox_write("/proc/self/uid_map", "%u %u 1", uid, uid))
+		return "write /proc/self/uid_map";
+	if (!sandbox_write("/proc/self/gid_map", "%u %u 1", gid, gid))
+		return "write /proc/self/gid_map";
+	/* The mounts of the test must not propagate to the host. */
+	if ((clone & CLONE_NEWNS) &&
+			mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+		return "make the mounts private";
+	sandbox_mntns = (clone & CLONE_NEWNS) != 0;
+	if ((flags & SANDBOX_TMP) &&
+			mount("tmpfs", "/tmp", "tmpfs", 0, "mode=1777") == -1)
+		return "mount /tmp";
+	if ((flags & SANDBOX_NET) && !sandbox_loopback())
+		return "bring up the loopback";
+	return NULL;
+}
+
+/* Wait for the other sandboxed tests, the lock is released at exit. */
+static void
+sandbox_lock(void)
+{
+	const char *dir = getenv("TMPDIR");
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir != NULL ? dir : "/tmp",
+			SANDBOX_LOCK);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666)) == -1)
+		err_sys("open %s", path);
+	while (flock(fd, LOCK_EX) == -1)
+		if (errno != EINTR)
+			err_sys("flock %s", path);
+}
+
+/*
+ * Enter the namespaces `flags`, a combination of test_sandbox values, or
+ * wait for the other sandboxed tests if they cannot be created. Return 1 if
+ * the process runs in the namespaces, 0 if it waited, or -1 if it created
+ * them but could not set them up, with the step that failed in `err`. It
+ * must be single threaded.
+ */
+int
+sandbox_enter(unsigned int flags, char *err, size_t size)
+{
+	uid_t uid = geteuid();
+	gid_t gid = getegid();
+	int clone = CLONE_NEWUSER;
+	const char *step;
+
+	assert(flags != 0);
+	if (flags & SANDBOX_NET)
+		clone |= CLONE_NEWNET;
+	if (flags & (SANDBOX_MOUNT | SANDBOX_TMP))
+		clone |= CLONE_NEWNS;
+	if (unshare(clone) == -1) {
+		sandbox_lock();
+		return 0;
+	}
+	if ((step = sandbox_setup(flags, clone, uid, gid)) != NULL) {
+		snprintf(err, size, "the sandbox failed to %s: %s", step,
+				strerror(errno));
+		return -1;
+	}
+	return 1;
+}
+
+/* Return true if the mounts of the process are its own. */
+bool
+sandbox_mounts(void)
+{
+	return sandbox_mntns;
+}
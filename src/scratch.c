@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <linux/magic.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The scratch directories of the tests. They live on a tmpfs, where a file
+ * costs no disk I/O to create or to remove, and are named after the process
+ * that created them: unittest-PID-N. The runner of the isolated mode
+ * removes the directories of a child that did not end normally. A test
+ * that runs in its own mount namespace gets a tmpfs of its own, that one
+ * unmount removes whatever it holds.
+ */
+
+#define SCRATCH_PREFIX "unittest-"
+/* The most of directories open at once by nftw. */
+#define SCRATCH_MAXFD 8
+
+static struct {
+	/* Keep the directory of a failed test. */
+	bool keep;
+	/* The number of directories created by this process. */
+	unsigned int count;
+} config = {false, 0};
+
+void
+scratch_configure(bool keep)
+{
+	config.keep = keep;
+}
+
+static bool
+scratch_tmpfs(const char *dir)
+{
+	struct statfs st;
+
+	return dir != NULL && statfs(dir, &st) == 0 &&
+		st.f_type == TMPFS_MAGIC && access(dir, W_OK | X_OK) == 0;
+}
+
+/* The directory of the scratch directories, the same in every process. */
+static const char *
+scratch_base(void)
+{
+	const char *tmpdir = getenv("TMPDIR");
+
+	if (scratch_tmpfs(tmpdir))
+		return tmpdir;
+	if (scratch_tmpfs("/dev/shm"))
+		return "/dev/shm";
+	return tmpdir != NULL ? tmpdir : "/tmp";
+}
+
+char *
+scratch_new(void)
+{
+	char path[PATH_MAX];
+	char *dir;
+
+	for (;;) {
+		snprintf(path, sizeof(path), "%s/" SCRATCH_PREFIX "%ld-%u",
+				scratch_base(), (long) getpid(), config.count++);
+		if (mkdir(path, 0700) == 0)
+			break;
+		/* A directory left by a process of the same pid. */
+		if (errno != EEXIST)
+			err_sys("mkdir %s", path);
+	}
+	/* A tmpfs in a private namespace would hide the kept files. */
+	if (sandbox_mounts() && !config.keep)
+		mount("tmpfs", path, "tmpfs", 0, "mode=0700");
+	if ((dir = strdup(path)) == NULL)
+		err_sys("malloc");
+	return dir;
+}
+
+static int
+scratch_unlink(const char *path, const struct stat *st, int flag,
+		struct FTW *ftw)
+{
+	if (flag == FTW_DP)
+		rmdir(path);
+	else
+		unlink(path);
+	return 0;
+}
+
+static void
+scratch_remove(const char *path)
+{
+	if (sandbox_mounts())
+		umount2(path, MNT_DETACH);
+	nftw(path, scratch_unlink, SCRATCH_MAXFD, FTW_DEPTH | FTW_PHYS);
+}
+
+/*
+ * Remove the scratch directory `path` of `test` when it ends, or keep it if
+ * the test failed and the user asked for it.
+ */
+void
+scratch_end(const char *path, const struct test_case *test, bool failed)
+{
+	assert(path != NULL);
+	if (failed && config.keep)
+		fprintf(stderr, "%s: the scratch directory is kept in %s\n",
+				test->name, path);
+	else
+		scratch_remove(path);
+}
+
+/* Remove the scratch directories of the child `pid` after a crash. */
+void
+scratch_reap(pid_t pid, const struct test_case *test)
+{
+	char prefix[32], path[PATH_MAX];
+	const char *base = scratch_base();
+	struct dirent *entry;
+	size_t len;
+	DIR *dir;
+
+	len = snprintf(prefix, sizeof(prefix), SCRATCH_PREFIX "%ld-", (long) pid);
+	if ((dir = opendir(base)) == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, prefix, len) != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", base, entry->d_name);
+		scratch_end(path, test, true);
+	}
+	closedir(dir);
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/* Above this sample size the U test uses the normal approximation. */
+#define STATS_EXACT_MAX 50
+
+static int
+stats_cmp(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+double
+stats_mean(const double *x, size_t n)
+{
+	double sum = 0.0;
+	size_t i;
+
+	assert(n > 0);
+	for (i = 0; i < n; i++)
+		sum += x[i];
+	return sum / n;
+}
+
+double
+stats_stddev(const double *x, size_t n)
+{
+	double mean, sum = 0.0;
+	size_t i;
+
+	if (n < 2)
+		return 0.0;
+	mean = stats_mean(x, n);
+	for (i = 0; i < n; i++)
+		sum += (x[i] - mean) * (x[i] - mean);
+	return sqrt(sum / (n - 1));
+}
+
+double
+stats_median(const double *x, size_t n)
+{
+	double *sorted, median;
+
+	assert(n > 0);
+	if ((sorted = malloc(n * sizeof(double))) == NULL)
+		err_sys("malloc");
+	memcpy(sorted, x, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), stats_cmp);
+	median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+	free(sorted);
+	return median;
+}
+
+/*
+ * Return P(U >= u) for two samples of sizes m and n without ties, counting
+ * the arrangements with a given U: f(m, n, u) = f(m - 1, n, u - n) +
+ * f(m, n - 1, u).
+ */
+static double
+mann_whitney_exact(size_t m, size_t n, double u)
+{
+	double *f, *g, *t, total = 0.0, tail = 0.0;
+	size_t i, j, k, max = m * n;
+
+	if ((f = calloc(2 * (n + 1) * (max + 1), sizeof(double))) == NULL)
+		err_sys("malloc");
+	g = f + (n + 1) * (max + 1);
+	/* f[j][k]: i values of the first sample, j of the second, U = k. */
+	for (j = 0; j <= n; j++)
+		f[j * (max + 1)] = 1.0;
+	for (i = 1; i <= m; i++) {
+		memset(g, 0, (n + 1) * (max + 1) * sizeof(double));
+		g[0] = 1.0;
+		for (j = 1; j <= n; j++)
+			for (k = 0; k <= i * j; k++)
+				g[j * (max + 1) + k] = (k >= j ? f[j * (max + 1) + k - j] : 0.0)
+					+ g[(j - 1) * (max + 1) + k];
+		t = f;
+		f = g;
+		g = t;
+	}
+	for (k = 0; k <= max; k++) {
+		total += f[n * (max + 1) + k];
+		if (k >= u)
+			tail += f[n * (max + 1) + k];
+	}
+	free(f < g ? f : g);
+	return tail / total;
+}
+
+double
+stats_mann_whitney(const double *x, size_t m, const double *y, size_t n)
+{
+	double u = 0.0, mu, sigma, ties = 0.0, z, *all;
+	size_t i, j, t;
+
+	assert(m > 0 && n > 0);
+	for (i = 0; i < m; i++)
+		for (j = 0; j < n; j++)
+			u += x[i] > y[j] ? 1.0 : x[i] == y[j] ? 0.5 : 0.0;
+	if ((all = malloc((m + n) * sizeof(double))) == NULL)
+		err_sys("malloc");
+	memcpy(all, x, m * sizeof(double));
+	memcpy(all + m, y, n * sizeof(double));
+	qsort(all, m + n, sizeof(double), stats_cmp);
+	for (i = 0; i < m + n; i = j) {
+		for (j = i + 1; j < m + n && all[j] == all[i]; j++)
+			;
+		t = j - i;
+		ties += (double) t * t * t - t;
+	}
+	free(all);
+	if (ties == 0.0 && m <= STATS_EXACT_MAX && n <= STATS_EXACT_MAX)
+		return mann_whitney_exact(m, n, u);
+	/* The normal approximation with tie and continuity corrections. */
+	mu = m * n / 2.0;
+	sigma = sqrt(m * n / 12.0 *
+			((m + n + 1) - ties / ((m + n) * (m + n - 1.0))));
+	if (sigma == 0.0)
+		return 1.0;
+	z = (u - mu - 0.5) / sigma;
+	return 0.5 * erfc(z / sqrt(2.0));
+}
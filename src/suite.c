@@ -66,21 +66,36 @@ test_suite_len(struct test_suite *suite)
 	unsigned int c;
 	struct test_suite_impl *si = (struct test_suite_impl *) suite;
 	struct test_suite *suitep;
+	struct test_case *test;
+	unsigned int len;
 
 	c = 0;
+	for (iter = si->tests; iter != NULL; iter = iter->next) {
+		test = (struct test_case *) iter->data;
+		c += test->len(test);
+	}
 	for (iter = si->suites; iter != NULL; iter = iter->next) {
 		suitep = (struct test_suite *) iter->data;
-		if (suitep->skip == NULL)
-			c += suitep->len(suitep);
+		if (suitep->skip != NULL)
+			continue;
+		if ((len = suitep->len(suitep)) == SUITE_LEN_UNKNOWN)
+			return SUITE_LEN_UNKNOWN;
+		c += len;
 	}
-	return list_len(si->tests) + c;
+	return c;
+}
+
+static void
+test_suite_free_child(void *suite)
+{
+	((struct test_suite *) suite)->free((struct test_suite *) suite);
 }
 
 static void
 test_suite_free(struct test_suite *suite)
 {
 	list_free(((struct test_suite_impl *)suite)->tests, free);
-	list_free(((struct test_suite_impl *)suite)->suites, free);
+	list_free(((struct test_suite_impl *)suite)->suites, test_suite_free_child);
 	free(suite);
 }
 
@@ -0,0 +1,689 @@
+#include <unistd.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The TAP parser. A line is parsed where it is: in the buffer fed to the
+ * parser when it is complete there, otherwise in the buffer of the parser,
+ * that holds at most the start of one line. A line longer than this buffer
+ * is cut and the rest of it is dropped.
+ *
+ * The replay reports a test point when its YAML block ends, or at the next
+ * line if it has none, through a test case on the stack as the rows of a
+ * parameterized test are.
+ */
+
+/* The largest diagnostic kept for a replayed test. */
+#define TAP_MAXDIAG (64 * 1024)
+
+struct tap_replay {
+	struct test_result *result;
+	/* The test point waiting for its YAML block. */
+	bool pending;
+	bool inyaml;
+	bool ok;
+	/* A `# ERROR` comment, as the tap_result reports an error. */
+	bool error;
+	enum tap_directive directive;
+	char name[MAXLINE];
+	char msg[MAXLINE];
+	char reason[MAXLINE];
+	char condition[MAXLINE];
+	char filename[MAXLINE];
+	unsigned int lineno;
+	unsigned long assertions;
+	/* The field the lines of a block scalar go to, or NULL for diag. */
+	char *block;
+	char diag[TAP_MAXDIAG];
+	size_t diaglen;
+};
+
+struct tap_parser {
+	void (*callback)(const struct tap_event *event, void *usrptr);
+	void *usrptr;
+	/* The replay fed by the parser, owned by it, or NULL. */
+	struct tap_replay *replay;
+	/* If a YAML block is open, its indentation and depth. */
+	bool yaml;
+	size_t yamlindent;
+	unsigned int yamldepth;
+	/* If the previous line was a test point, its indentation. */
+	bool aftertest;
+	size_t testindent;
+	/* If the current line was cut, the rest of it is dropped. */
+	bool cut;
+	/* The start of the current line. */
+	size_t used;
+	char buf[TAP_MAXLINE];
+};
+
+static bool
+tap_word(char c)
+{
+	return isalnum((unsigned char) c) || c == '_';
+}
+
+static size_t
+tap_blanks(const char *s, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && (s[i] == ' ' || s[i] == '\t'); i++)
+		;
+	return i;
+}
+
+/* Remove the blanks around the `*len` bytes of `*s`. */
+static void
+tap_trim(const char **s, size_t *len)
+{
+	size_t n = tap_blanks(*s, *len);
+
+	*s += n;
+	*len -= n;
+	while (*len > 0 && ((*s)[*len - 1] == ' ' || (*s)[*len - 1] == '\t'))
+		(*len)--;
+}
+
+/* Return true if the `len` bytes of `s` start with the word `word`. */
+static bool
+tap_starts(const char *s, size_t len, const char *word)
+{
+	size_t n = strlen(word);
+
+	return len >= n && memcmp(s, word, n) == 0 &&
+		(len == n || !tap_word(s[n]));
+}
+
+/* Parse a decimal number and return the number of digits. */
+static size_t
+tap_number(const char *s, size_t len, unsigned long *number)
+{
+	size_t i;
+
+	*number = 0;
+	for (i = 0; i < len && isdigit((unsigned char) s[i]); i++)
+		*number = *number * 10 + (s[i] - '0');
+	return i;
+}
+
+/* Return the first `#` of `s` that is not escaped, or NULL. */
+static const char *
+tap_hash(const char *s, size_t len)
+{
+	const char *hash, *p, *end = s + len;
+
+	for (p = s; (hash = memchr(p, '#', end - p)) != NULL; p = hash + 1) {
+		for (p = hash; p > s && p[-1] == '\\'; p--)
+			;
+		if ((hash - p) % 2 == 0)
+			return hash;
+	}
+	return NULL;
+}
+
+/* Find the `#` of the directive of a description and set the directive. */
+static const char *
+tap_directive(const char *s, size_t len, struct tap_event *event)
+{
+	const char *hash, *word, *end = s + len;
+
+	for (; (hash = tap_hash(s, end - s)) != NULL; s = hash + 1) {
+		word = hash + 1 + tap_blanks(hash + 1, end - hash - 1);
+		if (end - word < 4 || (end - word > 4 && tap_word(word[4])))
+			continue;
+		if (strncasecmp(word, "skip", 4) == 0)
+			event->directive = TAP_SKIP;
+		else if (strncasecmp(word, "todo", 4) == 0)
+			event->directive = TAP_TODO;
+		else
+			continue;
+		event->text = word + 4;
+		event->textlen = end - word - 4;
+		tap_trim(&event->text, &event->textlen);
+		return hash;
+	}
+	return NULL;
+}
+
+static void
+tap_test(const char *s, size_t len, struct tap_event *event)
+{
+	const char *hash, *end = s + len;
+	size_t n;
+
+	event->type = TAP_TEST;
+	event->ok = *s == 'o';
+	s += event->ok ? 2 : 6;
+	s += tap_blanks(s, end - s);
+	n = tap_number(s, end - s, &event->number);
+	if (n > 0 && s + n < end && tap_word(s[n]))
+		event->number = 0;
+	else
+		s += n;
+	s += tap_blanks(s, end - s);
+	if (s < end && *s == '-' && (s + 1 == end || s[1] == ' ' || s[1] == '\t'))
+		s++;
+	if ((hash = tap_directive(s, end - s, event)) != NULL)
+		end = hash;
+	event->desc = s;
+	event->desclen = end - s;
+	tap_trim(&event->desc, &event->desclen);
+}
+
+/* Parse a plan, return false if the line is not one. */
+static bool
+tap_plan(const char *s, size_t len, struct tap_event *event)
+{
+	const char *end = s + len;
+	size_t n;
+
+	if ((n = tap_number(s + 3, len - 3, &event->number)) == 0)
+		return false;
+	s += 3 + n;
+	s += tap_blanks(s, end - s);
+	if (s < end && *s != '#') {
+		event->number = 0;
+		return false;
+	}
+	event->type = TAP_PLAN;
+	if (s < end) {
+		event->text = s + 1;
+		event->textlen = end - s - 1;
+		tap_trim(&event->text, &event->textlen);
+	}
+	return true;
+}
+
+/* Set `text` to what follows the first `skip` bytes of `s`. */
+static void
+tap_text(struct tap_event *event, const char *s, size_t len, size_t skip)
+{
+	event->text = s + skip;
+	event->textlen = len - skip;
+	tap_trim(&event->text, &event->textlen);
+}
+
+static void
+tap_line(struct tap_parser *parser, const char *line, size_t len)
+{
+	struct tap_event event;
+	const char *s, *end;
+	size_t indent;
+
+	if (len > 0 && line[len - 1] == '\r')
+		len--;
+	memset(&event, 0, sizeof(event));
+	event.line = line;
+	event.len = len;
+	for (indent = 0; indent < len && line[indent] == ' '; indent++)
+		;
+	s = line + indent;
+	end = line + len;
+	if (parser->yaml) {
+		event.depth = parser->yamldepth;
+		if (indent == parser->yamlindent && end - s >= 3 &&
+				memcmp(s, "...", 3) == 0 && tap_blanks(s + 3, end - s - 3) ==
+				(size_t) (end - s - 3)) {
+			event.type = TAP_YAML_END;
+			parser->yaml = false;
+			parser->callback(&event, parser->usrptr);
+			return;
+		}
+		/* A line less indented ends a block that was not closed. */
+		if (indent >= parser->yamlindent || s == end) {
+			event.type = TAP_YAML;
+			indent = indent < parser->yamlindent ? indent : parser->yamlindent;
+			event.text = line + indent;
+			event.textlen = len - indent;
+			parser->callback(&event, parser->usrptr);
+			return;
+		}
+		parser->yaml = false;
+	}
+	event.depth = indent / 4;
+	if (parser->aftertest && indent == parser->testindent + 2 &&
+			end - s >= 3 && memcmp(s, "---", 3) == 0 &&
+			tap_blanks(s + 3, end - s - 3) == (size_t) (end - s - 3)) {
+		event.type = TAP_YAML_BEGIN;
+		event.depth = parser->testindent / 4;
+		parser->yaml = true;
+		parser->yamlindent = indent;
+		parser->yamldepth = event.depth;
+	} else if (tap_starts(s, end - s, "ok") ||
+			tap_starts(s, end - s, "not ok"))
+		tap_test(s, end - s, &event);
+	else if (end - s > 3 && memcmp(s, "1..", 3) == 0 &&
+			tap_plan(s, end - s, &event))
+		;
+	else if (end - s > 12 && memcmp(s, "TAP version ", 12) == 0 &&
+			tap_number(s + 12, end - s - 12, &event.number) ==
+			(size_t) (end - s - 12))
+		event.type = TAP_VERSION;
+	else if (end - s >= 9 && memcmp(s, "Bail out!", 9) == 0) {
+		event.type = TAP_BAILOUT;
+		tap_text(&event, s, end - s, 9);
+	} else if (end - s > 7 && memcmp(s, "pragma ", 7) == 0 &&
+			(s[7] == '+' || s[7] == '-')) {
+		event.type = TAP_PRAGMA;
+		tap_text(&event, s, end - s, 7);
+	} else if (s < end && *s == '#') {
+		event.type = TAP_COMMENT;
+		tap_text(&event, s, end - s, 1);
+	} else {
+		event.type = TAP_UNKNOWN;
+		event.text = line;
+		event.textlen = len;
+	}
+	parser->aftertest = event.type == TAP_TEST;
+	parser->testindent = indent;
+	parser->callback(&event, parser->usrptr);
+}
+
+/* Add to the current line in the buffer, cut it if it is too long. */
+static void
+tap_append(struct tap_parser *parser, const char *buf, size_t len)
+{
+	size_t n = TAP_MAXLINE - parser->used;
+
+	if (parser->cut)
+		return;
+	n = len < n ? len : n;
+	memcpy(parser->buf + parser->used, buf, n);
+	parser->used += n;
+	if (parser->used == TAP_MAXLINE) {
+		tap_line(parser, parser->buf, parser->used);
+		parser->used = 0;
+		parser->cut = true;
+	}
+}
+
+/* End the current line in the buffer. */
+static void
+tap_flush(struct tap_parser *parser)
+{
+	if (!parser->cut)
+		tap_line(parser, parser->buf, parser->used);
+	parser->used = 0;
+	parser->cut = false;
+}
+
+void
+tap_parser_feed(struct tap_parser *parser, const void *buf, size_t len)
+{
+	const char *p = buf, *nl;
+
+	assert(parser != NULL);
+	assert(buf != NULL || len == 0);
+	if (parser->used > 0 || parser->cut) {
+		if ((nl = memchr(p, '\n', len)) == NULL) {
+			tap_append(parser, p, len);
+			return;
+		}
+		tap_append(parser, p, nl - p);
+		tap_flush(parser);
+		len -= nl + 1 - p;
+		p = nl + 1;
+	}
+	while ((nl = memchr(p, '\n', len)) != NULL) {
+		tap_line(parser, p, nl - p);
+		len -= nl + 1 - p;
+		p = nl + 1;
+	}
+	tap_append(parser, p, len);
+}
+
+ssize_t
+tap_parser_read(struct tap_parser *parser, int fd)
+{
+	char *p, *nl, *end;
+	ssize_t n;
+
+	assert(parser != NULL);
+	n = read(fd, parser->buf + parser->used, TAP_MAXLINE - parser->used);
+	if (n <= 0)
+		return n;
+	p = parser->buf;
+	end = parser->buf + parser->used + n;
+	for (nl = memchr(p + parser->used, '\n', n); nl != NULL;
+			nl = memchr(p, '\n', end - p)) {
+		if (!parser->cut)
+			tap_line(parser, p, nl - p);
+		parser->cut = false;
+		p = nl + 1;
+	}
+	if (parser->cut) {
+		parser->used = 0;
+		return n;
+	}
+	parser->used = end - p;
+	memmove(parser->buf, p, parser->used);
+	if (parser->used == TAP_MAXLINE) {
+		tap_line(parser, parser->buf, parser->used);
+		parser->used = 0;
+		parser->cut = true;
+	}
+	return n;
+}
+
+void
+tap_parser_end(struct tap_parser *parser)
+{
+	struct tap_event event;
+
+	assert(parser != NULL);
+	if (parser->used > 0)
+		tap_flush(parser);
+	parser->cut = false;
+	parser->yaml = false;
+	parser->aftertest = false;
+	memset(&event, 0, sizeof(event));
+	event.type = TAP_END;
+	parser->callback(&event, parser->usrptr);
+}
+
+struct tap_parser *
+tap_parser_new(void (*callback)(const struct tap_event *event, void *usrptr),
+		void *usrptr)
+{
+	struct tap_parser *parser;
+
+	assert(callback != NULL);
+	if ((parser = malloc(sizeof(struct tap_parser))) == NULL)
+		err_sys("malloc");
+	parser->callback = callback;
+	parser->usrptr = usrptr;
+	parser->replay = NULL;
+	parser->yaml = false;
+	parser->aftertest = false;
+	parser->cut = false;
+	parser->used = 0;
+	return parser;
+}
+
+void
+tap_parser_free(struct tap_parser *parser)
+{
+	assert(parser != NULL);
+	free(parser->replay);
+	free(parser);
+}
+
+/* Copy `s` to the field `dst` of MAXLINE bytes, unescaped if asked. */
+static void
+tap_replay_copy(char *dst, const char *s, size_t len, bool unescape)
+{
+	size_t i, n = 0;
+
+	for (i = 0; i < len && n < MAXLINE - 1; i++) {
+		if (unescape && s[i] == '\\' && i + 1 < len &&
+				(s[i + 1] == '#' || s[i + 1] == '\\'))
+			i++;
+		dst[n++] = s[i];
+	}
+	dst[n] = '\0';
+}
+
+/* Append a line to a block scalar. */
+static void
+tap_replay_append(char *field, const char *s, size_t len)
+{
+	size_t n = strlen(field);
+
+	if (n > 0 && n < MAXLINE - 1)
+		field[n++] = '\n';
+	len = len < MAXLINE - 1 - n ? len : MAXLINE - 1 - n;
+	memcpy(field + n, s, len);
+	field[n + len] = '\0';
+}
+
+/* Keep a line in the diagnostic, if it fits, as the tap_result prints it. */
+static void
+tap_replay_diag(struct tap_replay *replay, const char *s, size_t len)
+{
+	if (replay->diaglen + len + 4 > TAP_MAXDIAG)
+		return;
+	memcpy(replay->diag + replay->diaglen, "  ", 2);
+	memcpy(replay->diag + replay->diaglen + 2, s, len);
+	replay->diaglen += len + 3;
+	replay->diag[replay->diaglen - 1] = '\n';
+	replay->diag[replay->diaglen] = '\0';
+}
+
+/* Copy a plain or quoted YAML scalar. */
+static void
+tap_replay_scalar(char *field, const char *s, size_t len)
+{
+	size_t i, n = 0;
+	char quote;
+
+	if (len < 2 || (*s != '\'' && *s != '"') || s[len - 1] != *s) {
+		tap_replay_copy(field, s, len, false);
+		return;
+	}
+	quote = *s;
+	for (i = 1; i < len - 1 && n < MAXLINE - 1; i++) {
+		if (quote == '\'' && s[i] == '\'' && s[i + 1] == '\'')
+			i++;
+		else if (quote == '"' && s[i] == '\\' && i + 1 < len - 1) {
+			i++;
+			if (s[i] == 'n' || s[i] == 't') {
+				field[n++] = s[i] == 'n' ? '\n' : '\t';
+				continue;
+			}
+		}
+		field[n++] = s[i];
+	}
+	field[n] = '\0';
+}
+
+static bool
+tap_replay_key(const char *s, size_t len, const char *key)
+{
+	return len == strlen(key) && memcmp(s, key, len) == 0;
+}
+
+/* Read the entries of the YAML block that are fields of the test. */
+static void
+tap_replay_yaml(struct tap_replay *replay, const char *s, size_t len)
+{
+	const char *colon, *value;
+	unsigned long number;
+	size_t n, keylen;
+	char *field;
+
+	if (len == 0 || *s == ' ') {
+		if (replay->block == NULL) {
+			tap_replay_diag(replay, s, len);
+			return;
+		}
+		/* The lines of a block scalar are indented by 2. */
+		n = len < 2 ? len : 2;
+		n = tap_blanks(s, n) < n ? tap_blanks(s, n) : n;
+		tap_replay_append(replay->block, s + n, len - n);
+		return;
+	}
+	replay->block = NULL;
+	if ((colon = memchr(s, ':', len)) == NULL) {
+		tap_replay_diag(replay, s, len);
+		return;
+	}
+	keylen = colon - s;
+	value = colon + 1;
+	n = len - keylen - 1;
+	tap_trim(&value, &n);
+	if (tap_replay_key(s, keylen, "line") ||
+			tap_replay_key(s, keylen, "assertions")) {
+		if (n == 0 || tap_number(value, n, &number) != n) {
+			tap_replay_diag(replay, s, len);
+			return;
+		}
+		if (*s == 'l')
+			replay->lineno = number;
+		else
+			replay->assertions = number;
+		return;
+	}
+	if (tap_replay_key(s, keylen, "message"))
+		field = replay->msg;
+	else if (tap_replay_key(s, keylen, "condition"))
+		field = replay->condition;
+	else if (tap_replay_key(s, keylen, "file"))
+		field = replay->filename;
+	else {
+		tap_replay_diag(replay, s, len);
+		return;
+	}
+	if ((n == 1 && *value == '|') || (n == 2 && memcmp(value, "|-", 2) == 0)) {
+		*field = '\0';
+		replay->block = field;
+		return;
+	}
+	tap_replay_scalar(field, value, n);
+}
+
+/* Report the pending test point. */
+static void
+tap_replay_report(struct tap_replay *replay)
+{
+	struct test_result *result = replay->result;
+	struct test_case_impl row;
+	struct test_case *test = (struct test_case *) &row;
+	bool skip = replay->directive == TAP_SKIP && replay->ok;
+	bool todo = replay->directive == TAP_TODO;
+
+	if (!replay->pending)
+		return;
+	replay->pending = false;
+	replay->inyaml = false;
+	replay->block = NULL;
+	if (result->shouldstop)
+		return;
+	test_case_init(test, replay->name, skip ? replay->reason : NULL,
+			todo ? replay->reason : NULL, NULL);
+	test->msg = *replay->msg != '\0' || replay->error ? replay->msg : NULL;
+	test->condition = *replay->condition != '\0' ? replay->condition : NULL;
+	test->filename = *replay->filename != '\0' ? replay->filename : NULL;
+	test->lineno = replay->lineno;
+	test->assertions = replay->assertions;
+	test->diag = replay->diaglen > 0 ? replay->diag : NULL;
+	result->testsrun++;
+	if (result->start_test != NULL)
+		result->start_test(result, test);
+	if (todo && replay->ok)
+		result->add_xsuccess(result, test);
+	else if (todo)
+		result->add_xfailure(result, test);
+	else if (skip)
+		result->add_skip(result, test);
+	else if (replay->ok)
+		result->add_success(result, test);
+	else if (replay->error)
+		result->add_error(result, test);
+	else
+		result->add_failure(result, test);
+	if (result->stop_test != NULL)
+		result->stop_test(result, test);
+}
+
+/* Start a test point, its YAML block may follow. */
+static void
+tap_replay_start(struct tap_replay *replay, bool ok,
+		enum tap_directive directive)
+{
+	replay->pending = true;
+	replay->ok = ok;
+	replay->error = false;
+	replay->directive = directive;
+	replay->name[0] = '\0';
+	replay->msg[0] = '\0';
+	replay->reason[0] = '\0';
+	replay->condition[0] = '\0';
+	replay->filename[0] = '\0';
+	replay->lineno = 0;
+	replay->assertions = 0;
+	replay->diaglen = 0;
+	replay->diag[0] = '\0';
+}
+
+static void
+tap_replay_test(struct tap_replay *replay, const struct tap_event *event)
+{
+	const char *desc = event->desc, *hash, *msg = NULL;
+	size_t len = event->desclen, msglen = 0;
+
+	tap_replay_start(replay, event->ok, event->directive);
+	tap_replay_copy(replay->reason, event->text, event->textlen, false);
+	/* A comment that is not a directive is the message of the test. */
+	if ((hash = tap_hash(desc, len)) != NULL) {
+		msg = hash + 1;
+		msglen = desc + len - msg;
+		tap_trim(&msg, &msglen);
+		len = hash - desc;
+		tap_trim(&desc, &len);
+	}
+	if (!event->ok && msg != NULL && tap_starts(msg, msglen, "ERROR")) {
+		replay->error = true;
+		msg += 5;
+		msglen -= 5;
+		tap_trim(&msg, &msglen);
+	}
+	if (len > 0)
+		tap_replay_copy(replay->name, desc, len, true);
+	else
+		snprintf(replay->name, MAXLINE, "%lu", event->number);
+	tap_replay_copy(replay->msg, msg, msglen, true);
+}
+
+static void
+tap_replay_event(const struct tap_event *event, void *usrptr)
+{
+	struct tap_replay *replay = usrptr;
+
+	if (event->depth == 0 && replay->pending) {
+		switch (event->type) {
+			case TAP_YAML_BEGIN:
+				replay->inyaml = true;
+				return;
+			case TAP_YAML:
+				if (replay->inyaml)
+					tap_replay_yaml(replay, event->text, event->textlen);
+				return;
+			default:
+				break;
+		}
+	}
+	tap_replay_report(replay);
+	if (event->depth > 0)
+		return;
+	if (event->type == TAP_TEST)
+		tap_replay_test(replay, event);
+	else if (event->type == TAP_BAILOUT) {
+		tap_replay_start(replay, false, TAP_NODIRECTIVE);
+		replay->error = true;
+		strcpy(replay->name, "Bail out!");
+		tap_replay_copy(replay->msg, event->text, event->textlen, false);
+		tap_replay_report(replay);
+	}
+}
+
+struct tap_parser *
+tap_replay_new(struct test_result *result)
+{
+	struct tap_replay *replay;
+	struct tap_parser *parser;
+
+	assert(result != NULL);
+	if ((replay = calloc(1, sizeof(struct tap_replay))) == NULL)
+		err_sys("malloc");
+	replay->result = result;
+	parser = tap_parser_new(tap_replay_event, replay);
+	parser->replay = replay;
+	return parser;
+}
@@ -0,0 +1,676 @@
+/*
+ * unittest-run: run test programs and check their TAP output.
+ *
+ * As the LOG_DRIVER of automake it replaces tap-driver.sh: it runs the
+ * command after `--`, writes its .log and .trs files and prints a line for
+ * each result, with the same options and the same rules. Given programs
+ * without --test-name, it runs them in parallel, at most -j at a time,
+ * writes the .log and .trs files of each one next to it, then a summary and
+ * the global log of the failed ones. The output of a program is parsed
+ * by the TAP parser of the library as it comes, and the subtests are only
+ * checked through the test points that end them.
+ */
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+#define RUN_VERSION "0.1"
+#define RUN_READSIZE 65536
+
+enum run_result {
+	RUN_PASS,
+	RUN_FAIL,
+	RUN_XPASS,
+	RUN_XFAIL,
+	RUN_SKIP,
+	RUN_ERROR,
+	RUN_NRESULTS
+};
+
+static const char *run_names[RUN_NRESULTS] = {
+	"PASS", "FAIL", "XPASS", "XFAIL", "SKIP", "ERROR"
+};
+
+static const char *run_colors[RUN_NRESULTS] = {
+	"\033[0;32m", "\033[0;31m", "\033[0;31m", "\033[1;32m", "\033[1;34m",
+	"\033[0;35m"
+};
+
+enum run_plan {
+	RUN_NOPLAN,
+	RUN_EARLYPLAN,
+	RUN_LATEPLAN
+};
+
+/* A test program and the state of its TAP stream. */
+struct run_prog {
+	const char *name;
+	char **argv;
+	char *log;
+	char *trs;
+	pid_t pid;
+	/* The read end of the standard output of the program. */
+	int fd;
+	FILE *logfp;
+	/* Set if the log could not be opened, the program did not run. */
+	bool nolog;
+	/* The results printed on the standard output, once the program ends. */
+	FILE *out;
+	char *outbuf;
+	size_t outsize;
+	struct tap_parser *parser;
+	unsigned int planned;
+	unsigned int testno;
+	enum run_plan plan;
+	bool bailed;
+	/* The results, in order, for the .trs file. */
+	unsigned char *results;
+	size_t nresults;
+	size_t maxresults;
+	unsigned int counts[RUN_NRESULTS];
+};
+
+static struct {
+	const char *testname;
+	const char *logfile;
+	const char *trsfile;
+	const char *globallog;
+	bool color;
+	bool expectfailure;
+	bool merge;
+	bool ignoreexit;
+	bool comments;
+	const char *diagstring;
+	unsigned int jobs;
+} config = {
+	.globallog = "test-suite.log",
+	.diagstring = "#",
+};
+
+static const char *usage =
+	"Usage: %s --test-name=NAME --log-file=PATH --trs-file=PATH\n"
+	"          [--expect-failure={yes|no}] [--color-tests={yes|no}]\n"
+	"          [--enable-hard-errors={yes|no}] [--ignore-exit]\n"
+	"          [--diagnostic-string=STRING] [--merge|--no-merge]\n"
+	"          [--comments|--no-comments] [--] TEST-COMMAND\n"
+	"       %s [-j JOBS] [-o LOG] [options] PROGRAM...\n"
+	"\n"
+	"The first form is the LOG_DRIVER of automake. The second one runs the\n"
+	"programs in parallel, JOBS at a time (default: the number of CPUs),\n"
+	"writes their .log and .trs files, a summary and the global LOG of the\n"
+	"failures (default test-suite.log).\n";
+
+static void
+run_usage(const char *prog, int status) __attribute__((noreturn));
+
+static void
+run_usage(const char *prog, int status)
+{
+	fprintf(status == 0 ? stdout : stderr, usage, prog, prog);
+	exit(status);
+}
+
+static void
+run_add(struct run_prog *prog, enum run_result result)
+{
+	if (prog->nresults == prog->maxresults) {
+		prog->maxresults = prog->maxresults > 0 ? 2 * prog->maxresults : 64;
+		prog->results = realloc(prog->results, prog->maxresults);
+		if (prog->results == NULL)
+			err_sys("malloc");
+	}
+	prog->results[prog->nresults++] = result;
+	prog->counts[result]++;
+}
+
+/* Print a result, or a comment if `result` is RUN_NRESULTS. */
+static void
+run_report(struct run_prog *prog, int result, const char *details)
+{
+	const char *name = result < RUN_NRESULTS ? run_names[result] : "#";
+	const char *sep = result < RUN_NRESULTS ? ": " : " ";
+	const char *colon = result < RUN_NRESULTS ? "" : ":";
+
+	if (result < RUN_NRESULTS)
+		run_add(prog, result);
+	if (config.color && result < RUN_NRESULTS)
+		fprintf(prog->out, "%s%s\033[m", run_colors[result], name);
+	else
+		fputs(name, prog->out);
+	fprintf(prog->out, "%s%s%s%s%s\n", sep, prog->name, colon,
+			*details != '\0' ? " " : "", details);
+	if (prog->logfp != NULL)
+		fprintf(prog->logfp, "%s%s%s%s%s%s\n", name, sep, prog->name, colon,
+				*details != '\0' ? " " : "", details);
+}
+
+static void
+run_error(struct run_prog *prog, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void
+run_error(struct run_prog *prog, const char *fmt, ...)
+{
+	char details[MAXLINE];
+	va_list ap;
+
+	strcpy(details, "- ");
+	va_start(ap, fmt);
+	vsnprintf(details + 2, sizeof(details) - 2, fmt, ap);
+	va_end(ap);
+	run_report(prog, RUN_ERROR, details);
+}
+
+static void
+run_result(struct run_prog *prog, const struct tap_event *event)
+{
+	static const char *directives[] = {"", "SKIP", "TODO"};
+	char details[MAXLINE];
+	const char *desc = event->desc, *p;
+	size_t desclen = event->desclen;
+	unsigned long number;
+	bool unplanned;
+	int result, n;
+
+	prog->testno++;
+	number = event->number > 0 ? event->number : prog->testno;
+	unplanned = prog->plan == RUN_LATEPLAN ||
+		(prog->plan != RUN_NOPLAN && prog->testno > prog->planned);
+	/* The description is reported with its dash, as tap-driver.sh does. */
+	for (p = desc; p > event->line && (p[-1] == ' ' || p[-1] == '\t'); p--)
+		;
+	if (p > event->line && p[-1] == '-') {
+		desclen += desc - p + 1;
+		desc = p - 1;
+	}
+
+	n = snprintf(details, sizeof(details), "%lu%s%.*s", number,
+			desclen > 0 ? " " : "", (int) desclen, desc);
+	if (n >= (int) sizeof(details))
+		n = sizeof(details) - 1;
+	if (prog->plan == RUN_LATEPLAN)
+		snprintf(details + n, sizeof(details) - n, " # AFTER LATE PLAN");
+	else if (unplanned)
+		snprintf(details + n, sizeof(details) - n, " # UNPLANNED");
+	else if (number != prog->testno)
+		snprintf(details + n, sizeof(details) - n,
+				" # OUT-OF-ORDER (expecting %u)", prog->testno);
+	else if (event->directive != TAP_NODIRECTIVE)
+		snprintf(details + n, sizeof(details) - n, " # %s%s%.*s",
+				directives[event->directive], event->textlen > 0 ? " " : "",
+				(int) event->textlen, event->text);
+
+	if (unplanned || number != prog->testno || prog->plan == RUN_LATEPLAN)
+		result = RUN_ERROR;
+	else if (event->directive == TAP_TODO)
+		result = event->ok ? RUN_XPASS : RUN_XFAIL;
+	else if (event->directive == TAP_SKIP && event->ok)
+		result = RUN_SKIP;
+	else if (config.expectfailure)
+		result = event->ok ? RUN_XPASS : RUN_XFAIL;
+	else
+		result = event->ok ? RUN_PASS : RUN_FAIL;
+	run_report(prog, result, details);
+}
+
+static void
+run_plan(struct run_prog *prog, const struct tap_event *event)
+{
+	const char *reason = event->text;
+	size_t len = event->textlen;
+	char details[MAXLINE];
+
+	if (prog->plan != RUN_NOPLAN) {
+		run_error(prog, "multiple test plans");
+		return;
+	}
+	prog->planned = event->number;
+	prog->plan = prog->testno >= 1 ? RUN_LATEPLAN : RUN_EARLYPLAN;
+	if (prog->planned > 0 || prog->testno > 0)
+		return;
+	if (len >= 5 && strncmp(reason, "SKIP", 4) == 0 && (reason[4] == ':' ||
+				reason[4] == ' ' || reason[4] == '\t')) {
+		for (reason += 5, len -= 5; len > 0 && (*reason == ' ' ||
+					*reason == '\t'); reason++, len--)
+			;
+	}
+	snprintf(details, sizeof(details), "%s%.*s", len > 0 ? "- " : "",
+			(int) len, reason);
+	run_report(prog, RUN_SKIP, details);
+}
+
+/* Check a line of the TAP stream of a program. */
+static void
+run_event(const struct tap_event *event, void *usrptr)
+{
+	struct run_prog *prog = usrptr;
+	size_t len = strlen(config.diagstring);
+	char details[MAXLINE];
+	const char *p, *end;
+
+	if (event->type == TAP_END)
+		return;
+	fprintf(prog->logfp, "%.*s\n", (int) event->len, event->line);
+	if (prog->bailed)
+		return;
+	if (event->type == TAP_BAILOUT) {
+		prog->bailed = true;
+		run_error(prog, "Bail out!%s%.*s", event->textlen > 0 ? " " : "",
+				(int) event->textlen, event->text);
+		return;
+	}
+	/* The subtests are checked by the test point that ends them. */
+	if (event->type == TAP_TEST && event->depth == 0) {
+		run_result(prog, event);
+		return;
+	}
+	if (event->type == TAP_PLAN && event->depth == 0) {
+		run_plan(prog, event);
+		return;
+	}
+	if (config.comments && event->len >= len &&
+			strncmp(event->line, config.diagstring, len) == 0) {
+		end = event->line + event->len;
+		for (p = event->line + len; p < end && (*p == ' ' || *p == '\t'); p++)
+			;
+		while (end > p && (end[-1] == ' ' || end[-1] == '\t'))
+			end--;
+		if (p < end) {
+			snprintf(details, sizeof(details), "%.*s", (int) (end - p), p);
+			run_report(prog, RUN_NRESULTS, details);
+		}
+	}
+}
+
+static void run_finish(struct run_prog *prog);
+
+/* Start the program, or report an error if it cannot run. */
+static bool
+run_start(struct run_prog *prog)
+{
+	int fds[2];
+
+	if (config.testname != NULL)
+		prog->out = stdout;
+	else if ((prog->out = open_memstream(&prog->outbuf,
+					&prog->outsize)) == NULL)
+		err_sys("open_memstream");
+	if ((prog->logfp = fopen(prog->log, "we")) == NULL) {
+		prog->nolog = true;
+		run_error(prog, "%s: %s", prog->log, strerror(errno));
+		run_finish(prog);
+		return false;
+	}
+	/* The lines of the log and the standard error of the test interleave. */
+	setvbuf(prog->logfp, NULL, _IOLBF, 0);
+	if (pipe2(fds, O_CLOEXEC) == -1)
+		err_sys("pipe");
+	fflush(NULL);
+	if ((prog->pid = fork()) == -1)
+		err_sys("fork");
+	if (prog->pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(config.merge ? fds[1] : fileno(prog->logfp), STDERR_FILENO);
+		execvp(prog->argv[0], prog->argv);
+		fprintf(stderr, "unittest-run: %s: %s\n", prog->argv[0],
+				strerror(errno));
+		_exit(127);
+	}
+	close(fds[1]);
+	prog->fd = fds[0];
+	prog->parser = tap_parser_new(run_event, prog);
+	return true;
+}
+
+static void
+run_exit(struct run_prog *prog, int status)
+{
+	int code;
+
+	if (WIFSIGNALED(status)) {
+		run_error(prog, "terminated by signal %d", WTERMSIG(status));
+		return;
+	}
+	if ((code = WEXITSTATUS(status)) == 0)
+		return;
+	run_error(prog, "exited with status %d%s", code,
+			code == 127 ? " (command not found?)" : "");
+}
+
+static const char *
+run_global(const struct run_prog *prog)
+{
+	unsigned int i;
+
+	if (prog->counts[RUN_ERROR] > 0)
+		return "ERROR";
+	if (prog->counts[RUN_FAIL] > 0 || prog->counts[RUN_XPASS] > 0)
+		return "FAIL";
+	for (i = 0; i < RUN_NRESULTS; i++)
+		if (i != RUN_SKIP && prog->counts[i] > 0)
+			return "PASS";
+	return "SKIP";
+}
+
+/* The results that make a program worth checking again. */
+static bool
+run_recheck(const struct run_prog *prog)
+{
+	return prog->counts[RUN_FAIL] + prog->counts[RUN_XPASS] +
+		prog->counts[RUN_ERROR] > 0;
+}
+
+static void
+run_trs(struct run_prog *prog)
+{
+	FILE *fp;
+	size_t i;
+
+	if ((fp = fopen(prog->trs, "w")) == NULL)
+		err_sys("%s", prog->trs);
+	fprintf(fp, ":global-test-result: %s\n", run_global(prog));
+	fprintf(fp, ":recheck: %s\n", run_recheck(prog) ? "yes" : "no");
+	fprintf(fp, ":copy-in-global-log: %s\n",
+			prog->counts[RUN_PASS] == prog->nresults ? "no" : "yes");
+	for (i = 0; i < prog->nresults; i++)
+		fprintf(fp, ":test-result: %s\n", run_names[prog->results[i]]);
+	if (fclose(fp) == EOF)
+		err_sys("%s", prog->trs);
+}
+
+/* Check the end of the stream and the exit status. */
+static void
+run_end(struct run_prog *prog)
+{
+	int status;
+
+	tap_parser_end(prog->parser);
+	close(prog->fd);
+	prog->fd = -1;
+	while (waitpid(prog->pid, &status, 0) == -1)
+		if (errno != EINTR)
+			err_sys("waitpid");
+	if (!prog->bailed) {
+		if (prog->plan == RUN_NOPLAN)
+			run_error(prog, "missing test plan");
+		else if (prog->planned != prog->testno)
+			run_error(prog, "too %s tests run (expected %u, got %u)",
+					prog->testno > prog->planned ? "many" : "few",
+					prog->planned, prog->testno);
+		if (!config.ignoreexit)
+			run_exit(prog, status);
+	}
+	if (fclose(prog->logfp) == EOF)
+		err_sys("%s", prog->log);
+	prog->logfp = NULL;
+	run_finish(prog);
+	tap_parser_free(prog->parser);
+	prog->parser = NULL;
+}
+
+/* Write the .trs file and print the results of the program. */
+static void
+run_finish(struct run_prog *prog)
+{
+	run_trs(prog);
+	if (prog->out != stdout) {
+		fclose(prog->out);
+		fwrite(prog->outbuf, 1, prog->outsize, stdout);
+		fflush(stdout);
+		free(prog->outbuf);
+		prog->outbuf = NULL;
+	}
+}
+
+/* Run the programs, at most config.jobs at a time. */
+static void
+run_all(struct run_prog *progs, size_t nprogs)
+{
+	struct pollfd *pfds;
+	struct run_prog **running;
+	size_t next = 0, nrunning = 0, i;
+	ssize_t n;
+
+	pfds = calloc(config.jobs, sizeof(struct pollfd));
+	running = calloc(config.jobs, sizeof(struct run_prog *));
+	if (pfds == NULL || running == NULL)
+		err_sys("malloc");
+	while (next < nprogs || nrunning > 0) {
+		while (nrunning < config.jobs && next < nprogs) {
+			if (run_start(&progs[next]))
+				running[nrunning++] = &progs[next];
+			next++;
+		}
+		if (nrunning == 0)
+			continue;
+		for (i = 0; i < nrunning; i++) {
+			pfds[i].fd = running[i]->fd;
+			pfds[i].events = POLLIN;
+		}
+		if (poll(pfds, nrunning, -1) == -1) {
+			if (errno == EINTR)
+				continue;
+			err_sys("poll");
+		}
+		for (i = nrunning; i-- > 0;) {
+			if (pfds[i].revents == 0)
+				continue;
+			n = tap_parser_read(running[i]->parser, running[i]->fd);
+			if (n > 0 || (n == -1 && errno == EINTR))
+				continue;
+			run_end(running[i]);
+			running[i] = running[--nrunning];
+		}
+	}
+	free(running);
+	free(pfds);
+}
+
+/* Write the logs of the programs that did not only pass. */
+static void
+run_global_log(const struct run_prog *progs, size_t nprogs)
+{
+	char buf[RUN_READSIZE];
+	FILE *fp, *log;
+	size_t i, n;
+
+	if ((fp = fopen(config.globallog, "w")) == NULL)
+		err_sys("%s", config.globallog);
+	for (i = 0; i < nprogs; i++) {
+		if (progs[i].counts[RUN_PASS] == progs[i].nresults)
+			continue;
+		fprintf(fp, "%s: %s\n", run_global(&progs[i]), progs[i].name);
+		fprintf(fp, "%.*s\n\n", (int) strlen(progs[i].name) +
+				(int) strlen(run_global(&progs[i])) + 2,
+				"=============================================="
+				"==============================================");
+		if ((log = fopen(progs[i].log, "r")) == NULL)
+			continue;
+		while ((n = fread(buf, 1, sizeof(buf), log)) > 0)
+			fwrite(buf, 1, n, fp);
+		fclose(log);
+		fputc('\n', fp);
+	}
+	if (fclose(fp) == EOF)
+		err_sys("%s", config.globallog);
+}
+
+/* Print the summary and return the exit status of the run. */
+static int
+run_summary(const struct run_prog *progs, size_t nprogs)
+{
+	static const int order[] = {
+		RUN_PASS, RUN_SKIP, RUN_XFAIL, RUN_FAIL, RUN_XPASS, RUN_ERROR
+	};
+	unsigned int counts[RUN_NRESULTS] = {0}, total = 0;
+	size_t i, j;
+
+	for (i = 0; i < nprogs; i++)
+		for (j = 0; j < RUN_NRESULTS; j++) {
+			counts[j] += progs[i].counts[j];
+			total += progs[i].counts[j];
+		}
+	printf("========================================"
+			"====================================\n"
+			"Testsuite summary\n"
+			"========================================"
+			"====================================\n");
+	printf("# TOTAL: %u\n", total);
+	for (i = 0; i < sizeof(order) / sizeof(order[0]); i++)
+		printf("# %s:%*s%u\n", run_names[order[i]],
+				(int) (6 - strlen(run_names[order[i]])), "",
+				counts[order[i]]);
+	if (counts[RUN_FAIL] + counts[RUN_XPASS] + counts[RUN_ERROR] == 0)
+		return 0;
+	printf("See %s\n", config.globallog);
+	return 1;
+}
+
+static bool
+run_yes(const char *arg)
+{
+	return strcmp(arg, "yes") == 0;
+}
+
+static char *
+run_path(const char *prefix, const char *prog, const char *suffix)
+{
+	char *path;
+
+	if (asprintf(&path, "%s%s%s", prefix, prog, suffix) == -1)
+		err_sys("malloc");
+	return path;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const struct option options[] = {
+		{"test-name", required_argument, NULL, 'N'},
+		{"log-file", required_argument, NULL, 'L'},
+		{"trs-file", required_argument, NULL, 'S'},
+		{"color-tests", required_argument, NULL, 'c'},
+		{"expect-failure", required_argument, NULL, 'x'},
+		{"enable-hard-errors", required_argument, NULL, 'e'},
+		{"merge", no_argument, NULL, 'm'},
+		{"no-merge", no_argument, NULL, 'M'},
+		{"ignore-exit", no_argument, NULL, 'i'},
+		{"comments", no_argument, NULL, 'C'},
+		{"no-comments", no_argument, NULL, 'D'},
+		{"diagnostic-string", required_argument, NULL, 'd'},
+		{"help", no_argument, NULL, 'h'},
+		{"version", no_argument, NULL, 'V'},
+		{NULL, 0, NULL, 0}
+	};
+	struct run_prog *progs;
+	size_t nprogs, i;
+	long ncpus;
+	int opt, status;
+
+	while ((opt = getopt_long(argc, argv, "+j:o:h", options, NULL)) != -1) {
+		switch (opt) {
+			case 'N':
+				config.testname = optarg;
+				break;
+			case 'L':
+				config.logfile = optarg;
+				break;
+			case 'S':
+				config.trsfile = optarg;
+				break;
+			case 'c':
+				config.color = run_yes(optarg);
+				break;
+			case 'x':
+				config.expectfailure = run_yes(optarg);
+				break;
+			case 'e':
+				break;
+			case 'm':
+				config.merge = true;
+				break;
+			case 'M':
+				config.merge = false;
+				break;
+			case 'i':
+				config.ignoreexit = true;
+				break;
+			case 'C':
+				config.comments = true;
+				break;
+			case 'D':
+				config.comments = false;
+				break;
+			case 'd':
+				config.diagstring = optarg;
+				break;
+			case 'j':
+				config.jobs = strtoul(optarg, NULL, 0);
+				break;
+			case 'o':
+				config.globallog = optarg;
+				break;
+			case 'h':
+				run_usage(argv[0], 0);
+			case 'V':
+				printf("unittest-run %s\n", RUN_VERSION);
+				return 0;
+			default:
+				run_usage(argv[0], 2);
+		}
+	}
+	if (optind == argc)
+		run_usage(argv[0], 2);
+
+	if (config.testname != NULL) {
+		if (config.logfile == NULL || config.trsfile == NULL)
+			run_usage(argv[0], 2);
+		if ((progs = calloc(1, sizeof(struct run_prog))) == NULL)
+			err_sys("malloc");
+		progs->name = config.testname;
+		progs->argv = &argv[optind];
+		progs->log = (char *) config.logfile;
+		progs->trs = (char *) config.trsfile;
+		config.jobs = 1;
+		run_all(progs, 1);
+		/* The results are in the .trs file, unless the program did not run. */
+		status = progs->nolog ? 1 : 0;
+		free(progs->results);
+		free(progs);
+		return status;
+	}
+
+	nprogs = argc - optind;
+	if ((progs = calloc(nprogs, sizeof(struct run_prog))) == NULL)
+		err_sys("malloc");
+	for (i = 0; i < nprogs; i++) {
+		progs[i].name = argv[optind + i];
+		progs[i].argv = calloc(2, sizeof(char *));
+		if (progs[i].argv == NULL)
+			err_sys("malloc");
+		/* A program is not searched in the PATH. */
+		progs[i].argv[0] = run_path(strchr(argv[optind + i], '/') == NULL ?
+				"./" : "", argv[optind + i], "");
+		progs[i].log = run_path("", argv[optind + i], ".log");
+		progs[i].trs = run_path("", argv[optind + i], ".trs");
+	}
+	if (config.jobs == 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		config.jobs = ncpus > 0 ? ncpus : 1;
+	}
+	run_all(progs, nprogs);
+	run_global_log(progs, nprogs);
+	return run_summary(progs, nprogs);
+}
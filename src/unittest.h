@@ -6,7 +6,11 @@
  */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
 
 #ifndef UNITTEST_H
 #define UNITTEST_H
@@ -23,6 +27,13 @@ struct test_suite;
 	bool shouldstop; \
 	/** Set to interrupt the tests at the first failure. */ \
 	bool failfast; \
+	/** The number of tests run so far. */ \
+	unsigned int testsrun; \
+	/**
+	 * Set to call assert_impl for every assertion. Otherwise the passing
+	 * assertions are only counted and assert_impl is called on failure.
+	 */ \
+	bool record; \
 	/** The stream to use to print the results of the run. */ \
 	FILE *stream; \
 	/** Free the resources acquired by the result. */ \
@@ -78,6 +89,130 @@ struct test_result {
  */
 struct test_result *tap_result_new(bool failfast, FILE *stream);
 
+/**
+ * The kinds of the lines of a TAP stream, see tap_parser_new.
+ */
+enum tap_type {
+	/** `TAP version N`, N in `number`. */
+	TAP_VERSION,
+	/** `1..N`, N in `number` and the comment after `#`, if any, in `text`. */
+	TAP_PLAN,
+	/** `ok` or `not ok`, a test point. */
+	TAP_TEST,
+	/** The `---` that opens the YAML block of the previous test point. */
+	TAP_YAML_BEGIN,
+	/** A line of a YAML block, without the indentation of the block. */
+	TAP_YAML,
+	/** The `...` that closes a YAML block. */
+	TAP_YAML_END,
+	/** `Bail out!`, the reason in `text`. */
+	TAP_BAILOUT,
+	/** `pragma +name` or `pragma -name`, the pragma in `text`. */
+	TAP_PRAGMA,
+	/** A line that starts with `#`, the comment after it in `text`. */
+	TAP_COMMENT,
+	/** A line that is not TAP, e.g. a blank line or the output of a test. */
+	TAP_UNKNOWN,
+	/** The end of the stream, an event without line. */
+	TAP_END
+};
+
+/**
+ * The directive of a test point.
+ */
+enum tap_directive {
+	TAP_NODIRECTIVE,
+	TAP_SKIP,
+	TAP_TODO
+};
+
+/**
+ * A line of a TAP stream. The strings point in the input, they are not
+ * copied nor terminated, and are valid until the callback returns. The
+ * escapes of `\#` and `\\` are left in the description.
+ */
+struct tap_event {
+	enum tap_type type;
+	/** The level of the subtest: the indentation of the line by 4. */
+	unsigned int depth;
+	/** The whole line, without the newline. */
+	const char *line;
+	size_t len;
+	/** For a test point, if it is `ok`. */
+	bool ok;
+	/**
+	 * The number of a test point, 0 if it has none, of tests in a plan or
+	 * the version of TAP.
+	 */
+	unsigned long number;
+	/** The description of a test point, without the number and the `-`. */
+	const char *desc;
+	size_t desclen;
+	enum tap_directive directive;
+	/** The reason of a directive, of a plan or of a bail out, or a line. */
+	const char *text;
+	size_t textlen;
+};
+
+/**
+ * The longest line of a TAP stream, a longer one is cut.
+ */
+#define TAP_MAXLINE 65536
+
+/**
+ * An incremental TAP 14 parser: it splits its input in lines and calls a
+ * function for each one as soon as it is complete. A line is parsed in the
+ * input when it can, and copied only if it spans two reads. The memory is
+ * constant whatever the length of the stream.
+ */
+struct tap_parser;
+
+/**
+ * Create a TAP parser.
+ * @note If the memory allocation fails, the program aborts.
+ * @param callback The function called for each line, then for the end.
+ * @param usrptr The last argument of `callback`.
+ */
+struct tap_parser *tap_parser_new(
+		void (*callback)(const struct tap_event *event, void *usrptr),
+		void *usrptr);
+
+/**
+ * Create a TAP parser that replays the test points of the top level on
+ * `result`, as the runner would report the tests: a child's output is
+ * reported by any result. The message, condition, file, line and assertions
+ * entries of a YAML block set the fields of the test, the others are kept
+ * in its diagnostic. The subtests are only reported through the test point
+ * that ends them, and a bail out as an error.
+ * @note If the memory allocation fails, the program aborts.
+ * @note The tests are reported by a test case on the stack, a result must
+ * not keep them past its stop_test function.
+ */
+struct tap_parser *tap_replay_new(struct test_result *result);
+
+/**
+ * Parse `len` bytes of the stream.
+ */
+void tap_parser_feed(struct tap_parser *parser, const void *buf, size_t len);
+
+/**
+ * Read the stream once from `fd` and parse what was read, in the buffer of
+ * the parser.
+ * @return The result of read(): 0 at the end of the stream, -1 on error.
+ */
+ssize_t tap_parser_read(struct tap_parser *parser, int fd);
+
+/**
+ * End the stream: parse its last line, even if it is not terminated, and
+ * send the TAP_END event.
+ */
+void tap_parser_end(struct tap_parser *parser);
+
+/**
+ * Free the parser.
+ */
+void tap_parser_free(struct tap_parser *parser);
+
 /**
  * Groups the required test arguments in a macro to hide the implementation
  * requirements.
@@ -86,6 +221,26 @@ struct test_result *tap_result_new(bool failfast, FILE *stream);
 #define _RESULTARG __result__
 #define TESTARGS struct test_case *_TESTARG, struct test_result *_RESULTARG
 
+/**
+ * The number of failed EXPECT_ assertions recorded for each thread. The
+ * failures past this limit are only counted.
+ */
+#define EXPECT_MAXFAILURES 32
+
+/**
+ * A failed EXPECT_ assertion.
+ */
+struct test_failure {
+	/** The message of the assertion. */
+	const char *msg;
+	/** The condition tested. */
+	const char *condition;
+	/** The name of the file where the assertion is located. */
+	const char *filename;
+	/** The line number in the file. */
+	unsigned int lineno;
+};
+
 /**
  * Define the common fields for the test_case types.
  */
@@ -104,11 +259,45 @@ struct test_result *tap_result_new(bool failfast, FILE *stream);
 	const char *filename; \
 	/** The line number in the file. */ \
 	unsigned int lineno; \
+	/** The number of assertions that passed. */ \
+	unsigned long assertions; \
+	/** The failed EXPECT_ assertions, in order. */ \
+	const struct test_failure *failures; \
+	/** The number of entries in `failures`. */ \
+	unsigned int nfailures; \
+	/** The number of failed EXPECT_ assertions not in `failures`. */ \
+	unsigned int overflow; \
+	/**
+	 * If not NULL, YAML lines, already indented, added to the diagnostic of
+	 * the test. The diagnostic is printed even if the test passes.
+	 */ \
+	const char *diag; \
+	/** If not NULL, passed to `func` in place of the usrptr of the suite. */ \
+	void *usrptr; \
+	/**
+	 * If not NULL, the resource limits of the test when it runs in its own
+	 * process, on top of the ones of the `-l` option.
+	 */ \
+	const struct test_limits *limits; \
+	/**
+	 * The namespaces of the test, a combination of test_sandbox flags. A
+	 * test with a sandbox always runs in its own process.
+	 */ \
+	unsigned int sandbox; \
 	void (*func)(struct test_case *test, struct test_result *result, \
 			void *usrptr); \
 	/** Run the test. All the arguments must be not NULL. */ \
 	void (*run)(struct test_case *test, struct test_suite *suite, \
 			struct test_result *result); \
+	/** Return the number of tests reported when the test case is run. */ \
+	unsigned int (*len)(struct test_case *test); \
+	/**
+	 * Run only the `i`-th of the tests counted by `len`, e.g. a row of a
+	 * parameterized test, for a runner that schedules them one by one.
+	 * All the arguments must be not NULL.
+	 */ \
+	void (*run_row)(struct test_case *test, unsigned int i, \
+			struct test_suite *suite, struct test_result *result); \
 	/**
 	 * Check that `condition` is true and update the result.
 	 * Don't use it directly but one of the ASSERT_ macros instead.
@@ -131,7 +320,43 @@ struct test_result *tap_result_new(bool failfast, FILE *stream);
 	 * @param lineno the line number in the file.
 	 */ \
 	void (*error)(struct test_case *test, struct test_result *result, \
-			const char *msg, const char *filename, unsigned int lineno);
+			const char *msg, const char *filename, unsigned int lineno); \
+	/**
+	 * Like assert_impl but record a failure and return: the test fails when
+	 * it ends. Don't use it directly but one of the EXPECT_ macros instead.
+	 */ \
+	void (*expect_impl)(struct test_case *test, struct test_result *result, \
+			bool pass, const char *condition, const char *msg, \
+			const char *filename, unsigned int lineno);
+
+/**
+ * The resource limits of a test that runs in its own process, see the `-i`
+ * and `-l` options. A field set to 0 leaves the limit unchanged.
+ */
+struct test_limits {
+	/** The size of the address space in bytes (RLIMIT_AS). */
+	unsigned long long as;
+	/** The CPU time in seconds (RLIMIT_CPU). */
+	unsigned long cpu;
+	/** The number of open files (RLIMIT_NOFILE). */
+	unsigned long nofile;
+};
+
+/**
+ * The namespaces that a test can run in, to not conflict with the tests
+ * running at the same time, e.g. on a port or a path. They are created
+ * through a user namespace and need no privilege. Where they are not
+ * available, the sandboxed tests of all the programs on the host run one
+ * at a time instead.
+ */
+enum test_sandbox {
+	/** A network namespace, with only its own loopback. */
+	SANDBOX_NET = 1,
+	/** A mount namespace, the mounts of the test are its own. */
+	SANDBOX_MOUNT = 2,
+	/** A mount namespace with an empty tmpfs on /tmp. */
+	SANDBOX_TMP = 4
+};
 
 /**
  * Represent the smallest unit of testing.
@@ -174,6 +399,28 @@ struct test_case *test_case_new_impl(const char *name, const char *skip,
 		const char *todo,
 		void (*func)(struct test_case *, struct test_result *, void *));
 
+/**
+ * Create a new test case that runs `func` once for each row of `table`, an
+ * array of `count` elements of `stride` bytes each. The row is passed to the
+ * function as `usrptr` and each row is reported as a separate test named
+ * `func[i]`. The rows share the same test case, they are not allocated.
+ * @note If the memory allocation fails, the program aborts.
+ * @param func The function to run as part of the test.
+ * @param table The array of the parameters.
+ * @param stride The size of each element of the array.
+ * @param count The number of elements of the array.
+ */
+#define test_case_param_new(func, table, stride, count) \
+	test_case_param_new_impl(#func, func, table, stride, count)
+
+/**
+ * Create a new parameterized test case.
+ * @note Don't use this function but the test_case_param_new macro.
+ */
+struct test_case *test_case_param_new_impl(const char *name,
+		void (*func)(struct test_case *, struct test_result *, void *),
+		const void *table, size_t stride, unsigned int count);
+
 /**
  * Define the common fields for the test_suite types.
  */
@@ -199,9 +446,14 @@ struct test_case *test_case_new_impl(const char *name, const char *skip,
 	void (*add_suite)(struct test_suite *suite, struct test_suite *suitec); \
 	/** Run all the tests of the suite. */ \
 	void (*run)(struct test_suite *suite, struct test_result *result); \
-	/** Return the number of the tests in the suite. */ \
+	/** Return the number of the tests in the suite or SUITE_LEN_UNKNOWN. */ \
 	unsigned int (*len)(struct test_suite *suite);
 
+/**
+ * The length of a suite whose tests are not known before they are run.
+ */
+#define SUITE_LEN_UNKNOWN ((unsigned int) -1)
+
 /**
  * A collection of test cases.
  * TODO: make it also a collection of suites.
@@ -216,6 +468,270 @@ struct test_suite {
  */
 struct test_suite *test_suite_new(void);
 
+/**
+ * Create a new suite whose tests are generated while the suite runs, one at a
+ * time. Only one test case is alive at any time, no matter how many tests the
+ * generator produces.
+ * For each test, `next` is called with a blank test case and must set at
+ * least its `name` and `func` fields, and optionally `usrptr`, `skip` and
+ * `todo`. The strings must be valid until the next call. `next` returns false
+ * when there are no more tests.
+ * @note If the memory allocation fails, the program aborts.
+ * @note The suite can be run only once.
+ * @param next The generator.
+ * @param state The first argument passed to `next`.
+ * @param len The number of tests generated or SUITE_LEN_UNKNOWN. In the
+ * latter case the TAP plan is printed after the tests.
+ */
+struct test_suite *generator_suite_new(bool (*next)(void *state,
+			struct test_case *test), void *state, unsigned int len);
+
+/**
+ * The name of the linker section where the TEST macros store their
+ * descriptors.
+ */
+#define TEST_SECTION unittest_tests
+
+/**
+ * The name of the symbol that every program or library that uses the TEST
+ * macros exports to let the loader find its tests.
+ */
+#define TEST_SECTION_SYMBOL "unittest_section"
+
+/**
+ * A read only file mapped in memory, shared by the suites that use it.
+ */
+struct test_fixture {
+	/** The path of the file. */
+	const char *path;
+	/** The content of the file, NULL if it is empty. */
+	const void *data;
+	/** The size of the file in bytes. */
+	size_t size;
+};
+
+/** How a file is mapped. */
+enum test_fixture_flags {
+	/** Read the file ahead, before the tests use it. */
+	FIXTURE_WILLNEED = 1,
+	/** Align the mapping to use transparent huge pages where available. */
+	FIXTURE_HUGEPAGES = 2
+};
+
+/**
+ * Map the file `path` read only, or return the mapping that already exists.
+ * The mapping is shared with the page cache: however many suites use the
+ * file, its content is in memory once, and the tests that run in their own
+ * process inherit the mapping instead of reading the file again.
+ * @note If the file can't be mapped, the program aborts.
+ * @param path The path of the file.
+ * @param flags A combination of test_fixture_flags values, used when the
+ * file is mapped for the first time.
+ * @return The mapping, to release with fixture_unmap.
+ */
+const struct test_fixture *fixture_map(const char *path, unsigned int flags);
+
+/** Release a mapping, the file is unmapped when its last user releases it. */
+void fixture_unmap(const struct test_fixture *fixture);
+
+/**
+ * A suite declared at compile time with TEST_SUITE.
+ */
+struct test_suite_desc {
+	/** The name of the suite. */
+	const char *name;
+	/** A documentation string. */
+	const char *doc;
+	/** If not NULL the suite is skipped. */
+	const char *skip;
+	/** Called before each test of the suite. */
+	void (*setup)(struct test_suite *suite);
+	/** Called after each test of the suite. */
+	void (*teardown)(struct test_suite *suite);
+	/** The test_sandbox flags of all the tests of the suite. */
+	unsigned int sandbox;
+	/** The file mapped for the tests of the suite or NULL. */
+	const char *mapping;
+	/** The test_fixture_flags of the mapping. */
+	unsigned int mapflags;
+};
+
+/**
+ * A test case declared at compile time with one of the TEST macros.
+ * The descriptors are constant and are collected by the linker in the
+ * TEST_SECTION section, registering a test does not cost anything at
+ * runtime. The alignment of the descriptors is forced to the one of the
+ * structure so that the section is a proper array.
+ */
+struct test_desc {
+	/** The name of the test. */
+	const char *name;
+	/** If not NULL the test is skipped. */
+	const char *skip;
+	/** If not NULL the reason why test (should) fail. */
+	const char *todo;
+	/** The suite the test belongs to. */
+	const struct test_suite_desc *suite;
+	/** The test function. */
+	void (*func)(struct test_case *test, struct test_result *result,
+			void *usrptr);
+	/** The resource limits of the test or NULL. */
+	const struct test_limits *limits;
+	/** The test_sandbox flags of the test. */
+	unsigned int sandbox;
+};
+
+/**
+ * The bounds of the TEST_SECTION section of a program or a library.
+ */
+struct test_section {
+	const struct test_desc *start;
+	const struct test_desc *stop;
+};
+
+#define _TEST_CONCAT(a, b) a ## b
+#define _TEST_START(section) _TEST_CONCAT(__start_, section)
+#define _TEST_STOP(section) _TEST_CONCAT(__stop_, section)
+#define _TEST_STRING(section) _TEST_STRING2(section)
+#define _TEST_STRING2(section) #section
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define _TEST_NO_REORDER no_reorder,
+#else
+#define _TEST_NO_REORDER
+#endif
+
+/**
+ * Declare the suite of the tests defined with the TEST macros in the current
+ * source file.
+ * It must be used once per file, before any TEST.
+ * @param sname The name of the suite.
+ * @param ssetup The setup function or NULL.
+ * @param steardown The teardown function or NULL.
+ */
+#define TEST_SUITE_FIXTURE(sname, ssetup, steardown) \
+	_TEST_SUITE_DESC(sname, NULL, ssetup, steardown, 0, NULL, 0)
+
+#define _TEST_SUITE_DESC(sname, sskip, ssetup, steardown, ssandbox, \
+		smapping, smapflags) \
+	extern const struct test_desc _TEST_START(TEST_SECTION)[] \
+		__attribute__((weak, visibility("hidden"))); \
+	extern const struct test_desc _TEST_STOP(TEST_SECTION)[] \
+		__attribute__((weak, visibility("hidden"))); \
+	const struct test_section unittest_section __attribute__((weak)) = { \
+		_TEST_START(TEST_SECTION), \
+		_TEST_STOP(TEST_SECTION) \
+	}; \
+	static const struct test_suite_desc _unittest_suite = { \
+		#sname, NULL, sskip, ssetup, steardown, ssandbox, smapping, \
+		smapflags \
+	}
+
+/**
+ * Declare the suite of the tests defined in the current source file.
+ * Look TEST_SUITE_FIXTURE for the details.
+ * @param sname The name of the suite.
+ */
+#define TEST_SUITE(sname) TEST_SUITE_FIXTURE(sname, NULL, NULL)
+
+/**
+ * Declare the suite of the tests defined in the current source file and
+ * skip all of them: as for a test_suite with a skip reason, they are not
+ * run nor counted.
+ * @param sname The name of the suite.
+ * @param reason Why the suite is skipped.
+ */
+#define TEST_SUITE_SKIP(sname, reason) \
+	_TEST_SUITE_DESC(sname, reason, NULL, NULL, 0, NULL, 0)
+
+/**
+ * Declare the suite of the tests defined in the current source file and
+ * run each of them in its own process, in the namespaces `flags`, a
+ * combination of test_sandbox values.
+ * @param sname The name of the suite.
+ * @param flags The namespaces of the tests.
+ */
+#define TEST_SUITE_SANDBOX(sname, flags) \
+	_TEST_SUITE_DESC(sname, NULL, NULL, NULL, flags, NULL, 0)
+
+/**
+ * Declare the suite of the tests defined in the current source file and
+ * pass them the file `path` mapped in memory, as a `const struct
+ * test_fixture *` in `usrptr`. See fixture_map.
+ * @param sname The name of the suite.
+ * @param path The path of the file.
+ * @param flags A combination of test_fixture_flags values.
+ */
+#define TEST_SUITE_MAPPED(sname, path, flags) \
+	_TEST_SUITE_DESC(sname, NULL, NULL, NULL, 0, path, flags)
+
+#define _TEST_DESC(tname, tskip, ttodo, tlimits, tsandbox) \
+	static void tname(TESTARGS, void *usrptr); \
+	static const struct test_desc _unittest_desc_ ## tname \
+		__attribute__((used, _TEST_NO_REORDER aligned(sizeof(void *)), \
+					section(_TEST_STRING(TEST_SECTION)))) = { \
+		#tname, tskip, ttodo, &_unittest_suite, tname, tlimits, tsandbox \
+	}; \
+	static void tname(TESTARGS, void *usrptr)
+
+/**
+ * Define and register a test case. The macro is followed by the body of the
+ * test:
+ *
+ *		TEST(test_success)
+ *		{
+ *			SUCCESS("hello world");
+ *		}
+ *
+ * The test function receives the usual `usrptr` argument.
+ * @param tname The name of the test.
+ */
+#define TEST(tname) _TEST_DESC(tname, NULL, NULL, NULL, 0)
+
+/**
+ * Define and register a test case that is skipped.
+ * @param tname The name of the test.
+ * @param reason The reason why the test must be skipped.
+ */
+#define TEST_SKIP(tname, reason) _TEST_DESC(tname, reason, NULL, NULL, 0)
+
+/**
+ * Define and register a test case that is expected to fail.
+ * @param tname The name of the test.
+ * @param reason The reason why the test fails.
+ */
+#define TEST_TODO(tname, reason) _TEST_DESC(tname, NULL, reason, NULL, 0)
+
+/**
+ * Define and register a test case with its own resource limits, applied
+ * when the tests run in isolated processes. The limits are the fields of a
+ * test_limits:
+ *
+ *		TEST_LIMITS(test_parse_huge, .as = 1ULL << 30, .cpu = 5)
+ *		{
+ *			...
+ *		}
+ *
+ * @param tname The name of the test.
+ */
+#define TEST_LIMITS(tname, ...) \
+	_TEST_DESC(tname, NULL, NULL, \
+			(&(const struct test_limits) { __VA_ARGS__ }), 0)
+
+/**
+ * Define and register a test case that runs in its own process, in the
+ * namespaces `flags`, a combination of test_sandbox values:
+ *
+ *		TEST_SANDBOX(test_server, SANDBOX_NET)
+ *		{
+ *			... bind 127.0.0.1:8080 ...
+ *		}
+ *
+ * @param tname The name of the test.
+ * @param flags The namespaces of the test.
+ */
+#define TEST_SANDBOX(tname, flags) _TEST_DESC(tname, NULL, NULL, NULL, flags)
+
 /**
  * Define the common fields for the test_runner types.
  */
@@ -260,7 +776,8 @@ struct test_runner *tap_runner_new(int verbosity, bool failfast, bool buffered,
 /**
  * The loader loads the tests to run.
  * The default implementation search in the main program for the function
- * `load_test_suite()` and, if found, run it.
+ * `load_test_suite()` and, if found, run it. The tests registered with the
+ * TEST macros are loaded too.
  */
 struct test_loader {
 	LOADER_HEAD
@@ -272,6 +789,20 @@ struct test_loader {
  */
 struct test_loader *test_loader_new(void);
 
+/**
+ * Create a new test_loader that, in addition to what the default loader does,
+ * registers as test cases all the global functions whose names start with
+ * `prefix`.
+ * The functions are discovered reading the symbol table of the main program
+ * and of the libraries, the result is cached using the build-id of the object
+ * as key. The cache is in `$XDG_CACHE_HOME/libunittest` or in the directory
+ * named by the `UNITTEST_CACHE_DIR` environment variable, if it is empty the
+ * cache is disabled.
+ * @note If the memory allocation fails, the program aborts.
+ * @param prefix The prefix of the test functions, i.e. `"test_"`.
+ */
+struct test_loader *symbol_loader_new(const char *prefix);
+
 /**
  * A loader implementation that load a single function as test case.
  */
@@ -335,6 +866,35 @@ int test_main(int argc, char *argv[], struct test_runner *runner,
 int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
 		char *argv[]);
 
+#if defined(__GNUC__)
+#define _TEST_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define _TEST_UNLIKELY(x) (x)
+#endif
+
+/**
+ * Evaluate `cond` inline and call `impl` out of line only if the assertion
+ * fails or the result records every assertion. A passing assertion is just
+ * counted. Don't use it directly but one of the ASSERT_ or EXPECT_ macros
+ * instead.
+ */
+#define _CHECK(impl, cond, condition, msg) do { \
+	bool _unittest_pass_ = (cond); \
+	if (_TEST_UNLIKELY(!_unittest_pass_ || _RESULTARG->record)) \
+		_TESTARG->impl(_TESTARG, \
+				_RESULTARG, \
+				_unittest_pass_, \
+				condition, \
+				msg, \
+				__FILE__, \
+				__LINE__); \
+	else \
+		_TESTARG->assertions++; \
+} while(0)
+
+#define _ASSERT(cond, condition, msg) _CHECK(assert_impl, cond, condition, msg)
+#define _EXPECT(cond, condition, msg) _CHECK(expect_impl, cond, condition, msg)
+
 /**
  * A test that always pass.
  * @param msg A message to print.
@@ -372,6 +932,12 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
 			__LINE__); \
 } while(0)
 
+#define _CHECK_EQUAL(check, first, second, msg) do { \
+	check((first) == (second), \
+			"(" #first ") == (" #second ")", \
+			msg); \
+} while(0)
+
 /**
  * Test that the `first` and `second` parameters are equal.
  * @note If it fails, it does not return.
@@ -379,14 +945,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second member of the comparition.
  * @param msg A message to print.
  */
-#define ASSERT_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(first) == (second), \
-			"(" #first ") == (" #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_EQUAL(first, second, msg) \
+	_CHECK_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_EQUAL but the test goes on after a failure. */
+#define EXPECT_EQUAL(first, second, msg) \
+	_CHECK_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_NOT_EQUAL(check, first, second, msg) do { \
+	check((first) != (second), \
+			"(" #first ") != (" #second ")", \
+			msg); \
 } while(0)
 
 /**
@@ -396,14 +965,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second member of the comparition.
  * @param msg A message to print.
  */
-#define ASSERT_NOT_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(first) != (second), \
-			"(" #first ") != (" #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_NOT_EQUAL(first, second, msg) \
+	_CHECK_NOT_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_NOT_EQUAL but the test goes on after a failure. */
+#define EXPECT_NOT_EQUAL(first, second, msg) \
+	_CHECK_NOT_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_PTR_EQUAL(check, first, second, msg) do { \
+	check((const void *)(first) == (const void *)(second), \
+			"(const void *)(" #first ") == (const void *)(" #second ")", \
+			msg); \
 } while(0)
 
 /**
@@ -413,14 +985,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second pointer.
  * @param msg A message to print.
  */
-#define ASSERT_PTR_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(const void *)(first) == (const void *)(second), \
-			"(const void *)(" #first ") == (const void *)(" #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_PTR_EQUAL(first, second, msg) \
+	_CHECK_PTR_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_PTR_EQUAL but the test goes on after a failure. */
+#define EXPECT_PTR_EQUAL(first, second, msg) \
+	_CHECK_PTR_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_PTR_NOT_EQUAL(check, first, second, msg) do { \
+	check((const void *)(first) != (const void *)(second), \
+			"(const void *)(" #first ") != (const void *)(" #second ")", \
+			msg); \
 } while(0)
 
 /**
@@ -430,14 +1005,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second pointer.
  * @param msg A message to print.
  */
-#define ASSERT_PTR_NOT_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(const void *)(first) != (const void *)(second), \
-			"(const void *)(" #first ") != (const void *)(" #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_PTR_NOT_EQUAL(first, second, msg) \
+	_CHECK_PTR_NOT_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_PTR_NOT_EQUAL but the test goes on after a failure. */
+#define EXPECT_PTR_NOT_EQUAL(first, second, msg) \
+	_CHECK_PTR_NOT_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_PTR_NULL(check, ptr, msg) do { \
+	check((const void *)(ptr) == NULL, \
+			"(const void *)(" #ptr ") == NULL", \
+			msg); \
 } while(0)
 
 /**
@@ -446,14 +1024,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param ptr The pointer to test.
  * @param msg A message to print.
  */
-#define ASSERT_PTR_NULL(ptr, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(const void *)(ptr) == NULL, \
-			"(const void *)(" #ptr ") == NULL", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_PTR_NULL(ptr, msg) \
+	_CHECK_PTR_NULL(_ASSERT, ptr, msg)
+
+/** Like ASSERT_PTR_NULL but the test goes on after a failure. */
+#define EXPECT_PTR_NULL(ptr, msg) \
+	_CHECK_PTR_NULL(_EXPECT, ptr, msg)
+
+#define _CHECK_PTR_NOT_NULL(check, ptr, msg) do { \
+	check((const void *)(ptr) != NULL, \
+			"(const void *)(" #ptr ") != NULL", \
+			msg); \
 } while(0)
 
 /**
@@ -462,14 +1043,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param ptr The pointer to test.
  * @param msg A message to print.
  */
-#define ASSERT_PTR_NOT_NULL(ptr, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			(const void *)(ptr) != NULL, \
-			"(const void *)(" #ptr ") != NULL", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_PTR_NOT_NULL(ptr, msg) \
+	_CHECK_PTR_NOT_NULL(_ASSERT, ptr, msg)
+
+/** Like ASSERT_PTR_NOT_NULL but the test goes on after a failure. */
+#define EXPECT_PTR_NOT_NULL(ptr, msg) \
+	_CHECK_PTR_NOT_NULL(_EXPECT, ptr, msg)
+
+#define _CHECK_STRING_EQUAL(check, first, second, msg) do { \
+	check(strcmp((const char *)(first), (const char *)(second)) == 0, \
+			"strcmp(" #first ", " #second ") == 0", \
+			msg); \
 } while(0)
 
 /**
@@ -479,14 +1063,17 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second string.
  * @param msg A message to print.
  */
-#define ASSERT_STRING_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			strcmp((const char *)(first) == (const char *)(second)), \
-			"strcmp(" #first " == " #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_STRING_EQUAL(first, second, msg) \
+	_CHECK_STRING_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_STRING_EQUAL but the test goes on after a failure. */
+#define EXPECT_STRING_EQUAL(first, second, msg) \
+	_CHECK_STRING_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_STRING_NOT_EQUAL(check, first, second, msg) do { \
+	check(strcmp((const char *)(first), (const char *)(second)) != 0, \
+			"strcmp(" #first ", " #second ") != 0", \
+			msg); \
 } while(0)
 
 /**
@@ -496,14 +1083,19 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second string.
  * @param msg A message to print.
  */
-#define ASSERT_STRING_NOT_EQUAL(first, second, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			strcmp((const char *)(first) != (const char *)(second)), \
-			"strcmp(" #first " != " #second ")", \
-			msg, \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_STRING_NOT_EQUAL(first, second, msg) \
+	_CHECK_STRING_NOT_EQUAL(_ASSERT, first, second, msg)
+
+/** Like ASSERT_STRING_NOT_EQUAL but the test goes on after a failure. */
+#define EXPECT_STRING_NOT_EQUAL(first, second, msg) \
+	_CHECK_STRING_NOT_EQUAL(_EXPECT, first, second, msg)
+
+#define _CHECK_ALMOST_EQUAL(check, first, second, delta, msg) do { \
+	check(fabs((double) (first) - (double) (second)) <= \
+				fabs((double) (delta)), \
+			"fabs((double) (" #first ") - (double) (" #second ")) <= " \
+				"fabs((double) " #delta ")", \
+			msg); \
 } while(0)
 
 /**
@@ -514,15 +1106,19 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second number.
  * @param msg A message to print.
  */
-#define ASSERT_ALMOST_EQUAL(first, second, delta, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			fabs((double) (first) - (double) (second)) <= \
-				fabs((double) delta), \
-			"fabs((double) (" #first ") - (double) (" #second ")) <= " \
+#define ASSERT_ALMOST_EQUAL(first, second, delta, msg) \
+	_CHECK_ALMOST_EQUAL(_ASSERT, first, second, delta, msg)
+
+/** Like ASSERT_ALMOST_EQUAL but the test goes on after a failure. */
+#define EXPECT_ALMOST_EQUAL(first, second, delta, msg) \
+	_CHECK_ALMOST_EQUAL(_EXPECT, first, second, delta, msg)
+
+#define _CHECK_NOT_ALMOST_EQUAL(check, first, second, delta, msg) do { \
+	check(fabs((double) (first) - (double) (second)) > \
+				fabs((double) (delta)), \
+			"fabs((double) (" #first ") - (double) (" #second ")) > " \
 				"fabs((double) " #delta ")", \
-			__FILE__, \
-			__LINE__); \
+			msg); \
 } while(0)
 
 /**
@@ -533,15 +1129,821 @@ int run_tests(struct test_runner *runner, struct test_loader *loader, int argc,
  * @param second The second number.
  * @param msg A message to print.
  */
-#define ASSERT_NOT_ALMOST_EQUAL(first, second, delta, msg) do { \
-	_TESTARG->assert_impl(_TESTARG, \
-			_RESULTARG, \
-			fabs((double) (first) - (double) (second)) > \
-				fabs((double) delta), \
-			"fabs((double) (" #first ") - (double) (" #second ")) > " \
-				"fabs((double) " #delta ")", \
-			__FILE__, \
-			__LINE__); \
+#define ASSERT_NOT_ALMOST_EQUAL(first, second, delta, msg) \
+	_CHECK_NOT_ALMOST_EQUAL(_ASSERT, first, second, delta, msg)
+
+/** Like ASSERT_NOT_ALMOST_EQUAL but the test goes on after a failure. */
+#define EXPECT_NOT_ALMOST_EQUAL(first, second, delta, msg) \
+	_CHECK_NOT_ALMOST_EQUAL(_EXPECT, first, second, delta, msg)
+
+/**
+ * Return the offset of the first byte that differs between the two buffers or
+ * `len` if they are equal. The comparison runs with the widest vector
+ * instructions supported by the CPU.
+ */
+size_t mem_mismatch(const void *first, const void *second, size_t len);
+
+/**
+ * Format the failure message of ASSERT_MEM_EQUAL: the number of differing
+ * bytes and a hexdump of both buffers around the first mismatch.
+ * @return A thread local buffer, overwritten by the next call.
+ */
+const char *mem_diff(const char *msg, const void *first, const void *second,
+		size_t len, size_t offset);
+
+#define _CHECK_MEM_EQUAL(check, first, second, len, msg) do { \
+	const void *_unittest_first_ = (first), *_unittest_second_ = (second); \
+	size_t _unittest_len_ = (len), _unittest_off_; \
+	_unittest_off_ = mem_mismatch(_unittest_first_, _unittest_second_, \
+			_unittest_len_); \
+	check(_unittest_off_ == _unittest_len_, \
+			"memcmp(" #first ", " #second ", " #len ") == 0", \
+			_unittest_off_ == _unittest_len_ ? (msg) : \
+				mem_diff(msg, _unittest_first_, _unittest_second_, \
+					_unittest_len_, _unittest_off_)); \
+} while(0)
+
+/**
+ * Test that the first `len` bytes of the two buffers are equal. On failure
+ * the message reports the offset of the first mismatch, the number of
+ * differing bytes and a hexdump of the two buffers around it.
+ * @note If it fails, it does not return.
+ * @param first The first buffer.
+ * @param second The second buffer.
+ * @param len The number of bytes to compare.
+ * @param msg A message to print.
+ */
+#define ASSERT_MEM_EQUAL(first, second, len, msg) \
+	_CHECK_MEM_EQUAL(_ASSERT, first, second, len, msg)
+
+/** Like ASSERT_MEM_EQUAL but the test goes on after a failure. */
+#define EXPECT_MEM_EQUAL(first, second, len, msg) \
+	_CHECK_MEM_EQUAL(_EXPECT, first, second, len, msg)
+
+/**
+ * Compare `len` bytes of `buf` with the golden file `path`. If the program
+ * runs with -U, a golden file that does not match or does not exist is
+ * replaced with `buf` instead, by a rename: the tests that read it at the
+ * same time see either the old or the new content.
+ * @return NULL if the buffer matches or the golden file was updated,
+ * otherwise the failure message in a thread local buffer, overwritten by
+ * the next call.
+ */
+const char *golden_check(const void *buf, size_t len, const char *path,
+		const char *msg);
+
+#define _CHECK_GOLDEN(check, buf, len, path, msg) do { \
+	const char *_unittest_fail_ = golden_check(buf, len, path, msg); \
+	check(_unittest_fail_ == NULL, \
+			"golden(" #buf ", " #len ") == " #path, \
+			_unittest_fail_ == NULL ? (msg) : _unittest_fail_); \
 } while(0)
 
+/**
+ * Test that the first `len` bytes of `buf` are the content of the golden
+ * file `path`. The file is mapped and compared in place. On failure the
+ * message reports the line and the column of the first difference and
+ * quotes the line on both sides. Run the program with -U to rewrite the
+ * golden files that do not match.
+ * @note If it fails, it does not return.
+ * @param buf The output to check.
+ * @param len The number of bytes of the output.
+ * @param path The path of the golden file.
+ * @param msg A message to print.
+ */
+#define ASSERT_MATCHES_GOLDEN(buf, len, path, msg) \
+	_CHECK_GOLDEN(_ASSERT, buf, len, path, msg)
+
+/** Like ASSERT_MATCHES_GOLDEN but the test goes on after a failure. */
+#define EXPECT_MATCHES_GOLDEN(buf, len, path, msg) \
+	_CHECK_GOLDEN(_EXPECT, buf, len, path, msg)
+
+/** The comparisons of the floating point arrays. */
+enum array_cmp {
+	ARRAY_NEAR_F32,
+	ARRAY_NEAR_F64,
+	ARRAY_ULP_F32,
+	ARRAY_ULP_F64
+};
+
+/**
+ * Return the number of elements of the two arrays that differ. For the NEAR
+ * comparisons two elements differ if `|a - b| > max(tol, reltol * max(|a|,
+ * |b|))`; for the ULP ones if they are more than `tol` representable numbers
+ * apart (`reltol` is unused). In both cases two NaN are equal and a NaN
+ * differs from any number. The comparison runs with the widest vector
+ * instructions supported by the CPU.
+ */
+size_t array_violations(enum array_cmp cmp, const void *first,
+		const void *second, size_t n, double tol, double reltol);
+
+/**
+ * Format the failure message of the ASSERT_ARRAY_ macros: the number of
+ * elements that differ, the worst one and its error.
+ * @return A thread local buffer, overwritten by the next call.
+ */
+const char *array_diff(enum array_cmp cmp, const char *msg, const void *first,
+		const void *second, size_t n, double tol, double reltol);
+
+#define _CHECK_ARRAY(check, cmp, type, first, second, n, tol, reltol, \
+		condition, msg) do { \
+	const type *_unittest_first_ = (first), *_unittest_second_ = (second); \
+	size_t _unittest_n_ = (n), _unittest_bad_; \
+	double _unittest_tol_ = (tol), _unittest_reltol_ = (reltol); \
+	_unittest_bad_ = array_violations(cmp, _unittest_first_, \
+			_unittest_second_, _unittest_n_, _unittest_tol_, \
+			_unittest_reltol_); \
+	check(_unittest_bad_ == 0, \
+			condition, \
+			_unittest_bad_ == 0 ? (msg) : \
+				array_diff(cmp, msg, _unittest_first_, _unittest_second_, \
+					_unittest_n_, _unittest_tol_, _unittest_reltol_)); \
+} while(0)
+
+/**
+ * Test that the two arrays of `float` are equal within the tolerance: each
+ * pair of elements must satisfy `|a - b| <= max(abstol, reltol * max(|a|,
+ * |b|))`. Two NaN are equal. On failure the message reports the number of
+ * elements out of tolerance and the worst one.
+ * @note If it fails, it does not return.
+ * @param first The first array.
+ * @param second The second array.
+ * @param n The number of elements.
+ * @param abstol The absolute tolerance.
+ * @param reltol The tolerance relative to the larger of the two elements.
+ * @param msg A message to print.
+ */
+#define ASSERT_ARRAY_NEAR_F32(first, second, n, abstol, reltol, msg) \
+	_CHECK_ARRAY(_ASSERT, ARRAY_NEAR_F32, float, first, second, n, \
+			abstol, reltol, \
+			"near(" #first ", " #second ", " #n ", " #abstol ", " \
+				#reltol ")", \
+			msg)
+
+/** Like ASSERT_ARRAY_NEAR_F32 but the test goes on after a failure. */
+#define EXPECT_ARRAY_NEAR_F32(first, second, n, abstol, reltol, msg) \
+	_CHECK_ARRAY(_EXPECT, ARRAY_NEAR_F32, float, first, second, n, \
+			abstol, reltol, \
+			"near(" #first ", " #second ", " #n ", " #abstol ", " \
+				#reltol ")", \
+			msg)
+
+/**
+ * Test that the two arrays of `double` are equal within the tolerance.
+ * See ASSERT_ARRAY_NEAR_F32.
+ */
+#define ASSERT_ARRAY_NEAR_F64(first, second, n, abstol, reltol, msg) \
+	_CHECK_ARRAY(_ASSERT, ARRAY_NEAR_F64, double, first, second, n, \
+			abstol, reltol, \
+			"near(" #first ", " #second ", " #n ", " #abstol ", " \
+				#reltol ")", \
+			msg)
+
+/** Like ASSERT_ARRAY_NEAR_F64 but the test goes on after a failure. */
+#define EXPECT_ARRAY_NEAR_F64(first, second, n, abstol, reltol, msg) \
+	_CHECK_ARRAY(_EXPECT, ARRAY_NEAR_F64, double, first, second, n, \
+			abstol, reltol, \
+			"near(" #first ", " #second ", " #n ", " #abstol ", " \
+				#reltol ")", \
+			msg)
+
+/**
+ * Test that the elements of the two arrays of `float` are at most `ulps`
+ * representable numbers apart. Two NaN are equal.
+ * @note If it fails, it does not return.
+ * @param first The first array.
+ * @param second The second array.
+ * @param n The number of elements.
+ * @param ulps The maximum distance in units in the last place.
+ * @param msg A message to print.
+ */
+#define ASSERT_ARRAY_ULP_F32(first, second, n, ulps, msg) \
+	_CHECK_ARRAY(_ASSERT, ARRAY_ULP_F32, float, first, second, n, \
+			ulps, 0.0, \
+			"ulp(" #first ", " #second ", " #n ") <= " #ulps, \
+			msg)
+
+/** Like ASSERT_ARRAY_ULP_F32 but the test goes on after a failure. */
+#define EXPECT_ARRAY_ULP_F32(first, second, n, ulps, msg) \
+	_CHECK_ARRAY(_EXPECT, ARRAY_ULP_F32, float, first, second, n, \
+			ulps, 0.0, \
+			"ulp(" #first ", " #second ", " #n ") <= " #ulps, \
+			msg)
+
+/**
+ * Test that the elements of the two arrays of `double` are at most `ulps`
+ * representable numbers apart. See ASSERT_ARRAY_ULP_F32.
+ */
+#define ASSERT_ARRAY_ULP_F64(first, second, n, ulps, msg) \
+	_CHECK_ARRAY(_ASSERT, ARRAY_ULP_F64, double, first, second, n, \
+			ulps, 0.0, \
+			"ulp(" #first ", " #second ", " #n ") <= " #ulps, \
+			msg)
+
+/** Like ASSERT_ARRAY_ULP_F64 but the test goes on after a failure. */
+#define EXPECT_ARRAY_ULP_F64(first, second, n, ulps, msg) \
+	_CHECK_ARRAY(_EXPECT, ARRAY_ULP_F64, double, first, second, n, \
+			ulps, 0.0, \
+			"ulp(" #first ", " #second ", " #n ") <= " #ulps, \
+			msg)
+
+/** How the child of a death test must end. */
+enum death_how {
+	DEATH_EXITS,
+	DEATH_SIGNALS
+};
+
+/** What the child of a death test tells the test, in a shared mapping. */
+struct death_shared {
+	/** Set by the child if the statement returned. */
+	volatile bool returned;
+	/** Set by the child if an assertion of the statement failed. */
+	volatile bool failed;
+};
+
+/**
+ * A death test in progress. Don't use it directly but ASSERT_EXITS or
+ * ASSERT_SIGNALS instead.
+ */
+struct death_test {
+	/** The child that runs the statement. */
+	pid_t pid;
+	/** The file where the child writes its standard error. */
+	int fd;
+	/** The memory shared with the child. */
+	struct death_shared *shared;
+};
+
+/** Prepare a death test, before the child starts. */
+void death_start(struct death_test *death);
+
+/** Prepare the child of a death test, before it runs the statement. */
+void death_child(struct death_test *death);
+
+/** End the child of a death test whose statement returned. */
+void death_returned(struct death_test *death);
+
+/**
+ * Wait for the child of a death test and check how it ended and, if
+ * `pattern` is not NULL, that its standard error matches the extended
+ * regular expression `pattern`.
+ * @return NULL if the child ended as expected, otherwise the failure
+ * message in a thread local buffer, overwritten by the next call.
+ */
+const char *death_end(struct death_test *death, enum death_how how,
+		int value, const char *pattern, const char *msg);
+
+/*
+ * The child comes from fork: its exit runs the exit handlers and flushes
+ * the streams of its own copy of the test, and the other threads of the
+ * test, absent from the child, hold none of its locks. In exchange, the
+ * fork copies the page tables, a cost that grows with the heap.
+ */
+#define _CHECK_DEATH(check, stmt, how, value, pattern, condition, msg) do { \
+	struct death_test _unittest_death_; \
+	const char *_unittest_fail_; \
+	death_start(&_unittest_death_); \
+	if ((_unittest_death_.pid = fork()) == 0) { \
+		death_child(&_unittest_death_); \
+		stmt; \
+		death_returned(&_unittest_death_); \
+	} \
+	_unittest_fail_ = death_end(&_unittest_death_, how, value, pattern, \
+			msg); \
+	check(_unittest_fail_ == NULL, condition, \
+			_unittest_fail_ == NULL ? (msg) : _unittest_fail_); \
+} while(0)
+
+/**
+ * Test that `stmt` makes the program exit with `status`. The statement runs
+ * in a child process from fork(2), hence what it changes is lost for the
+ * test, and an exit(3) runs the exit handlers of the program in the child
+ * only. The standard output of the child is discarded and its standard
+ * error is captured.
+ * @note If it fails, it does not return.
+ * @param stmt The statement, it can be a block.
+ * @param status The expected exit status.
+ * @param pattern If not NULL, an extended regular expression that the
+ * standard error of the child must match.
+ * @param msg A message to print.
+ */
+#define ASSERT_EXITS(stmt, status, pattern, msg) \
+	_CHECK_DEATH(_ASSERT, stmt, DEATH_EXITS, status, pattern, \
+			"exits(" #stmt ") == " #status, msg)
+
+/** Like ASSERT_EXITS but the test goes on after a failure. */
+#define EXPECT_EXITS(stmt, status, pattern, msg) \
+	_CHECK_DEATH(_EXPECT, stmt, DEATH_EXITS, status, pattern, \
+			"exits(" #stmt ") == " #status, msg)
+
+/**
+ * Test that `stmt` kills the program with the signal `sig`, e.g. SIGABRT
+ * for a failed assert(3). See ASSERT_EXITS.
+ * @note If it fails, it does not return.
+ * @param stmt The statement, it can be a block.
+ * @param sig The expected signal.
+ * @param pattern If not NULL, an extended regular expression that the
+ * standard error of the child must match.
+ * @param msg A message to print.
+ */
+#define ASSERT_SIGNALS(stmt, sig, pattern, msg) \
+	_CHECK_DEATH(_ASSERT, stmt, DEATH_SIGNALS, sig, pattern, \
+			"signals(" #stmt ") == " #sig, msg)
+
+/** Like ASSERT_SIGNALS but the test goes on after a failure. */
+#define EXPECT_SIGNALS(stmt, sig, pattern, msg) \
+	_CHECK_DEATH(_EXPECT, stmt, DEATH_SIGNALS, sig, pattern, \
+			"signals(" #stmt ") == " #sig, msg)
+
+/**
+ * Run the rest of the test on a virtual clock. The clocks of
+ * clock_gettime(2), except the CPU time ones, gettimeofday(2) and time(2)
+ * stand still, and nanosleep(2), clock_nanosleep(2), usleep(3) and
+ * sleep(3) return at once, having moved the clock forward by the time they
+ * should have waited. So do poll(2) and epoll_wait(2) when no descriptor is
+ * ready, a wait without timeout stays real. The clock is shared by the
+ * threads of the test and goes back to the real time when the next test
+ * starts. Calling it again restarts the clock at the real time.
+ * @note The program must call the functions of the C library, not the
+ * system calls. In a static program, the real clock is read with the system
+ * calls instead of the vDSO, hence more slowly.
+ */
+void vclock_start(void);
+
+/** Move the virtual clock forward by `ns` nanoseconds. */
+void vclock_advance(uint64_t ns);
+
+/** Return the nanoseconds elapsed on the virtual clock since it started. */
+uint64_t vclock_elapsed(void);
+
+/**
+ * Return the scratch directory of the running test, created on the first
+ * call. It is on a tmpfs if one is writable, $TMPDIR or /dev/shm, and it is
+ * private to the test, even when several programs run at once. It is
+ * removed with all its files when the test ends, unless the test failed
+ * and the program runs with -k. Any thread of the test can call it with
+ * its view of the test.
+ * @param test The running test.
+ * @return The path of the directory, valid until the test ends.
+ */
+const char *test_case_scratch(struct test_case *test);
+
+/** The scratch directory of the running test, see test_case_scratch. */
+#define SCRATCH_DIR() test_case_scratch(_TESTARG)
+
+/**
+ * The state of the pseudo random number generator of the property tests
+ * (xoshiro256**).
+ */
+struct prop_rng {
+	uint64_t s[4];
+};
+
+/** Seed the generator. */
+void prop_rng_seed(struct prop_rng *rng, uint64_t seed);
+
+/** Return the next 64 random bits. */
+uint64_t prop_rng_next(struct prop_rng *rng);
+
+/** Return a random integer between `min` and `max` inclusive. */
+long long prop_rng_range(struct prop_rng *rng, long long min, long long max);
+
+/**
+ * A generator of random values for the property tests. The generators are
+ * composable: PROP_ARRAY generates arrays of values of another generator.
+ */
+struct prop_gen {
+	/** The size in bytes of a value. */
+	size_t size;
+	/** Store a random value in `value`. */
+	void (*generate)(const struct prop_gen *gen, struct prop_rng *rng,
+			void *value);
+	/**
+	 * Store in `candidate` the k-th simpler version of `value`, the first
+	 * candidates are the simplest ones. Return false if there are no more
+	 * candidates. If NULL, the values are not shrunk.
+	 */
+	bool (*shrink)(const struct prop_gen *gen, const void *value,
+			unsigned int k, void *candidate);
+	/** Print `value` like snprintf(). */
+	int (*print)(const struct prop_gen *gen, const void *value, char *buf,
+			size_t len);
+	/** The range of the integer generators. */
+	long long min, max;
+	/** The range of the floating point generators. */
+	double dmin, dmax;
+	/** The generator of the elements of the arrays. */
+	const struct prop_gen *elem;
+	/** The maximum length of the arrays. */
+	size_t maxlen;
+};
+
+/**
+ * The value generated by PROP_ARRAY.
+ */
+struct prop_array {
+	/** The number of elements. */
+	size_t len;
+	/** The elements. */
+	char data[];
+};
+
+/** How many simpler candidates of an element an array tries. */
+#define PROP_ARRAY_SHRINKS 8
+
+void prop_int_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value);
+bool prop_int_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate);
+int prop_int_print(const struct prop_gen *gen, const void *value, char *buf,
+		size_t len);
+void prop_double_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value);
+bool prop_double_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate);
+int prop_double_print(const struct prop_gen *gen, const void *value,
+		char *buf, size_t len);
+void prop_array_generate(const struct prop_gen *gen, struct prop_rng *rng,
+		void *value);
+bool prop_array_shrink(const struct prop_gen *gen, const void *value,
+		unsigned int k, void *candidate);
+int prop_array_print(const struct prop_gen *gen, const void *value,
+		char *buf, size_t len);
+
+#define _PROP_INTEGER(type, lo, hi) (&(const struct prop_gen) { \
+	.size = sizeof(type), \
+	.generate = prop_int_generate, \
+	.shrink = prop_int_shrink, \
+	.print = prop_int_print, \
+	.min = (lo), \
+	.max = (hi), \
+})
+
+/** Generate an `int` between `lo` and `hi` inclusive. */
+#define PROP_INT(lo, hi) _PROP_INTEGER(int, lo, hi)
+
+/** Generate a `long long` between `lo` and `hi` inclusive. */
+#define PROP_LONG(lo, hi) _PROP_INTEGER(long long, lo, hi)
+
+/** Generate an `unsigned char`. */
+#define PROP_BYTE() _PROP_INTEGER(unsigned char, 0, 255)
+
+/** Generate a `double` between `lo` and `hi`. */
+#define PROP_DOUBLE(lo, hi) (&(const struct prop_gen) { \
+	.size = sizeof(double), \
+	.generate = prop_double_generate, \
+	.shrink = prop_double_shrink, \
+	.print = prop_double_print, \
+	.dmin = (lo), \
+	.dmax = (hi), \
+})
+
+/**
+ * Generate a struct prop_array of at most `n` elements generated by `gen`.
+ */
+#define PROP_ARRAY(gen, n) (&(const struct prop_gen) { \
+	.size = sizeof(struct prop_array) + (n) * (gen)->size, \
+	.generate = prop_array_generate, \
+	.shrink = prop_array_shrink, \
+	.print = prop_array_print, \
+	.elem = (gen), \
+	.maxlen = (n), \
+})
+
+/** Generate an array of at most `n` bytes. */
+#define PROP_BYTES(n) PROP_ARRAY(PROP_BYTE(), n)
+
+/**
+ * Run the property `body` over random inputs.
+ * @note Don't use this function directly but the PROPERTY macro instead.
+ */
+void property_check(struct test_case *test, struct test_result *result,
+		const struct prop_gen *const *gens, unsigned int ngens,
+		void (*body)(struct test_case *, struct test_result *, void *const *));
+
+#define _PROPARGS __propargs__
+
+/**
+ * Define a property test. The macro is followed by the body of the property,
+ * that uses the ASSERT_ macros as any test and gets its inputs with PROP_ARG:
+ *
+ *		PROPERTY(test_reverse, PROP_ARRAY(PROP_INT(-100, 100), 32))
+ *		{
+ *			struct prop_array *a = &PROP_ARG(struct prop_array, 0);
+ *			...
+ *		}
+ *
+ * The result is a test function named `pname` that runs the body over random
+ * inputs created by the generators, many iterations in parallel across the
+ * cores. The first failing input is shrunk to a minimal counterexample that
+ * is reported along with the seed, which replays the run if passed to the
+ * `-s` option of test_main. The `-n` and `-t` options of test_main set the
+ * number of iterations and the time budget of each property.
+ * @param pname The name of the test.
+ * @param ... The generators of the inputs.
+ */
+#define PROPERTY(pname, ...) \
+	static void pname ## _property(TESTARGS, void *const *_PROPARGS); \
+	static void pname(TESTARGS, void *usrptr) \
+	{ \
+		const struct prop_gen *const _gens[] = { __VA_ARGS__ }; \
+		property_check(_TESTARG, _RESULTARG, _gens, \
+				sizeof(_gens) / sizeof(_gens[0]), pname ## _property); \
+	} \
+	static void pname ## _property(TESTARGS, void *const *_PROPARGS)
+
+/**
+ * The i-th input of a property.
+ * @param type The type of the input.
+ * @param i The index of the generator.
+ */
+#define PROP_ARG(type, i) (*(type *) _PROPARGS[i])
+
+/** The values below 2^BENCH_HIST_BITS are exact, the others within 1/64. */
+#define BENCH_HIST_BITS 7
+/** The values from 2^BENCH_HIST_MAXBITS ns, about 5 hours, are clamped. */
+#define BENCH_HIST_MAXBITS 44
+#define BENCH_HIST_BUCKETS \
+	((BENCH_HIST_MAXBITS - BENCH_HIST_BITS + 2) << (BENCH_HIST_BITS - 1))
+
+/**
+ * A log-linear histogram of latencies in ns, as in HdrHistogram. Its size is
+ * constant and recording a value never allocates.
+ */
+struct bench_histogram {
+	/** The number of values recorded. */
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	/** The sum of the values, for the mean. */
+	double sum;
+	uint64_t buckets[BENCH_HIST_BUCKETS];
+};
+
+/** Remove the values of the histogram. */
+void bench_histogram_reset(struct bench_histogram *histogram);
+
+/** Record a value in the histogram. */
+void bench_histogram_record(struct bench_histogram *histogram, uint64_t value);
+
+/** Add the values of the histogram `src` to the histogram `dst`. */
+void bench_histogram_merge(struct bench_histogram *dst,
+		const struct bench_histogram *src);
+
+/**
+ * Return the value below which `percentile` percent of the values fall, e.g.
+ * 99.9, or 0 if the histogram is empty.
+ */
+uint64_t bench_histogram_percentile(const struct bench_histogram *histogram,
+		double percentile);
+
+/**
+ * The state of a running benchmark. A benchmark body runs its operation
+ * BENCH_N times:
+ *
+ *		BENCHMARK(bench_sum)
+ *		{
+ *			unsigned long long i;
+ *
+ *			for (i = 0; i < BENCH_N; i++)
+ *				sum(data, len);
+ *		}
+ *
+ * @note Only `n` is meant to be read by the body, the other fields belong to
+ * the timer.
+ */
+struct bench {
+	/** The number of times the body must run the operation. */
+	unsigned long long n;
+	/** The wall clock time measured so far, in seconds. */
+	double elapsed;
+	/** The CPU time of the thread measured so far, in seconds. */
+	double cputime;
+	/** When the timer started, negative if it is stopped. */
+	double start;
+	/** The CPU time when the timer started. */
+	double cpustart;
+	/** The input size of the run, for the benchmarks over a range. */
+	long range;
+	/** The bytes processed by one operation, to report a throughput. */
+	double bytes;
+	/** The items processed by one operation, to report a throughput. */
+	double items;
+	/** The latencies of the operations timed by the body. */
+	struct bench_histogram *latency;
+	/** When the current operation started, in ns. */
+	uint64_t opstart;
+	/** The index of the thread that runs the body, from 0. */
+	unsigned int thread;
+	/** The number of threads that run the body together. */
+	unsigned int threads;
+};
+
+/** The asymptotic complexities that the benchmarks over a range are fit to. */
+enum bench_complexity {
+	BENCH_O1,
+	BENCH_OLOGN,
+	BENCH_ON,
+	BENCH_ONLOGN,
+	BENCH_ON2,
+	/** No bound on the complexity. */
+	BENCH_OANY,
+};
+
+/**
+ * The input sizes of a benchmark: `lo`, then the powers of `mult` up to
+ * `hi`, then `hi`, and the complexity that must not be exceeded.
+ */
+struct bench_range {
+	long lo;
+	long hi;
+	long mult;
+	enum bench_complexity bound;
+};
+
+/** Start the timer, if stopped. The timer is running when the body starts. */
+void bench_timer_start(struct bench *bench);
+
+/** Stop the timer, to exclude the work that follows from the measure. */
+void bench_timer_stop(struct bench *bench);
+
+/** Discard the time measured so far, e.g. by an expensive setup. */
+void bench_timer_reset(struct bench *bench);
+
+/** Start timing one operation, see BENCH_OP_START. */
+void bench_op_start(struct bench *bench);
+
+/** Record the latency of the operation in the histogram of the benchmark. */
+void bench_op_stop(struct bench *bench);
+
+/**
+ * Calibrate and run the benchmark `body`, then report its time per operation.
+ * Don't use it directly but BENCHMARK instead.
+ *
+ * The number of iterations is grown until a run lasts at least the minimum
+ * time, then the body is run the given number of repetitions. If a baseline
+ * file is given, the test fails when the median time per operation is slower
+ * than the baseline beyond the threshold and a one-sided Mann-Whitney U test
+ * over the repetitions confirms it. The results can be written in the JSON
+ * format of Google Benchmark, which is the format of the baselines too.
+ *
+ * If `range` is not NULL, the benchmark is run for each input size of the
+ * range and the median times are fit to the complexities O(1), O(log n),
+ * O(n), O(n log n) and O(n^2). The one with the lowest RMS is reported and
+ * the test fails if it exceeds the bound of the range.
+ */
+void bench_run(struct test_case *test, struct test_result *result,
+		void (*body)(struct test_case *, struct test_result *, struct bench *,
+			void *),
+		void *usrptr, const struct bench_range *range);
+
+/**
+ * Run the benchmark `body` in 1, 2, 4... up to `maxthreads` threads, or as
+ * many as the CPUs if it is 0. Don't use it directly but BENCHMARK_THREADS
+ * instead.
+ *
+ * For each number of threads, the threads start together from a barrier and
+ * each one runs the operation BENCH_N times, on its own CPU if `pin`. The
+ * slowest thread gives the time of the round. The total throughput, the
+ * throughput of a thread and the scaling efficiency, the throughput relative
+ * to the one of a single thread times the number of threads, are reported.
+ * The body can use the assertions: a failure ends its thread and the test.
+ */
+void bench_run_threads(struct test_case *test, struct test_result *result,
+		void (*body)(struct test_case *, struct test_result *, struct bench *,
+			void *),
+		void *usrptr, unsigned int maxthreads, bool pin);
+
+#define _BENCHARG __bench__
+#define BENCHARGS TESTARGS, struct bench *_BENCHARG
+
+/** The number of times the body of the benchmark runs the operation. */
+#define BENCH_N (_BENCHARG->n)
+
+/** The input size of the benchmarks over a range, see BENCHMARK_RANGE. */
+#define BENCH_RANGE (_BENCHARG->range)
+
+/** The index of the thread that runs the body, see BENCHMARK_THREADS. */
+#define BENCH_THREAD (_BENCHARG->thread)
+
+/** The number of threads that run the body together. */
+#define BENCH_THREADS (_BENCHARG->threads)
+
+/** Declare the bytes processed by one operation, to report the GB/s. */
+#define BENCH_SET_BYTES(b) (_BENCHARG->bytes = (b))
+
+/** Declare the items processed by one operation, to report the items/s. */
+#define BENCH_SET_ITEMS(i) (_BENCHARG->items = (i))
+
+/**
+ * Time one operation. The latencies of the operations enclosed between
+ * BENCH_OP_START and BENCH_OP_STOP are recorded in a histogram, and their
+ * p50, p90, p99, p99.9 and max are reported with the benchmark.
+ */
+#define BENCH_OP_START() bench_op_start(_BENCHARG)
+
+/** See BENCH_OP_START. */
+#define BENCH_OP_STOP() bench_op_stop(_BENCHARG)
+
+/** See bench_timer_start. */
+#define BENCH_START_TIMER() bench_timer_start(_BENCHARG)
+
+/** See bench_timer_stop. */
+#define BENCH_STOP_TIMER() bench_timer_stop(_BENCHARG)
+
+/** See bench_timer_reset. */
+#define BENCH_RESET_TIMER() bench_timer_reset(_BENCHARG)
+
+/**
+ * Define a benchmark. The macro is followed by the body, that runs the
+ * operation BENCH_N times and can use the ASSERT_ macros. The result is a test
+ * function named `bname`. The options of test_main set the minimum time of
+ * each run (`-m`), the number of repetitions (`-r`), the JSON output (`-J`),
+ * the baseline (`-B`) and the threshold in percent (`-T`).
+ * @param bname The name of the benchmark.
+ */
+#define BENCHMARK(bname) \
+	static void bname ## _bench(BENCHARGS, void *usrptr); \
+	static void bname(TESTARGS, void *usrptr) \
+	{ \
+		bench_run(_TESTARG, _RESULTARG, bname ## _bench, usrptr, NULL); \
+	} \
+	static void bname ## _bench(BENCHARGS, void *usrptr)
+
+/**
+ * Define a benchmark run for each input size from `lo` to `hi`, growing by
+ * `mult`. The body reads the size in BENCH_RANGE. The complexity that fits
+ * the times best is reported, see bench_run.
+ */
+#define BENCHMARK_RANGE(bname, lo, hi, mult) \
+	BENCHMARK_COMPLEXITY(bname, lo, hi, mult, BENCH_OANY)
+
+/**
+ * Like BENCHMARK_RANGE, but the test fails if the complexity that fits the
+ * times best exceeds `bound`, e.g. BENCH_ONLOGN.
+ */
+#define BENCHMARK_COMPLEXITY(bname, lo, hi, mult, bound) \
+	static void bname ## _bench(BENCHARGS, void *usrptr); \
+	static void bname(TESTARGS, void *usrptr) \
+	{ \
+		static const struct bench_range range = {lo, hi, mult, bound}; \
+		bench_run(_TESTARG, _RESULTARG, bname ## _bench, usrptr, &range); \
+	} \
+	static void bname ## _bench(BENCHARGS, void *usrptr)
+
+/**
+ * Define a benchmark run concurrently by 1, 2, 4... up to `maxthreads`
+ * threads, see bench_run_threads. The body reads the index of its thread in
+ * BENCH_THREAD.
+ * @param bname The name of the benchmark.
+ * @param maxthreads The maximum number of threads, 0 for the number of CPUs.
+ * @param pin If each thread must run on its own CPU.
+ */
+#define BENCHMARK_THREADS(bname, maxthreads, pin) \
+	static void bname ## _bench(BENCHARGS, void *usrptr); \
+	static void bname(TESTARGS, void *usrptr) \
+	{ \
+		bench_run_threads(_TESTARG, _RESULTARG, bname ## _bench, usrptr, \
+				maxthreads, pin); \
+	} \
+	static void bname ## _bench(BENCHARGS, void *usrptr)
+
+/**
+ * Call `func` at a fixed rate for a fixed time, from a scheduler thread, and
+ * report the latencies of the calls. Don't use it directly but
+ * BENCHMARK_LOAD instead.
+ *
+ * The load is open-loop: the i-th call is due at i / `rate` seconds from the
+ * start, whenever the previous calls end, and its latency is measured from
+ * then rather than from when it actually started. A slow call therefore
+ * counts in the latency of the calls it delays, as it would with independent
+ * clients, and the tail is not understated (the coordinated omission). The
+ * calls still due at the end count with their wait. The achieved rate, the
+ * corrected latencies and the service times are reported, and the test fails
+ * if the corrected p99 exceeds `slo`.
+ * @param rate The calls per second.
+ * @param duration The seconds of the run.
+ * @param slo The maximum p99 in ns, or 0.
+ */
+void bench_load(struct test_case *test, struct test_result *result,
+		void (*func)(struct test_case *, struct test_result *, void *),
+		void *usrptr, double rate, double duration, uint64_t slo);
+
+/**
+ * Define a load test: the body, a request, is called `rate` times per second
+ * for `duration` seconds, see bench_load. The body can use the assertions.
+ * @param lname The name of the test.
+ * @param rate The requests per second.
+ * @param duration The seconds of the run.
+ * @param slo The maximum p99 latency in ns, or 0 for none.
+ */
+#define BENCHMARK_LOAD(lname, rate, duration, slo) \
+	static void lname ## _load(TESTARGS, void *usrptr); \
+	static void lname(TESTARGS, void *usrptr) \
+	{ \
+		bench_load(_TESTARG, _RESULTARG, lname ## _load, usrptr, rate, \
+				duration, slo); \
+	} \
+	static void lname ## _load(TESTARGS, void *usrptr)
+
 #endif /* UNITTEST_H */
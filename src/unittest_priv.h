@@ -1,6 +1,10 @@
 #ifndef __UNITTEST_PRIV_H
 #define __UNITTEST_PRIV_H
 
+#include <setjmp.h>
+#include <pthread.h>
+#include "unittest.h"
+
 #define MAXLINE 4096
 
 void err_sys(const char *, ...);
@@ -15,4 +19,136 @@ void list_free(struct list *list, void (*free_el)(void *));
 unsigned int list_len(struct list *list);
 struct list *list_last(struct list *list);
 
+struct test_case_impl {
+	CASE_HEAD
+	jmp_buf *jmpbuffer;
+	/* The EXPECT_ stack of the thread that runs the test. */
+	struct test_failure *expect;
+	char (*expectmsgs)[MAXLINE];
+	unsigned int *expecttop;
+	/* Serialize the failures of the threads of the test. */
+	pthread_mutex_t lock;
+	/* How the first failed thread ended, SUCCESS if none failed. */
+	int thrown;
+	char thrownmsg[MAXLINE];
+	const char *throwncondition;
+	const char *thrownfilename;
+	unsigned int thrownlineno;
+	/* For the view of a thread, the test that it belongs to. */
+	struct test_case_impl *parent;
+	/* The scratch directory of the running test, if it asked for one. */
+	char *scratch;
+};
+
+void test_case_init(struct test_case *test, const char *name,
+		const char *skip, const char *todo,
+		void (*func)(struct test_case *, struct test_result *, void *));
+struct test_case *test_case_thread_new(struct test_case *test);
+void test_case_thread_free(struct test_case *thread);
+void test_case_thread_raise(struct test_case *test);
+
+struct test_suite *desc_suite_new(const struct test_desc *start,
+		const struct test_desc *stop, void *handle, bool owned);
+struct test_suite *elf_suite_new(void *handle, const char *prefix);
+
+void isolate_configure(bool enabled, const struct test_limits *limits);
+bool isolate_enabled(const struct test_case *test);
+bool isolate_parse_limits(const char *spec, struct test_limits *limits);
+void isolate_run(struct test_case *test, struct test_suite *suite,
+		struct test_result *result);
+const char *isolate_signal_name(int sig);
+
+void death_child_fail(void);
+
+int sandbox_enter(unsigned int flags, char *err, size_t size);
+bool sandbox_mounts(void);
+
+void scratch_configure(bool keep);
+
+void golden_configure(bool update);
+char *scratch_new(void);
+void scratch_end(const char *path, const struct test_case *test, bool failed);
+void scratch_reap(pid_t pid, const struct test_case *test);
+
+void vclock_reset(void);
+
+void property_configure(unsigned int iterations, double budget, uint64_t seed,
+		bool hasseed);
+
+struct bench_config {
+	/* The minimum time of each run, in seconds. */
+	double mintime;
+	unsigned int repetitions;
+	/* The slowdown that fails a benchmark, as a fraction of the baseline. */
+	double threshold;
+	/* The paths of the JSON output and of the baseline, or NULL. */
+	const char *json;
+	const char *baseline;
+	/* The CPU to pin the benchmarks to, or -1. */
+	int cpu;
+	/* If the thread of the benchmarks gets a higher priority. */
+	bool priority;
+	/* The coefficient of variation above which a run is noisy, or 0. */
+	double maxcv;
+	/* How many times a noisy run is measured again. */
+	unsigned int retries;
+};
+
+struct bench_env {
+	/* The CPU the benchmarks are pinned to, or -1. */
+	int cpu;
+	bool priority;
+	/* If there is a time stamp counter. */
+	bool hastsc;
+	char governor[64];
+	char isolated[256];
+};
+
+void bench_configure(const struct bench_config *config);
+void bench_finish(void);
+const struct bench_env *bench_env_setup(int cpu, bool priority);
+void bench_env_pin(void);
+void bench_env_unpin(void);
+void bench_env_restore(void);
+void bench_env_loadavg(double loadavg[3]);
+int bench_env_cpu(unsigned int i);
+void bench_env_thread(int cpu);
+uint64_t bench_env_tsc(void);
+double bench_env_reference(void);
+enum bench_complexity bench_fit(const double *sizes, const double *times,
+		size_t len, double *coef, double *rms);
+
+double stats_mean(const double *x, size_t n);
+double stats_stddev(const double *x, size_t n);
+double stats_median(const double *x, size_t n);
+/* Return the one-sided p-value of the hypothesis that x is greater than y. */
+double stats_mann_whitney(const double *x, size_t m, const double *y,
+		size_t n);
+
+enum json_type {
+	JSON_NULL,
+	JSON_BOOL,
+	JSON_NUMBER,
+	JSON_STRING,
+	JSON_ARRAY,
+	JSON_OBJECT
+};
+
+struct json {
+	enum json_type type;
+	/* The name of the member, if the parent is an object. */
+	char *key;
+	char *string;
+	/* The value of a number or a bool. */
+	double number;
+	/* The elements of an array or the members of an object. */
+	struct json *child;
+	struct json *next;
+};
+
+struct json *json_parse(const char *text);
+const struct json *json_get(const struct json *object, const char *key);
+void json_free(struct json *json);
+void json_print_string(FILE *stream, const char *str);
+
 #endif /* __UNITTEST_PRIV_H */
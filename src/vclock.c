@@ -0,0 +1,314 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/*
+ * The virtual clock of a test. The library defines the functions of the C
+ * library that read the time or wait for it, hence the calls of the program
+ * come here first. Until a test starts the virtual clock, they call the
+ * functions of the C library found with dlsym(RTLD_NEXT), or the system calls
+ * in a static program, where there is no next object. Once started, the
+ * clocks stand still at the time of the start plus an offset, and a sleep
+ * moves the offset forward instead of waiting. The CPU time clocks are never
+ * virtual.
+ */
+
+/* The clock ids below CLOCK_TAI + 1, the virtual ones have a base. */
+#define VCLOCK_NCLOCKS 12
+
+static struct {
+	bool enabled;
+	/* The real time of each clock when the virtual clock started. */
+	struct timespec base[VCLOCK_NCLOCKS];
+	/* The virtual time elapsed since the start, in nanoseconds. */
+	uint64_t offset;
+} vclock;
+
+/* The functions of the C library, looked up on their first call. */
+static void *real_clock_gettime, *real_gettimeofday, *real_clock_nanosleep,
+	    *real_nanosleep, *real_usleep, *real_sleep, *real_poll,
+	    *real_epoll_wait;
+
+/* The system calls, when the C library has no definition to look up. */
+static int
+sys_clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	return syscall(SYS_clock_gettime, clock, ts);
+}
+
+static int
+sys_gettimeofday(struct timeval *restrict tv, void *restrict tz)
+{
+	return syscall(SYS_gettimeofday, tv, tz);
+}
+
+static int
+sys_clock_nanosleep(clockid_t clock, int flags, const struct timespec *req,
+		struct timespec *rem)
+{
+	return syscall(SYS_clock_nanosleep, clock, flags, req, rem) == -1 ?
+		errno : 0;
+}
+
+static int
+sys_nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	return syscall(SYS_nanosleep, req, rem);
+}
+
+static int
+sys_usleep(useconds_t usec)
+{
+	struct timespec ts = {usec / 1000000, usec % 1000000 * 1000};
+
+	return sys_nanosleep(&ts, NULL);
+}
+
+static unsigned int
+sys_sleep(unsigned int seconds)
+{
+	struct timespec ts = {seconds, 0};
+
+	if (sys_nanosleep(&ts, &ts) == -1)
+		return ts.tv_sec + (ts.tv_nsec > 0);
+	return 0;
+}
+
+/* The signal mask of the kernel, for ppoll and epoll_pwait. */
+#define VCLOCK_SIGSETSIZE (_NSIG / 8)
+
+static int
+sys_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	struct timespec ts = {timeout / 1000, timeout % 1000 * 1000000};
+
+	return syscall(SYS_ppoll, fds, nfds, timeout >= 0 ? &ts : NULL, NULL,
+			VCLOCK_SIGSETSIZE);
+}
+
+static int
+sys_epoll_wait(int epfd, struct epoll_event *events, int maxevents,
+		int timeout)
+{
+	return syscall(SYS_epoll_pwait, epfd, events, maxevents, timeout, NULL,
+			VCLOCK_SIGSETSIZE);
+}
+
+static void *
+vclock_real(const char *name, void **func, void *sys)
+{
+	if (*func == NULL && (*func = dlsym(RTLD_NEXT, name)) == NULL)
+		*func = sys;
+	return *func;
+}
+
+#define VCLOCK_REAL(name) \
+	((__typeof__(&name)) vclock_real(#name, &real_##name, (void *) sys_##name))
+
+static bool
+vclock_enabled(void)
+{
+	return __atomic_load_n(&vclock.enabled, __ATOMIC_ACQUIRE);
+}
+
+static bool
+vclock_virtual(clockid_t clock)
+{
+	switch (clock) {
+		case CLOCK_REALTIME:
+		case CLOCK_MONOTONIC:
+		case CLOCK_MONOTONIC_RAW:
+		case CLOCK_REALTIME_COARSE:
+		case CLOCK_MONOTONIC_COARSE:
+		case CLOCK_BOOTTIME:
+		case CLOCK_TAI:
+			return vclock_enabled();
+		default:
+			return false;
+	}
+}
+
+static uint64_t
+vclock_ns(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/* The virtual time of `clock`, in nanoseconds. */
+static uint64_t
+vclock_read(clockid_t clock)
+{
+	return vclock_ns(&vclock.base[clock]) +
+		__atomic_load_n(&vclock.offset, __ATOMIC_RELAXED);
+}
+
+static void
+vclock_forward(uint64_t ns)
+{
+	__atomic_add_fetch(&vclock.offset, ns, __ATOMIC_RELAXED);
+}
+
+void
+vclock_start(void)
+{
+	clockid_t clock;
+
+	__atomic_store_n(&vclock.enabled, false, __ATOMIC_RELEASE);
+	for (clock = 0; clock < VCLOCK_NCLOCKS; clock++)
+		VCLOCK_REAL(clock_gettime)(clock, &vclock.base[clock]);
+	vclock.offset = 0;
+	__atomic_store_n(&vclock.enabled, true, __ATOMIC_RELEASE);
+}
+
+void
+vclock_advance(uint64_t ns)
+{
+	assert(vclock_enabled());
+	vclock_forward(ns);
+}
+
+uint64_t
+vclock_elapsed(void)
+{
+	assert(vclock_enabled());
+	return __atomic_load_n(&vclock.offset, __ATOMIC_RELAXED);
+}
+
+/* Go back to the real time, at the start and at the end of each test. */
+void
+vclock_reset(void)
+{
+	__atomic_store_n(&vclock.enabled, false, __ATOMIC_RELEASE);
+}
+
+int
+clock_gettime(clockid_t clock, struct timespec *ts)
+{
+	uint64_t now;
+
+	if (!vclock_virtual(clock))
+		return VCLOCK_REAL(clock_gettime)(clock, ts);
+	now = vclock_read(clock);
+	ts->tv_sec = now / 1000000000;
+	ts->tv_nsec = now % 1000000000;
+	return 0;
+}
+
+int
+gettimeofday(struct timeval *restrict tv, void *restrict tz)
+{
+	struct timespec ts;
+
+	if (!vclock_enabled())
+		return VCLOCK_REAL(gettimeofday)(tv, tz);
+	if (tz != NULL)
+		memset(tz, 0, sizeof(struct timezone));
+	clock_gettime(CLOCK_REALTIME, &ts);
+	tv->tv_sec = ts.tv_sec;
+	tv->tv_usec = ts.tv_nsec / 1000;
+	return 0;
+}
+
+time_t
+time(time_t *t)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	if (t != NULL)
+		*t = ts.tv_sec;
+	return ts.tv_sec;
+}
+
+int
+clock_nanosleep(clockid_t clock, int flags, const struct timespec *req,
+		struct timespec *rem)
+{
+	uint64_t ns, now;
+
+	if (!vclock_virtual(clock))
+		return VCLOCK_REAL(clock_nanosleep)(clock, flags, req, rem);
+	if (req->tv_nsec < 0 || req->tv_nsec >= 1000000000)
+		return EINVAL;
+	ns = vclock_ns(req);
+	if (flags & TIMER_ABSTIME) {
+		now = vclock_read(clock);
+		vclock_forward(ns > now ? ns - now : 0);
+	} else
+		vclock_forward(ns);
+	if (rem != NULL && !(flags & TIMER_ABSTIME))
+		rem->tv_sec = rem->tv_nsec = 0;
+	return 0;
+}
+
+int
+nanosleep(const struct timespec *req, struct timespec *rem)
+{
+	int ret;
+
+	if (!vclock_enabled())
+		return VCLOCK_REAL(nanosleep)(req, rem);
+	if ((ret = clock_nanosleep(CLOCK_MONOTONIC, 0, req, rem)) != 0) {
+		errno = ret;
+		return -1;
+	}
+	return 0;
+}
+
+int
+usleep(useconds_t usec)
+{
+	if (!vclock_enabled())
+		return VCLOCK_REAL(usleep)(usec);
+	vclock_forward(usec * 1000ULL);
+	return 0;
+}
+
+unsigned int
+sleep(unsigned int seconds)
+{
+	if (!vclock_enabled())
+		return VCLOCK_REAL(sleep)(seconds);
+	vclock_forward(seconds * 1000000000ULL);
+	return 0;
+}
+
+/*
+ * A wait for descriptors checks them once without waiting: if none is ready,
+ * the wait times out at once. A wait without timeout stays real.
+ */
+int
+poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	int ret;
+
+	if (!vclock_enabled() || timeout <= 0)
+		return VCLOCK_REAL(poll)(fds, nfds, timeout);
+	if ((ret = VCLOCK_REAL(poll)(fds, nfds, 0)) == 0)
+		vclock_forward(timeout * 1000000ULL);
+	return ret;
+}
+
+int
+epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout)
+{
+	int ret;
+
+	if (!vclock_enabled() || timeout <= 0)
+		return VCLOCK_REAL(epoll_wait)(epfd, events, maxevents, timeout);
+	if ((ret = VCLOCK_REAL(epoll_wait)(epfd, events, maxevents, 0)) == 0)
+		vclock_forward(timeout * 1000000ULL);
+	return ret;
+}
@@ -0,0 +1,29 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "unittest.h"
+#include "helpers.h"
+
+
+char *
+run_output(struct test_case *test, bool record)
+{
+	struct test_suite *suite;
+	struct test_result *result;
+	char *buf = NULL;
+	size_t size;
+	FILE *stream;
+
+	assert(test != NULL);
+	stream = open_memstream(&buf, &size);
+	assert(stream != NULL);
+	suite = test_suite_new();
+	suite->add_test(suite, test);
+	result = tap_result_new(false, stream);
+	result->record = record;
+	suite->run(suite, result);
+	result->free(result);
+	suite->free(suite);
+	fclose(stream);
+	return buf;
+}
@@ -0,0 +1,13 @@
+#ifndef __HELPERS_H
+#define __HELPERS_H
+
+#include <stdbool.h>
+#include "unittest.h"
+
+/*
+ * Run `test` alone in a suite, on a tap_result that records the successes
+ * if `record`, and return the TAP output, to free. The suite frees the test.
+ */
+char *run_output(struct test_case *test, bool record);
+
+#endif /* __HELPERS_H */
@@ -1,7 +1,15 @@
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <math.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <assert.h>
 #include "unittest.h"
 #include "unittest_priv.h"
+#include "helpers.h"
 
 #define loader_for_function(loader, func, skip, todo) \
 	((struct test_loader_func *) loader)->name = #func; \
@@ -93,6 +101,477 @@ test_todo(TESTARGS, void *usrptr)
 	ASSERT_EQUAL(r->was_successful(r), 0, "A failure is expected");
 }
 
+static void
+_test_counted(TESTARGS, void *usrptr)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		ASSERT_EQUAL(i, i, "counted");
+	ASSERT_STRING_EQUAL("abc", "abc", "same string");
+	ASSERT_STRING_NOT_EQUAL("abc", "abd", "different string");
+	ASSERT_ALMOST_EQUAL(1.0, 1.05, 0.1, "almost the same");
+	ASSERT_NOT_ALMOST_EQUAL(1.0, 1.5, 0.1, "not the same");
+	ASSERT_EQUAL(i, 0, "the last one fails");
+}
+
+static void
+test_assertions_counted(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_counted), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_counted # the last one "
+				"fails\n"), "The failure is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  condition: '(i) == (0)'\n"),
+			"The condition is in the diagnostic");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  assertions: 1004\n"),
+			"The passed assertions are counted");
+	free(output);
+}
+
+static void
+test_assertions_recorded(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_success), false);
+	ASSERT_PTR_NULL(strstr(output, "  ---\n"),
+			"No diagnostic for a success by default");
+	free(output);
+	output = run_output(test_case_new(_test_success), true);
+	ASSERT_PTR_NOT_NULL(strstr(output, "  assertions: 1\n"),
+			"A verbose runner reports the successes");
+	free(output);
+}
+
+static void
+test_mem_mismatch(TESTARGS, void *usrptr)
+{
+	unsigned char a[300], b[300];
+	size_t off, len;
+
+	for (off = 0; off < sizeof(a); off++) {
+		a[off] = off;
+		b[off] = off;
+	}
+	for (len = 0; len <= sizeof(a); len += 7)
+		ASSERT_EQUAL(mem_mismatch(a, b, len), len, "Equal buffers");
+	for (off = 0; off < sizeof(a); off++) {
+		b[off] ^= 0x80;
+		ASSERT_EQUAL(mem_mismatch(a, b, sizeof(a)), off, "First mismatch");
+		ASSERT_EQUAL(mem_mismatch(a, b, off), off, "Mismatch past the end");
+		b[off] ^= 0x80;
+	}
+}
+
+static void
+_test_mem(TESTARGS, void *usrptr)
+{
+	unsigned char a[256], b[256];
+	int i;
+
+	for (i = 0; i < 256; i++)
+		a[i] = b[i] = i;
+	ASSERT_MEM_EQUAL(a, b, sizeof(a), "equal buffers");
+	b[100] = b[101] = b[200] = 0;
+	ASSERT_MEM_EQUAL(a, b, sizeof(a), "the buffers differ");
+}
+
+static void
+_expect_mem(TESTARGS, void *usrptr)
+{
+	unsigned char a[256], b[256];
+	int i;
+
+	for (i = 0; i < 256; i++)
+		a[i] = b[i] = i;
+	b[100] = 0;
+	EXPECT_MEM_EQUAL(a, b, sizeof(a), "the buffers differ, and this "
+			"message is long enough to take a good part of the room of the "
+			"message of the failure, which is no longer a problem since the "
+			"room of an expectation is the room of the formatters of the "
+			"assertions, that write the message, then a hexdump of the "
+			"bytes around the first difference, then the markers of the "
+			"differing bytes under the rows, for a total well beyond a "
+			"quarter of a line");
+}
+
+static void
+test_expect_mem_equal(TESTARGS, void *usrptr)
+{
+	char *output, *last;
+
+	output = run_output(test_case_new(_expect_mem), false);
+	last = strstr(output, "  failures:\n");
+	ASSERT_PTR_NOT_NULL(last, "The expectation is in the failures");
+	last = strstr(last, "\n        00000080  80 81 82 83 84 85 86 87 88 89 "
+			"8a 8b 8c 8d 8e 8f\n");
+	ASSERT_PTR_NOT_NULL(last, "The hexdump of the expectation is whole");
+	ASSERT_PTR_NOT_NULL(strstr(last + 1, "\n        00000080  80 81 82 83 "
+				"84 85 86 87 88 89 8a 8b 8c 8d 8e 8f\n"),
+			"up to the last row of the second buffer");
+	free(output);
+}
+
+static void
+test_mem_equal(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_mem), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_mem # the buffers "
+				"differ: 3 of 256 bytes differ, the first at offset 100\n"),
+			"The mismatch is reported on the test line");
+	ASSERT_PTR_NOT_NULL(strstr(output, "\n    00000060  60 61 62 63 64 65"),
+			"The hexdump is in the diagnostic");
+	ASSERT_PTR_NOT_NULL(strstr(output, "\n                          ^^ ^^\n"),
+			"The differing bytes are marked");
+	ASSERT_PTR_NULL(strstr(output, "000000a0"), "The hexdump is a window");
+	free(output);
+}
+
+/* Write `content` in the file `name` of the scratch directory. */
+static const char *
+_golden(struct test_case *test, char *path, const char *name,
+		const char *content)
+{
+	FILE *fp;
+
+	snprintf(path, PATH_MAX, "%s/%s", test_case_scratch(test), name);
+	if (content != NULL && (fp = fopen(path, "w")) != NULL) {
+		fputs(content, fp);
+		fclose(fp);
+	}
+	return path;
+}
+
+static void
+test_golden(TESTARGS, void *usrptr)
+{
+	const char *out = "first line\nsecond line\nthird line\n";
+	char path[PATH_MAX], other[PATH_MAX];
+	const char *msg;
+
+	_golden(_TESTARG, path, "out.golden", out);
+	ASSERT_MATCHES_GOLDEN(out, strlen(out), path, "the output matches");
+	ASSERT_PTR_NULL(golden_check("", 0, _golden(_TESTARG, other, "empty", ""),
+				NULL), "an empty output matches an empty file");
+	msg = golden_check("first line\nsecond lime\nthird line\n", strlen(out),
+			path, "rendered");
+	ASSERT_PTR_NOT_NULL(msg, "a different output does not match");
+	ASSERT_EQUAL(strncmp(msg, "rendered: the output differs from ", 34), 0,
+			"the message starts with the user's one");
+	ASSERT_PTR_NOT_NULL(strstr(msg, "at line 2, column 10\n"),
+			"the first difference is located");
+	ASSERT_PTR_NOT_NULL(strstr(msg, "\nexpected \"second line\"\n"
+				"     got \"second lime\"\n"), "the lines are quoted");
+	msg = golden_check(out, 11, path, NULL);
+	ASSERT_PTR_NOT_NULL(strstr(msg, "at line 2, column 1 (11 bytes, "
+				"expected 34)\nexpected \"second line\"\n     got \"\"\n"),
+			"a shorter output is reported");
+	msg = golden_check(out, strlen(out),
+			_golden(_TESTARG, other, "missing", NULL), NULL);
+	ASSERT_PTR_NOT_NULL(strstr(msg, "No such file or directory"),
+			"a missing golden file is a failure");
+}
+
+static void
+test_golden_update(TESTARGS, void *usrptr)
+{
+	char path[PATH_MAX], created[PATH_MAX], buf[64] = "";
+	const char *out = "new output\n";
+	struct stat st;
+	FILE *fp;
+
+	_golden(_TESTARG, path, "old.golden", "old output\n");
+	_golden(_TESTARG, created, "new.golden", NULL);
+	chmod(path, 0640);
+	golden_configure(true);
+	EXPECT_PTR_NULL(golden_check(out, strlen(out), path, NULL),
+			"a mismatch is updated");
+	EXPECT_PTR_NULL(golden_check(out, strlen(out), created, NULL),
+			"a missing golden file is created");
+	golden_configure(false);
+	ASSERT_MATCHES_GOLDEN(out, strlen(out), path, "the file was rewritten");
+	ASSERT_MATCHES_GOLDEN(out, strlen(out), created, "the file was created");
+	ASSERT_EQUAL(stat(path, &st), 0, "stat");
+	ASSERT_EQUAL(st.st_mode & 0777, 0640, "the mode is kept");
+	fp = fopen(path, "r");
+	ASSERT_PTR_NOT_NULL(fp, "the golden file is readable");
+	ASSERT_PTR_NOT_NULL(fgets(buf, sizeof(buf), fp), "it is not empty");
+	fclose(fp);
+	ASSERT_STRING_EQUAL(buf, out, "it has the new output");
+}
+
+static void
+test_array_near(TESTARGS, void *usrptr)
+{
+	float a[1000], b[1000];
+	double c[1000], d[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		a[i] = b[i] = c[i] = d[i] = i * 0.1;
+		b[i] += 1e-3f;
+		d[i] *= 1 + 1e-9;
+	}
+	a[10] = b[10] = NAN;
+	a[20] = b[20] = INFINITY;
+	ASSERT_ARRAY_NEAR_F32(a, b, 1000, 1e-2, 0.0, "Absolute tolerance");
+	ASSERT_ARRAY_NEAR_F64(c, d, 1000, 0.0, 1e-8, "Relative tolerance");
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F64, c, d, 1000, 0.0, 1e-10),
+			999, "All but 0 are out of tolerance");
+	b[10] = 1.0;
+	b[20] = -INFINITY;
+	b[999] = 0.0;
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F32, a, b, 1000, 1e-2, 0.0), 3,
+			"NaN and infinities are compared");
+}
+
+static void
+test_array_near_inf(TESTARGS, void *usrptr)
+{
+	float a[] = {1.0f, INFINITY, INFINITY, -INFINITY, 1e30f};
+	float b[] = {INFINITY, -INFINITY, INFINITY, -INFINITY, INFINITY};
+	double c[] = {1.0, INFINITY, INFINITY, -INFINITY, 1e300};
+	double d[] = {INFINITY, -INFINITY, INFINITY, -INFINITY, INFINITY};
+
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F32, a, b, 5, 0.0, 1e-6), 3,
+			"an infinity is only near itself with a relative tolerance");
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F64, c, d, 5, 0.0, 1e-6), 3,
+			"an infinity is only near itself with a relative tolerance");
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F32, a, b, 5, 1.0, 0.5), 3,
+			"and with both tolerances");
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F64, c, d, 5, 1.0, 0.5), 3,
+			"and with both tolerances");
+	ASSERT_EQUAL(array_violations(ARRAY_NEAR_F64, c + 2, d + 2, 2, 0.0, 1.0),
+			0, "equal infinities are near");
+}
+
+static void
+test_array_ulp(TESTARGS, void *usrptr)
+{
+	float a[300], b[300];
+	double c[300], d[300];
+	int i;
+
+	for (i = 0; i < 300; i++) {
+		a[i] = c[i] = (i - 150) * 1e-3;
+		b[i] = nextafterf(nextafterf(a[i], INFINITY), INFINITY);
+		d[i] = nextafter(c[i], -INFINITY);
+	}
+	a[150] = 0.0f;
+	b[150] = -0.0f;
+	ASSERT_ARRAY_ULP_F32(a, b, 300, 2, "Two representable numbers apart");
+	ASSERT_ARRAY_ULP_F64(c, d, 300, 1, "One representable number apart");
+	ASSERT_EQUAL(array_violations(ARRAY_ULP_F32, a, b, 300, 1, 0.0), 299,
+			"Out of tolerance but the zeros");
+	a[0] = INFINITY;
+	b[0] = NAN;
+	ASSERT_EQUAL(array_violations(ARRAY_ULP_F32, a, b, 1, 1e9, 0.0), 1,
+			"NaN is not next to infinity");
+}
+
+static void
+_test_array(TESTARGS, void *usrptr)
+{
+	double a[1000], b[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		a[i] = b[i] = i;
+	b[300] += 0.5;
+	b[700] -= 2.0;
+	ASSERT_ARRAY_NEAR_F64(a, b, 1000, 0.1, 0.0, "the arrays differ");
+}
+
+static void
+test_array_message(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_array), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_array # the arrays "
+				"differ: 2 of 1000 elements differ, the worst at index 700: "
+				"700 != 698 (error 2)\n"),
+			"The worst element is reported");
+	free(output);
+}
+
+static void
+_test_expect(TESTARGS, void *usrptr)
+{
+	int i;
+
+	EXPECT_EQUAL(1, 2, "first");
+	EXPECT_STRING_EQUAL("a", "a", "passes");
+	EXPECT_PTR_NULL(usrptr, "passes too");
+	EXPECT_NOT_EQUAL(1, 1, "second");
+	for (i = 0; i < 40; i++)
+		EXPECT_EQUAL(i, -1, "many");
+	ASSERT_EQUAL(1, 3, "fatal");
+	EXPECT_EQUAL(1, 4, "not reached");
+}
+
+static void
+test_expect(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_expect), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_expect # fatal\n"),
+			"The fatal assertion ends the test");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  assertions: 2\n"),
+			"The expectations that pass are counted");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  failures:\n"
+				"    - message: 'first'\n"
+				"      condition: '(1) == (2)'\n"),
+			"The first failure is recorded");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    - message: 'second'\n"),
+			"The test goes on after a failure");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  unrecorded: 10\n"),
+			"The failures past the buffer are counted");
+	ASSERT_PTR_NULL(strstr(output, "not reached"), "The test stops");
+	free(output);
+}
+
+static void
+_test_expect_only(TESTARGS, void *usrptr)
+{
+	EXPECT_EQUAL(1, 2, "the only failure");
+	SUCCESS("the test goes on");
+}
+
+static void
+test_expect_only(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_expect_only), false);
+	ASSERT_PTR_NOT_NULL(strstr(output,
+				"not ok _test_expect_only # the only failure\n"),
+			"The test fails when it ends");
+	free(output);
+}
+
+static void
+test_death(TESTARGS, void *usrptr)
+{
+	ASSERT_EXITS(exit(2), 2, NULL, "the exit status is checked");
+	ASSERT_SIGNALS(abort(), SIGABRT, NULL, "the signal is checked");
+	ASSERT_SIGNALS(*(volatile int *) NULL = 1, SIGSEGV, NULL,
+			"a crash is a signal");
+	ASSERT_EXITS({
+				fprintf(stderr, "bad input: %d\n", 42);
+				exit(3);
+			}, 3, "^bad input: [0-9]+$", "the standard error is matched");
+	ASSERT_EXITS(_exit(0), 0, NULL, "a success is an exit too");
+}
+
+static void
+_test_death_returns(TESTARGS, void *usrptr)
+{
+	ASSERT_EXITS((void) usrptr, 2, NULL, "returns");
+}
+
+static void
+_test_death_exits(TESTARGS, void *usrptr)
+{
+	ASSERT_SIGNALS(exit(1), SIGABRT, NULL, "exits");
+}
+
+static void
+_test_death_stderr(TESTARGS, void *usrptr)
+{
+	ASSERT_EXITS({
+				fputs("oops\n", stderr);
+				exit(1);
+			}, 1, "^fine$", "stderr");
+}
+
+static void
+_test_death_assert(TESTARGS, void *usrptr)
+{
+	ASSERT_EXITS({
+				ASSERT_EQUAL(1, 2, "inner");
+				exit(0);
+			}, 0, NULL, "outer");
+}
+
+static pid_t _atexit_pid;
+static int _atexit_fd;
+
+static void
+_atexit_mark(void)
+{
+	if (getpid() == _atexit_pid && write(_atexit_fd, "x", 1) != 1)
+		_exit(1);
+}
+
+static void
+_test_death_atexit(TESTARGS, void *usrptr)
+{
+	ASSERT_EXITS(exit(2), 2, NULL, "exits");
+}
+
+static void
+test_death_atexit(TESTARGS, void *usrptr)
+{
+	int fds[2], status;
+	pid_t pid;
+	char c;
+
+	ASSERT_EQUAL(pipe(fds), 0, "The pipe is created");
+	fflush(NULL);
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		_atexit_fd = fds[1];
+		_atexit_pid = getpid();
+		atexit(_atexit_mark);
+		free(run_output(test_case_new(_test_death_atexit), false));
+		exit(0);
+	}
+	close(fds[1]);
+	ASSERT_EQUAL(read(fds[0], &c, 1), 1,
+			"The exit handler of the test runs after the death test");
+	close(fds[0]);
+	ASSERT_EQUAL(waitpid(pid, &status, 0), pid, "The program ends");
+}
+
+static void
+test_death_message(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_test_death_returns), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_death_returns # "
+				"returns: the statement returned, expected to exit with "
+				"status 2\n"),
+			"A statement that returns fails");
+	free(output);
+	output = run_output(test_case_new(_test_death_exits), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_death_exits # "
+				"exits: the statement exited with status 1, expected to be "
+				"killed by SIGABRT\n"),
+			"The wrong death fails");
+	free(output);
+	output = run_output(test_case_new(_test_death_stderr), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_death_stderr # "
+				"stderr: the standard error does not match the pattern "
+				"/^fine$/\n"),
+			"The wrong standard error fails");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  oops\n"),
+			"The standard error is reported");
+	free(output);
+	output = run_output(test_case_new(_test_death_assert), false);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _test_death_assert # "
+				"outer: the statement failed an assertion, expected to exit "
+				"with status 0\n"),
+			"An assertion of the statement ends the child");
+	free(output);
+}
+
 static void
 _setup(struct test_suite *suite)
 {
@@ -101,6 +580,7 @@ _setup(struct test_suite *suite)
 	usrdata = (struct _usrdata *) malloc(sizeof(struct _usrdata));
 	usrdata->runner = tap_runner_new(0, false, false, NULL);
 	usrdata->loader = func_loader_new();
+	usrdata->suite = NULL;
 	suite->usrptr = usrdata;
 }
 
@@ -111,7 +591,8 @@ _teardown(struct test_suite *suite)
 
 	usrdata->runner->free(usrdata->runner);
 	usrdata->loader->free(usrdata->loader);
-	usrdata->suite->free(usrdata->suite);
+	if (usrdata->suite != NULL)
+		usrdata->suite->free(usrdata->suite);
 	free(usrdata);
 }
 
@@ -143,6 +624,22 @@ load_test_suite(struct test_loader *loader)
 	suite->add_test(suite, test_case_new(test_skip));
 	suite->add_test(suite, test_case_new(test_no_assertions));
 	suite->add_test(suite, test_case_new(test_todo));
+	suite->add_test(suite, test_case_new(test_assertions_counted));
+	suite->add_test(suite, test_case_new(test_assertions_recorded));
+	suite->add_test(suite, test_case_new(test_mem_mismatch));
+	suite->add_test(suite, test_case_new(test_mem_equal));
+	suite->add_test(suite, test_case_new(test_expect_mem_equal));
+	suite->add_test(suite, test_case_new(test_golden));
+	suite->add_test(suite, test_case_new(test_golden_update));
+	suite->add_test(suite, test_case_new(test_array_near));
+	suite->add_test(suite, test_case_new(test_array_near_inf));
+	suite->add_test(suite, test_case_new(test_array_ulp));
+	suite->add_test(suite, test_case_new(test_array_message));
+	suite->add_test(suite, test_case_new(test_expect));
+	suite->add_test(suite, test_case_new(test_expect_only));
+	suite->add_test(suite, test_case_new(test_death));
+	suite->add_test(suite, test_case_new(test_death_atexit));
+	suite->add_test(suite, test_case_new(test_death_message));
 	suite->setup = _setup;
 	suite->teardown = _teardown;
 	return suite;
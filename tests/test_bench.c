@@ -0,0 +1,510 @@
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+#include "helpers.h"
+
+
+static char json_path[] = "/tmp/unittest-bench-XXXXXX";
+
+BENCHMARK(_bench_loop)
+{
+	volatile unsigned long long sum = 0;
+	unsigned long long i;
+
+	for (i = 0; i < BENCH_N; i++)
+		sum += i;
+}
+
+BENCHMARK_COMPLEXITY(_bench_linear, 256, 16384, 4, BENCH_O1)
+{
+	volatile unsigned long long sum = 0;
+	unsigned long long i;
+	long j;
+
+	BENCH_SET_BYTES(BENCH_RANGE * sizeof(long));
+	for (i = 0; i < BENCH_N; i++)
+		for (j = 0; j < BENCH_RANGE; j++)
+			sum += j;
+}
+
+BENCHMARK_COMPLEXITY(_bench_bounded, 256, 16384, 4, BENCH_ON2)
+{
+	volatile unsigned long long sum = 0;
+	unsigned long long i;
+	long j;
+
+	BENCH_SET_ITEMS(BENCH_RANGE);
+	for (i = 0; i < BENCH_N; i++)
+		for (j = 0; j < BENCH_RANGE; j++)
+			sum += j;
+}
+
+BENCHMARK(_bench_latency)
+{
+	volatile unsigned long long sum = 0;
+	unsigned long long i;
+
+	for (i = 0; i < BENCH_N; i++) {
+		BENCH_OP_START();
+		sum += i;
+		BENCH_OP_STOP();
+	}
+}
+
+static unsigned long long shared_counter;
+
+BENCHMARK_THREADS(_bench_shared, 4, true)
+{
+	unsigned long long i;
+
+	ASSERT_EQUAL(BENCH_THREAD < BENCH_THREADS, 1, "The thread index");
+	for (i = 0; i < BENCH_N; i++)
+		__atomic_fetch_add(&shared_counter, 1, __ATOMIC_RELAXED);
+}
+
+BENCHMARK_THREADS(_bench_failing, 2, false)
+{
+	ASSERT_NOT_EQUAL(BENCH_THREAD, 1, "The second thread fails");
+}
+
+BENCHMARK_THREADS(_bench_expecting, 2, false)
+{
+	EXPECT_NOT_EQUAL(BENCH_THREAD, 1, "The second thread expects");
+}
+
+BENCHMARK(_bench_assert)
+{
+	ASSERT_EQUAL(BENCH_N, 0, "The body fails");
+}
+
+static unsigned int load_calls;
+
+BENCHMARK_LOAD(_load_fast, 2000, 0.2, 50000000)
+{
+	load_calls++;
+	ASSERT_EQUAL(1, 1, "A request");
+}
+
+BENCHMARK_LOAD(_load_slow, 1000, 0.1, 5000000)
+{
+	usleep(2000);
+}
+
+/* Run the test with the given configuration and return the TAP output. */
+static char *
+_run_bench_config(void (*func)(TESTARGS, void *),
+		const struct bench_config *config)
+{
+	char *buf;
+
+	bench_configure(config);
+	buf = run_output(test_case_new_impl("_bench_loop", NULL, NULL, func),
+			false);
+	bench_finish();
+	return buf;
+}
+
+static char *
+_run_bench(void (*func)(TESTARGS, void *), const char *json,
+		const char *baseline)
+{
+	struct bench_config config = {
+		.mintime = 0.001,
+		.repetitions = 5,
+		.threshold = 0.05,
+		.json = json,
+		.baseline = baseline,
+		.cpu = -1,
+	};
+
+	return _run_bench_config(func, &config);
+}
+
+static void
+_write_baseline(const char *path, double time)
+{
+	FILE *stream;
+	int i;
+
+	stream = fopen(path, "w");
+	assert(stream != NULL);
+	fputs("{\"context\": {}, \"benchmarks\": [", stream);
+	for (i = 0; i < 5; i++)
+		fprintf(stream, "%s{\"name\": \"_bench_loop\", \"run_type\": "
+				"\"iteration\", \"real_time\": %g, \"time_unit\": \"us\"}",
+				i > 0 ? ", " : "", time * (1.0 + i / 100.0));
+	fputs(", {\"name\": \"_bench_loop_mean\", \"run_type\": \"aggregate\", "
+			"\"real_time\": 1e9}]}", stream);
+	fclose(stream);
+}
+
+static void
+test_mann_whitney(TESTARGS, void *usrptr)
+{
+	double x[] = {6, 7, 8, 9, 10}, y[] = {1, 2, 3, 4, 5}, z[30];
+	int i;
+
+	ASSERT_ALMOST_EQUAL(stats_mann_whitney(x, 5, y, 5), 1.0 / 252, 1e-12,
+			"The exact p-value of separated samples");
+	ASSERT_ALMOST_EQUAL(stats_mann_whitney(y, 5, x, 5), 1.0, 1e-12,
+			"The other tail");
+	for (i = 0; i < 30; i++)
+		z[i] = i % 3;
+	ASSERT_ALMOST_EQUAL(stats_mann_whitney(z, 30, z, 30), 0.5, 0.05,
+			"The same samples do not differ");
+	ASSERT_ALMOST_EQUAL(stats_median(x, 5), 8.0, 0.0, "Odd median");
+	ASSERT_ALMOST_EQUAL(stats_median(x, 4), 7.5, 0.0, "Even median");
+}
+
+static void
+test_json(TESTARGS, void *usrptr)
+{
+	struct json *root;
+	const struct json *a;
+
+	root = json_parse("{\"a\": [1, 2.5e1, true, null], \"b\": \"x\\\"\\u0041\"}");
+	ASSERT_PTR_NOT_NULL(root, "A valid document");
+	a = json_get(root, "a");
+	ASSERT_EQUAL(a->type, JSON_ARRAY, "An array");
+	ASSERT_ALMOST_EQUAL(a->child->next->number, 25.0, 0.0, "A number");
+	ASSERT_EQUAL(a->child->next->next->type, JSON_BOOL, "A bool");
+	ASSERT_STRING_EQUAL(json_get(root, "b")->string, "x\"A", "A string");
+	ASSERT_PTR_NULL(json_get(root, "c"), "A missing member");
+	json_free(root);
+	ASSERT_PTR_NULL(json_parse("{\"a\": [1, 2,]}"), "Invalid document");
+	ASSERT_PTR_NULL(json_parse("[1] 2"), "Trailing garbage");
+}
+
+static void
+test_bench_fit(TESTARGS, void *usrptr)
+{
+	double sizes[] = {8, 64, 512, 4096}, times[4], coef, rms;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		times[i] = 3.0 * sizes[i] * log2(sizes[i]);
+	ASSERT_EQUAL(bench_fit(sizes, times, 4, &coef, &rms), BENCH_ONLOGN,
+			"An exact n log n");
+	ASSERT_ALMOST_EQUAL(coef, 3.0, 1e-9, "The coefficient");
+	ASSERT_ALMOST_EQUAL(rms, 0.0, 1e-9, "The RMS");
+	for (i = 0; i < 4; i++)
+		times[i] = 50.0 + (i % 2);
+	ASSERT_EQUAL(bench_fit(sizes, times, 4, &coef, &rms), BENCH_O1,
+			"A constant");
+	for (i = 0; i < 4; i++)
+		times[i] = sizes[i] * sizes[i] * (1.0 + (i % 2) / 20.0);
+	ASSERT_EQUAL(bench_fit(sizes, times, 4, &coef, &rms), BENCH_ON2,
+			"A noisy square");
+}
+
+static void
+test_bench_range(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = _run_bench(_bench_linear, NULL, NULL);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # ", 21), 0,
+			"A linear benchmark exceeds O(1)");
+	ASSERT_PTR_NOT_NULL(strstr(output, "exceeds the bound O(1)"),
+			"The bound is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    - range: 16384\n"),
+			"Each range is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "      bytes_per_second: "),
+			"The throughput is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  complexity:\n    big_o: "),
+			"The complexity is reported");
+	free(output);
+
+	output = _run_bench(_bench_bounded, json_path, NULL);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # O(", 19), 0,
+			"A linear benchmark is within O(n^2)");
+	ASSERT_PTR_NOT_NULL(strstr(output, "      items_per_second: "),
+			"The items are reported");
+	free(output);
+}
+
+static void
+test_histogram(TESTARGS, void *usrptr)
+{
+	struct bench_histogram *all, *half;
+	uint64_t i, p;
+
+	all = calloc(2, sizeof(*all));
+	half = all + 1;
+	for (i = 1; i <= 100000; i++) {
+		bench_histogram_record(all, i);
+		if (i % 2)
+			bench_histogram_record(half, i);
+	}
+	ASSERT_EQUAL(all->count, 100000, "The values are counted");
+	ASSERT_EQUAL(bench_histogram_percentile(all, 100.0), 100000, "The max");
+	ASSERT_EQUAL(bench_histogram_percentile(all, 0.0), 1, "The min");
+	p = bench_histogram_percentile(all, 99.9);
+	ASSERT_ALMOST_EQUAL(p, 99900.0, 99900.0 / 64, "The p99.9 is close");
+	p = bench_histogram_percentile(all, 50.0);
+	ASSERT_ALMOST_EQUAL(p, 50000.0, 50000.0 / 64, "The p50 is close");
+	for (i = 2; i <= 100000; i += 2)
+		bench_histogram_record(half, i);
+	ASSERT_EQUAL(bench_histogram_percentile(half, 50.0), p,
+			"The order does not matter");
+	bench_histogram_merge(half, all);
+	ASSERT_EQUAL(half->count, 200000, "The merged values are counted");
+	ASSERT_EQUAL(bench_histogram_percentile(half, 50.0), p,
+			"The merged percentiles");
+	bench_histogram_reset(all);
+	bench_histogram_record(all, UINT64_MAX);
+	ASSERT_EQUAL(bench_histogram_percentile(all, 50.0),
+			(1ULL << BENCH_HIST_MAXBITS) - 1, "The huge values are clamped");
+	free(all);
+}
+
+static void
+test_bench_latency(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = _run_bench(_bench_latency, json_path, NULL);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"The benchmark passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, " ns/op, p99 "), "The p99 is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    latency:\n      count: "),
+			"The diagnostic reports the latencies");
+	ASSERT_PTR_NOT_NULL(strstr(output, "      p99_9: "), "The p99.9");
+	free(output);
+}
+
+static void
+test_bench_threads(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = _run_bench(_bench_shared, json_path, NULL);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"The benchmark passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, " in 4 threads, "),
+			"The maximum number of threads is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    - threads: 2\n"),
+			"Each number of threads is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "      efficiency: "),
+			"The efficiency is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "      ops_per_thread: "),
+			"The throughput of a thread is reported");
+	free(output);
+
+	output = _run_bench(_bench_failing, NULL, NULL);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # The second thread fails",
+				44), 0, "The failure of a thread fails the test");
+	free(output);
+
+	output = _run_bench(_bench_expecting, NULL, NULL);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # The second thread "
+				"expects", 46), 0, "The expectations of a thread are recorded");
+	free(output);
+}
+
+static void
+test_bench_load(TESTARGS, void *usrptr)
+{
+	unsigned long sent, missed;
+	const char *p;
+	char *output;
+
+	output = _run_bench(_load_fast, json_path, NULL);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"The load test passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, " req/s of 2000, p99 "),
+			"The rates are reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    service_time:\n"),
+			"The service time is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  assertions: "),
+			"The assertions of the requests are counted");
+	p = strstr(output, "    requests: ");
+	ASSERT_PTR_NOT_NULL(p, "The requests are reported");
+	ASSERT_EQUAL(sscanf(p, "    requests: %lu\n    missed: %lu", &sent,
+				&missed), 2, "The missed requests are reported");
+	ASSERT_EQUAL(sent, load_calls, "Each request sent calls the function");
+	ASSERT_EQUAL(load_calls <= 400, 1, "No more requests than the rate");
+	ASSERT_EQUAL(sent + missed, 400, "The missed requests are counted");
+	free(output);
+
+	output = _run_bench(_load_slow, NULL, NULL);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # p99 ", 25), 0,
+			"A slow service fails the SLO");
+	ASSERT_PTR_NOT_NULL(strstr(output, " exceeds the SLO 5000000 ns"),
+			"The SLO is reported");
+	ASSERT_PTR_NULL(strstr(output, "    missed: 0\n"),
+			"The requests not sent are counted");
+	free(output);
+}
+
+static void
+test_bench_noise(TESTARGS, void *usrptr)
+{
+	struct bench_config config = {
+		.mintime = 0.001,
+		.repetitions = 5,
+		.threshold = 0.05,
+		.cpu = 0,
+		.maxcv = 1e-12,
+		.retries = 2,
+	};
+	char *output;
+
+	output = _run_bench_config(_bench_loop, &config);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"A noisy benchmark passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, ", noisy\n"), "It is flagged");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    noisy: true\n    retries: 2\n"),
+			"It is measured again");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    warmup: "), "It is warmed up");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  environment:\n    cpu: 0\n"),
+			"It is pinned");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    load_avg: ["),
+			"The load is recorded");
+	free(output);
+}
+
+static void
+test_bench_unpinned(TESTARGS, void *usrptr)
+{
+	struct bench_config config = {
+		.mintime = 0.001,
+		.repetitions = 5,
+		.threshold = 0.05,
+		.cpu = 0,
+	};
+	cpu_set_t before, after;
+	char *output;
+
+	ASSERT_EQUAL(sched_getaffinity(0, sizeof(before), &before), 0,
+			"The CPUs of the test");
+	bench_configure(&config);
+	free(run_output(test_case_new_impl("_bench_loop", NULL, NULL,
+					_bench_loop), false));
+	sched_getaffinity(0, sizeof(after), &after);
+	EXPECT_EQUAL(CPU_EQUAL(&before, &after), 1,
+			"The test runs on all its CPUs after a benchmark");
+	output = run_output(test_case_new_impl("_bench_loop", NULL, NULL,
+				_bench_assert), false);
+	bench_finish();
+	sched_getaffinity(0, sizeof(after), &after);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # The body fails", 35),
+			0, "The benchmark fails");
+	free(output);
+	ASSERT_EQUAL(CPU_EQUAL(&before, &after), 1,
+			"The test runs on all its CPUs after a failed benchmark");
+}
+
+static void
+test_bench_report(TESTARGS, void *usrptr)
+{
+	struct json *root;
+	const struct json *entry;
+	const char *build;
+	char *output, *text;
+	FILE *stream;
+	long size;
+	int entries = 0;
+
+	output = _run_bench(_bench_loop, json_path, NULL);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"The benchmark passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, " ns/op (+/- "), "The time is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  benchmark:\n    iterations: "),
+			"The diagnostic reports the iterations");
+	free(output);
+
+	stream = fopen(json_path, "r");
+	ASSERT_PTR_NOT_NULL(stream, "The JSON file is written");
+	fseek(stream, 0, SEEK_END);
+	size = ftell(stream);
+	rewind(stream);
+	text = calloc(1, size + 1);
+	fread(text, 1, size, stream);
+	fclose(stream);
+	root = json_parse(text);
+	free(text);
+	ASSERT_PTR_NOT_NULL(root, "The JSON file is valid");
+	for (entry = json_get(root, "benchmarks")->child; entry != NULL;
+			entry = entry->next)
+		entries++;
+	ASSERT_EQUAL(entries, 5 + 4, "The repetitions and the aggregates");
+	ASSERT_STRING_EQUAL(json_get(json_get(root, "benchmarks")->child,
+				"name")->string, "_bench_loop", "The name of the benchmark");
+#ifdef NDEBUG
+	build = "release";
+#else
+	build = "debug";
+#endif
+	ASSERT_STRING_EQUAL(json_get(json_get(root, "context"),
+				"library_build_type")->string, build,
+			"The build type follows NDEBUG");
+	json_free(root);
+}
+
+static void
+test_bench_regression(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	_write_baseline(json_path, 1e-9);
+	output = _run_bench(_bench_loop, NULL, json_path);
+	ASSERT_EQUAL(strncmp(output, "not ok _bench_loop # ", 21), 0,
+			"A slower benchmark fails");
+	ASSERT_PTR_NOT_NULL(strstr(output, "slower than the baseline"),
+			"The regression is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    p_value: 0.003968\n"),
+			"The U test confirms the regression");
+	free(output);
+
+	_write_baseline(json_path, 1e9);
+	output = _run_bench(_bench_loop, NULL, json_path);
+	ASSERT_EQUAL(strncmp(output, "ok _bench_loop # ", 17), 0,
+			"A faster benchmark passes");
+	ASSERT_PTR_NOT_NULL(strstr(output, "% from the baseline"),
+			"The change is reported");
+	free(output);
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_bench";
+	suite->doc = "Test the benchmarks";
+	suite->add_test(suite, test_case_new(test_mann_whitney));
+	suite->add_test(suite, test_case_new(test_json));
+	suite->add_test(suite, test_case_new(test_bench_fit));
+	suite->add_test(suite, test_case_new(test_bench_range));
+	suite->add_test(suite, test_case_new(test_histogram));
+	suite->add_test(suite, test_case_new(test_bench_latency));
+	suite->add_test(suite, test_case_new(test_bench_threads));
+	suite->add_test(suite, test_case_new(test_bench_load));
+	suite->add_test(suite, test_case_new(test_bench_noise));
+	suite->add_test(suite, test_case_new(test_bench_unpinned));
+	suite->add_test(suite, test_case_new(test_bench_report));
+	suite->add_test(suite, test_case_new(test_bench_regression));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int fd, ret;
+
+	if ((fd = mkstemp(json_path)) == -1)
+		return 99;
+	close(fd);
+	ret = test_main3(argc, argv);
+	unlink(json_path);
+	return ret;
+}
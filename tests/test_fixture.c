@@ -0,0 +1,112 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+#define DATA "test_fixture.dat"
+#define DATASIZE (1 << 20)
+
+TEST_SUITE_MAPPED(test_fixture, DATA, FIXTURE_WILLNEED);
+
+static const struct test_fixture *parent;
+
+static void
+_isolated_read(TESTARGS, void *usrptr)
+{
+	const struct test_fixture *fixture = usrptr;
+
+	ASSERT_EQUAL(fixture, parent, "the child inherits the fixture");
+	ASSERT_EQUAL(((const unsigned char *) fixture->data)[DATASIZE - 1],
+			(DATASIZE - 1) % 251, "the child reads the mapping");
+}
+
+TEST(test_usrptr)
+{
+	const struct test_fixture *fixture = usrptr;
+	const unsigned char *data;
+	size_t i;
+
+	ASSERT_PTR_NOT_NULL(fixture, "the mapping is in usrptr");
+	ASSERT_STRING_EQUAL(fixture->path, DATA, "the file is mapped");
+	ASSERT_EQUAL(fixture->size, DATASIZE, "the whole file is mapped");
+	data = fixture->data;
+	for (i = 0; i < DATASIZE; i += 4093)
+		ASSERT_EQUAL(data[i], i % 251, "the content is the file");
+}
+
+TEST(test_shared)
+{
+	const struct test_fixture *fixture;
+
+	fixture = fixture_map(DATA, 0);
+	ASSERT_EQUAL(fixture, usrptr, "the file is mapped once");
+	fixture_unmap(fixture);
+	ASSERT_EQUAL(((const struct test_fixture *) usrptr)->size, DATASIZE,
+			"the suite still holds the mapping");
+}
+
+TEST(test_isolated)
+{
+	struct test_suite *suite;
+	struct test_result *result;
+	FILE *stream;
+
+	parent = usrptr;
+	stream = fopen("/dev/null", "w");
+	suite = test_suite_new();
+	suite->usrptr = usrptr;
+	suite->add_test(suite, test_case_new(_isolated_read));
+	result = tap_result_new(false, stream);
+	isolate_configure(true, NULL);
+	suite->run(suite, result);
+	isolate_configure(false, NULL);
+	ASSERT_EQUAL(result->was_successful(result), 0,
+			"the isolated test reads the mapping");
+	result->free(result);
+	suite->free(suite);
+	fclose(stream);
+}
+
+TEST(test_hugepages)
+{
+	const struct test_fixture *fixture;
+
+	fixture = fixture_map(DATA ".huge", FIXTURE_HUGEPAGES);
+	ASSERT_EQUAL(fixture->size, DATASIZE, "the file is mapped");
+	ASSERT_EQUAL((uintptr_t) fixture->data % (2 << 20), 0,
+			"the mapping is aligned on a huge page");
+	ASSERT_EQUAL(memcmp(fixture->data,
+				((const struct test_fixture *) usrptr)->data, DATASIZE), 0,
+			"the content is the file");
+	fixture_unmap(fixture);
+}
+
+static void
+_write(const char *path)
+{
+	FILE *fp;
+	int i;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	for (i = 0; i < DATASIZE; i++)
+		fputc(i % 251, fp);
+	fclose(fp);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int ret;
+
+	_write(DATA);
+	_write(DATA ".huge");
+	ret = test_main3(argc, argv);
+	remove(DATA);
+	remove(DATA ".huge");
+	return ret;
+}
@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+#include "helpers.h"
+
+
+static int counter;
+/* A port bound by the parent, that a network sandbox does not see. */
+static struct sockaddr_in bound;
+
+static void
+_isolated_pass(TESTARGS, void *usrptr)
+{
+	counter++;
+	ASSERT_EQUAL(counter, 1, "the child has a copy of the counter");
+}
+
+static void
+_isolated_expect(TESTARGS, void *usrptr)
+{
+	EXPECT_EQUAL(1, 2, "first expectation");
+	EXPECT_EQUAL(3, 4, "second expectation");
+}
+
+static void
+_isolated_spin(TESTARGS, void *usrptr)
+{
+	volatile unsigned long i;
+
+	for (i = 0;; i++)
+		;
+}
+
+static void
+_isolated_exit(TESTARGS, void *usrptr)
+{
+	exit(3);
+}
+
+static void
+_isolated_nofile(TESTARGS, void *usrptr)
+{
+	int fd, n;
+
+	for (n = 0; (fd = open("/dev/null", O_RDONLY)) != -1; n++)
+		;
+	ASSERT_EQUAL(n < 16, true, "the open files are limited");
+}
+
+static void
+_isolated_memory(TESTARGS, void *usrptr)
+{
+	void *p;
+
+	p = malloc(1ULL << 30);
+	ASSERT_PTR_NULL(p, "the address space is limited");
+}
+
+static void
+_isolated_segv(TESTARGS, void *usrptr)
+{
+	*(volatile int *) NULL = 1;
+}
+
+static void
+_isolated_abort(TESTARGS, void *usrptr)
+{
+	abort();
+}
+
+static int
+_listen(struct sockaddr_in *addr)
+{
+	socklen_t len = sizeof(*addr);
+	int fd;
+
+	addr->sin_family = AF_INET;
+	addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+		return -1;
+	if (bind(fd, (struct sockaddr *) addr, sizeof(*addr)) == -1 ||
+			listen(fd, 1) == -1 ||
+			getsockname(fd, (struct sockaddr *) addr, &len) == -1) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void
+_isolated_net(TESTARGS, void *usrptr)
+{
+	struct sockaddr_in addr = bound;
+	int fd, client;
+
+	fd = _listen(&addr);
+	ASSERT_NOT_EQUAL(fd, -1, "the port of the parent is free");
+	client = socket(AF_INET, SOCK_STREAM, 0);
+	ASSERT_EQUAL(connect(client, (struct sockaddr *) &addr, sizeof(addr)), 0,
+			"the loopback is up");
+	close(client);
+	close(fd);
+}
+
+static void
+_isolated_tmp(TESTARGS, void *usrptr)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int n = 0;
+
+	dir = opendir("/tmp");
+	ASSERT_PTR_NOT_NULL(dir, "/tmp exists");
+	while ((entry = readdir(dir)) != NULL)
+		n += strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..");
+	closedir(dir);
+	ASSERT_EQUAL(n, 0, "/tmp is empty");
+	ASSERT_NOT_EQUAL(creat("/tmp/unittest-sandbox-probe", 0600), -1,
+			"/tmp is writable");
+}
+
+/* Run `func` in isolated mode and return the TAP output. */
+static char *
+_run_isolated(void (*func)(TESTARGS, void *), const struct test_limits *limits,
+		const struct test_limits *global, unsigned int sandbox)
+{
+	struct test_case *test;
+	char *buf;
+
+	isolate_configure(true, global);
+	test = test_case_new_impl("_isolated", NULL, NULL, func);
+	test->limits = limits;
+	test->sandbox = sandbox;
+	buf = run_output(test, false);
+	isolate_configure(false, NULL);
+	return buf;
+}
+
+static void
+test_isolate_parse_limits(TESTARGS, void *usrptr)
+{
+	struct test_limits limits = {0, 0, 0};
+
+	ASSERT_EQUAL(isolate_parse_limits("as=512M,cpu=10,nofile=64", &limits),
+			true, "the limits are parsed");
+	ASSERT_EQUAL(limits.as, 512ULL << 20, "the size has a suffix");
+	ASSERT_EQUAL(limits.cpu, 10, "the CPU time is set");
+	ASSERT_EQUAL(limits.nofile, 64, "the open files are set");
+	ASSERT_EQUAL(isolate_parse_limits("stack=1M", &limits), false,
+			"an unknown limit is refused");
+	ASSERT_EQUAL(isolate_parse_limits("as=1X", &limits), false,
+			"an unknown suffix is refused");
+	ASSERT_EQUAL(isolate_parse_limits("cpu", &limits), false,
+			"a value is required");
+}
+
+static void
+test_isolate_success(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	counter = 0;
+	output = _run_isolated(_isolated_pass, NULL, NULL, 0);
+	ASSERT_EQUAL(strncmp(output, "ok _isolated\n", 13), 0,
+			"the test passes in the child");
+	ASSERT_EQUAL(counter, 0, "the parent is not changed by the test");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  resources:\n    max_rss_kb: "),
+			"the peak RSS is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    minor_faults: "),
+			"the page faults are reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    involuntary_switches: "),
+			"the context switches are reported");
+	free(output);
+}
+
+static void
+test_isolate_failures(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = _run_isolated(_isolated_expect, NULL, NULL, 0);
+	ASSERT_EQUAL(strncmp(output, "not ok _isolated # first expectation\n",
+				37), 0, "the failure is sent to the parent");
+	ASSERT_PTR_NOT_NULL(strstr(output, "    - message: 'second expectation'"),
+			"every expectation is sent");
+	free(output);
+}
+
+static void
+test_isolate_cpu(TESTARGS, void *usrptr)
+{
+	struct test_limits limits = {.cpu = 1};
+	char *output;
+
+	output = _run_isolated(_isolated_spin, &limits, NULL, 0);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _isolated # ERROR the test "
+				"exceeded its CPU time limit of 1 s\n"),
+			"the CPU time limit is an error");
+	free(output);
+}
+
+static void
+test_isolate_exit(TESTARGS, void *usrptr)
+{
+	struct test_limits global = {.as = 1ULL << 30};
+	char *output;
+
+	output = _run_isolated(_isolated_exit, NULL, &global, 0);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _isolated # ERROR the test "
+				"process exited with status 3, its address space limit "
+				"is 1073741824 bytes\n"),
+			"an early exit is an error");
+	free(output);
+}
+
+static void
+test_isolate_limits(TESTARGS, void *usrptr)
+{
+	struct test_limits global = {.nofile = 1024};
+	struct test_limits limits = {.as = 256ULL << 20, .nofile = 16};
+	char *output;
+
+	output = _run_isolated(_isolated_nofile, &limits, &global, 0);
+	ASSERT_EQUAL(strncmp(output, "ok _isolated\n", 13), 0,
+			"the limit of the test overrides the global one");
+	free(output);
+	output = _run_isolated(_isolated_memory, &limits, &global, 0);
+	ASSERT_EQUAL(strncmp(output, "ok _isolated\n", 13), 0,
+			"an allocation over the limit fails");
+	free(output);
+}
+
+static void
+test_isolate_crash(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite;
+	struct test_result *result;
+	char *output = NULL;
+	size_t size;
+	FILE *stream;
+
+	isolate_configure(true, NULL);
+	stream = open_memstream(&output, &size);
+	suite = test_suite_new();
+	suite->add_test(suite, test_case_new(_isolated_segv));
+	suite->add_test(suite, test_case_new(_isolated_abort));
+	suite->add_test(suite, test_case_new(_isolated_pass));
+	result = tap_result_new(false, stream);
+	counter = 0;
+	suite->run(suite, result);
+	ASSERT_EQUAL(result->testsrun, 3, "the run goes on after a crash");
+	result->free(result);
+	suite->free(suite);
+	fclose(stream);
+	isolate_configure(false, NULL);
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _isolated_segv # ERROR the "
+				"test process was killed by SIGSEGV ("),
+			"the segmentation fault is an error");
+	ASSERT_PTR_NOT_NULL(strstr(output, "not ok _isolated_abort # ERROR the "
+				"test process was killed by SIGABRT ("),
+			"the abort is an error");
+	ASSERT_PTR_NOT_NULL(strstr(output, "  backtrace: |-\n    "),
+			"the backtrace of the crash is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "isolate_run"),
+			"the backtrace has the symbols");
+	ASSERT_PTR_NOT_NULL(strstr(output, "\nok _isolated_pass\n"),
+			"the next test runs in a new process");
+	free(output);
+}
+
+static void
+test_isolate_sandbox(TESTARGS, void *usrptr)
+{
+	struct stat st;
+	char *output;
+	int fd;
+
+	fd = _listen(&bound);
+	ASSERT_NOT_EQUAL(fd, -1, "the parent binds a port");
+	output = _run_isolated(_isolated_net, NULL, NULL, SANDBOX_NET);
+	close(fd);
+	if (strstr(output, "  sandbox: serialized\n") != NULL) {
+		free(output);
+		SUCCESS("no namespaces on this host, the test ran alone");
+		return;
+	}
+	ASSERT_PTR_NOT_NULL(strstr(output, "  sandbox: namespaces\n"),
+			"the sandbox is reported");
+	ASSERT_EQUAL(strncmp(output, "ok _isolated\n", 13), 0,
+			"the test has its own network");
+	free(output);
+	output = _run_isolated(_isolated_tmp, NULL, NULL, SANDBOX_TMP);
+	ASSERT_EQUAL(strncmp(output, "ok _isolated\n", 13), 0,
+			"the test has its own /tmp");
+	ASSERT_EQUAL(stat("/tmp/unittest-sandbox-probe", &st), -1,
+			"the files of the test are gone");
+	free(output);
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_isolate";
+	suite->doc = "Test the tests run in their own process";
+	suite->add_test(suite, test_case_new(test_isolate_parse_limits));
+	suite->add_test(suite, test_case_new(test_isolate_success));
+	suite->add_test(suite, test_case_new(test_isolate_failures));
+	suite->add_test(suite, test_case_new(test_isolate_cpu));
+	suite->add_test(suite, test_case_new(test_isolate_exit));
+	suite->add_test(suite, test_case_new(test_isolate_limits));
+	suite->add_test(suite, test_case_new(test_isolate_crash));
+	suite->add_test(suite, test_case_new(test_isolate_sandbox));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
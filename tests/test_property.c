@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+#include "helpers.h"
+
+
+PROPERTY(test_commutative, PROP_INT(-1000, 1000), PROP_INT(-1000, 1000))
+{
+	int a = PROP_ARG(int, 0),
+		b = PROP_ARG(int, 1);
+
+	ASSERT_EQUAL(a + b, b + a, "The addition is commutative");
+}
+
+PROPERTY(_prop_small, PROP_INT(0, 1000))
+{
+	ASSERT_EQUAL(PROP_ARG(int, 0) < 50, 1, "All the numbers are small");
+}
+
+PROPERTY(_prop_bytes, PROP_BYTES(64))
+{
+	struct prop_array *bytes = &PROP_ARG(struct prop_array, 0);
+	size_t i;
+
+	for (i = 0; i < bytes->len; i++)
+		ASSERT_EQUAL((unsigned char) bytes->data[i] < 200, 1,
+				"No large bytes");
+}
+
+static void
+test_shrink_int(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_prop_small), false);
+	ASSERT_EQUAL(strncmp(output, "not ok", 6), 0, "The property fails");
+	ASSERT_PTR_NOT_NULL(strstr(output, "by (50)"),
+			"The counterexample is minimal");
+	ASSERT_PTR_NOT_NULL(strstr(output, "seed 0x"), "The seed is reported");
+	free(output);
+}
+
+static void
+test_shrink_array(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = run_output(test_case_new(_prop_bytes), false);
+	ASSERT_EQUAL(strncmp(output, "not ok", 6), 0, "The property fails");
+	ASSERT_PTR_NOT_NULL(strstr(output, "by ([200])"),
+			"The counterexample is minimal");
+	free(output);
+}
+
+static void
+test_rng(TESTARGS, void *usrptr)
+{
+	struct prop_rng a, b;
+	int i;
+
+	prop_rng_seed(&a, 42);
+	prop_rng_seed(&b, 42);
+	for (i = 0; i < 1000; i++)
+		ASSERT_EQUAL(prop_rng_next(&a), prop_rng_next(&b),
+				"The same seed gives the same sequence");
+	for (i = 0; i < 1000; i++) {
+		long long v = prop_rng_range(&a, -3, 3);
+		ASSERT_EQUAL(v >= -3 && v <= 3, 1, "The range is inclusive");
+	}
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_property";
+	suite->doc = "Test the property based testing";
+	suite->add_test(suite, test_case_new(test_commutative));
+	suite->add_test(suite, test_case_new(test_shrink_int));
+	suite->add_test(suite, test_case_new(test_shrink_array));
+	suite->add_test(suite, test_case_new(test_rng));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+static void
+_setup(struct test_suite *suite)
+{
+	static int value = 42;
+
+	suite->usrptr = &value;
+}
+
+TEST_SUITE_FIXTURE(test_registry, _setup, NULL);
+
+TEST(test_registered)
+{
+	SUCCESS("registered at compile time");
+}
+
+TEST(test_usrptr)
+{
+	ASSERT_PTR_NOT_NULL(usrptr, "the setup is run before each test");
+	ASSERT_EQUAL(*(int *) usrptr, 42, "the setup set the usrptr");
+}
+
+TEST_SKIP(test_skipped, "test skip")
+{
+	abort();
+}
+
+TEST_TODO(test_todo, "test todo")
+{
+	FAIL("this test should be fixed");
+}
+
+TEST_LIMITS(test_limits, .cpu = 10, .nofile = 64)
+{
+	ASSERT_PTR_NOT_NULL(_TESTARG->limits, "the limits are in the test");
+	ASSERT_EQUAL(_TESTARG->limits->cpu, 10, "the CPU time is set");
+	ASSERT_EQUAL(_TESTARG->limits->nofile, 64, "the open files are set");
+	ASSERT_EQUAL(_TESTARG->limits->as, 0, "the address space is unchanged");
+}
+
+TEST(test_section)
+{
+	ASSERT_EQUAL(unittest_section.stop - unittest_section.start, 8,
+			"All the tests of the file are in the section");
+	ASSERT_EQUAL(strcmp(unittest_section.start->name, "test_registered"), 0,
+			"The tests are in order of definition");
+}
+
+TEST(test_desc_suite_len)
+{
+	struct test_suite *suite;
+
+	suite = desc_suite_new(unittest_section.start, unittest_section.stop,
+			NULL, false);
+	ASSERT_EQUAL(suite->len(suite), 8, "One entry for each test");
+	suite->free(suite);
+}
+
+static void
+_skipped_test(TESTARGS, void *usrptr)
+{
+	abort();
+}
+
+static void
+_counted_test(TESTARGS, void *usrptr)
+{
+	SUCCESS("run");
+}
+
+TEST(test_suite_skip)
+{
+	static const struct test_suite_desc skipped = {
+		"skipped", NULL, "suite skip"
+	};
+	static const struct test_desc descs[] = {
+		{"a", NULL, NULL, &skipped, _skipped_test},
+		{"b", NULL, NULL, NULL, _counted_test},
+		{"c", NULL, NULL, &skipped, _skipped_test},
+	};
+	struct test_suite *suite;
+	struct test_result *myres;
+
+	suite = desc_suite_new(descs, descs + 3, NULL, false);
+	ASSERT_EQUAL(suite->len(suite), 1,
+			"The tests of a skipped suite are not counted");
+	myres = tap_result_new(false, NULL);
+	suite->run(suite, myres);
+	ASSERT_EQUAL(myres->testsrun, 1,
+			"The tests of a skipped suite are not run");
+	myres->free(myres);
+	suite->free(suite);
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
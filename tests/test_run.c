@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+/* Run `cmd` with the shell and return its standard output and status. */
+static char *
+_popen(const char *cmd, int *status)
+{
+	char *buf = NULL;
+	size_t size, n;
+	char chunk[4096];
+	FILE *in, *out;
+
+	out = open_memstream(&buf, &size);
+	in = popen(cmd, "r");
+	assert(in != NULL);
+	while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+		fwrite(chunk, 1, n, out);
+	*status = WEXITSTATUS(pclose(in));
+	fclose(out);
+	return buf;
+}
+
+static char *
+_read(const char *path)
+{
+	char *buf = NULL;
+	size_t size, n;
+	char chunk[4096];
+	FILE *in, *out;
+
+	if ((in = fopen(path, "r")) == NULL)
+		return strdup("");
+	out = open_memstream(&buf, &size);
+	while ((n = fread(chunk, 1, sizeof(chunk), in)) > 0)
+		fwrite(chunk, 1, n, out);
+	fclose(in);
+	fclose(out);
+	return buf;
+}
+
+/* Run unittest-run as the driver of automake on a shell command. */
+static char *
+_drive(struct test_case *test, const char *tap, char **trs, char **log)
+{
+	char cmd[4096], path[PATH_MAX];
+	const char *dir = test_case_scratch(test);
+	char *output;
+	int status;
+
+	snprintf(cmd, sizeof(cmd), "%s --test-name t --log-file %s/t.log "
+			"--trs-file %s/t.trs --color-tests no -- /bin/sh -c '%s'",
+			UNITTEST_RUN, dir, dir, tap);
+	output = _popen(cmd, &status);
+	assert(status == 0);
+	snprintf(path, sizeof(path), "%s/t.trs", dir);
+	*trs = _read(path);
+	snprintf(path, sizeof(path), "%s/t.log", dir);
+	*log = _read(path);
+	return output;
+}
+
+static void
+test_run_results(TESTARGS, void *usrptr)
+{
+	char *output, *trs, *log;
+
+	output = _drive(_TESTARG, "echo 1..5; echo ok 1 first; "
+			"echo not ok 2 second; echo \"ok 3 # SKIP no network\"; "
+			"echo \"not ok 4 # TODO later\"; echo \"ok 5 # todo done\"; "
+			"echo error >&2", &trs, &log);
+	ASSERT_STRING_EQUAL(output,
+			"PASS: t 1 first\n"
+			"FAIL: t 2 second\n"
+			"SKIP: t 3 # SKIP no network\n"
+			"XFAIL: t 4 # TODO later\n"
+			"XPASS: t 5 # TODO done\n", "a line for each result");
+	ASSERT_STRING_EQUAL(trs,
+			":global-test-result: FAIL\n"
+			":recheck: yes\n"
+			":copy-in-global-log: yes\n"
+			":test-result: PASS\n"
+			":test-result: FAIL\n"
+			":test-result: SKIP\n"
+			":test-result: XFAIL\n"
+			":test-result: XPASS\n", "the .trs file has every result");
+	ASSERT_PTR_NOT_NULL(strstr(log, "not ok 2 second\nFAIL: t 2 second\n"),
+			"the log has the output and the results");
+	ASSERT_PTR_NOT_NULL(strstr(log, "error\n"), "the log has the errors");
+	free(output);
+	free(trs);
+	free(log);
+}
+
+static void
+test_run_errors(TESTARGS, void *usrptr)
+{
+	char *output, *trs, *log;
+
+	output = _drive(_TESTARG, "echo 1..3; echo ok 1; echo ok 3; exit 2",
+			&trs, &log);
+	ASSERT_STRING_EQUAL(output,
+			"PASS: t 1\n"
+			"ERROR: t 3 # OUT-OF-ORDER (expecting 2)\n"
+			"ERROR: t - too few tests run (expected 3, got 2)\n"
+			"ERROR: t - exited with status 2\n", "the errors are reported");
+	ASSERT_EQUAL(strncmp(trs, ":global-test-result: ERROR\n", 27), 0,
+			"the program is an error");
+	free(output);
+	free(trs);
+	free(log);
+	output = _drive(_TESTARG, "echo ok; echo \"Bail out! no disk\"; echo ok",
+			&trs, &log);
+	ASSERT_STRING_EQUAL(output, "PASS: t 1\nERROR: t - Bail out! no disk\n",
+			"the rest of a bailed out stream is ignored");
+	free(output);
+	free(trs);
+	free(log);
+	output = _drive(_TESTARG, "echo \"1..0 # SKIP no GPU\"", &trs, &log);
+	ASSERT_STRING_EQUAL(output, "SKIP: t - no GPU\n",
+			"an empty plan skips the program");
+	ASSERT_EQUAL(strncmp(trs, ":global-test-result: SKIP\n", 26), 0,
+			"the program is skipped");
+	free(output);
+	free(trs);
+	free(log);
+	output = _drive(_TESTARG, "kill -9 $$", &trs, &log);
+	ASSERT_STRING_EQUAL(output, "ERROR: t - missing test plan\n"
+			"ERROR: t - terminated by signal 9\n", "a killed program is an error");
+	free(output);
+	free(trs);
+	free(log);
+}
+
+static void
+test_run_nolog(TESTARGS, void *usrptr)
+{
+	char cmd[4096], expected[MAXLINE], path[PATH_MAX];
+	const char *dir = test_case_scratch(_TESTARG);
+	char *output, *trs;
+	int status;
+
+	snprintf(cmd, sizeof(cmd), "%s --test-name t --log-file %s/no/t.log "
+			"--trs-file %s/t.trs -- /bin/sh -c 'echo 1..1; echo ok'",
+			UNITTEST_RUN, dir, dir);
+	output = _popen(cmd, &status);
+	snprintf(expected, sizeof(expected),
+			"ERROR: t - %s/no/t.log: No such file or directory\n", dir);
+	ASSERT_STRING_EQUAL(output, expected, "the missing log is reported");
+	ASSERT_NOT_EQUAL(status, 0, "the driver fails");
+	snprintf(path, sizeof(path), "%s/t.trs", dir);
+	trs = _read(path);
+	ASSERT_EQUAL(strncmp(trs, ":global-test-result: ERROR\n", 27), 0,
+			"the program is an error");
+	free(trs);
+	free(output);
+	snprintf(cmd, sizeof(cmd), "cd %s && mkdir t.log && cp /bin/true t && "
+			"%s -o all.log ./t", dir, UNITTEST_RUN);
+	output = _popen(cmd, &status);
+	ASSERT_PTR_NOT_NULL(strstr(output, "ERROR: ./t - ./t.log: Is a directory\n"),
+			"the program is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "# ERROR: 1\n"),
+			"the program is in the summary");
+	ASSERT_EQUAL(status, 1, "the run fails");
+	free(output);
+}
+
+static void
+test_run_parallel(TESTARGS, void *usrptr)
+{
+	const char *dir = SCRATCH_DIR();
+	char cmd[4096], path[PATH_MAX];
+	char *output, *trs;
+	int status, i;
+	FILE *fp;
+
+	for (i = 0; i < 8; i++) {
+		snprintf(path, sizeof(path), "%s/prog%d", dir, i);
+		fp = fopen(path, "w");
+		ASSERT_PTR_NOT_NULL(fp, "the program is written");
+		fprintf(fp, "#!/bin/sh\necho 1..2\nsleep 0.2\necho ok 1\n"
+				"echo %sok 2\n", i == 5 ? "not " : "");
+		fclose(fp);
+		chmod(path, 0755);
+	}
+	snprintf(cmd, sizeof(cmd), "cd %s && %s -j 8 -o all.log prog0 prog1 "
+			"prog2 prog3 prog4 prog5 prog6 prog7", dir, UNITTEST_RUN);
+	output = _popen(cmd, &status);
+	ASSERT_EQUAL(status, 1, "a failure fails the run");
+	ASSERT_PTR_NOT_NULL(strstr(output, "PASS: prog0 1\nPASS: prog0 2\n"),
+			"the lines of a program are together");
+	ASSERT_PTR_NOT_NULL(strstr(output, "FAIL: prog5 2\n"),
+			"the failure is reported");
+	ASSERT_PTR_NOT_NULL(strstr(output, "# TOTAL: 16\n# PASS:  15\n"
+				"# SKIP:  0\n# XFAIL: 0\n# FAIL:  1\n# XPASS: 0\n"
+				"# ERROR: 0\n"), "the summary merges the results");
+	snprintf(path, sizeof(path), "%s/prog3.trs", dir);
+	trs = _read(path);
+	ASSERT_EQUAL(strncmp(trs, ":global-test-result: PASS\n", 26), 0,
+			"each program has its .trs file");
+	free(trs);
+	snprintf(path, sizeof(path), "%s/all.log", dir);
+	trs = _read(path);
+	ASSERT_EQUAL(strncmp(trs, "FAIL: prog5\n===========\n", 24), 0,
+			"the global log has the failed programs");
+	ASSERT_PTR_NULL(strstr(trs, "prog3"), "and only them");
+	free(trs);
+	free(output);
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_run";
+	suite->doc = "Test the unittest-run driver";
+	suite->add_test(suite, test_case_new(test_run_results));
+	suite->add_test(suite, test_case_new(test_run_errors));
+	suite->add_test(suite, test_case_new(test_run_nolog));
+	suite->add_test(suite, test_case_new(test_run_parallel));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+#include "helpers.h"
+
+
+/* The directory of the last inner test, shared with an isolated child. */
+static char *last;
+
+static void
+_fill(const char *dir, int n)
+{
+	char path[PATH_MAX];
+	int i, fd;
+
+	snprintf(path, PATH_MAX, "%s/sub", dir);
+	mkdir(path, 0700);
+	for (i = 0; i < n; i++) {
+		snprintf(path, PATH_MAX, "%s/%s%d", dir, i % 2 ? "sub/" : "", i);
+		if ((fd = creat(path, 0600)) != -1)
+			close(fd);
+	}
+}
+
+static void
+_scratch_pass(TESTARGS, void *usrptr)
+{
+	snprintf(last, PATH_MAX, "%s", SCRATCH_DIR());
+	_fill(last, 100);
+}
+
+static void
+_scratch_fail(TESTARGS, void *usrptr)
+{
+	snprintf(last, PATH_MAX, "%s", SCRATCH_DIR());
+	_fill(last, 10);
+	FAIL("the test fails");
+}
+
+static void
+_scratch_crash(TESTARGS, void *usrptr)
+{
+	snprintf(last, PATH_MAX, "%s", SCRATCH_DIR());
+	_fill(last, 10);
+	abort();
+}
+
+static void
+_run(void (*func)(TESTARGS, void *), const char *name)
+{
+	free(run_output(test_case_new_impl(name, NULL, NULL, func), false));
+}
+
+static void
+test_scratch_dir(TESTARGS, void *usrptr)
+{
+	struct test_case *thread;
+	const char *dir;
+	struct stat st;
+
+	dir = SCRATCH_DIR();
+	ASSERT_PTR_NOT_NULL(dir, "the test has a scratch directory");
+	ASSERT_EQUAL(stat(dir, &st), 0, "the directory exists");
+	ASSERT_EQUAL(S_ISDIR(st.st_mode), true, "it is a directory");
+	ASSERT_EQUAL(st.st_mode & 0777, 0700, "it is private");
+	ASSERT_PTR_NOT_NULL(strstr(dir, "/unittest-"), "it is named after us");
+	ASSERT_EQUAL(SCRATCH_DIR(), dir, "the test has one directory");
+	thread = test_case_thread_new(_TESTARG);
+	ASSERT_EQUAL(test_case_scratch(thread), dir,
+			"the threads share the directory");
+	test_case_thread_free(thread);
+}
+
+static void
+test_scratch_remove(TESTARGS, void *usrptr)
+{
+	struct stat st;
+
+	_run(_scratch_pass, "_scratch_pass");
+	ASSERT_EQUAL(stat(last, &st), -1, "the directory is removed");
+	_run(_scratch_fail, "_scratch_fail");
+	ASSERT_EQUAL(stat(last, &st), -1, "the directory of a failure too");
+}
+
+static void
+test_scratch_keep(TESTARGS, void *usrptr)
+{
+	char path[PATH_MAX];
+	struct stat st;
+
+	scratch_configure(true);
+	_run(_scratch_pass, "_scratch_pass");
+	ASSERT_EQUAL(stat(last, &st), -1, "the directory of a success is removed");
+	_run(_scratch_fail, "_scratch_fail");
+	scratch_configure(false);
+	snprintf(path, PATH_MAX, "%s/sub/9", last);
+	EXPECT_EQUAL(stat(path, &st), 0, "the files of a failure are kept");
+	/* Remove it as the test would. */
+	scratch_end(last, _TESTARG, false);
+	ASSERT_EQUAL(stat(last, &st), -1, "the directory is removed");
+}
+
+static void
+test_scratch_crash(TESTARGS, void *usrptr)
+{
+	struct stat st;
+
+	isolate_configure(true, NULL);
+	_run(_scratch_crash, "_scratch_crash");
+	isolate_configure(false, NULL);
+	ASSERT_NOT_EQUAL(last[0], '\0', "the child created a directory");
+	ASSERT_EQUAL(stat(last, &st), -1,
+			"the runner removes the directory of a crashed test");
+	last[0] = '\0';
+	isolate_configure(true, NULL);
+	_run(_scratch_pass, "_scratch_pass");
+	isolate_configure(false, NULL);
+	ASSERT_NOT_EQUAL(last[0], '\0', "the child created a directory");
+	ASSERT_EQUAL(stat(last, &st), -1, "the child removes its directory");
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	last = mmap(NULL, PATH_MAX, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(last != MAP_FAILED);
+	suite = test_suite_new();
+	suite->name = "test_scratch";
+	suite->doc = "Test the scratch directories of the tests";
+	suite->add_test(suite, test_case_new(test_scratch_dir));
+	suite->add_test(suite, test_case_new(test_scratch_remove));
+	suite->add_test(suite, test_case_new(test_scratch_keep));
+	suite->add_test(suite, test_case_new(test_scratch_crash));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
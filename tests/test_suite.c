@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <assert.h>
+#include <string.h>
 #include "unittest.h"
 #include "unittest_priv.h"
 
@@ -186,6 +187,131 @@ test_skip_suite(TESTARGS, void *usrptr)
 	myres->free(myres);
 }
 
+struct _vectors {
+	unsigned int next;
+	unsigned int count;
+	int values[3];
+};
+
+static void
+_test_vector(TESTARGS, void *usrptr)
+{
+	ASSERT_EQUAL(*(int *) usrptr % 2, 0, "The vectors are even numbers");
+}
+
+static bool
+_generate(void *state, struct test_case *test)
+{
+	struct _vectors *vectors = (struct _vectors *) state;
+
+	if (vectors->next == vectors->count)
+		return false;
+	test->name = "_test_vector";
+	test->func = _test_vector;
+	test->usrptr = &vectors->values[vectors->next++];
+	return true;
+}
+
+static void
+test_generator_len(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite = (struct test_suite *) usrptr;
+	struct _vectors vectors = {0, 3, {2, 4, 6}};
+
+	suite->add_test(suite, test_case_new(_test_success));
+	suite->add_suite(suite, generator_suite_new(_generate, &vectors, 3));
+	ASSERT_EQUAL(suite->len(suite), 4, "The generator knows its length");
+	suite->add_suite(suite, generator_suite_new(_generate, &vectors,
+				SUITE_LEN_UNKNOWN));
+	ASSERT_EQUAL(suite->len(suite), SUITE_LEN_UNKNOWN,
+			"The length of a generator is unknown");
+}
+
+static void
+test_generator_run(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite = (struct test_suite *) usrptr;
+	struct _vectors vectors = {0, 3, {2, 4, 6}};
+	struct test_result *myres;
+
+	suite->add_suite(suite, generator_suite_new(_generate, &vectors,
+				SUITE_LEN_UNKNOWN));
+	myres = tap_result_new(false, NULL);
+	suite->run(suite, myres);
+	ASSERT_EQUAL(myres->testsrun, 3, "Each vector is a test");
+	ASSERT_EQUAL(myres->was_successful(myres), 0, "All the vectors pass.");
+	myres->free(myres);
+}
+
+static void
+test_generator_plan(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite = (struct test_suite *) usrptr;
+	struct _vectors vectors = {0, 3, {2, 4, 6}};
+	struct test_runner *runner;
+	char *buf = NULL, *plan;
+	size_t size;
+	FILE *stream;
+
+	stream = open_memstream(&buf, &size);
+	suite->add_suite(suite, generator_suite_new(_generate, &vectors,
+				SUITE_LEN_UNKNOWN));
+	runner = tap_runner_new(0, false, false, stream);
+	runner->run(runner, suite);
+	runner->free(runner);
+	fclose(stream);
+	plan = strstr(buf, "1..");
+	ASSERT_PTR_NOT_NULL(plan, "There is a plan.");
+	ASSERT_EQUAL(strcmp(plan, "1..3\n"), 0, "The plan is at the end.");
+	free(buf);
+}
+
+static void
+test_param_len(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite = (struct test_suite *) usrptr;
+	int table[] = {2, 4, 6, 8};
+
+	suite->add_test(suite, test_case_param_new(_test_vector, table,
+				sizeof(int), 4));
+	ASSERT_EQUAL(suite->len(suite), 4, "Each row is a test");
+}
+
+static void
+test_param_run(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite = (struct test_suite *) usrptr;
+	int table[] = {2, 4, 5, 8};
+	struct test_result *myres;
+
+	suite->add_test(suite, test_case_param_new(_test_vector, table,
+				sizeof(int), 4));
+	myres = tap_result_new(false, NULL);
+	suite->run(suite, myres);
+	ASSERT_EQUAL(myres->testsrun, 4, "Each row is run");
+	ASSERT_EQUAL(myres->was_successful(myres), 1, "The third row fails.");
+	myres->free(myres);
+}
+
+static void
+test_param_run_row(TESTARGS, void *usrptr)
+{
+	int table[] = {2, 4, 5, 8};
+	struct test_result *myres;
+	struct test_case *test;
+
+	test = test_case_param_new(_test_vector, table, sizeof(int), 4);
+	myres = tap_result_new(false, NULL);
+	test->run_row(test, 3, usrptr, myres);
+	ASSERT_EQUAL(myres->testsrun, 1, "Only the row is run");
+	ASSERT_EQUAL(myres->was_successful(myres), 0, "The fourth row passes.");
+	test->run_row(test, 2, usrptr, myres);
+	ASSERT_EQUAL(myres->testsrun, 2, "The rows run in any order");
+	ASSERT_EQUAL(myres->was_successful(myres), 1, "The third row fails.");
+	myres->free(myres);
+	free(test);
+}
+
 static void
 _setup(struct test_suite *suite)
 {
@@ -219,6 +345,12 @@ load_test_suite(struct test_loader *loader)
 	suite->add_test(suite, test_case_new(test_run_tests2));
 	suite->add_test(suite, test_case_new(test_run_tests3));
 	suite->add_test(suite, test_case_new(test_skip_suite));
+	suite->add_test(suite, test_case_new(test_generator_len));
+	suite->add_test(suite, test_case_new(test_generator_run));
+	suite->add_test(suite, test_case_new(test_generator_plan));
+	suite->add_test(suite, test_case_new(test_param_len));
+	suite->add_test(suite, test_case_new(test_param_run));
+	suite->add_test(suite, test_case_new(test_param_run_row));
 	suite->setup = _setup;
 	suite->teardown = _teardown;
 	return suite;
@@ -0,0 +1,122 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+/* The tests are global functions discovered by name. */
+
+static int
+cache_count(const char *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	int c = 0;
+
+	if ((dir = opendir(path)) == NULL)
+		return -1;
+	while ((entry = readdir(dir)) != NULL)
+		if (entry->d_name[0] != '.')
+			c++;
+	closedir(dir);
+	return c;
+}
+
+static void
+cache_cleanup(const char *path)
+{
+	DIR *dir;
+	struct dirent *entry;
+	char buf[MAXLINE];
+
+	if ((dir = opendir(path)) == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(buf, sizeof(buf), "%s/%s", path, entry->d_name);
+		unlink(buf);
+	}
+	closedir(dir);
+	rmdir(path);
+}
+
+
+void
+test_discovered(TESTARGS, void *usrptr)
+{
+	SUCCESS("found in the symbol table");
+}
+
+void
+test_len(TESTARGS, void *usrptr)
+{
+	struct test_loader *loader;
+	struct test_suite *suite;
+
+	loader = symbol_loader_new("test_");
+	suite = loader->load_tests(loader, 0, (char **) {NULL});
+	ASSERT_EQUAL(suite->len(suite), 4, "All the test_ functions are found");
+	suite->free(suite);
+	loader->free(loader);
+}
+
+void
+test_cache(TESTARGS, void *usrptr)
+{
+	ASSERT_EQUAL(cache_count(getenv("UNITTEST_CACHE_DIR")), 1,
+			"The symbols of the program are cached");
+}
+
+static void
+load_prefix(const char *prefix)
+{
+	struct test_loader *loader;
+	struct test_suite *suite;
+
+	loader = symbol_loader_new(prefix);
+	suite = loader->load_tests(loader, 0, (char **) {NULL});
+	suite->free(suite);
+	loader->free(loader);
+}
+
+void
+test_cache_prefix(TESTARGS, void *usrptr)
+{
+	const char *cache = getenv("UNITTEST_CACHE_DIR");
+	char dir[MAXLINE];
+	int c;
+
+	load_prefix("nomatch_");
+	ASSERT_EQUAL(cache_count(cache), 2,
+			"Another prefix, even without symbols, has its own entry");
+	load_prefix("test_");
+	ASSERT_EQUAL(cache_count(cache), 2, "The entries are reused");
+	snprintf(dir, sizeof(dir), "%s/a/b", cache);
+	setenv("UNITTEST_CACHE_DIR", dir, 1);
+	load_prefix("test_");
+	setenv("UNITTEST_CACHE_DIR", cache, 1);
+	c = cache_count(dir);
+	cache_cleanup(dir);
+	snprintf(dir, sizeof(dir), "%s/a", cache);
+	rmdir(dir);
+	ASSERT_EQUAL(c, 1, "The parents of the cache directory are created");
+}
+
+int
+main(int argc, char *argv[])
+{
+	char cache[] = "/tmp/unittest-cache-XXXXXX";
+	struct test_loader *loader;
+	int ret;
+
+	if (mkdtemp(cache) == NULL)
+		return 99;
+	setenv("UNITTEST_CACHE_DIR", cache, 1);
+	loader = symbol_loader_new("test_");
+	ret = test_main(argc, argv, NULL, loader);
+	loader->free(loader);
+	cache_cleanup(cache);
+	return ret;
+}
@@ -0,0 +1,371 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <stdlib.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+static const char *stream =
+	"TAP version 14\n"
+	"1..5\n"
+	"# Subtest: sub\n"
+	"    1..2\n"
+	"    ok 1 - inner\n"
+	"    not ok 2 inner two\n"
+	"      ---\n"
+	"      message: 'no'\n"
+	"      ...\n"
+	"ok 1 - sub\n"
+	"not ok 2 escaped \\# hash # TODO later\n"
+	"  ---\n"
+	"  message: 'it ''fails'''\n"
+	"  data:\n"
+	"    - 1\n"
+	"  ...\n"
+	"ok 3 # skip no network\n"
+	"pragma +strict\n"
+	"ok 4 3rd\n"
+	"junk\r\n"
+	"Bail out! stop";
+
+static const char *events =
+	"VERSION 0 14\n"
+	"PLAN 0 5\n"
+	"COMMENT 0 'Subtest: sub'\n"
+	"PLAN 1 2\n"
+	"TEST 1 ok 1 'inner'\n"
+	"TEST 1 not ok 2 'inner two'\n"
+	"YAML_BEGIN 1\n"
+	"YAML 1 'message: 'no''\n"
+	"YAML_END 1\n"
+	"TEST 0 ok 1 'sub'\n"
+	"TEST 0 not ok 2 'escaped \\# hash' TODO 'later'\n"
+	"YAML_BEGIN 0\n"
+	"YAML 0 'message: 'it ''fails''''\n"
+	"YAML 0 'data:'\n"
+	"YAML 0 '  - 1'\n"
+	"YAML_END 0\n"
+	"TEST 0 ok 3 '' SKIP 'no network'\n"
+	"PRAGMA 0 '+strict'\n"
+	"TEST 0 ok 4 '3rd'\n"
+	"UNKNOWN 0 'junk'\n"
+	"BAILOUT 0 'stop'\n"
+	"END 0\n";
+
+/* Print the events as a line each. */
+static void
+_record(const struct tap_event *event, void *usrptr)
+{
+	static const char *types[] = {
+		"VERSION", "PLAN", "TEST", "YAML_BEGIN", "YAML", "YAML_END",
+		"BAILOUT", "PRAGMA", "COMMENT", "UNKNOWN", "END"
+	};
+	static const char *directives[] = {"", " SKIP", " TODO"};
+	FILE *out = usrptr;
+
+	fprintf(out, "%s %u", types[event->type], event->depth);
+	if (event->type == TAP_TEST)
+		fprintf(out, " %s %lu '%.*s'%s", event->ok ? "ok" : "not ok",
+				event->number, (int) event->desclen, event->desc,
+				directives[event->directive]);
+	else if (event->type == TAP_VERSION || event->type == TAP_PLAN)
+		fprintf(out, " %lu", event->number);
+	if (event->textlen > 0 || event->directive != TAP_NODIRECTIVE ||
+			event->type == TAP_YAML)
+		fprintf(out, " '%.*s'", (int) event->textlen, event->text);
+	fputc('\n', out);
+}
+
+/* Parse `len` bytes of `buf` fed by chunks of `chunk` bytes. */
+static char *
+_parse(const char *buf, size_t len, size_t chunk)
+{
+	struct tap_parser *parser;
+	char *output;
+	size_t size, n;
+	FILE *out;
+
+	out = open_memstream(&output, &size);
+	parser = tap_parser_new(_record, out);
+	for (; len > 0; buf += n, len -= n) {
+		n = len < chunk ? len : chunk;
+		tap_parser_feed(parser, buf, n);
+	}
+	tap_parser_end(parser);
+	tap_parser_free(parser);
+	fclose(out);
+	return output;
+}
+
+/* Parse `len` bytes of `buf` read from a pipe. */
+static char *
+_read(const char *buf, size_t len)
+{
+	struct tap_parser *parser;
+	char *output;
+	size_t size;
+	int fds[2];
+	pid_t pid;
+	FILE *out;
+
+	assert(pipe(fds) == 0);
+	if ((pid = fork()) == 0) {
+		close(fds[0]);
+		for (; len > 0; buf += size, len -= size)
+			size = write(fds[1], buf, len < 5000 ? len : 5000);
+		_exit(0);
+	}
+	close(fds[1]);
+	out = open_memstream(&output, &size);
+	parser = tap_parser_new(_record, out);
+	while (tap_parser_read(parser, fds[0]) > 0)
+		;
+	tap_parser_end(parser);
+	tap_parser_free(parser);
+	close(fds[0]);
+	fclose(out);
+	return output;
+}
+
+static void
+test_tap_events(TESTARGS, void *usrptr)
+{
+	char *output;
+
+	output = _parse(stream, strlen(stream), strlen(stream));
+	ASSERT_STRING_EQUAL(output, events, "each line is an event");
+	free(output);
+	output = _parse(stream, strlen(stream), 1);
+	ASSERT_STRING_EQUAL(output, events, "the parser is incremental");
+	free(output);
+	output = _parse(stream, strlen(stream), 7);
+	ASSERT_STRING_EQUAL(output, events, "the lines span the chunks");
+	free(output);
+	output = _read(stream, strlen(stream));
+	ASSERT_STRING_EQUAL(output, events, "the parser reads a file descriptor");
+	free(output);
+}
+
+static void
+test_tap_long_line(TESTARGS, void *usrptr)
+{
+	size_t len = 3 * TAP_MAXLINE;
+	char expected[64], *buf, *output;
+
+	buf = malloc(len + 16);
+	memcpy(buf, "ok 1 ", 5);
+	memset(buf + 5, 'x', len - 5);
+	memcpy(buf + len, "\nok 2\n", 7);
+	snprintf(expected, sizeof(expected), "%zu", (size_t) TAP_MAXLINE - 5);
+	output = _parse(buf, len + 6, 4096);
+	ASSERT_EQUAL(strncmp(output, "TEST 0 ok 1 'xxx", 16), 0,
+			"the long line is parsed");
+	ASSERT_EQUAL(strspn(output + 13, "x"), (size_t) TAP_MAXLINE - 5,
+			"the copy of a long line is cut");
+	ASSERT_PTR_NOT_NULL(strstr(output, "'\nTEST 0 ok 2 ''\nEND 0\n"),
+			"the rest of the long line is dropped");
+	free(output);
+	output = _read(buf, len + 6);
+	ASSERT_EQUAL(strspn(output + 13, "x"), (size_t) TAP_MAXLINE - 5,
+			"a long line read is cut");
+	ASSERT_PTR_NOT_NULL(strstr(output, "'\nTEST 0 ok 2 ''\nEND 0\n"),
+			"the rest of the long line read is dropped");
+	free(output);
+	output = _parse(buf, len + 6, len + 6);
+	ASSERT_EQUAL(strspn(output + 13, "x"), len - 5,
+			"a line complete in the input is not copied");
+	free(output);
+	free(buf);
+}
+
+static void
+_pass(TESTARGS, void *usrptr)
+{
+	ASSERT_EQUAL(1, 1, "one");
+	SUCCESS("two");
+}
+
+static void
+_fail(TESTARGS, void *usrptr)
+{
+	EXPECT_EQUAL(1, 2, "it's not two");
+	EXPECT_EQUAL(1, 3, NULL);
+	ASSERT_STRING_EQUAL("a", "b", "a line\nand another\n  indented");
+}
+
+static void
+_error(TESTARGS, void *usrptr)
+{
+	ERROR("an error");
+}
+
+static void
+_todo(TESTARGS, void *usrptr)
+{
+	FAIL("not yet");
+}
+
+static struct test_suite *
+_suite(void)
+{
+	struct test_suite *suite;
+
+	suite = test_suite_new();
+	suite->add_test(suite, test_case_new(_pass));
+	suite->add_test(suite, test_case_new(_fail));
+	suite->add_test(suite, test_case_new(_error));
+	suite->add_test(suite, test_case_skip_new(_pass, "no reason"));
+	suite->add_test(suite, test_case_todo_new(_todo, "later"));
+	suite->add_test(suite, test_case_todo_new(_pass, "fixed"));
+	return suite;
+}
+
+static void
+test_tap_replay(TESTARGS, void *usrptr)
+{
+	struct test_result *result, *replayed;
+	struct test_suite *suite;
+	struct tap_parser *parser;
+	char *expected, *output;
+	size_t size, i;
+	FILE *out;
+
+	out = open_memstream(&expected, &size);
+	suite = _suite();
+	result = tap_result_new(false, out);
+	suite->run(suite, result);
+	fclose(out);
+	out = open_memstream(&output, &size);
+	replayed = tap_result_new(false, out);
+	parser = tap_replay_new(replayed);
+	for (i = 0; expected[i] != '\0'; i += 3)
+		tap_parser_feed(parser, expected + i, expected[i + 1] == '\0' ||
+				expected[i + 2] == '\0' ? strlen(expected + i) : 3);
+	tap_parser_end(parser);
+	tap_parser_free(parser);
+	fclose(out);
+	ASSERT_PTR_NOT_NULL(strstr(expected, "  failures:\n"),
+			"the output has a YAML block");
+	ASSERT_STRING_EQUAL(output, expected, "the replay reports the same tests");
+	ASSERT_EQUAL(replayed->testsrun, result->testsrun, "each test is replayed");
+	ASSERT_EQUAL(replayed->was_successful(replayed),
+			result->was_successful(result), "the replay fails too");
+	replayed->free(replayed);
+	result->free(result);
+	suite->free(suite);
+	free(output);
+	free(expected);
+}
+
+static void
+test_tap_replay_subtests(TESTARGS, void *usrptr)
+{
+	struct test_result *result;
+	struct tap_parser *parser;
+	char *output;
+	size_t size;
+	FILE *out;
+
+	out = open_memstream(&output, &size);
+	result = tap_result_new(false, out);
+	parser = tap_replay_new(result);
+	tap_parser_feed(parser, stream, strlen(stream));
+	tap_parser_end(parser);
+	tap_parser_free(parser);
+	fclose(out);
+	ASSERT_STRING_EQUAL(output,
+			"ok sub\n"
+			"not ok escaped # hash # TODO later\n"
+			"ok 3 # SKIP no network\n"
+			"ok 3rd\n"
+			"not ok Bail out! # ERROR stop\n"
+			"  ---\n"
+			"  message: 'stop'\n"
+			"  assertions: 0\n"
+			"  ...\n", "the top level tests are replayed");
+	ASSERT_EQUAL(result->testsrun, 5, "the subtests are not");
+	result->free(result);
+	free(output);
+}
+
+#ifdef HAVE_MALLINFO2
+/* The bytes allocated by malloc. */
+static size_t
+_allocated(void)
+{
+	struct mallinfo2 mi = mallinfo2();
+
+	return mi.uordblks + mi.hblkhd;
+}
+#else
+/* Not called: test_tap_replay_bounded is skipped without mallinfo2. */
+static size_t
+_allocated(void)
+{
+	return 0;
+}
+#endif
+
+static void
+test_tap_replay_bounded(TESTARGS, void *usrptr)
+{
+	const char *points = "ok a\n"
+		"not ok b\n"
+		"  ---\n"
+		"  message: 'b'\n"
+		"  ...\n"
+		"ok c # SKIP later\n";
+	struct test_result *result;
+	struct tap_parser *parser;
+	size_t before, after;
+	unsigned int i;
+
+	result = tap_result_new(false, NULL);
+	parser = tap_replay_new(result);
+	tap_parser_feed(parser, points, strlen(points));
+	before = _allocated();
+	for (i = 1; i < 100000; i++)
+		tap_parser_feed(parser, points, strlen(points));
+	after = _allocated();
+	tap_parser_end(parser);
+	tap_parser_free(parser);
+	ASSERT_EQUAL(result->testsrun, 300000, "each test is replayed");
+	ASSERT_EQUAL(result->was_successful(result), 1, "the replay fails");
+	ASSERT_ALMOST_EQUAL(after, before, 4096,
+			"the memory does not grow with the log");
+	result->free(result);
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_tap";
+	suite->doc = "Test the TAP parser";
+	suite->add_test(suite, test_case_new(test_tap_events));
+	suite->add_test(suite, test_case_new(test_tap_long_line));
+	suite->add_test(suite, test_case_new(test_tap_replay));
+	suite->add_test(suite, test_case_new(test_tap_replay_subtests));
+#ifdef HAVE_MALLINFO2
+	suite->add_test(suite, test_case_new(test_tap_replay_bounded));
+#else
+	suite->add_test(suite, test_case_skip_new(test_tap_replay_bounded,
+				"mallinfo2 is not available"));
+#endif
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+#include "unittest.h"
+#include "unittest_priv.h"
+
+
+static uint64_t
+_now(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+_virtual_sleep(TESTARGS, void *usrptr)
+{
+	vclock_start();
+	sleep(1000);
+	ASSERT_EQUAL(vclock_elapsed(), 1000000000000ULL, "the test slept");
+}
+
+static void
+test_vclock_sleep(TESTARGS, void *usrptr)
+{
+	struct timespec ts = {0, 250000000};
+	uint64_t start, cpu;
+
+	cpu = _now(CLOCK_PROCESS_CPUTIME_ID);
+	vclock_start();
+	start = _now(CLOCK_MONOTONIC);
+	ASSERT_EQUAL(_now(CLOCK_MONOTONIC), start, "the clock stands still");
+	ASSERT_EQUAL(sleep(3600), 0, "sleep returns at once");
+	ASSERT_EQUAL(usleep(500000), 0, "usleep returns at once");
+	ASSERT_EQUAL(nanosleep(&ts, NULL), 0, "nanosleep returns at once");
+	ASSERT_EQUAL(_now(CLOCK_MONOTONIC) - start, 3600750000000ULL,
+			"the sleeps moved the clock forward");
+	ASSERT_EQUAL(vclock_elapsed(), 3600750000000ULL,
+			"the elapsed time is the sum of the sleeps");
+	ts.tv_sec = (_now(CLOCK_MONOTONIC) + 60000000000ULL) / 1000000000;
+	ts.tv_nsec = 0;
+	ASSERT_EQUAL(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL), 0,
+			"clock_nanosleep returns at once");
+	ASSERT_EQUAL(_now(CLOCK_MONOTONIC), ts.tv_sec * 1000000000ULL,
+			"the clock reached the deadline");
+	ASSERT_EQUAL(_now(CLOCK_PROCESS_CPUTIME_ID) - cpu < 1000000000ULL, true,
+			"the CPU time stays real");
+}
+
+static void
+test_vclock_advance(TESTARGS, void *usrptr)
+{
+	struct timeval before, after;
+	time_t now;
+
+	vclock_start();
+	gettimeofday(&before, NULL);
+	now = time(NULL);
+	vclock_advance(90500000000ULL);
+	gettimeofday(&after, NULL);
+	ASSERT_EQUAL((after.tv_sec - before.tv_sec) * 1000000 +
+			after.tv_usec - before.tv_usec, 90500000,
+			"gettimeofday follows the clock");
+	ASSERT_EQUAL(time(NULL) - now >= 90, true, "time follows the clock");
+	ASSERT_EQUAL(vclock_elapsed(), 90500000000ULL, "the clock moved");
+}
+
+static void
+test_vclock_poll(TESTARGS, void *usrptr)
+{
+	struct epoll_event event = {.events = EPOLLIN};
+	struct pollfd pfd;
+	int fds[2], epfd;
+
+	ASSERT_EQUAL(pipe(fds), 0, "pipe");
+	epfd = epoll_create1(0);
+	ASSERT_NOT_EQUAL(epfd, -1, "epoll_create1");
+	ASSERT_EQUAL(epoll_ctl(epfd, EPOLL_CTL_ADD, fds[0], &event), 0,
+			"epoll_ctl");
+	pfd.fd = fds[0];
+	pfd.events = POLLIN;
+	vclock_start();
+	ASSERT_EQUAL(poll(&pfd, 1, 5000), 0, "poll times out");
+	ASSERT_EQUAL(epoll_wait(epfd, &event, 1, 2000), 0,
+			"epoll_wait times out");
+	ASSERT_EQUAL(vclock_elapsed(), 7000000000ULL, "the timeouts elapsed");
+	ASSERT_EQUAL(write(fds[1], "x", 1), 1, "write");
+	ASSERT_EQUAL(poll(&pfd, 1, 5000), 1, "poll sees the data");
+	ASSERT_EQUAL(epoll_wait(epfd, &event, 1, 2000), 1,
+			"epoll_wait sees the data");
+	ASSERT_EQUAL(vclock_elapsed(), 7000000000ULL,
+			"a ready descriptor takes no time");
+	close(epfd);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void
+test_vclock_reset(TESTARGS, void *usrptr)
+{
+	struct test_suite *suite;
+	struct test_result *result;
+	struct timespec ts = {0, 1000000};
+	uint64_t start;
+	FILE *stream;
+
+	stream = fopen("/dev/null", "w");
+	suite = test_suite_new();
+	suite->add_test(suite, test_case_new(_virtual_sleep));
+	result = tap_result_new(false, stream);
+	suite->run(suite, result);
+	ASSERT_EQUAL(result->was_successful(result), 0,
+			"the test ran on the virtual clock");
+	result->free(result);
+	suite->free(suite);
+	fclose(stream);
+	start = _now(CLOCK_MONOTONIC);
+	nanosleep(&ts, NULL);
+	ASSERT_EQUAL(_now(CLOCK_MONOTONIC) - start >= 1000000, true,
+			"the clock is real after the test");
+	ASSERT_EQUAL(_now(CLOCK_MONOTONIC) - start < 100000000000ULL, true,
+			"the sleep was real");
+}
+
+struct test_suite*
+load_test_suite(struct test_loader *loader)
+{
+	struct test_suite *suite;
+
+	assert(loader != NULL);
+	suite = test_suite_new();
+	suite->name = "test_vclock";
+	suite->doc = "Test the virtual clock";
+	suite->add_test(suite, test_case_new(test_vclock_sleep));
+	suite->add_test(suite, test_case_new(test_vclock_advance));
+	suite->add_test(suite, test_case_new(test_vclock_poll));
+	suite->add_test(suite, test_case_new(test_vclock_reset));
+	return suite;
+}
+
+int
+main(int argc, char *argv[])
+{
+	return test_main3(argc, argv);
+}